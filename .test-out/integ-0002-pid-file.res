@@ -0,0 +1 @@
+PASS 0 0002-pid-file
@@ -0,0 +1 @@
+PASS 1 0010-plain-forward
@@ -0,0 +1 @@
+PASS 1 0011-splice-forward
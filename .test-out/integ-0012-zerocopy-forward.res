@@ -0,0 +1 @@
+PASS 1 0012-zerocopy-forward
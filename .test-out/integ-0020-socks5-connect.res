@@ -0,0 +1 @@
+PASS 1 0020-socks5-connect
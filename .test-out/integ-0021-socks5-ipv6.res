@@ -0,0 +1 @@
+PASS 1 0021-socks5-ipv6
@@ -0,0 +1 @@
+PASS 2 0022-socks5-domain
@@ -0,0 +1 @@
+PASS 1 0023-socks5-auth
@@ -0,0 +1 @@
+PASS 1 0024-socks5-error-replies
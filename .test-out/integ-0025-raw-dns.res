@@ -0,0 +1 @@
+PASS 1 0025-raw-dns
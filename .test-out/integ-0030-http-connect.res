@@ -0,0 +1 @@
+PASS 1 0030-http-connect
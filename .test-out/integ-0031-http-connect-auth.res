@@ -0,0 +1 @@
+PASS 1 0031-http-connect-auth
@@ -0,0 +1 @@
+PASS 1 0032-http-forward
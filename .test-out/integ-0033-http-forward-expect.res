@@ -0,0 +1 @@
+PASS 1 0033-http-forward-expect
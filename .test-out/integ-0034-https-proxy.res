@@ -0,0 +1 @@
+PASS 2 0034-https-proxy
@@ -0,0 +1 @@
+PASS 1 0035-http-bad-gateway
@@ -0,0 +1 @@
+PASS 2 0036-http-userinfo
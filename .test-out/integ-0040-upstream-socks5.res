@@ -0,0 +1 @@
+PASS 2 0040-upstream-socks5
@@ -0,0 +1 @@
+PASS 2 0041-upstream-socks5-auth
@@ -0,0 +1 @@
+PASS 2 0042-upstream-http
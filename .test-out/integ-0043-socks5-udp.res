@@ -0,0 +1 @@
+PASS 12 0043-socks5-udp
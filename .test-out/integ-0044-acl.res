@@ -0,0 +1 @@
+PASS 20 0044-acl
@@ -0,0 +1 @@
+PASS 1 0050-concurrency
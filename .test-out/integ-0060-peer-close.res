@@ -0,0 +1 @@
+PASS 0 0060-peer-close
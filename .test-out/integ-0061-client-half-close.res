@@ -0,0 +1 @@
+PASS 1 0061-client-half-close
@@ -0,0 +1 @@
+PASS 11 0062-connect-timeout
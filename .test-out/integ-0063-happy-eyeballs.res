@@ -0,0 +1 @@
+PASS 6 0063-happy-eyeballs
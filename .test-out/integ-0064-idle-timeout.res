@@ -0,0 +1 @@
+PASS 9 0064-idle-timeout
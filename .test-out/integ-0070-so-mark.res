@@ -0,0 +1 @@
+SKIP 0 0070-so-mark
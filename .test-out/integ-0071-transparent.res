@@ -0,0 +1 @@
+SKIP 1 0071-transparent
@@ -0,0 +1 @@
+SKIP 0 0072-acl-bind-mark
@@ -0,0 +1 @@
+PASS 9 0073-bind-source
@@ -0,0 +1 @@
+SKIP 0 0074-bind-iface
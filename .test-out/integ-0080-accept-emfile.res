@@ -0,0 +1 @@
+PASS 2 0080-accept-emfile
@@ -0,0 +1 @@
+PASS 1 acl
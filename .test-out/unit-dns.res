@@ -0,0 +1 @@
+FAIL 0 dns
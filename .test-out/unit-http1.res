@@ -0,0 +1 @@
+PASS 1 http1
@@ -0,0 +1 @@
+PASS 0 pool
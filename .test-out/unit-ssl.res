@@ -0,0 +1 @@
+PASS 8 ssl
@@ -0,0 +1,10 @@
+/*
+ * Automatically generated by configure - do not modify!
+ *
+ * Configured with: * './configure' * '--use-openssl' * '--use-new-dns-resolver'
+ */
+#define CONFIG_NEW_DNS_RESOLVER
+#define CONFIG_HTTPS
+#define CONFIG_LINUX
+#define CONFIG_HAVE_GETADDRINFO_A
+#define CONFIG_HAVE_GETRANDOM
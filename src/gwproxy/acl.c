@@ -8,7 +8,9 @@
 #define _GNU_SOURCE
 #endif
 #include <gwproxy/acl.h>
+#include <gwproxy/qsbr.h>
 #include <arpa/inet.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,13 +68,42 @@ struct gwp_acl_dnat {
 	uint8_t		addr[16];	/* network bytes when set_addr */
 };
 
+/* A 128-bit address as two host-order halves, so ranges compare as integers. */
+struct acl_u128 {
+	uint64_t	h;
+	uint64_t	l;
+};
+
+/*
+ * The contents of an address set: the sorted, merged ranges of each family.
+ * Lower and upper bounds live in separate arrays so the binary search only
+ * walks @lo4 / @lo6. Never modified once published; a reload builds a new
+ * one and swaps it in.
+ */
+struct acl_set_tab {
+	uint32_t		*lo4, *hi4;
+	struct acl_u128		*lo6, *hi6;
+	uint32_t		nr4, nr6;
+	/* On gwp_acl.retired_tabs. */
+	struct acl_set_tab	*next;
+};
+
+/* A "--set NAME FILE" declaration, owned by the ruleset that declares it. */
+struct gwp_acl_set {
+	struct gwp_acl_set		*next;
+	char				*name;
+	char				*path;
+	_Atomic(struct acl_set_tab *)	tab;
+};
+
 /*
  * Ordered to minimise padding: the pointer-aligned members lead, then the
  * address prefixes, then the action payload, then a single bit-field block.
  * Three sets of mutually exclusive fields share unions to keep the struct
  * compact as criteria grow:
- *   - the -m domain value is either an exact string or (on a PCRE build) a
- *     compiled regex, selected by @domain_is_re; likewise -m user / @user_is_re;
+ *   - the -m domain value is either a string (exact, or a zone suffix when
+ *     @domain_is_suffix) or (on a PCRE build) a compiled regex, selected by
+ *     @domain_is_re; likewise -m user / @user_is_re;
  *   - a rule carries exactly one -j action payload -- a DNAT rewrite, a MARK
  *     value, or a BIND spec -- selected by @action (ACCEPT/REJECT carry none).
  * The per-criterion present/negated flags and the small proto/action selectors
@@ -81,7 +112,10 @@ struct gwp_acl_dnat {
  */
 struct gwp_acl_rule {
 	struct gwp_acl_rule	*next;
-	/* -m domain: exact .str, or compiled .re when @domain_is_re (PCRE). */
+	/*
+	 * -m domain: .str (exact, or a lowercased zone without a leading dot
+	 * when @domain_is_suffix), or compiled .re when @domain_is_re (PCRE).
+	 */
 	union {
 		char		*str;
 #ifdef CONFIG_PCRE
@@ -95,6 +129,8 @@ struct gwp_acl_rule {
 		pcre2_code	*re;
 #endif
 	} user;
+	/* -m set --match-set: the set, owned by the ruleset. */
+	struct gwp_acl_set	*set;
 	struct gwp_acl_ports	sports, dports;
 	struct gwp_acl_cidr	src, dst;
 	/* -j action payload; the live member is selected by @action. */
@@ -109,7 +145,10 @@ struct gwp_acl_rule {
 	bool			neg_src : 1, neg_dst : 1, neg_domain : 1,
 				neg_proto : 1, neg_sports : 1, neg_dports : 1;
 	bool			has_user : 1, neg_user : 1;
+	bool			has_set : 1, neg_set : 1;
+	bool			set_dst : 1;		/* --match-set ... dst */
 	bool			domain_is_re : 1;	/* --domain-regexp */
+	bool			domain_is_suffix : 1;	/* --domain-suffix */
 	bool			user_is_re : 1;		/* --user-regexp */
 	/*
 	 * --accept on a MARK/BIND rule: apply the modifier, then stop and
@@ -122,16 +161,47 @@ struct gwp_acl_rule {
 	uint8_t			action : 3;	/* enum gwp_acl_action */
 };
 
+struct acl_prog;
+
+/*
+ * The rule lists own the rules and keep their file order; @in_prog and
+ * @out_prog are the indexes eval actually walks, compiled from the lists
+ * once the whole text has parsed (NULL for an empty chain). A ruleset is
+ * never modified once published.
+ */
 struct gwp_acl_ruleset {
 	struct gwp_acl_rule	*in_head, **in_tail;
 	struct gwp_acl_rule	*out_head, **out_tail;
+	struct acl_prog		*in_prog, *out_prog;
+	struct gwp_acl_set	*sets;
 	enum gwp_acl_verdict	in_policy, out_policy;
+	/* Some OUTPUT rule looks at the client address / source port. */
+	bool			out_uses_client;
+	bool			out_uses_sport;
+	/* On gwp_acl.retired. */
+	struct gwp_acl_ruleset	*next;
 };
 
+/*
+ * Eval loads @rs and takes no lock. gwp_acl_reload() swaps in a whole new
+ * ruleset and retires the old one to @qsbr, which frees it once no worker
+ * can still be reading it; gwp_acl_reload_sets() does the same for one
+ * set's table. Without a @qsbr (tests, or an ACL nobody attached one to)
+ * replaced rulesets and tables are kept on @retired / @retired_tabs until
+ * destroy.
+ *
+ * @gen starts at 1 and is bumped after every swap, so a gwp_acl_memo entry
+ * stamped with an older one is stale.
+ */
 struct gwp_acl {
-	struct gwp_acl_ruleset	rs;
-	char			*path;
-	pthread_rwlock_t	lock;
+	_Atomic(struct gwp_acl_ruleset *)	rs;
+	_Atomic(uint64_t)			gen;
+	char					*path;
+	struct gwp_qsbr				*qsbr;
+	/* Serialises reloads; readers never take it. */
+	pthread_mutex_t				reload_lock;
+	struct gwp_acl_ruleset			*retired;
+	struct acl_set_tab			*retired_tabs;
 };
 
 #define ACL_MAX_TOKENS	32
@@ -430,26 +500,776 @@ static int parse_dnat(const char *s, struct gwp_acl_dnat *d)
 		unsigned long port;
 		char *end;
 
-		*colon = '\0';
-		errno = 0;
-		port = strtoul(colon + 1, &end, 10);
-		if (errno || *end || colon[1] == '\0' || port > 65535)
-			return -EINVAL;
-		d->port = (uint16_t)port;
-		d->set_port = true;
-	}
+		*colon = '\0';
+		errno = 0;
+		port = strtoul(colon + 1, &end, 10);
+		if (errno || *end || colon[1] == '\0' || port > 65535)
+			return -EINVAL;
+		d->port = (uint16_t)port;
+		d->set_port = true;
+	}
+
+	if (host[0] == '\0')		/* port-only rewrite: address unchanged */
+		return d->set_port ? 0 : -EINVAL;
+
+	if (inet_pton(AF_INET, host, d->addr) == 1)
+		d->family = AF_INET;
+	else if (inet_pton(AF_INET6, host, d->addr) == 1)
+		d->family = AF_INET6;
+	else
+		return -EINVAL;
+	d->set_addr = true;
+	return 0;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * Address sets
+ * ------------------------------------------------------------------------
+ *
+ * A set file holds one entry per line -- "IP", "IP/prefixlen" or "IP-IP"
+ * -- with '#' comments, and may run to millions of lines (threat feeds,
+ * geo ranges). It is mapped rather than read into a copy, every entry
+ * becomes a [lo, hi] range, and each family's ranges are sorted and merged
+ * so that overlapping and adjacent ones collapse. A lookup is then one
+ * binary search over @lo4 / @lo6, whatever the size of the set.
+ */
+
+/* Longest accepted set line: two IPv6 literals and a '-', with room to spare. */
+#define ACL_SET_MAX_LINE	128u
+
+struct acl_r4 {
+	uint32_t	lo;
+	uint32_t	hi;
+};
+
+struct acl_r6 {
+	struct acl_u128	lo;
+	struct acl_u128	hi;
+};
+
+/* The ranges of a set file while it is being loaded. */
+struct acl_set_build {
+	struct acl_r4	*r4;
+	struct acl_r6	*r6;
+	size_t		nr4, cap4;
+	size_t		nr6, cap6;
+};
+
+static uint32_t u32_load(const uint8_t *ip)
+{
+	return (uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 |
+	       (uint32_t)ip[2] << 8 | ip[3];
+}
+
+static struct acl_u128 u128_load(const uint8_t *ip)
+{
+	struct acl_u128 v = { 0, 0 };
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		v.h = v.h << 8 | ip[i];
+		v.l = v.l << 8 | ip[i + 8];
+	}
+	return v;
+}
+
+static int u128_cmp(const struct acl_u128 *a, const struct acl_u128 *b)
+{
+	if (a->h != b->h)
+		return a->h < b->h ? -1 : 1;
+	if (a->l != b->l)
+		return a->l < b->l ? -1 : 1;
+	return 0;
+}
+
+/* Is @b the address right after @a? */
+static bool u128_next(const struct acl_u128 *a, const struct acl_u128 *b)
+{
+	if (a->l != UINT64_MAX)
+		return b->h == a->h && b->l == a->l + 1;
+	return a->h != UINT64_MAX && b->h == a->h + 1 && b->l == 0;
+}
+
+static int set_push4(struct acl_set_build *b, uint32_t lo, uint32_t hi)
+{
+	if (b->nr4 == b->cap4) {
+		size_t cap = b->cap4 ? b->cap4 * 2 : 64;
+		struct acl_r4 *v = realloc(b->r4, cap * sizeof(*v));
+
+		if (!v)
+			return -ENOMEM;
+		b->r4 = v;
+		b->cap4 = cap;
+	}
+	b->r4[b->nr4].lo = lo;
+	b->r4[b->nr4].hi = hi;
+	b->nr4++;
+	return 0;
+}
+
+static int set_push6(struct acl_set_build *b, const struct acl_u128 *lo,
+		     const struct acl_u128 *hi)
+{
+	if (b->nr6 == b->cap6) {
+		size_t cap = b->cap6 ? b->cap6 * 2 : 64;
+		struct acl_r6 *v = realloc(b->r6, cap * sizeof(*v));
+
+		if (!v)
+			return -ENOMEM;
+		b->r6 = v;
+		b->cap6 = cap;
+	}
+	b->r6[b->nr6].lo = *lo;
+	b->r6[b->nr6].hi = *hi;
+	b->nr6++;
+	return 0;
+}
+
+/* Add one NUL-terminated entry ("IP", "IP/len" or "IP-IP") to @b. */
+static int set_parse_entry(struct acl_set_build *b, char *s)
+{
+	struct acl_u128 lo6, hi6;
+	struct gwp_acl_cidr c;
+	uint8_t a[16], z[16];
+	char *dash;
+
+	dash = strchr(s, '-');
+	if (dash) {
+		*dash = '\0';
+		if (inet_pton(AF_INET, s, a) == 1 &&
+		    inet_pton(AF_INET, dash + 1, z) == 1) {
+			if (u32_load(a) > u32_load(z))
+				return -EINVAL;
+			return set_push4(b, u32_load(a), u32_load(z));
+		}
+		if (inet_pton(AF_INET6, s, a) != 1 ||
+		    inet_pton(AF_INET6, dash + 1, z) != 1)
+			return -EINVAL;
+		lo6 = u128_load(a);
+		hi6 = u128_load(z);
+		if (u128_cmp(&lo6, &hi6) > 0)
+			return -EINVAL;
+		return set_push6(b, &lo6, &hi6);
+	}
+
+	if (parse_cidr(s, &c))
+		return -EINVAL;
+	if (c.is_v4) {
+		uint32_t lo = u32_load(c.addr);
+
+		return set_push4(b, lo,
+				 lo | (c.bits >= 32 ? 0 : UINT32_MAX >> c.bits));
+	}
+
+	lo6 = hi6 = u128_load(c.addr);
+	if (c.bits < 64) {
+		hi6.h |= UINT64_MAX >> c.bits;
+		hi6.l = UINT64_MAX;
+	} else if (c.bits < 128) {
+		hi6.l |= UINT64_MAX >> (c.bits - 64);
+	}
+	return set_push6(b, &lo6, &hi6);
+}
+
+/* Add the entry on one line of a set file; @line is not NUL-terminated. */
+static int set_parse_line(struct acl_set_build *b, const char *line,
+			  size_t len)
+{
+	char buf[ACL_SET_MAX_LINE];
+	const char *hash;
+	size_t i = 0;
+
+	hash = memchr(line, '#', len);
+	if (hash)
+		len = (size_t)(hash - line);
+	while (len && strchr(" \t\r", line[len - 1]))
+		len--;
+	while (i < len && strchr(" \t", line[i]))
+		i++;
+	if (i == len)
+		return 0;		/* blank / comment-only */
+	if (len - i >= sizeof(buf))
+		return -EINVAL;
+	memcpy(buf, line + i, len - i);
+	buf[len - i] = '\0';
+	return set_parse_entry(b, buf);
+}
+
+static int cmp_r4(const void *a, const void *b)
+{
+	const struct acl_r4 *x = a, *y = b;
+
+	return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+static int cmp_r6(const void *a, const void *b)
+{
+	const struct acl_r6 *x = a, *y = b;
+
+	return u128_cmp(&x->lo, &y->lo);
+}
+
+static void set_tab_free(void *p)
+{
+	struct acl_set_tab *tab = p;
+
+	if (!tab)
+		return;
+	free(tab->lo4);
+	free(tab->hi4);
+	free(tab->lo6);
+	free(tab->hi6);
+	free(tab);
+}
+
+/* Sort and merge @b's ranges into the lookup arrays of @tab. */
+static int set_tab_build(struct acl_set_tab *tab, struct acl_set_build *b)
+{
+	size_t i, n;
+
+	if (b->nr4)
+		qsort(b->r4, b->nr4, sizeof(*b->r4), cmp_r4);
+	for (i = n = 0; i < b->nr4; i++) {
+		struct acl_r4 *prev = n ? &b->r4[n - 1] : NULL;
+
+		if (prev && (uint64_t)b->r4[i].lo <= (uint64_t)prev->hi + 1) {
+			if (b->r4[i].hi > prev->hi)
+				prev->hi = b->r4[i].hi;
+			continue;
+		}
+		b->r4[n++] = b->r4[i];
+	}
+	if (n) {
+		tab->lo4 = malloc(n * sizeof(*tab->lo4));
+		tab->hi4 = malloc(n * sizeof(*tab->hi4));
+		if (!tab->lo4 || !tab->hi4)
+			return -ENOMEM;
+		for (i = 0; i < n; i++) {
+			tab->lo4[i] = b->r4[i].lo;
+			tab->hi4[i] = b->r4[i].hi;
+		}
+	}
+	tab->nr4 = (uint32_t)n;
+
+	if (b->nr6)
+		qsort(b->r6, b->nr6, sizeof(*b->r6), cmp_r6);
+	for (i = n = 0; i < b->nr6; i++) {
+		struct acl_r6 *prev = n ? &b->r6[n - 1] : NULL;
+
+		if (prev && (u128_cmp(&b->r6[i].lo, &prev->hi) <= 0 ||
+			     u128_next(&prev->hi, &b->r6[i].lo))) {
+			if (u128_cmp(&b->r6[i].hi, &prev->hi) > 0)
+				prev->hi = b->r6[i].hi;
+			continue;
+		}
+		b->r6[n++] = b->r6[i];
+	}
+	if (n) {
+		tab->lo6 = malloc(n * sizeof(*tab->lo6));
+		tab->hi6 = malloc(n * sizeof(*tab->hi6));
+		if (!tab->lo6 || !tab->hi6)
+			return -ENOMEM;
+		for (i = 0; i < n; i++) {
+			tab->lo6[i] = b->r6[i].lo;
+			tab->hi6[i] = b->r6[i].hi;
+		}
+	}
+	tab->nr6 = (uint32_t)n;
+	return 0;
+}
+
+/* Read @path into a NUL-terminated buffer; @len_p, if set, gets its length. */
+static int read_file(const char *path, char **out, size_t *len_p)
+{
+	long sz;
+	char *buf;
+	size_t rd;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -errno;
+
+	if (fseek(fp, 0, SEEK_END) || (sz = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return -EIO;
+	}
+
+	buf = malloc((size_t)sz + 1);
+	if (!buf) {
+		fclose(fp);
+		return -ENOMEM;
+	}
+
+	rd = fread(buf, 1, (size_t)sz, fp);
+	buf[rd] = '\0';
+	fclose(fp);
+	*out = buf;
+	if (len_p)
+		*len_p = rd;
+	return 0;
+}
+
+/* Walk the set file's text at @buf, @size bytes long, into @b. */
+static int set_parse_buf(struct acl_set_build *b, const char *name,
+			 const char *buf, size_t size)
+{
+	const char *p = buf, *end = buf + size, *nl;
+	unsigned lineno = 0;
+	int r;
+
+	while (p < end) {
+		lineno++;
+		nl = memchr(p, '\n', (size_t)(end - p));
+		if (!nl)
+			nl = end;
+		r = set_parse_line(b, p, (size_t)(nl - p));
+		if (r) {
+			fprintf(stderr, "acl: set '%s': parse error on line %u: %s\n",
+				name, lineno, strerror(-r));
+			return r;
+		}
+		p = nl + 1;
+	}
+	return 0;
+}
+
+/*
+ * Load the set file at @path into a new table. The file is copied out
+ * rather than mapped: a reload runs as soon as a writer closes it, and a
+ * mapping of a file truncated or rewritten under the parse would SIGBUS.
+ */
+static int set_tab_load(const char *path, const char *name,
+			struct acl_set_tab **tab_p)
+{
+	struct acl_set_build b = { 0 };
+	struct acl_set_tab *tab;
+	size_t len;
+	char *buf;
+	int r;
+
+	r = read_file(path, &buf, &len);
+	if (r)
+		return r;
+
+	tab = calloc(1, sizeof(*tab));
+	if (!tab) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	r = set_parse_buf(&b, name, buf, len);
+	if (!r)
+		r = set_tab_build(tab, &b);
+	if (r) {
+		set_tab_free(tab);
+		goto out;
+	}
+	*tab_p = tab;
+
+out:
+	free(buf);
+	free(b.r4);
+	free(b.r6);
+	return r;
+}
+
+static void set_free_list(struct gwp_acl_set *set)
+{
+	while (set) {
+		struct gwp_acl_set *next = set->next;
+
+		set_tab_free(atomic_load(&set->tab));
+		free(set->name);
+		free(set->path);
+		free(set);
+		set = next;
+	}
+}
+
+/* Is @a in one of the ranges of @set? */
+static bool set_match(struct gwp_acl_set *set, const struct gwp_sockaddr *a)
+{
+	const struct acl_set_tab *tab = atomic_load(&set->tab);
+	const uint8_t *ip;
+	bool is_v4;
+	uint32_t n;
+
+	canon_ip(a, &is_v4, &ip);
+	if (is_v4) {
+		const uint32_t *base = tab->lo4;
+		uint32_t v = u32_load(ip);
+
+		/* The last lower bound <= @v, if any. */
+		n = tab->nr4;
+		if (!n)
+			return false;
+		while (n > 1) {
+			uint32_t half = n / 2;
+
+			if (base[half] <= v)
+				base += half;
+			n -= half;
+		}
+		return *base <= v && v <= tab->hi4[base - tab->lo4];
+	} else {
+		const struct acl_u128 *base = tab->lo6;
+		struct acl_u128 v = u128_load(ip);
+
+		n = tab->nr6;
+		if (!n)
+			return false;
+		while (n > 1) {
+			uint32_t half = n / 2;
+
+			if (u128_cmp(&base[half], &v) <= 0)
+				base += half;
+			n -= half;
+		}
+		return u128_cmp(base, &v) <= 0 &&
+		       u128_cmp(&v, &tab->hi6[base - tab->lo6]) <= 0;
+	}
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * Compiled chains
+ * ------------------------------------------------------------------------
+ *
+ * Generated rule files run to tens of thousands of rules, and a chain is
+ * evaluated for every accepted client and every connect candidate, so eval
+ * must not visit each rule. After parsing, a chain is numbered in file order
+ * and every rule is filed under ONE positive, exactly-keyed criterion:
+ *
+ *   - an exact -m domain, by its lowercased name;
+ *   - a --domain-suffix zone, by its lowercased name in a map of its own; a
+ *     lookup tries the requested name and every parent of it, so all suffix
+ *     rules cost one probe per label;
+ *   - the longer of -d/-s, by (family, prefix length, masked address);
+ *     a lookup masks the address once per prefix length the chain uses;
+ *   - a small --dports set, by each port in it;
+ *   - otherwise (negated, regex-only, set-only, port-range-only, or no
+ *     criteria at all) the catch-all list, which every request visits.
+ *
+ * A rule cannot match a request unless its filing key matched, so the lists
+ * found for a request hold every rule that might match it. Each list is in
+ * rule order, and eval merges them by rule index and runs rule_matches() on
+ * each candidate: rules are tried in exactly the order the linear walk used,
+ * which keeps first-match, the MARK/BIND modifiers and --accept unchanged.
+ */
+
+/* A --dports set with more ports than this is not worth expanding. */
+#define ACL_MAX_PORT_KEYS	16u
+/* Longer names are not valid hostnames; such rules stay on the catch-all. */
+#define ACL_MAX_DOM_KEY		255u
+/* 2 bytes of (family, prefix length), then the address. */
+#define ACL_MAX_KEY		(ACL_MAX_DOM_KEY + 1u)
+
+/* Rule indices in ascending order. */
+struct acl_idx {
+	uint32_t	*v;
+	uint32_t	nr;
+	uint32_t	cap;
+};
+
+struct acl_key {
+	struct acl_key	*next;
+	struct acl_idx	rules;
+	uint32_t	hash;
+	uint16_t	len;
+	uint8_t		key[];
+};
+
+struct acl_keymap {
+	struct acl_key	**tab;
+	uint32_t	mask;
+	uint32_t	nr;
+};
+
+/* Prefix lengths filed in a prefix map, longest first. */
+struct acl_lens {
+	uint8_t		v[129];
+	uint8_t		nr;
+};
+
+struct acl_prog {
+	const struct gwp_acl_rule	**rules;
+	uint32_t			nr_rules;
+	struct acl_idx			any;
+	struct acl_keymap		dom, dsuf, dport, src, dst;
+	/* [0] IPv4, [1] IPv6. */
+	struct acl_lens			src_lens[2], dst_lens[2];
+};
+
+static uint32_t key_hash(const uint8_t *key, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int idx_push(struct acl_idx *x, uint32_t i)
+{
+	/* A port set like "80,80-81" files the same rule twice. */
+	if (x->nr && x->v[x->nr - 1] == i)
+		return 0;
+
+	if (x->nr == x->cap) {
+		uint32_t cap = x->cap ? x->cap * 2 : 4;
+		uint32_t *v = realloc(x->v, cap * sizeof(*v));
+
+		if (!v)
+			return -ENOMEM;
+		x->v = v;
+		x->cap = cap;
+	}
+	x->v[x->nr++] = i;
+	return 0;
+}
+
+static const struct acl_key *keymap_find(const struct acl_keymap *m,
+					 const uint8_t *key, size_t len)
+{
+	const struct acl_key *k;
+	uint32_t h;
+
+	if (!m->tab)
+		return NULL;
+
+	h = key_hash(key, len);
+	for (k = m->tab[h & m->mask]; k; k = k->next) {
+		if (k->hash == h && k->len == len && !memcmp(k->key, key, len))
+			return k;
+	}
+	return NULL;
+}
+
+static int keymap_grow(struct acl_keymap *m)
+{
+	uint32_t nr_buckets = m->tab ? (m->mask + 1) * 2 : 64, i;
+	struct acl_key **tab, *k, *next;
+
+	tab = calloc(nr_buckets, sizeof(*tab));
+	if (!tab)
+		return -ENOMEM;
+
+	for (i = 0; m->tab && i <= m->mask; i++) {
+		for (k = m->tab[i]; k; k = next) {
+			next = k->next;
+			k->next = tab[k->hash & (nr_buckets - 1)];
+			tab[k->hash & (nr_buckets - 1)] = k;
+		}
+	}
+	free(m->tab);
+	m->tab = tab;
+	m->mask = nr_buckets - 1;
+	return 0;
+}
+
+/* File rule @i under @key, adding the key if it is new. */
+static int keymap_add(struct acl_keymap *m, const uint8_t *key, size_t len,
+		      uint32_t i)
+{
+	struct acl_key *k = (struct acl_key *)keymap_find(m, key, len);
+	uint32_t h;
+
+	if (k)
+		return idx_push(&k->rules, i);
+
+	if ((!m->tab || m->nr > m->mask) && keymap_grow(m))
+		return -ENOMEM;
+
+	k = calloc(1, sizeof(*k) + len);
+	if (!k)
+		return -ENOMEM;
+	if (idx_push(&k->rules, i)) {
+		free(k);
+		return -ENOMEM;
+	}
+
+	h = key_hash(key, len);
+	memcpy(k->key, key, len);
+	k->len = (uint16_t)len;
+	k->hash = h;
+	k->next = m->tab[h & m->mask];
+	m->tab[h & m->mask] = k;
+	m->nr++;
+	return 0;
+}
+
+static void keymap_free(struct acl_keymap *m)
+{
+	struct acl_key *k, *next;
+	uint32_t i;
+
+	for (i = 0; m->tab && i <= m->mask; i++) {
+		for (k = m->tab[i]; k; k = next) {
+			next = k->next;
+			free(k->rules.v);
+			free(k);
+		}
+	}
+	free(m->tab);
+}
+
+/* Lowercase @dom into @key. Returns the length, or 0 if it is too long. */
+static size_t dom_key(const char *dom, uint8_t *key)
+{
+	size_t i;
+
+	for (i = 0; dom[i]; i++) {
+		if (i == ACL_MAX_DOM_KEY)
+			return 0;
+		key[i] = (uint8_t)dom[i];
+		if (key[i] >= 'A' && key[i] <= 'Z')
+			key[i] += 'a' - 'A';
+	}
+	return i;
+}
+
+static size_t prefix_key(bool is_v4, uint8_t bits, const uint8_t *ip,
+			 uint8_t *key)
+{
+	size_t alen = is_v4 ? 4 : 16;
+
+	key[0] = !is_v4;
+	key[1] = bits;
+	memcpy(&key[2], ip, alen);
+	mask_addr(&key[2], bits, alen);
+	return 2 + alen;
+}
+
+static void lens_add(struct acl_lens *l, uint8_t bits)
+{
+	uint8_t i, j;
+
+	for (i = 0; i < l->nr && l->v[i] >= bits; i++) {
+		if (l->v[i] == bits)
+			return;
+	}
+	for (j = l->nr; j > i; j--)
+		l->v[j] = l->v[j - 1];
+	l->v[i] = bits;
+	l->nr++;
+}
+
+static int file_prefix(struct acl_keymap *m, struct acl_lens *lens,
+		       const struct gwp_acl_cidr *c, uint32_t i)
+{
+	uint8_t key[ACL_MAX_KEY];
+	size_t len;
+
+	len = prefix_key(c->is_v4, c->bits, c->addr, key);
+	lens_add(&lens[!c->is_v4], c->bits);
+	return keymap_add(m, key, len, i);
+}
+
+static uint32_t ports_span(const struct gwp_acl_ports *p)
+{
+	uint32_t n = 0;
+	size_t i;
+
+	for (i = 0; i < p->nr; i++)
+		n += (uint32_t)p->v[i].hi - p->v[i].lo + 1;
+	return n;
+}
+
+static int file_rule(struct acl_prog *pg, const struct gwp_acl_rule *r,
+		     uint32_t i)
+{
+	const struct gwp_acl_cidr *src = NULL, *dst = NULL;
+	uint8_t key[ACL_MAX_KEY];
+	size_t len, j;
+
+	if (r->has_domain && !r->neg_domain && !r->domain_is_re) {
+		len = dom_key(r->domain.str, key);
+		if (len)
+			return keymap_add(r->domain_is_suffix ? &pg->dsuf : &pg->dom,
+					  key, len, i);
+	}
+
+	/* A /0 prefix keys nothing. */
+	if (r->has_dst && !r->neg_dst && r->dst.bits)
+		dst = &r->dst;
+	if (r->has_src && !r->neg_src && r->src.bits)
+		src = &r->src;
+	if (dst && (!src || dst->bits >= src->bits))
+		return file_prefix(&pg->dst, pg->dst_lens, dst, i);
+	if (src)
+		return file_prefix(&pg->src, pg->src_lens, src, i);
+
+	if (r->has_dports && !r->neg_dports &&
+	    ports_span(&r->dports) <= ACL_MAX_PORT_KEYS) {
+		for (j = 0; j < r->dports.nr; j++) {
+			uint32_t p;
+
+			for (p = r->dports.v[j].lo; p <= r->dports.v[j].hi; p++) {
+				key[0] = (uint8_t)(p >> 8);
+				key[1] = (uint8_t)p;
+				if (keymap_add(&pg->dport, key, 2, i))
+					return -ENOMEM;
+			}
+		}
+		return 0;
+	}
+
+	return idx_push(&pg->any, i);
+}
+
+static void prog_free(struct acl_prog *pg)
+{
+	if (!pg)
+		return;
+	keymap_free(&pg->dom);
+	keymap_free(&pg->dsuf);
+	keymap_free(&pg->dport);
+	keymap_free(&pg->src);
+	keymap_free(&pg->dst);
+	free(pg->any.v);
+	free(pg->rules);
+	free(pg);
+}
+
+/* Compile the chain at @head into *@pg_p; an empty chain gets NULL. */
+static int prog_compile(struct acl_prog **pg_p, const struct gwp_acl_rule *head)
+{
+	const struct gwp_acl_rule *r;
+	struct acl_prog *pg;
+	uint32_t nr = 0, i;
+
+	*pg_p = NULL;
+	for (r = head; r; r = r->next)
+		nr++;
+	if (!nr)
+		return 0;
 
-	if (host[0] == '\0')		/* port-only rewrite: address unchanged */
-		return d->set_port ? 0 : -EINVAL;
+	pg = calloc(1, sizeof(*pg));
+	if (!pg)
+		return -ENOMEM;
+	pg->rules = malloc(nr * sizeof(*pg->rules));
+	if (!pg->rules)
+		goto out_nomem;
+	pg->nr_rules = nr;
+
+	for (i = 0, r = head; r; i++, r = r->next) {
+		pg->rules[i] = r;
+		if (file_rule(pg, r, i))
+			goto out_nomem;
+	}
 
-	if (inet_pton(AF_INET, host, d->addr) == 1)
-		d->family = AF_INET;
-	else if (inet_pton(AF_INET6, host, d->addr) == 1)
-		d->family = AF_INET6;
-	else
-		return -EINVAL;
-	d->set_addr = true;
+	*pg_p = pg;
 	return 0;
+
+out_nomem:
+	prog_free(pg);
+	return -ENOMEM;
 }
 
 /*
@@ -494,14 +1314,22 @@ static void ruleset_init(struct gwp_acl_ruleset *rs)
 	rs->in_tail = &rs->in_head;
 	rs->out_head = NULL;
 	rs->out_tail = &rs->out_head;
+	rs->in_prog = NULL;
+	rs->out_prog = NULL;
+	rs->sets = NULL;
 	rs->in_policy = GWP_ACL_ACCEPT;
 	rs->out_policy = GWP_ACL_ACCEPT;
+	rs->out_uses_client = false;
+	rs->out_uses_sport = false;
 }
 
 static void ruleset_free(struct gwp_acl_ruleset *rs)
 {
+	prog_free(rs->in_prog);
+	prog_free(rs->out_prog);
 	free_rule_list(rs->in_head);
 	free_rule_list(rs->out_head);
+	set_free_list(rs->sets);
 	ruleset_init(rs);
 }
 
@@ -650,6 +1478,56 @@ static int parse_policy(struct gwp_acl_ruleset *rs, char **tok, int n)
 	return 0;
 }
 
+static struct gwp_acl_set *find_set(const struct gwp_acl_ruleset *rs,
+				    const char *name)
+{
+	struct gwp_acl_set *set;
+
+	for (set = rs->sets; set; set = set->next) {
+		if (!strcmp(set->name, name))
+			return set;
+	}
+	return NULL;
+}
+
+/* "--set NAME FILE": load an address set for later -m set rules. */
+static int parse_set(struct gwp_acl_ruleset *rs, char **tok, int n)
+{
+	struct acl_set_tab *tab;
+	struct gwp_acl_set *set;
+	int r;
+
+	if (n != 3)
+		return -EINVAL;
+	if (find_set(rs, tok[1]))
+		return -EEXIST;
+
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return -ENOMEM;
+	set->name = strdup(tok[1]);
+	set->path = strdup(tok[2]);
+	if (!set->name || !set->path) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	r = set_tab_load(set->path, set->name, &tab);
+	if (r)
+		goto out;
+	atomic_init(&set->tab, tab);
+
+	set->next = rs->sets;
+	rs->sets = set;
+	return 0;
+
+out:
+	free(set->name);
+	free(set->path);
+	free(set);
+	return r;
+}
+
 /* Consume the value token following an option; advances *i. */
 static const char *next_val(char **tok, int n, int *i)
 {
@@ -663,7 +1541,8 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 {
 	struct gwp_acl_rule *r;
 	enum gwp_acl_chain chain;
-	bool neg = false, m_domain = false, m_user = false, have_jump = false;
+	bool neg = false, m_domain = false, m_user = false, m_set = false;
+	bool have_jump = false;
 	/* At most one -j action payload group may be present (they share a union). */
 	bool have_to = false, have_setmark = false;
 	bool have_src = false, have_iface = false;
@@ -717,6 +1596,8 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 				if (chain != GWP_ACL_OUTPUT)
 					goto out;	/* -m user is OUTPUT-only */
 				m_user = true;
+			} else if (!strcmp(v, "set")) {
+				m_set = true;
 			} else {
 				goto out;
 			}
@@ -733,6 +1614,26 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 			}
 			r->has_domain = true;
 			r->neg_domain = neg;
+		} else if (!strcmp(o, "--domain-suffix")) {
+			v = next_val(tok, n, &i);
+			if (chain != GWP_ACL_OUTPUT || !m_domain || !v ||
+			    r->has_domain || r->has_dst)
+				goto out;
+			/* "*.example.com" and ".example.com" mean the same. */
+			if (v[0] == '*' && v[1] == '.')
+				v += 2;
+			else if (v[0] == '.')
+				v++;
+			if (!v[0] || v[0] == '.' || strchr(v, '*'))
+				goto out;
+			r->domain.str = strdup(v);
+			if (!r->domain.str) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			r->domain_is_suffix = true;
+			r->has_domain = true;
+			r->neg_domain = neg;
 		} else if (!strcmp(o, "--domain-regexp")) {
 			v = next_val(tok, n, &i);
 			if (chain != GWP_ACL_OUTPUT || !m_domain || !v ||
@@ -780,6 +1681,25 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 			ret = -ENOSYS;
 			goto out;
 #endif
+		} else if (!strcmp(o, "--match-set")) {
+			const char *dir;
+
+			v = next_val(tok, n, &i);
+			dir = v ? next_val(tok, n, &i) : NULL;
+			if (!m_set || !dir || r->has_set)
+				goto out;
+			r->set = find_set(rs, v);
+			if (!r->set)
+				goto out;
+			if (!strcmp(dir, "dst")) {
+				if (chain != GWP_ACL_OUTPUT)
+					goto out;	/* no target on INPUT */
+				r->set_dst = true;
+			} else if (strcmp(dir, "src")) {
+				goto out;
+			}
+			r->has_set = true;
+			r->neg_set = neg;
 		} else if (eq(o, "-p", "--protocol")) {
 			v = next_val(tok, n, &i);
 			if (!v || r->has_proto)
@@ -880,8 +1800,8 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 
 	/*
 	 * A declared match module must be followed by its value option: "-m
-	 * domain" needs --domain/--domain-regexp, "-m user" needs
-	 * --user/--user-regexp. Otherwise the module is a no-op and the rule
+	 * domain" needs --domain/--domain-suffix/--domain-regexp, "-m user"
+	 * needs --user/--user-regexp, "-m set" needs --match-set. Otherwise the module is a no-op and the rule
 	 * silently matches everything (a typo like "--domian" would become an
 	 * unconditional ACCEPT/REJECT).
 	 */
@@ -889,6 +1809,8 @@ static int parse_rule(struct gwp_acl_ruleset *rs, char **tok, int n)
 		goto out;
 	if (m_user && !r->has_user)
 		goto out;
+	if (m_set && !r->has_set)
+		goto out;
 
 	/*
 	 * Exactly the action's own payload group may be present. The cross-group
@@ -963,11 +1885,14 @@ static int parse_line(struct gwp_acl_ruleset *rs, char *line)
 		return parse_policy(rs, tok, n);
 	if (!strcmp(tok[0], "-A"))
 		return parse_rule(rs, tok, n);
+	if (!strcmp(tok[0], "--set"))
+		return parse_set(rs, tok, n);
 	return -EINVAL;
 }
 
 static int parse_text(struct gwp_acl_ruleset *rs, const char *text)
 {
+	const struct gwp_acl_rule *rule;
 	char *copy, *cursor, *line;
 	unsigned lineno = 0;
 	int r = 0;
@@ -991,37 +1916,53 @@ static int parse_text(struct gwp_acl_ruleset *rs, const char *text)
 	}
 
 	free(copy);
-	return r;
+	if (r)
+		return r;
+
+	r = prog_compile(&rs->in_prog, rs->in_head);
+	if (!r)
+		r = prog_compile(&rs->out_prog, rs->out_head);
+	if (r) {
+		ruleset_free(rs);
+		return r;
+	}
+
+	for (rule = rs->out_head; rule; rule = rule->next) {
+		if (rule->has_src || (rule->has_set && !rule->set_dst))
+			rs->out_uses_client = true;
+		if (rule->has_sports)
+			rs->out_uses_sport = true;
+	}
+	return 0;
 }
 
-static int read_file(const char *path, char **out)
+/* Parse @text into a new heap ruleset for publishing. */
+static int ruleset_new(struct gwp_acl_ruleset **rs_p, const char *text)
 {
-	long sz;
-	char *buf;
-	size_t rd;
-	FILE *fp;
+	struct gwp_acl_ruleset *rs;
+	int r;
 
-	fp = fopen(path, "rb");
-	if (!fp)
-		return -errno;
+	rs = malloc(sizeof(*rs));
+	if (!rs)
+		return -ENOMEM;
 
-	if (fseek(fp, 0, SEEK_END) || (sz = ftell(fp)) < 0 ||
-	    fseek(fp, 0, SEEK_SET)) {
-		fclose(fp);
-		return -EIO;
+	r = parse_text(rs, text);
+	if (r) {
+		free(rs);
+		return r;
 	}
+	rs->next = NULL;
+	*rs_p = rs;
+	return 0;
+}
 
-	buf = malloc((size_t)sz + 1);
-	if (!buf) {
-		fclose(fp);
-		return -ENOMEM;
-	}
+/* Also the retire callback, hence the void pointer. */
+static void ruleset_destroy(void *p)
+{
+	struct gwp_acl_ruleset *rs = p;
 
-	rd = fread(buf, 1, (size_t)sz, fp);
-	buf[rd] = '\0';
-	fclose(fp);
-	*out = buf;
-	return 0;
+	ruleset_free(rs);
+	free(rs);
 }
 
 /*
@@ -1032,6 +1973,7 @@ static int read_file(const char *path, char **out)
 
 int gwp_acl_parse_str(struct gwp_acl **out, const char *text)
 {
+	struct gwp_acl_ruleset *rs;
 	struct gwp_acl *acl;
 	int r;
 
@@ -1039,19 +1981,21 @@ int gwp_acl_parse_str(struct gwp_acl **out, const char *text)
 	if (!acl)
 		return -ENOMEM;
 
-	r = pthread_rwlock_init(&acl->lock, NULL);
+	r = pthread_mutex_init(&acl->reload_lock, NULL);
 	if (r) {
 		free(acl);
 		return -r;
 	}
 
-	r = parse_text(&acl->rs, text);
+	r = ruleset_new(&rs, text);
 	if (r) {
-		pthread_rwlock_destroy(&acl->lock);
+		pthread_mutex_destroy(&acl->reload_lock);
 		free(acl);
 		return r;
 	}
 
+	atomic_init(&acl->rs, rs);
+	atomic_init(&acl->gen, 1);
 	*out = acl;
 	return 0;
 }
@@ -1067,7 +2011,7 @@ int gwp_acl_create(struct gwp_acl **out, const char *path)
 		return 0;
 	}
 
-	r = read_file(path, &text);
+	r = read_file(path, &text, NULL);
 	if (r)
 		return r;
 
@@ -1086,43 +2030,108 @@ int gwp_acl_create(struct gwp_acl **out, const char *path)
 	return 0;
 }
 
+void gwp_acl_set_qsbr(struct gwp_acl *acl, struct gwp_qsbr *q)
+{
+	acl->qsbr = q;
+}
+
 int gwp_acl_reload(struct gwp_acl *acl)
 {
-	struct gwp_acl_ruleset rs;
+	struct gwp_acl_ruleset *rs, *old;
 	char *text;
 	int r;
 
 	if (!acl || !acl->path)
 		return -EINVAL;
 
-	r = read_file(acl->path, &text);
+	r = read_file(acl->path, &text, NULL);
 	if (r)
 		return r;
 
-	r = parse_text(&rs, text);
+	/* Parsed and compiled off to the side; eval keeps running meanwhile. */
+	r = ruleset_new(&rs, text);
 	free(text);
 	if (r)
 		return r;			/* keep the old rules */
 
-	pthread_rwlock_wrlock(&acl->lock);
-	ruleset_free(&acl->rs);
-	acl->rs = rs;
-	/* The tail pointers in @rs point at @rs's stack head slots when a chain
-	 * is empty; re-anchor them to the live struct. */
-	if (!acl->rs.in_head)
-		acl->rs.in_tail = &acl->rs.in_head;
-	if (!acl->rs.out_head)
-		acl->rs.out_tail = &acl->rs.out_head;
-	pthread_rwlock_unlock(&acl->lock);
+	pthread_mutex_lock(&acl->reload_lock);
+	old = atomic_exchange(&acl->rs, rs);
+	atomic_fetch_add(&acl->gen, 1);
+	if (!acl->qsbr || gwp_qsbr_retire(acl->qsbr, ruleset_destroy, old)) {
+		old->next = acl->retired;
+		acl->retired = old;
+	}
+	pthread_mutex_unlock(&acl->reload_lock);
 	return 0;
 }
 
+int gwp_acl_for_each_set(struct gwp_acl *acl,
+			 int (*fn)(const char *path, void *arg), void *arg)
+{
+	struct gwp_acl_set *set;
+	int r = 0;
+
+	if (!acl)
+		return 0;
+
+	/* The lock keeps a rule reload from freeing the list under us. */
+	pthread_mutex_lock(&acl->reload_lock);
+	for (set = atomic_load(&acl->rs)->sets; set && !r; set = set->next)
+		r = fn(set->path, arg);
+	pthread_mutex_unlock(&acl->reload_lock);
+	return r;
+}
+
+int gwp_acl_reload_sets(struct gwp_acl *acl,
+			bool (*changed)(const char *path, void *arg),
+			void *arg)
+{
+	struct acl_set_tab *tab, *old;
+	struct gwp_acl_set *set;
+	int r, err = 0, nr = 0;
+
+	if (!acl)
+		return 0;
+
+	pthread_mutex_lock(&acl->reload_lock);
+	for (set = atomic_load(&acl->rs)->sets; set; set = set->next) {
+		if (!changed(set->path, arg))
+			continue;
+		r = set_tab_load(set->path, set->name, &tab);
+		if (r) {
+			if (!err)
+				err = r;	/* keep the old contents */
+			continue;
+		}
+		old = atomic_exchange(&set->tab, tab);
+		atomic_fetch_add(&acl->gen, 1);
+		if (!acl->qsbr || gwp_qsbr_retire(acl->qsbr, set_tab_free, old)) {
+			old->next = acl->retired_tabs;
+			acl->retired_tabs = old;
+		}
+		nr++;
+	}
+	pthread_mutex_unlock(&acl->reload_lock);
+	return err ? err : nr;
+}
+
 void gwp_acl_destroy(struct gwp_acl *acl)
 {
+	struct gwp_acl_ruleset *rs, *next;
+	struct acl_set_tab *tab, *tnext;
+
 	if (!acl)
 		return;
-	ruleset_free(&acl->rs);
-	pthread_rwlock_destroy(&acl->lock);
+	ruleset_destroy(atomic_load(&acl->rs));
+	for (rs = acl->retired; rs; rs = next) {
+		next = rs->next;
+		ruleset_destroy(rs);
+	}
+	for (tab = acl->retired_tabs; tab; tab = tnext) {
+		tnext = tab->next;
+		set_tab_free(tab);
+	}
+	pthread_mutex_destroy(&acl->reload_lock);
 	free(acl->path);
 	free(acl);
 }
@@ -1149,10 +2158,21 @@ static bool crit_ok(bool present, bool matched, bool negate)
 	return !present || (matched != negate);
 }
 
+/* Is @dom the zone @zone itself or a name under it (case-insensitive)? */
+static bool suffix_match(const char *dom, const char *zone)
+{
+	size_t dlen = strlen(dom), zlen = strlen(zone);
+
+	if (dlen < zlen || strcasecmp(dom + dlen - zlen, zone))
+		return false;
+	return dlen == zlen || dom[dlen - zlen - 1] == '.';
+}
+
 /*
  * True if rule @r's -m domain criterion matches the requested hostname @dom
- * (exact, case-insensitive; or PCRE when --domain-regexp was used). Returns
- * false for a NULL @dom so a literal-IP request never matches a domain rule.
+ * (exact, case-insensitive; a zone and its subdomains with --domain-suffix;
+ * or PCRE when --domain-regexp was used). Returns false for a NULL @dom so a
+ * literal-IP request never matches a domain rule.
  */
 static bool domain_match(const struct gwp_acl_rule *r, const char *dom)
 {
@@ -1162,7 +2182,24 @@ static bool domain_match(const struct gwp_acl_rule *r, const char *dom)
 	if (r->domain_is_re)
 		return r->domain.re && regex_match(r->domain.re, dom);
 #endif
-	return r->domain.str && !strcasecmp(dom, r->domain.str);
+	if (!r->domain.str)
+		return false;
+	if (r->domain_is_suffix)
+		return suffix_match(dom, r->domain.str);
+	return !strcasecmp(dom, r->domain.str);
+}
+
+/*
+ * True if the address rule @r's -m set criterion looks at (the client for
+ * "src", the target for "dst") is in its set. False when that address is
+ * unknown.
+ */
+static bool set_match_req(const struct gwp_acl_rule *r,
+			  const struct gwp_acl_req *q)
+{
+	const struct gwp_sockaddr *a = r->set_dst ? q->target : q->client;
+
+	return r->set && a && set_match(r->set, a);
 }
 
 /*
@@ -1185,14 +2222,16 @@ static bool rule_matches(const struct gwp_acl_rule *r,
 			 const struct gwp_acl_req *q)
 {
 	/*
-	 * Target-dependent criteria (-d, --dports) cannot be evaluated for a
-	 * domain-only request (socks5h remote-DNS: no resolved IP, @dport unset).
-	 * Such a rule matches NEITHER polarity -- otherwise crit_ok would let a
-	 * negated "! -d"/"! --dports" flip the unknown into a match and fail open
-	 * (e.g. an allow-by-exclusion rule bypassing an internal-range REJECT).
+	 * Target-dependent criteria (-d, --dports, --match-set ... dst) cannot
+	 * be evaluated for a domain-only request (socks5h remote-DNS: no
+	 * resolved IP, @dport unset). Such a rule matches NEITHER polarity --
+	 * otherwise crit_ok would let a negated "! -d"/"! --dports" flip the
+	 * unknown into a match and fail open (e.g. an allow-by-exclusion rule
+	 * bypassing an internal-range REJECT).
 	 * -m domain / -m user still evaluate here (domain/user are known).
 	 */
-	if (!q->target && (r->has_dst || r->has_dports))
+	if (!q->target && (r->has_dst || r->has_dports ||
+			   (r->has_set && r->set_dst)))
 		return false;
 
 	return crit_ok(r->has_src,
@@ -1202,6 +2241,7 @@ static bool rule_matches(const struct gwp_acl_rule *r,
 	       crit_ok(r->has_domain, domain_match(r, q->domain),
 		       r->neg_domain) &&
 	       crit_ok(r->has_user, user_match(r, q->user), r->neg_user) &&
+	       crit_ok(r->has_set, set_match_req(r, q), r->neg_set) &&
 	       crit_ok(r->has_proto, q->proto == r->proto, r->neg_proto) &&
 	       crit_ok(r->has_sports, ports_match(&r->sports, q->sport),
 		       r->neg_sports) &&
@@ -1259,82 +2299,346 @@ static void apply_dnat(struct gwp_acl_req *req, const struct gwp_acl_dnat *d)
 }
 
 /*
- * Walk @head, returning the first terminal verdict. DNAT rewrites @req->dnat;
- * MARK is a composable modifier that records @req->mark and keeps matching.
+ * Apply rule @r, which matched @req. Returns true with the verdict in *@v when
+ * the rule is terminal, false for a modifier that lets matching go on. DNAT
+ * rewrites @req->dnat; MARK and BIND record @req->mark / @req->bind.
  */
-static enum gwp_acl_verdict eval_chain(const struct gwp_acl_rule *head,
-				       enum gwp_acl_verdict policy,
-				       struct gwp_acl_req *req)
+static bool apply_rule(const struct gwp_acl_rule *r, struct gwp_acl_req *req,
+		       enum gwp_acl_verdict *v)
 {
-	const struct gwp_acl_rule *r;
+	switch (r->action) {
+	case GWP_ACL_ACT_MARK:
+		/*
+		 * Modifier: record the fwmark and keep matching. A later MARK
+		 * overrides it; a terminal rule (or the policy) then decides
+		 * the verdict. With --accept the rule is terminal itself, so
+		 * nothing below it can override or re-match.
+		 */
+		req->mark = r->act.setmark;
+		req->mark_set = true;
+		*v = GWP_ACL_ACCEPT;
+		return r->then_accept;
+	case GWP_ACL_ACT_BIND:
+		/* Modifier: record the source/iface bind, keep matching. */
+		req->bind = r->act.bind;
+		*v = GWP_ACL_ACCEPT;
+		return r->then_accept;
+	case GWP_ACL_ACT_DNAT:
+		/*
+		 * DNAT is terminal (like iptables' nat table): record the
+		 * rewrite and accept, so later rules cannot re-match or
+		 * override it.
+		 */
+		apply_dnat(req, &r->act.dnat);
+		*v = GWP_ACL_ACCEPT;
+		return true;
+	case GWP_ACL_ACT_REJECT:
+		*v = GWP_ACL_REJECT;
+		return true;
+	default: /* GWP_ACL_ACT_ACCEPT */
+		*v = GWP_ACL_ACCEPT;
+		return true;
+	}
+}
 
-	for (r = head; r; r = r->next) {
-		if (!rule_matches(r, req))
-			continue;
+/* One candidate list of a request: rule indices in [p, end), ascending. */
+struct acl_cursor {
+	const uint32_t	*p;
+	const uint32_t	*end;
+};
 
-		switch (r->action) {
-		case GWP_ACL_ACT_MARK:
-			/*
-			 * Modifier: record the fwmark and keep matching. A later
-			 * MARK overrides it; a terminal rule (or the policy) then
-			 * decides the verdict. With --accept the rule is terminal
-			 * itself, so nothing below it can override or re-match.
-			 */
-			req->mark = r->act.setmark;
-			req->mark_set = true;
-			if (r->then_accept)
-				return GWP_ACL_ACCEPT;
-			continue;
-		case GWP_ACL_ACT_BIND:
-			/* Modifier: record the source/iface bind, keep matching. */
-			req->bind = r->act.bind;
-			if (r->then_accept)
-				return GWP_ACL_ACCEPT;
+/*
+ * The catch-all, domain and port lists, a list per -s and -d length, and a
+ * --domain-suffix list per label of the longest name dom_key() takes.
+ */
+#define ACL_MAX_CURSORS	(3 + 2 * 129 + (ACL_MAX_DOM_KEY + 1) / 2)
+
+static void cursor_add(struct acl_cursor *c, uint32_t *nr,
+		       const struct acl_idx *x)
+{
+	if (!x->nr)
+		return;
+	c[*nr].p = x->v;
+	c[*nr].end = x->v + x->nr;
+	(*nr)++;
+}
+
+/* Add the list of every prefix in @m that covers @addr. */
+static void cursor_add_prefixes(struct acl_cursor *c, uint32_t *nr,
+				const struct acl_keymap *m,
+				const struct acl_lens *lens,
+				const struct gwp_sockaddr *addr)
+{
+	const struct acl_lens *l;
+	const struct acl_key *k;
+	uint8_t key[ACL_MAX_KEY];
+	const uint8_t *ip;
+	uint8_t i;
+	size_t len;
+	bool is_v4;
+
+	if (!addr || !m->tab)
+		return;
+
+	canon_ip(addr, &is_v4, &ip);
+	l = &lens[!is_v4];
+	for (i = 0; i < l->nr; i++) {
+		len = prefix_key(is_v4, l->v[i], ip, key);
+		k = keymap_find(m, key, len);
+		if (k)
+			cursor_add(c, nr, &k->rules);
+	}
+}
+
+/*
+ * Add the --domain-suffix list of @name (lowercased) and of each parent. A
+ * zone never starts with a dot, so only the start of a label is tried.
+ */
+static void cursor_add_suffixes(struct acl_cursor *c, uint32_t *nr,
+				const struct acl_keymap *m,
+				const uint8_t *name, size_t len)
+{
+	const struct acl_key *k;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (name[i] == '.' || (i && name[i - 1] != '.'))
 			continue;
-		case GWP_ACL_ACT_DNAT:
-			/*
-			 * DNAT is terminal (like iptables' nat table): record
-			 * the rewrite and accept, so later rules cannot re-match
-			 * or override it.
-			 */
-			apply_dnat(req, &r->act.dnat);
-			return GWP_ACL_ACCEPT;
-		case GWP_ACL_ACT_REJECT:
-			return GWP_ACL_REJECT;
-		default: /* GWP_ACL_ACT_ACCEPT */
-			return GWP_ACL_ACCEPT;
-		}
+		k = keymap_find(m, &name[i], len - i);
+		if (k)
+			cursor_add(c, nr, &k->rules);
 	}
-	return policy;
 }
 
-enum gwp_acl_verdict gwp_acl_eval_output(struct gwp_acl *acl,
-					 struct gwp_acl_req *req)
+/*
+ * Collect the candidate lists for @q. A domain-only request (no @q->target)
+ * skips the -d and --dports lists: rule_matches() refuses those rules then.
+ */
+static uint32_t collect_cursors(const struct acl_prog *pg,
+				const struct gwp_acl_req *q,
+				struct acl_cursor *c)
+{
+	const struct acl_key *k;
+	uint8_t key[ACL_MAX_KEY];
+	uint32_t nr = 0;
+	size_t len;
+
+	cursor_add(c, &nr, &pg->any);
+
+	if (q->domain && (pg->dom.tab || pg->dsuf.tab)) {
+		len = dom_key(q->domain, key);
+		k = len ? keymap_find(&pg->dom, key, len) : NULL;
+		if (k)
+			cursor_add(c, &nr, &k->rules);
+		if (len && pg->dsuf.tab)
+			cursor_add_suffixes(c, &nr, &pg->dsuf, key, len);
+	}
+
+	cursor_add_prefixes(c, &nr, &pg->src, pg->src_lens, q->client);
+
+	if (q->target) {
+		cursor_add_prefixes(c, &nr, &pg->dst, pg->dst_lens, q->target);
+		key[0] = (uint8_t)(q->dport >> 8);
+		key[1] = (uint8_t)q->dport;
+		k = keymap_find(&pg->dport, key, 2);
+		if (k)
+			cursor_add(c, &nr, &k->rules);
+	}
+	return nr;
+}
+
+/*
+ * Try the candidate rules of @pg in rule order and return the first terminal
+ * verdict, or @policy when none is.
+ */
+static enum gwp_acl_verdict eval_chain(const struct acl_prog *pg,
+				       enum gwp_acl_verdict policy,
+				       struct gwp_acl_req *req)
 {
-	enum gwp_acl_verdict verdict;
+	struct acl_cursor c[ACL_MAX_CURSORS];
+	enum gwp_acl_verdict v;
+	uint32_t nr, i, best;
+	int bi;
+
+	if (!pg)
+		return policy;
+
+	nr = collect_cursors(pg, req, c);
+	for (;;) {
+		best = UINT32_MAX;
+		bi = -1;
+		for (i = 0; i < nr; i++) {
+			if (c[i].p < c[i].end && *c[i].p < best) {
+				best = *c[i].p;
+				bi = (int)i;
+			}
+		}
+		if (bi < 0)
+			return policy;
+
+		c[bi].p++;
+		if (rule_matches(pg->rules[best], req) &&
+		    apply_rule(pg->rules[best], req, &v))
+			return v;
+	}
+}
 
+static enum gwp_acl_verdict eval_output(const struct gwp_acl_ruleset *rs,
+					struct gwp_acl_req *req)
+{
 	req->dnat_applied = false;
 	req->mark_set = false;
 	req->bind.set = false;
-	if (!acl)
+	return eval_chain(rs->out_prog, rs->out_policy, req);
+}
+
+enum gwp_acl_verdict gwp_acl_eval_output(struct gwp_acl *acl,
+					 struct gwp_acl_req *req)
+{
+	if (!acl) {
+		req->dnat_applied = false;
+		req->mark_set = false;
+		req->bind.set = false;
 		return GWP_ACL_ACCEPT;
+	}
+	return eval_output(atomic_load(&acl->rs), req);
+}
+
+/*
+ * Pack @req's domain and user into @buf as "domain\0user\0" (each only
+ * when present). False when they do not fit, and the request is then not
+ * remembered.
+ */
+static bool memo_str(const struct gwp_acl_req *req, char *buf, size_t *len)
+{
+	size_t dl = req->domain ? strlen(req->domain) + 1 : 0;
+	size_t ul = req->user ? strlen(req->user) + 1 : 0;
+
+	if (dl + ul > GWP_ACL_MEMO_STR)
+		return false;
+	if (dl)
+		memcpy(buf, req->domain, dl);
+	if (ul)
+		memcpy(buf + dl, req->user, ul);
+	*len = dl + ul;
+	return true;
+}
+
+/*
+ * The target must match exactly: a DNAT that keeps the address or the port
+ * copies it from the target, family and all. The client only matters to
+ * -s and set matches, which compare the canonical address.
+ */
+static bool memo_hit(const struct gwp_acl_memo_ent *e,
+		     const struct gwp_acl_req *req, const char *str, size_t len)
+{
+	const struct gwp_sockaddr *t = req->target, *c = req->client;
+
+	if (e->proto != req->proto || e->dport != req->dport ||
+	    (e->sport_keyed && e->sport != req->sport))
+		return false;
+	if (e->has_domain != !!req->domain || e->has_user != !!req->user ||
+	    e->str_len != len || memcmp(e->str, str, len))
+		return false;
+
+	if (e->has_target != !!t)
+		return false;
+	if (t && (t->sa.sa_family != e->target.sa.sa_family ||
+		  sa_port(t) != sa_port(&e->target)))
+		return false;
+	if (t && t->sa.sa_family == AF_INET &&
+	    t->i4.sin_addr.s_addr != e->target.i4.sin_addr.s_addr)
+		return false;
+	if (t && t->sa.sa_family == AF_INET6 &&
+	    memcmp(&t->i6.sin6_addr, &e->target.i6.sin6_addr, 16))
+		return false;
+
+	if (e->client_keyed) {
+		const uint8_t *x, *y;
+		bool xv4, yv4;
+
+		if (e->has_client != !!c)
+			return false;
+		if (c) {
+			canon_ip(c, &xv4, &x);
+			canon_ip(&e->client, &yv4, &y);
+			if (xv4 != yv4 || memcmp(x, y, xv4 ? 4 : 16))
+				return false;
+		}
+	}
+	return true;
+}
+
+enum gwp_acl_verdict gwp_acl_eval_output_memo(struct gwp_acl *acl,
+					      struct gwp_acl_memo *memo,
+					      struct gwp_acl_req *req)
+{
+	const struct gwp_acl_ruleset *rs;
+	struct gwp_acl_memo_ent *e;
+	char str[GWP_ACL_MEMO_STR];
+	enum gwp_acl_verdict v;
+	uint64_t gen;
+	size_t len;
+	uint32_t i;
+
+	if (!acl || !memo || !memo_str(req, str, &len))
+		return gwp_acl_eval_output(acl, req);
+
+	/*
+	 * The generation is read before the rules: an entry is never stamped
+	 * newer than the rules that produced it.
+	 */
+	gen = atomic_load(&acl->gen);
+	for (i = 0; i < GWP_ACL_MEMO_NR; i++) {
+		e = &memo->ent[i];
+		if (e->gen != gen || !memo_hit(e, req, str, len))
+			continue;
+		req->dnat_applied = e->dnat_applied;
+		req->dnat = e->dnat;
+		req->mark_set = e->mark_set;
+		req->mark = e->mark;
+		req->bind = e->bind;
+		return e->verdict;
+	}
 
-	pthread_rwlock_rdlock(&acl->lock);
-	verdict = eval_chain(acl->rs.out_head, acl->rs.out_policy, req);
-	pthread_rwlock_unlock(&acl->lock);
-	return verdict;
+	rs = atomic_load(&acl->rs);
+	v = eval_output(rs, req);
+
+	e = &memo->ent[memo->next++ % GWP_ACL_MEMO_NR];
+	memset(e, 0, sizeof(*e));
+	e->gen = gen;
+	if (req->client)
+		e->client = *req->client;
+	if (req->target)
+		e->target = *req->target;
+	e->dnat = req->dnat;
+	e->bind = req->bind;
+	e->mark = req->mark;
+	e->sport = req->sport;
+	e->dport = req->dport;
+	e->proto = req->proto;
+	e->verdict = (uint8_t)v;
+	e->str_len = (uint8_t)len;
+	e->has_client = !!req->client;
+	e->has_target = !!req->target;
+	e->has_domain = !!req->domain;
+	e->has_user = !!req->user;
+	e->client_keyed = rs->out_uses_client;
+	e->sport_keyed = rs->out_uses_sport;
+	e->dnat_applied = req->dnat_applied;
+	e->mark_set = req->mark_set;
+	memcpy(e->str, str, len);
+	return v;
 }
 
 enum gwp_acl_verdict gwp_acl_eval_input(struct gwp_acl *acl,
 					struct gwp_acl_req *req)
 {
-	enum gwp_acl_verdict verdict;
+	const struct gwp_acl_ruleset *rs;
 
 	if (!acl)
 		return GWP_ACL_ACCEPT;
 
-	pthread_rwlock_rdlock(&acl->lock);
-	verdict = eval_chain(acl->rs.in_head, acl->rs.in_policy, req);
-	pthread_rwlock_unlock(&acl->lock);
-	return verdict;
+	rs = atomic_load(&acl->rs);
+	return eval_chain(rs->in_prog, rs->in_policy, req);
 }
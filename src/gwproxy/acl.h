@@ -7,8 +7,8 @@
  * incoming clients (the INPUT chain) and outgoing targets (the OUTPUT chain);
  * a chain's -P policy applies when no rule matches.
  *
- * This module is self-contained (depends only on net.h types and libc) so it
- * can be unit-tested in isolation.
+ * This module is self-contained (depends only on net.h types, qsbr.c for
+ * reloads, and libc) so it can be unit-tested in isolation.
  */
 #ifndef GWP_ACL_H
 #define GWP_ACL_H
@@ -31,6 +31,7 @@ enum gwp_acl_proto {
 };
 
 struct gwp_acl;
+struct gwp_qsbr;
 
 /*
  * A -j BIND request: pin the outgoing connection to a source address (and/or
@@ -70,10 +71,37 @@ int gwp_acl_parse_str(struct gwp_acl **out, const char *text);
 /*
  * Re-read the file the ACL was created from and atomically swap in the new
  * rules. On any parse error the previous rules are kept and a negative errno is
- * returned.
+ * returned. Never blocks evaluation: the old rules stay readable until @q (see
+ * gwp_acl_set_qsbr()) says no reader can still hold them.
  */
 int gwp_acl_reload(struct gwp_acl *acl);
 
+/*
+ * Free rules replaced by gwp_acl_reload() through @q. Evaluation must then
+ * only happen on @q's online readers. Without it they are kept until
+ * gwp_acl_destroy().
+ */
+void gwp_acl_set_qsbr(struct gwp_acl *acl, struct gwp_qsbr *q);
+
+/*
+ * Address sets ("--set NAME FILE" in the rule file, matched by "-m set
+ * --match-set NAME src|dst") each come from their own file and can be
+ * reloaded without re-reading the rules.
+ *
+ * gwp_acl_for_each_set() calls @fn with the file path of every set of the
+ * current rules, stopping at (and returning) the first non-zero result; the
+ * caller uses it to watch the files. gwp_acl_reload_sets() re-reads every
+ * set whose file @changed says was modified and swaps each one in on its
+ * own. It returns how many sets were reloaded, or the first error; a set
+ * that fails to load keeps its previous contents. Like gwp_acl_reload(),
+ * neither blocks evaluation.
+ */
+int gwp_acl_for_each_set(struct gwp_acl *acl,
+			 int (*fn)(const char *path, void *arg), void *arg);
+int gwp_acl_reload_sets(struct gwp_acl *acl,
+			bool (*changed)(const char *path, void *arg),
+			void *arg);
+
 /* Free an ACL (NULL is a no-op). */
 void gwp_acl_destroy(struct gwp_acl *acl);
 
@@ -138,6 +166,58 @@ struct gwp_acl_req {
 enum gwp_acl_verdict gwp_acl_eval_output(struct gwp_acl *acl,
 					 struct gwp_acl_req *req);
 
+/*
+ * A few remembered OUTPUT verdicts, owned by one thread: a worker keeps one
+ * for its TCP targets, a UDP association one for its datagrams (which come
+ * from one client and tend to go to one target). An entry is keyed on
+ * everything the chain can look at -- client and target address, ports,
+ * domain, user and protocol -- and holds the verdict with its DNAT, MARK
+ * and BIND output. Each one is stamped with the ACL generation, which every
+ * rule or set reload bumps, so a reload invalidates them all at once.
+ * Zero-initialise before first use.
+ */
+#define GWP_ACL_MEMO_NR		8u
+/* Domain and user are kept inline, "domain\0user\0"; longer ones are not. */
+#define GWP_ACL_MEMO_STR	128u
+
+struct gwp_acl_memo_ent {
+	uint64_t		gen;	/* 0: empty */
+	struct gwp_sockaddr	client;
+	struct gwp_sockaddr	target;
+	struct gwp_sockaddr	dnat;
+	struct gwp_acl_bind	bind;
+	uint32_t		mark;
+	uint16_t		sport;
+	uint16_t		dport;
+	uint8_t			proto;
+	uint8_t			verdict;
+	uint8_t			str_len;
+	bool			has_client : 1, has_target : 1;
+	bool			has_domain : 1, has_user : 1;
+	/*
+	 * Whether the rules look at the client address / source port at all;
+	 * when they do not, the entry serves every client.
+	 */
+	bool			client_keyed : 1, sport_keyed : 1;
+	bool			dnat_applied : 1, mark_set : 1;
+	char			str[GWP_ACL_MEMO_STR];
+};
+
+struct gwp_acl_memo {
+	struct gwp_acl_memo_ent	ent[GWP_ACL_MEMO_NR];
+	uint32_t		next;
+};
+
+/*
+ * gwp_acl_eval_output() through @memo: a request it has seen since the
+ * last reload gets the remembered verdict and outputs without walking the
+ * chain; anything else is evaluated and remembered. A NULL @memo evaluates
+ * directly.
+ */
+enum gwp_acl_verdict gwp_acl_eval_output_memo(struct gwp_acl *acl,
+					      struct gwp_acl_memo *memo,
+					      struct gwp_acl_req *req);
+
 /*
  * Evaluate the INPUT chain (incoming client) for @req. Returns GWP_ACL_ACCEPT
  * or GWP_ACL_REJECT; a NULL @acl returns ACCEPT.
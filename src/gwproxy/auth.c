@@ -15,20 +15,37 @@
 #include <stdint.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "auth.h"
+#include "qsbr.h"
 
 struct auth_entry {
 	char	*u, *p;
 	uint8_t	ulen, plen;
 };
 
-struct gwp_auth {
-	FILE			*fp;
-	pthread_rwlock_t	lock;
+/* One load of the credential file; never modified once published. */
+struct auth_snap {
 	struct auth_entry	*entries;
 	size_t			nr;
 	size_t			cap;
+	/* On gwp_auth.retired. */
+	struct auth_snap	*next;
+};
+
+/*
+ * Checks load @cur and take no lock. A reload publishes a whole new
+ * snapshot and retires the old one to @qsbr; without one, replaced
+ * snapshots are kept on @retired until destroy.
+ */
+struct gwp_auth {
+	FILE				*fp;
+	_Atomic(struct auth_snap *)	cur;
+	struct gwp_qsbr			*qsbr;
+	/* Serialises reloads (and @fp); readers never take it. */
+	pthread_mutex_t			reload_lock;
+	struct auth_snap		*retired;
 };
 
 /*
@@ -66,39 +83,39 @@ static char *trim_str(char *str)
 	return str;
 }
 
-static void free_auth_entries(struct gwp_auth *auth)
+/* Also the retire callback, hence the void pointer. */
+static void free_auth_snap(void *p)
 {
+	struct auth_snap *snap = p;
 	size_t i;
 
-	if (!auth)
+	if (!snap)
 		return;
 
-	for (i = 0; i < auth->nr; i++)
-		free(auth->entries[i].u);
+	for (i = 0; i < snap->nr; i++)
+		free(snap->entries[i].u);
 
-	free(auth->entries);
-	auth->entries = NULL;
-	auth->nr = 0;
-	auth->cap = 0;
+	free(snap->entries);
+	free(snap);
 }
 
-static int add_auth_entry(struct gwp_auth *auth, const char *line, size_t len)
+static int add_auth_entry(struct auth_snap *snap, const char *line, size_t len)
 {
 	struct auth_entry *ae;
 	size_t ulen, plen;
 	char *u, *p;
 
-	if (auth->nr >= auth->cap) {
-		size_t new_cap = auth->cap ? auth->cap * 2 : 16;
+	if (snap->nr >= snap->cap) {
+		size_t new_cap = snap->cap ? snap->cap * 2 : 16;
 		struct auth_entry *new_entries;
 
-		new_entries = realloc(auth->entries,
+		new_entries = realloc(snap->entries,
 				      new_cap * sizeof(*new_entries));
 		if (!new_entries)
 			return -ENOMEM;
 
-		auth->entries = new_entries;
-		auth->cap = new_cap;
+		snap->entries = new_entries;
+		snap->cap = new_cap;
 	}
 
 	u = malloc(len + 1);
@@ -120,7 +137,7 @@ static int add_auth_entry(struct gwp_auth *auth, const char *line, size_t len)
 	if (plen > 255)
 		goto out_free_u;
 
-	ae = &auth->entries[auth->nr++];
+	ae = &snap->entries[snap->nr++];
 	ae->u = u;
 	ae->p = p;
 	ae->ulen = ulen;
@@ -155,20 +172,20 @@ static bool ct_bytes_eq(const void *a, const void *b, size_t len)
 bool gwp_auth_check(struct gwp_auth *auth, const char *u, size_t ulen,
 		    const char *p, size_t plen)
 {
-	bool ret = false;
+	const struct auth_snap *snap;
 	size_t i;
 
 	if (!auth)
 		return false;
 
 	/*
-	 * Read the entry set under the lock; a concurrent gwp_auth_reload()
-	 * frees and rebuilds it under the write lock. When there are no
-	 * entries nr is 0 and the loop simply does not run.
+	 * The snapshot stays valid for the whole check even if a reload
+	 * swaps it out meanwhile. When there are no entries nr is 0 and the
+	 * loop simply does not run.
 	 */
-	pthread_rwlock_rdlock(&auth->lock);
-	for (i = 0; i < auth->nr; i++) {
-		const struct auth_entry *ae = &auth->entries[i];
+	snap = atomic_load(&auth->cur);
+	for (i = 0; i < snap->nr; i++) {
+		const struct auth_entry *ae = &snap->entries[i];
 		if (ulen != ae->ulen)
 			continue;
 		if (plen != ae->plen)
@@ -177,15 +194,19 @@ bool gwp_auth_check(struct gwp_auth *auth, const char *u, size_t ulen,
 			continue;
 		if (!ct_bytes_eq(p, ae->p, plen))
 			continue;
-		ret = true;
-		break;
+		return true;
 	}
-	pthread_rwlock_unlock(&auth->lock);
-	return ret;
+	return false;
+}
+
+void gwp_auth_set_qsbr(struct gwp_auth *auth, struct gwp_qsbr *q)
+{
+	auth->qsbr = q;
 }
 
 int gwp_auth_reload(struct gwp_auth *auth)
 {
+	struct auth_snap *snap, *old;
 	char buf[4096], *t;
 	size_t l;
 	int r = 0;
@@ -193,8 +214,11 @@ int gwp_auth_reload(struct gwp_auth *auth)
 	if (!auth || !auth->fp)
 		return -ENOSYS;
 
-	pthread_rwlock_wrlock(&auth->lock);
-	free_auth_entries(auth);
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&auth->reload_lock);
 	while (1) {
 		t = fgets(buf, sizeof(buf), auth->fp);
 		if (!t)
@@ -205,13 +229,26 @@ int gwp_auth_reload(struct gwp_auth *auth)
 		if (!l)
 			continue;
 
-		r = add_auth_entry(auth, t, l);
+		r = add_auth_entry(snap, t, l);
 		if (r < 0)
 			break;
 	}
 	rewind(auth->fp);
-	pthread_rwlock_unlock(&auth->lock);
-	return r;
+
+	/* A file that fails to load leaves the current entries in place. */
+	if (r < 0) {
+		pthread_mutex_unlock(&auth->reload_lock);
+		free_auth_snap(snap);
+		return r;
+	}
+
+	old = atomic_exchange(&auth->cur, snap);
+	if (old && (!auth->qsbr || gwp_qsbr_retire(auth->qsbr, free_auth_snap, old))) {
+		old->next = auth->retired;
+		auth->retired = old;
+	}
+	pthread_mutex_unlock(&auth->reload_lock);
+	return 0;
 }
 
 int gwp_auth_create(struct gwp_auth **out, const char *path)
@@ -229,7 +266,7 @@ int gwp_auth_create(struct gwp_auth **out, const char *path)
 	if (!auth)
 		return -ENOMEM;
 
-	r = pthread_rwlock_init(&auth->lock, NULL);
+	r = pthread_mutex_init(&auth->reload_lock, NULL);
 	if (r) {
 		free(auth);
 		return -r;
@@ -244,27 +281,32 @@ int gwp_auth_create(struct gwp_auth **out, const char *path)
 	auth->fp = fp;
 	r = gwp_auth_reload(auth);
 	if (r < 0)
-		goto out_free_ent;
+		goto out_close;
 
 	*out = auth;
 	return 0;
 
-out_free_ent:
-	free_auth_entries(auth);
+out_close:
 	fclose(auth->fp);
 out_destroy_lock:
-	pthread_rwlock_destroy(&auth->lock);
+	pthread_mutex_destroy(&auth->reload_lock);
 	free(auth);
 	return r;
 }
 
 void gwp_auth_destroy(struct gwp_auth *auth)
 {
+	struct auth_snap *snap, *next;
+
 	if (!auth)
 		return;
 
-	pthread_rwlock_destroy(&auth->lock);
-	free_auth_entries(auth);
+	pthread_mutex_destroy(&auth->reload_lock);
+	free_auth_snap(atomic_load(&auth->cur));
+	for (snap = auth->retired; snap; snap = next) {
+		next = snap->next;
+		free_auth_snap(snap);
+	}
 	fclose(auth->fp);
 	free(auth);
 }
@@ -5,7 +5,8 @@
  * The store is loaded from a colon-separated "user:password" file (one
  * entry per line) and is shared by the SOCKS5 (RFC 1929) and HTTP CONNECT
  * (RFC 7617 "Basic") proxy front-ends. It is safe for concurrent readers
- * across worker threads; reloads take a write lock.
+ * across worker threads; a check takes no lock, and a reload publishes a
+ * fresh snapshot of the entries without waiting for them.
  *
  * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
  */
@@ -16,6 +17,7 @@
 #include <stdbool.h>
 
 struct gwp_auth;
+struct gwp_qsbr;
 
 /**
  * Create a credential store from the file at @path.
@@ -39,12 +41,23 @@ void gwp_auth_destroy(struct gwp_auth *auth);
 
 /**
  * Re-read the credential file, atomically replacing the in-memory entries.
+ * If the file fails to load the current entries are kept.
  *
  * @param auth	The store to reload. Must have been created from a file.
  * @return	0 on success, or a negative error code on failure.
  */
 int gwp_auth_reload(struct gwp_auth *auth);
 
+/**
+ * Free the entries replaced by gwp_auth_reload() through @q. Checks must then
+ * only happen on @q's online readers. Without it they are kept until
+ * gwp_auth_destroy().
+ *
+ * @param auth	The store.
+ * @param q	The reclamation domain of the threads that run checks.
+ */
+void gwp_auth_set_qsbr(struct gwp_auth *auth, struct gwp_qsbr *q);
+
 /**
  * Check a username/password pair against the store in constant time.
  *
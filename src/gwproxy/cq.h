@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef GWPROXY_CQ_H
+#define GWPROXY_CQ_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+/*
+ * A worker's completion queue, fed by helper threads (DNS, TLS handshakes).
+ *
+ * Producers push onto a lock-free stack and only the first push onto an
+ * empty stack writes the eventfd: the worker reads the eventfd before it
+ * takes the whole stack, so a push it misses always rings again.
+ *
+ * The stack is intrusive: an object is linked through one of its own
+ * pointer members, named at the push site.
+ */
+struct gwp_cq {
+	_Atomic(void *)		head;
+	_Atomic(int)		ev_fd;
+} __attribute__((__aligned__(64)));
+
+static inline void gwp_cq_init(struct gwp_cq *cq)
+{
+	atomic_init(&cq->head, NULL);
+	atomic_init(&cq->ev_fd, -1);
+}
+
+/* Set the eventfd rung on the first push; -1 to stop ringing. */
+static inline void gwp_cq_set_fd(struct gwp_cq *cq, int ev_fd)
+{
+	atomic_store(&cq->ev_fd, ev_fd);
+}
+
+static inline void __gwp_cq_push(struct gwp_cq *cq, void *obj, size_t next_off)
+{
+	void **next = (void **)((char *)obj + next_off);
+	void *old;
+	int fd;
+
+	old = atomic_load_explicit(&cq->head, memory_order_relaxed);
+	do {
+		*next = old;
+	} while (!atomic_compare_exchange_weak_explicit(&cq->head, &old, obj,
+							memory_order_release,
+							memory_order_relaxed));
+
+	fd = atomic_load_explicit(&cq->ev_fd, memory_order_relaxed);
+	if (!old && fd >= 0)
+		eventfd_write(fd, 1);
+}
+
+/* Push @obj, linking it through its pointer member @member. */
+#define gwp_cq_push(cq, obj, member) \
+	__gwp_cq_push((cq), (obj), offsetof(__typeof__(*(obj)), member))
+
+/*
+ * Take everything pushed so far, newest first. Only the worker that owns
+ * @cq may call this.
+ */
+static inline void *gwp_cq_take(struct gwp_cq *cq)
+{
+	return atomic_exchange_explicit(&cq->head, NULL, memory_order_acquire);
+}
+
+#endif /* #ifndef GWPROXY_CQ_H */
@@ -8,10 +8,12 @@
 
 #include "dns.h"
 #include "dns_cache.h"
+#include "cq.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -22,10 +24,33 @@
 #include <signal.h>
 
 #include <pthread.h>
-#include <sys/eventfd.h>
 
 struct gwp_dns_ctx;
 
+/*
+ * A worker's private front for the shared cache, direct-mapped by name hash.
+ * A slot holds a reference on a shared entry, so a hit takes no lock and
+ * touches no shared cacheline. Only the worker that owns the completion
+ * queue of the same index uses it.
+ */
+#define GWP_DNS_L1_SLOTS	256u
+
+struct dns_l1_slot {
+	uint64_t			hash;
+	/* Past this, lookups go to the shared cache, which refreshes. */
+	time_t				fresh_until;
+	struct gwp_dns_cache_entry	*e;
+};
+
+struct dns_l1 {
+	struct dns_l1_slot	slots[GWP_DNS_L1_SLOTS];
+	/* Hits the shared cache never saw; added to its stats. */
+	unsigned long		nr_hit;
+} __attribute__((__aligned__(64)));
+
+/* Power of two; chains only grow with the number of names in flight. */
+#define GWP_DNS_INFLIGHT_BUCKETS	256u
+
 struct gwp_dns_wrk {
 	struct gwp_dns_ctx	*ctx;
 	uint32_t		id;
@@ -42,10 +67,113 @@ struct gwp_dns_ctx {
 	struct gwp_dns_entry	*tail;
 	struct gwp_dns_wrk	*workers;
 	struct gwp_dns_cache	*cache;
+	struct gwp_cq		*cqs;
+	/* One per completion queue; NULL without a cache. */
+	struct dns_l1		*l1;
+	/*
+	 * Names being resolved right now, keyed by name (restyp is the same
+	 * for the whole context), so a burst of requests for one cold name
+	 * costs one resolution whatever port each wants. Under @lock.
+	 */
+	struct gwp_dns_entry	*inflight[GWP_DNS_INFLIGHT_BUCKETS];
+	/* Requests that joined a resolution already in flight. Under @lock. */
+	unsigned long		nr_coalesced;
 	time_t			last_scan;
 	struct gwp_dns_cfg	cfg;
 };
 
+/*
+ * Must be called with ctx->lock held. Whether @e still has to be resolved:
+ * its owner is still around, somebody waits on its answer, or it is a cache
+ * refresh, which never has an owner.
+ */
+static bool entry_wanted(struct gwp_dns_entry *e)
+{
+	return atomic_load(&e->refcnt) > 1 || e->followers ||
+	       e->cq == GWP_DNS_CQ_REFRESH;
+}
+
+/* FNV-1a over the ASCII-lowercased name. */
+static uint32_t inflight_bucket(const char *name)
+{
+	uint32_t h = 2166136261u;
+	unsigned char c;
+
+	while ((c = (unsigned char)*name++)) {
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c - 'A' + 'a');
+		h = (h ^ c) * 16777619u;
+	}
+	return h & (GWP_DNS_INFLIGHT_BUCKETS - 1);
+}
+
+/*
+ * The port a numeric @service stands for (an empty one is port 0), or -1
+ * for a service name, whose port only getaddrinfo() knows.
+ */
+static int svc_port(const char *service)
+{
+	const char *p = service;
+	int port = 0;
+
+	for (; *p; p++) {
+		if (*p < '0' || *p > '9')
+			return -1;
+		port = port * 10 + (*p - '0');
+		if (port > 65535)
+			return -1;
+	}
+	return port;
+}
+
+/*
+ * Must be called with ctx->lock held. The entry resolving @name, preferably
+ * for @service too. Another port will do when both services are numeric:
+ * the follower then gets the lead's addresses with its own port.
+ */
+static struct gwp_dns_entry *inflight_find(struct gwp_dns_ctx *ctx,
+					   const char *name,
+					   const char *service)
+{
+	struct gwp_dns_entry *e, *any = NULL;
+	bool num = svc_port(service) >= 0;
+
+	e = ctx->inflight[inflight_bucket(name)];
+	for (; e; e = e->inflight_next) {
+		if (strcasecmp(e->name, name))
+			continue;
+		if (!strcmp(e->service, service))
+			return e;
+		if (!any && num && svc_port(e->service) >= 0)
+			any = e;
+	}
+	return any;
+}
+
+/* Must be called with ctx->lock held. */
+static void inflight_add(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
+{
+	struct gwp_dns_entry **head;
+
+	head = &ctx->inflight[inflight_bucket(e->name)];
+	e->inflight_next = *head;
+	*head = e;
+}
+
+/* Must be called with ctx->lock held. */
+static void inflight_del(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
+{
+	struct gwp_dns_entry **pp;
+
+	pp = &ctx->inflight[inflight_bucket(e->name)];
+	for (; *pp; pp = &(*pp)->inflight_next) {
+		if (*pp == e) {
+			*pp = e->inflight_next;
+			return;
+		}
+	}
+}
+
 static void put_all_entries(struct gwp_dns_entry *head)
 {
 	struct gwp_dns_entry *e, *next;
@@ -153,6 +281,52 @@ static void try_pass_result_to_cache(struct gwp_dns_ctx *ctx, const char *name,
 	gwp_dns_cache_insert(ctx->cache, name, ai, time(NULL) + x);
 }
 
+void gwp_dns_cache_store(struct gwp_dns_ctx *ctx, const char *name,
+			 const struct gwp_sockaddr *addrs, uint8_t nr,
+			 uint32_t ttl)
+{
+	struct addrinfo ai[GWP_DNS_MAX_ADDRS];
+	uint32_t x;
+	uint8_t i;
+
+	if (!ctx || !ctx->cache || !nr)
+		return;
+
+	if (nr > GWP_DNS_MAX_ADDRS)
+		nr = GWP_DNS_MAX_ADDRS;
+
+	memset(ai, 0, sizeof(ai));
+	for (i = 0; i < nr; i++) {
+		ai[i].ai_family = addrs[i].sa.sa_family;
+		ai[i].ai_addr = (struct sockaddr *)&addrs[i].sa;
+		ai[i].ai_next = i + 1 < nr ? &ai[i + 1] : NULL;
+	}
+
+	x = (uint32_t)ctx->cfg.cache_expiry;
+	if (ttl < x)
+		x = ttl;
+	if (x)
+		gwp_dns_cache_insert(ctx->cache, name, ai, time(NULL) + x);
+}
+
+int gwp_dns_ctx_cache_stats(struct gwp_dns_ctx *ctx,
+			    struct gwp_dns_cache_stats *st)
+{
+	uint32_t i;
+
+	if (!ctx->cache)
+		return -ENOSYS;
+
+	gwp_dns_cache_stats(ctx->cache, st);
+	for (i = 0; i < ctx->cfg.nr_cq; i++)
+		st->nr_hit += ctx->l1[i].nr_hit;
+
+	pthread_mutex_lock(&ctx->lock);
+	st->nr_coalesced = ctx->nr_coalesced;
+	pthread_mutex_unlock(&ctx->lock);
+	return 0;
+}
+
 int gwp_dns_resolve(struct gwp_dns_ctx *ctx, const char *name,
 		    const char *service, struct gwp_sockaddr *addrs,
 		    uint8_t cap, uint8_t *nr_addrs, uint32_t restyp)
@@ -182,12 +356,72 @@ static void gwp_dns_entry_free(struct gwp_dns_entry *e)
 	if (!e)
 		return;
 
-	assert(e->ev_fd >= 0);
-	__sys_close(e->ev_fd);
 	free(e->name);
 	free(e);
 }
 
+/*
+ * Hand a resolved entry to its worker. The reference the DNS thread held
+ * now belongs to the completion queue, so the caller must not touch @e
+ * afterwards: the worker may already have reaped and freed it.
+ */
+static void complete_entry(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
+{
+	/* A refresh: the cache already has the result, and nobody waits. */
+	if (e->cq == GWP_DNS_CQ_REFRESH) {
+		gwp_dns_entry_put(e);
+		return;
+	}
+
+	gwp_cq_push(&ctx->cqs[e->cq], e, next);
+}
+
+/* Give a follower the lead's answer, on the port it asked for. */
+static void copy_answer(struct gwp_dns_entry *f, const struct gwp_dns_entry *e)
+{
+	uint16_t port;
+	uint8_t i;
+
+	f->res = e->res;
+	f->nr_addrs = e->nr_addrs;
+	memcpy(f->addrs, e->addrs, sizeof(*e->addrs) * e->nr_addrs);
+	if (!strcmp(f->service, e->service))
+		return;
+
+	/* inflight_find() only pairs numeric services. */
+	port = htons((uint16_t)svc_port(f->service));
+	for (i = 0; i < f->nr_addrs; i++) {
+		if (f->addrs[i].sa.sa_family == AF_INET6)
+			f->addrs[i].i6.sin6_port = port;
+		else
+			f->addrs[i].i4.sin_port = port;
+	}
+}
+
+/*
+ * The resolution of @e is over, whatever e->res says. Take it out of the
+ * in-flight map so later requests resolve afresh, give every follower a
+ * copy of the answer, and complete them all. The caller must not touch @e
+ * afterwards.
+ */
+static void finish_entry(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
+{
+	struct gwp_dns_entry *f, *next;
+
+	pthread_mutex_lock(&ctx->lock);
+	inflight_del(ctx, e);
+	f = e->followers;
+	e->followers = NULL;
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (; f; f = next) {
+		next = f->next;
+		copy_answer(f, e);
+		complete_entry(ctx, f);
+	}
+	complete_entry(ctx, e);
+}
+
 /*
  * Must be called with ctx->lock held. May release the lock, but it
  * will reacquire it before returning.
@@ -302,11 +536,11 @@ static int dbq_add_entry(struct dns_batch_query *dbq, struct gwp_dns_entry *e)
 }
 
 static int collect_active_queries(struct gwp_dns_ctx *ctx,
-				  struct gwp_dns_entry **head_p,
+				  struct gwp_dns_entry *head,
 				  struct dns_batch_query **dbq_p)
 {
-	struct gwp_dns_entry *e, *next, *prev = NULL, *head = *head_p;
 	struct dns_batch_query *dbq;
+	struct gwp_dns_entry *e;
 
 	dbq = calloc(1, sizeof(*dbq));
 	if (!dbq)
@@ -314,45 +548,45 @@ static int collect_active_queries(struct gwp_dns_ctx *ctx,
 
 	assert(head);
 	prep_hints(&dbq->hints, ctx->cfg.restyp);
-	for (e = head; e; e = next) {
-		int x = atomic_load(&e->refcnt);
-		next = e->next;
-		if (x > 1) {
-
-			if (dbq_add_entry(dbq, e)) {
-				dbq_free(dbq);
-				/*
-				 * Hand back the partially-processed list: some
-				 * dead entries may already have been unlinked and
-				 * freed, so the caller must not keep the original
-				 * head (which could point at freed memory).
-				 */
-				*head_p = head;
-				return -ENOMEM;
-			}
-
-			prev = e;
+	for (e = head; e; e = e->next) {
+		if (dbq_add_entry(dbq, e)) {
+			dbq_free(dbq);
+			return -ENOMEM;
+		}
+	}
+
+	*dbq_p = dbq;
+	return 0;
+}
+
+/*
+ * Must be called with ctx->lock held. Unlink the entries nobody wants any
+ * more from @head and from the in-flight map, so no request can attach to
+ * them, and return them to be freed once the lock is dropped.
+ */
+static struct gwp_dns_entry *unlink_unwanted(struct gwp_dns_ctx *ctx,
+					     struct gwp_dns_entry **head_p)
+{
+	struct gwp_dns_entry **pp, *e, *dead = NULL;
+
+	for (pp = head_p; (e = *pp); ) {
+		if (entry_wanted(e)) {
+			pp = &e->next;
 			continue;
 		}
 
-		assert(x == 1);
 		/*
 		 * If the refcnt is 1, it means we are the last reference
 		 * to this entry. The client no longer cares about the
 		 * result. We can free it immediately. No need to resolve
-		 * the query nor to signal the eventfd.
+		 * the query nor to complete it.
 		 */
-		if (prev)
-			prev->next = next;
-		else
-			head = next;
-
-		gwp_dns_entry_free(e);
+		*pp = e->next;
+		inflight_del(ctx, e);
+		e->next = dead;
+		dead = e;
 	}
-
-	*head_p = head;
-	*dbq_p = dbq;
-	return 0;
+	return dead;
 }
 
 static void dispatch_batch_result(int r, struct gwp_dns_ctx *ctx,
@@ -377,9 +611,10 @@ static void dispatch_batch_result(int r, struct gwp_dns_ctx *ctx,
 			e->res = 0;
 		}
 
-		eventfd_write(e->ev_fd, 1);
+		/* Before completing: @e may be gone right after. */
 		if (!e->res)
 			try_pass_result_to_cache(ctx, e->name, ai);
+		finish_entry(ctx, e);
 	}
 }
 
@@ -403,19 +638,20 @@ static int prep_reqs(struct dns_batch_query *dbq)
 }
 
 /*
- * Signal every still-active entry (a client is still waiting) with an error so
- * it wakes up instead of hanging until its timeout. Used on the batch error
- * paths where the queries are never handed to getaddrinfo_a().
+ * Complete every entry, and whoever waits on it, with an error so they wake
+ * up instead of hanging until their timeout. Used on the batch error paths
+ * where the queries are never handed to getaddrinfo_a().
  */
-static void fail_active_entries(struct gwp_dns_entry *head, int err)
+static void fail_active_entries(struct gwp_dns_ctx *ctx,
+				struct gwp_dns_entry *head, int err)
 {
-	struct gwp_dns_entry *e;
+	struct gwp_dns_entry *e, *next;
 
-	for (e = head; e; e = e->next) {
-		if (atomic_load(&e->refcnt) > 1) {
-			e->res = err;
-			eventfd_write(e->ev_fd, 1);
-		}
+	for (e = head; e; e = next) {
+		next = e->next;
+		e->res = err;
+		e->nr_addrs = 0;
+		finish_entry(ctx, e);
 	}
 }
 
@@ -426,17 +662,26 @@ static void fail_active_entries(struct gwp_dns_entry *head, int err)
 static void process_queue_entry_batch(struct gwp_dns_ctx *ctx)
 {
 	struct gwp_dns_entry *head = unplug_queue_list(ctx);
+	struct gwp_dns_entry *dead;
 	struct dns_batch_query *dbq = NULL;
 
 	if (!head)
 		return;
 
+	dead = unlink_unwanted(ctx, &head);
 	pthread_mutex_unlock(&ctx->lock);
+	put_all_entries(dead);
+	if (!head)
+		goto out;
 
-	if (collect_active_queries(ctx, &head, &dbq)) {
-		fail_active_entries(head, -EHOSTUNREACH);
+	/*
+	 * Every entry left on @head is completed below, so the list must
+	 * not be walked afterwards.
+	 */
+	if (collect_active_queries(ctx, head, &dbq)) {
+		fail_active_entries(ctx, head, -EHOSTUNREACH);
 	} else if (prep_reqs(dbq)) {
-		fail_active_entries(head, -EHOSTUNREACH);
+		fail_active_entries(ctx, head, -EHOSTUNREACH);
 	} else {
 		struct sigevent ev;
 		int r;
@@ -448,7 +693,7 @@ static void process_queue_entry_batch(struct gwp_dns_ctx *ctx)
 	}
 
 	dbq_free(dbq);
-	put_all_entries(head);
+out:
 	pthread_mutex_lock(&ctx->lock);
 }
 #endif /* #ifdef CONFIG_HAVE_GETADDRINFO_A */
@@ -472,24 +717,26 @@ static void process_queue_entry_single(struct gwp_dns_ctx *ctx)
 	}
 
 	ctx->nr_entries--;
-	pthread_mutex_unlock(&ctx->lock);
 
-	if (atomic_load(&e->refcnt) == 1) {
+	if (!entry_wanted(e)) {
 		/*
 		 * If the refcnt is 1, it means we are the last reference
 		 * to this entry. The client no longer cares about the
 		 * result. We can free it immediately. No need to resolve
-		 * the query nor to signal the eventfd.
+		 * the query nor to complete it. Unmapped under the lock,
+		 * so nobody attaches to it in the meantime.
 		 */
+		inflight_del(ctx, e);
+		pthread_mutex_unlock(&ctx->lock);
 		gwp_dns_entry_free(e);
 		goto out;
 	}
 
+	pthread_mutex_unlock(&ctx->lock);
 	e->res = gwp_dns_resolve(ctx, e->name, e->service, e->addrs,
 				 GWP_DNS_MAX_ADDRS, &e->nr_addrs,
 				 ctx->cfg.restyp);
-	eventfd_write(e->ev_fd, 1);
-	gwp_dns_entry_put(e);
+	finish_entry(ctx, e);
 out:
 	pthread_mutex_lock(&ctx->lock);
 }
@@ -577,8 +824,9 @@ static int init_workers(struct gwp_dns_ctx *ctx)
 	uint32_t i;
 	int r;
 
+	/* A cache-only context (--raw-dns resolves in the workers). */
 	if (ctx->cfg.nr_workers == 0)
-		return -EINVAL;
+		return 0;
 
 	workers = calloc(ctx->cfg.nr_workers, sizeof(*workers));
 	if (!workers)
@@ -661,6 +909,26 @@ static int fetch_addr(struct gwp_dns_cache_entry *e, struct gwp_sockaddr *addr,
 	return 0;
 }
 
+static void queue_refresh(struct gwp_dns_ctx *ctx, const char *name);
+
+/*
+ * A hit on an entry that is near its end (or already serving stale): one
+ * caller queues a resolution on the DNS threads and everyone keeps using
+ * the entry meanwhile. The result lands in the cache and nowhere else.
+ *
+ * Without DNS threads (--raw-dns) nothing here can resolve, so the entry
+ * is left unclaimed: the claim would count a refresh that never happens.
+ */
+static void cond_refresh(struct gwp_dns_ctx *ctx, const char *name,
+			 struct gwp_dns_cache_entry *e)
+{
+	if (!ctx->cfg.nr_workers)
+		return;
+
+	if (gwp_dns_cache_claim_refresh(ctx->cache, e))
+		queue_refresh(ctx, name);
+}
+
 int gwp_dns_cache_lookup(struct gwp_dns_ctx *ctx, const char *name,
 			 const char *service, struct gwp_sockaddr *addr)
 {
@@ -674,6 +942,7 @@ int gwp_dns_cache_lookup(struct gwp_dns_ctx *ctx, const char *name,
 	if (r)
 		return r;
 
+	cond_refresh(ctx, name, e);
 	r = fetch_addr(e, addr, service ? atoi(service) : 0, ctx->cfg.restyp);
 	gwp_dns_cache_putent(e);
 	return r;
@@ -714,14 +983,79 @@ static void fetch_i6_at(struct gwp_dns_cache_entry *e, uint8_t idx,
 	memcpy(&addr->i6.sin6_addr, b, 16);
 }
 
+/* FNV-1a over the ASCII-lowercased name, the way the cache keys it. */
+static uint64_t l1_hash(const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned char c;
+
+	while ((c = (unsigned char)*name++)) {
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c - 'A' + 'a');
+		h = (h ^ c) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static bool l1_name_eq(const struct gwp_dns_cache_entry *e, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < e->name_len; i++) {
+		unsigned char c = (unsigned char)name[i];
+
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c - 'A' + 'a');
+		if (c != e->block[i])
+			return false;
+		if (!c)
+			return true;
+	}
+	return false;
+}
+
+static struct dns_l1_slot *l1_slot(struct gwp_dns_ctx *ctx, uint32_t cq,
+				   uint64_t hash)
+{
+	return &ctx->l1[cq].slots[hash & (GWP_DNS_L1_SLOTS - 1)];
+}
+
+/* Replace whatever @sl holds with another reference on @e. */
+static void l1_fill(struct dns_l1_slot *sl, uint64_t hash,
+		    struct gwp_dns_cache_entry *e)
+{
+	gwp_dns_cache_putent(sl->e);
+	gwp_dns_cache_entref(e);
+	sl->e = e;
+	sl->hash = hash;
+	sl->fresh_until = gwp_dns_cache_entfresh(e);
+}
+
+static void free_l1(struct gwp_dns_ctx *ctx)
+{
+	uint32_t i, j;
+
+	if (!ctx->l1)
+		return;
+
+	for (i = 0; i < ctx->cfg.nr_cq; i++)
+		for (j = 0; j < GWP_DNS_L1_SLOTS; j++)
+			gwp_dns_cache_putent(ctx->l1[i].slots[j].e);
+	free(ctx->l1);
+	ctx->l1 = NULL;
+}
+
 int gwp_dns_cache_lookup_list(struct gwp_dns_ctx *ctx, const char *name,
-			      const char *service, struct gwp_sockaddr *addrs,
-			      uint8_t cap, uint8_t *nr_addrs)
+			      const char *service, uint32_t cq,
+			      struct gwp_sockaddr *addrs, uint8_t cap,
+			      uint8_t *nr_addrs)
 {
-	struct gwp_dns_cache_entry *e;
+	struct gwp_dns_cache_entry *e, *ref = NULL;
 	uint8_t nr_v4, nr_v6, n = 0, i;
 	uint32_t rt = ctx->cfg.restyp;
+	struct dns_l1_slot *sl;
 	bool v6_first;
+	uint64_t hash;
 	uint16_t port;
 	int r;
 
@@ -732,9 +1066,23 @@ int gwp_dns_cache_lookup_list(struct gwp_dns_ctx *ctx, const char *name,
 	if (cap > GWP_DNS_MAX_ADDRS)
 		cap = GWP_DNS_MAX_ADDRS;
 
-	r = gwp_dns_cache_getent(ctx->cache, name, &e);
-	if (r)
-		return r;
+	assert(cq < ctx->cfg.nr_cq);
+	hash = l1_hash(name);
+	sl = l1_slot(ctx, cq, hash);
+	if (sl->e && sl->hash == hash && time(NULL) < sl->fresh_until &&
+	    l1_name_eq(sl->e, name)) {
+		e = sl->e;
+		ctx->l1[cq].nr_hit++;
+		/* The shared cache never sees this hit; keep the name warm. */
+		gwp_dns_cache_touch(e);
+	} else {
+		r = gwp_dns_cache_getent(ctx->cache, name, &e);
+		if (r)
+			return r;
+		cond_refresh(ctx, name, e);
+		l1_fill(sl, hash, e);
+		ref = e;
+	}
 
 	port = service ? (uint16_t)atoi(service) : 0;
 	nr_v4 = (rt == GWP_DNS_RESTYP_IPV6_ONLY) ? 0 : e->nr_i4;
@@ -757,7 +1105,7 @@ int gwp_dns_cache_lookup_list(struct gwp_dns_ctx *ctx, const char *name,
 		}
 	}
 
-	gwp_dns_cache_putent(e);
+	gwp_dns_cache_putent(ref);
 	*nr_addrs = n;
 	return n ? 0 : -EHOSTUNREACH;
 }
@@ -776,9 +1124,21 @@ static int init_cache(struct gwp_dns_ctx *ctx)
 		return 0;
 	}
 
+	ctx->l1 = aligned_alloc(64, sizeof(*ctx->l1) * ctx->cfg.nr_cq);
+	if (!ctx->l1)
+		return -ENOMEM;
+	memset(ctx->l1, 0, sizeof(*ctx->l1) * ctx->cfg.nr_cq);
+
 	r = gwp_dns_cache_init(&cache, cache_bucket_count(max), max);
-	if (r)
+	if (r) {
+		free_l1(ctx);
 		return r;
+	}
+
+	/* Without DNS threads there is nobody to refresh a stale entry. */
+	if (ctx->cfg.nr_workers)
+		gwp_dns_cache_set_refresh(cache, ctx->cfg.refresh_pct,
+					  ctx->cfg.stale_secs);
 
 	ctx->cache = cache;
 	return 0;
@@ -806,6 +1166,32 @@ static inline bool validate_restyp(int restyp)
 	}
 }
 
+static int init_cqs(struct gwp_dns_ctx *ctx)
+{
+	uint32_t i;
+
+	if (!ctx->cfg.nr_cq)
+		ctx->cfg.nr_cq = 1;
+
+	ctx->cqs = aligned_alloc(64, sizeof(*ctx->cqs) * ctx->cfg.nr_cq);
+	if (!ctx->cqs)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->cfg.nr_cq; i++)
+		gwp_cq_init(&ctx->cqs[i]);
+	return 0;
+}
+
+/* Drop the queue's reference on every entry nobody reaped. */
+static void free_cqs(struct gwp_dns_ctx *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->cfg.nr_cq; i++)
+		put_all_entries(gwp_cq_take(&ctx->cqs[i]));
+	free(ctx->cqs);
+}
+
 int gwp_dns_ctx_init(struct gwp_dns_ctx **ctx_p, const struct gwp_dns_cfg *cfg)
 {
 	struct gwp_dns_ctx *ctx;
@@ -819,10 +1205,14 @@ int gwp_dns_ctx_init(struct gwp_dns_ctx **ctx_p, const struct gwp_dns_cfg *cfg)
 		return -ENOMEM;
 
 	ctx->cfg = *cfg;
+	r = init_cqs(ctx);
+	if (r)
+		goto out_free_ctx;
+
 	r = pthread_mutex_init(&ctx->lock, NULL);
 	if (r) {
 		r = -r;
-		goto out_free_ctx;
+		goto out_free_cqs;
 	}
 
 	r = pthread_cond_init(&ctx->cond, NULL);
@@ -849,11 +1239,14 @@ int gwp_dns_ctx_init(struct gwp_dns_ctx **ctx_p, const struct gwp_dns_cfg *cfg)
 	*ctx_p = ctx;
 	return 0;
 out_free_cache:
+	free_l1(ctx);
 	free_cache(ctx->cache);
 out_destroy_cond:
 	pthread_cond_destroy(&ctx->cond);
 out_destroy_mutex:
 	pthread_mutex_destroy(&ctx->lock);
+out_free_cqs:
+	free(ctx->cqs);
 out_free_ctx:
 	free(ctx);
 	*ctx_p = NULL;
@@ -862,23 +1255,88 @@ out_free_ctx:
 
 static void put_all_queued_entries(struct gwp_dns_ctx *ctx)
 {
+	struct gwp_dns_entry *e;
+
+	/* Their followers were never queued; they go with them. */
+	for (e = ctx->head; e; e = e->next)
+		put_all_entries(e->followers);
 	put_all_entries(ctx->head);
 	ctx->head = ctx->tail = NULL;
 }
 
+void gwp_dns_ctx_stop(struct gwp_dns_ctx *ctx)
+{
+	free_workers(ctx);
+}
+
 void gwp_dns_ctx_free(struct gwp_dns_ctx *ctx)
 {
 	free_workers(ctx);
 	pthread_mutex_destroy(&ctx->lock);
 	pthread_cond_destroy(&ctx->cond);
 	put_all_queued_entries(ctx);
+	free_cqs(ctx);
+	free_l1(ctx);
 	free_cache(ctx->cache);
 	free(ctx);
 }
 
+void gwp_dns_set_cq_fd(struct gwp_dns_ctx *ctx, uint32_t cq, int ev_fd)
+{
+	gwp_cq_set_fd(&ctx->cqs[cq], ev_fd);
+}
+
+struct gwp_dns_entry *gwp_dns_reap(struct gwp_dns_ctx *ctx, uint32_t cq)
+{
+	struct gwp_dns_entry *e, *next, *fifo = NULL;
+
+	e = gwp_cq_take(&ctx->cqs[cq]);
+
+	/*
+	 * The stack is newest first; hand them out in completion order. Only
+	 * this worker drops the owner's reference, so a count of one cannot
+	 * change under us: the owner is gone and nobody wants the result.
+	 */
+	for (; e; e = next) {
+		next = e->next;
+		if (atomic_load(&e->refcnt) == 1) {
+			gwp_dns_entry_put(e);
+			continue;
+		}
+		e->next = fifo;
+		fifo = e;
+	}
+	return fifo;
+}
+
+/*
+ * Queue @e for the DNS threads, unless the same name is already being
+ * resolved: then @e waits on that entry and gets a copy of its answer
+ * (singleflight), whether that entry is a request or a cache refresh. A
+ * refresh needs no copy; the answer reaches the cache anyway, so it is
+ * dropped.
+ */
 static void push_queue(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
 {
+	struct gwp_dns_entry *lead;
+
+	e->followers = NULL;
 	pthread_mutex_lock(&ctx->lock);
+	lead = inflight_find(ctx, e->name, e->service);
+	if (lead) {
+		ctx->nr_coalesced++;
+		if (e->cq == GWP_DNS_CQ_REFRESH) {
+			pthread_mutex_unlock(&ctx->lock);
+			gwp_dns_entry_free(e);
+			return;
+		}
+		e->next = lead->followers;
+		lead->followers = e;
+		pthread_mutex_unlock(&ctx->lock);
+		return;
+	}
+
+	inflight_add(ctx, e);
 	if (ctx->tail)
 		ctx->tail->next = e;
 	else
@@ -892,8 +1350,7 @@ static void push_queue(struct gwp_dns_ctx *ctx, struct gwp_dns_entry *e)
 	pthread_mutex_unlock(&ctx->lock);
 }
 
-struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
-				    const char *name, const char *service)
+static struct gwp_dns_entry *alloc_entry(const char *name, const char *service)
 {
 	struct gwp_dns_entry *e;
 	size_t nl, sl;
@@ -902,10 +1359,6 @@ struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
 	if (!e)
 		return NULL;
 
-	e->ev_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
-	if (e->ev_fd < 0)
-		goto out_free_e;
-
 	/*
 	 * Merge name and service into a single allocated string to
 	 * avoid multiple allocations.
@@ -917,7 +1370,7 @@ struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
 	sl = service ? strlen(service) : 0;
 	e->name = malloc(nl + 1 + sl + 1);
 	if (!e->name)
-		goto out_close_ev_fd;
+		goto out_free_e;
 
 	e->service = e->name + nl + 1;
 	memcpy(e->name, name, nl + 1);
@@ -926,18 +1379,52 @@ struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
 	else
 		e->service[0] = '\0';
 
-	atomic_init(&e->refcnt, 2);
 	e->res = 0;
-	push_queue(ctx, e);
+	e->nr_addrs = 0;
 	return e;
 
-out_close_ev_fd:
-	__sys_close(e->ev_fd);
 out_free_e:
 	free(e);
 	return NULL;
 }
 
+struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
+				    const char *name, const char *service,
+				    uint32_t cq, void *udata)
+{
+	struct gwp_dns_entry *e;
+
+	assert(cq < ctx->cfg.nr_cq);
+	if (!ctx->cfg.nr_workers)
+		return NULL;
+
+	e = alloc_entry(name, service);
+	if (!e)
+		return NULL;
+
+	atomic_init(&e->refcnt, 2);
+	e->cq = cq;
+	e->udata = udata;
+	push_queue(ctx, e);
+	return e;
+}
+
+/* Only the queue holds a refresh; the DNS thread drops it when done. */
+static void queue_refresh(struct gwp_dns_ctx *ctx, const char *name)
+{
+	struct gwp_dns_entry *e;
+
+	/* The cache keeps addresses only, so any port resolves the same. */
+	e = alloc_entry(name, "0");
+	if (!e)
+		return;
+
+	atomic_init(&e->refcnt, 1);
+	e->cq = GWP_DNS_CQ_REFRESH;
+	e->udata = NULL;
+	push_queue(ctx, e);
+}
+
 bool gwp_dns_entry_put(struct gwp_dns_entry *e)
 {
 	int x;
@@ -21,12 +21,18 @@ struct gwp_dns_wrk;
  */
 #define GWP_DNS_MAX_ADDRS	8u
 
+/* gwp_dns_entry.cq of a cache refresh, which no worker reaps. */
+#define GWP_DNS_CQ_REFRESH	UINT32_MAX
+
 struct gwp_dns_entry {
 	char			*name;
 	char			*service;
 	_Atomic(int)		refcnt;
 	int			res;
-	int			ev_fd;
+	/* Completion queue (worker index) the finished entry goes to. */
+	uint32_t		cq;
+	/* The owner, handed back untouched by gwp_dns_reap(). */
+	void			*udata;
 	/*
 	 * Every usable address for @name, ordered the way they should be
 	 * tried: preferred family first, then families alternating, so a
@@ -37,6 +43,13 @@ struct gwp_dns_entry {
 	struct gwp_sockaddr	addrs[GWP_DNS_MAX_ADDRS];
 	uint8_t			nr_addrs;
 	struct gwp_dns_entry	*next;
+	/*
+	 * Private to dns.c. The in-flight map's chain, and on the entry that
+	 * is actually being resolved, the requests for the same name and
+	 * service that wait for its answer (linked through ->next).
+	 */
+	struct gwp_dns_entry	*inflight_next;
+	struct gwp_dns_entry	*followers;
 };
 
 enum {
@@ -50,8 +63,12 @@ enum {
 struct gwp_dns_cfg {
 	int		cache_expiry;	/* In seconds. <= 0 to disable cache. */
 	uint32_t	max_entries;	/* Max cache entries; 0 = unlimited. */
-	uint32_t	nr_workers;
+	uint32_t	nr_workers;	/* 0 = cache only, nothing resolves. */
 	uint32_t	restyp;
+	uint32_t	nr_cq;		/* Completion queues; 0 = one. */
+	/* See gwp_dns_cache_set_refresh(); need DNS threads. */
+	uint32_t	refresh_pct;
+	uint32_t	stale_secs;
 };
 
 struct gwp_dns_ctx;
@@ -79,20 +96,48 @@ int gwp_dns_ctx_init(struct gwp_dns_ctx **ctx_p, const struct gwp_dns_cfg *cfg);
 void gwp_dns_ctx_free(struct gwp_dns_ctx *ctx);
 
 /**
- * Queue a DNS resolution request. It returns a pointer to a gwp_dns_entry
- * with eventfd set to a valid file descriptor that can be used to wait for
- * the resolution result. The caller's responsible to call gwp_dns_entry_put()
- * to release the entry when it is no longer needed.
+ * Stop the DNS threads. Queries still queued are not resolved, and no
+ * completion queue is written from here on; the entries stay for
+ * gwp_dns_ctx_free(). Safe to call more than once.
  *
- * The returned eventfd file descriptor is non-blocking.
+ * @param ctx	Pointer to the DNS context.
+ */
+void gwp_dns_ctx_stop(struct gwp_dns_ctx *ctx);
+
+/**
+ * Queue a DNS resolution request. It returns a pointer to a gwp_dns_entry
+ * that comes back from gwp_dns_reap() on completion queue `cq` once it is
+ * resolved. The caller's responsible to call gwp_dns_entry_put() to release
+ * the entry when it is no longer needed; dropping it before the result
+ * arrives is how a caller cancels.
  *
  * @param ctx		Pointer to the DNS context.
  * @param name		Name to resolve.
  * @param service 	Service to resolve in port number ascii format.
+ * @param cq		Completion queue, below gwp_dns_cfg.nr_cq.
+ * @param udata		Stored in entry->udata.
  * @return		Pointer to a gwp_dns_entry on success, NULL on failure.
  */
 struct gwp_dns_entry *gwp_dns_queue(struct gwp_dns_ctx *ctx,
-				    const char *name, const char *service);
+				    const char *name, const char *service,
+				    uint32_t cq, void *udata);
+
+/*
+ * The eventfd written when completion queue @cq goes from empty to
+ * non-empty; -1 for none. One eventfd per worker replaces one per query:
+ * the worker reads it once and then takes every finished entry in one go.
+ * Set it before queueing to @cq.
+ */
+void gwp_dns_set_cq_fd(struct gwp_dns_ctx *ctx, uint32_t cq, int ev_fd);
+
+/*
+ * Take every resolved entry of queue @cq, oldest first, linked through
+ * ->next. Entries whose owner already let go are freed here and not
+ * returned. Each returned entry still carries the queue's reference, which
+ * the caller drops with gwp_dns_entry_put() on top of its own. Only the
+ * worker that owns @cq may call it. Returns NULL when none.
+ */
+struct gwp_dns_entry *gwp_dns_reap(struct gwp_dns_ctx *ctx, uint32_t cq);
 
 /**
  * Release a DNS entry. This function decrements the reference count of the
@@ -130,9 +175,28 @@ int gwp_dns_cache_lookup(struct gwp_dns_ctx *ctx, const char *name,
  * reads the same entry -- no extra lookup cost.
  */
 int gwp_dns_cache_lookup_list(struct gwp_dns_ctx *ctx, const char *name,
-			      const char *service, struct gwp_sockaddr *addrs,
-			      uint8_t cap, uint8_t *nr_addrs);
+			      const char *service, uint32_t cq,
+			      struct gwp_sockaddr *addrs, uint8_t cap,
+			      uint8_t *nr_addrs);
+
 
+/*
+ * Put @nr addresses for @name into the cache, for @ttl seconds at most (the
+ * configured expiry still caps it). For results that did not come from the
+ * DNS threads, such as --raw-dns. A no-op when the cache is disabled.
+ */
+void gwp_dns_cache_store(struct gwp_dns_ctx *ctx, const char *name,
+			 const struct gwp_sockaddr *addrs, uint8_t nr,
+			 uint32_t ttl);
+
+/*
+ * Fill @st with the cache's counters, the workers' private hits included.
+ * Returns -ENOSYS when the cache is disabled. Read it once the workers are
+ * gone; their hit counts are not synchronized.
+ */
+struct gwp_dns_cache_stats;
+int gwp_dns_ctx_cache_stats(struct gwp_dns_ctx *ctx,
+			    struct gwp_dns_cache_stats *st);
 
 /*
  * Resolve @name/@service into up to @cap addresses, written to @addrs in the
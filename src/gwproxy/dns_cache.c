@@ -32,31 +32,68 @@
 struct dns_cache_entry {
 	struct dns_cache_entry		*next;
 	time_t				expired_at;
+	/* Served stale until then; the same as @expired_at without a window. */
+	time_t				dead_at;
+	/* From then on a hit should re-resolve (see claim_refresh()). */
+	time_t				refresh_at;
+	_Atomic(time_t)			next_claim;
 	_Atomic(int)			ref_cnt;
+	/* CLOCK hit count, bumped by lookups and decayed by the hand. */
+	_Atomic(uint8_t)		clock;
 	struct gwp_dns_cache_entry	e;
 };
 
+/*
+ * One shard of the cache: its own lock and its own slice of the buckets, so
+ * workers looking up different names do not share a lock cacheline. A key's
+ * shard and bucket both come from its hash.
+ */
 struct dns_hash_map {
+	pthread_rwlock_t	lock;
+	/* Bumped under the read lock, which already dirties this line. */
+	_Atomic(unsigned long)	nr_hit;
+	_Atomic(unsigned long)	nr_miss;
+	_Atomic(unsigned long)	nr_evict;
+	_Atomic(unsigned long)	nr_stale;
 	struct dns_cache_entry	**table;
 	size_t			nr_buckets;
+	/* The rest is only touched with the lock held for writing. */
 	size_t			nr_entries;
 	size_t			max_entries;	/* 0 = unlimited */
-	uint64_t		seed;		/* per-cache random hash seed */
-};
+	/* The CLOCK hand: the bucket eviction resumes from. */
+	size_t			hand;
+	/* When an insert last swept this shard (see shard_housekeep()). */
+	time_t			last_sweep;
+} __attribute__((__aligned__(64)));
 
 struct gwp_dns_cache {
-	pthread_rwlock_t	lock;
-	struct dns_hash_map	map;
-	/*
-	 * Rate-limits the lookup-triggered expiry sweep (see throttled_housekeep).
-	 * A 32-bit seconds counter, not time_t: an 8-byte atomic is not lock-free
-	 * on 32-bit targets and would pull in libatomic. Unsigned wrap of the
-	 * delta is fine for a 1-second throttle.
-	 */
-	_Atomic(uint32_t)	last_housekeep;
+	struct dns_hash_map	*shards;
+	uint32_t		nr_shards;	/* power of two */
+	uint32_t		shard_shift;
+	uint64_t		seed;		/* per-cache random hash seed */
+	/* See gwp_dns_cache_set_refresh(). */
+	uint32_t		refresh_pct;
+	uint32_t		stale_secs;
+	_Atomic(unsigned long)	nr_refresh;
 };
 
-/* Minimum seconds between two lookup-triggered full sweeps. */
+/* Upper bound on the shard count; a small cache gets one per bucket. */
+#define GWP_DNS_CACHE_MAX_SHARDS	64u
+
+/*
+ * The cap is split evenly across shards and enforced per shard, so a shard
+ * never needs another's lock to make room. Keep each shard's share at least
+ * this big, or the hash spread alone would evict live names early.
+ */
+#define GWP_DNS_CACHE_MIN_PER_SHARD	64u
+
+/* Hits an entry can bank before the CLOCK hand has to pass it that often. */
+#define GWP_DNS_CLOCK_MAX		3u
+
+/* A refresh that went nowhere may be claimed again after this long. */
+#define GWP_DNS_REFRESH_RETRY_SECS	2
+
+/* Minimum seconds between two insert-triggered sweeps of one shard. */
 #define GWP_DNS_HOUSEKEEP_MIN_INTERVAL 1
 
 /*
@@ -123,17 +160,45 @@ static size_t normalize_key(const char *key, char *buf, size_t cap)
 static int dns_map_init(struct dns_hash_map *map, size_t nr_buckets,
 			size_t max_entries)
 {
+	int r;
+
 	map->table = calloc(nr_buckets, sizeof(*map->table));
 	if (!map->table)
 		return -ENOMEM;
 
+	r = pthread_rwlock_init(&map->lock, NULL);
+	if (r) {
+		free(map->table);
+		map->table = NULL;
+		return -r;
+	}
+
 	map->nr_buckets = nr_buckets;
 	map->nr_entries = 0;
 	map->max_entries = max_entries;
-	map->seed = gen_hash_seed();
+	map->hand = 0;
+	map->last_sweep = 0;
+	atomic_init(&map->nr_hit, 0ul);
+	atomic_init(&map->nr_miss, 0ul);
+	atomic_init(&map->nr_evict, 0ul);
+	atomic_init(&map->nr_stale, 0ul);
 	return 0;
 }
 
+/*
+ * The shard from the top bits of the mixed hash, the bucket from the hash
+ * itself, so the two do not correlate.
+ */
+static struct dns_hash_map *key_shard(struct gwp_dns_cache *cache,
+				      uint64_t hash)
+{
+	uint64_t h = hash * 0x9e3779b97f4a7c15ULL;
+
+	if (!cache->shard_shift)
+		return &cache->shards[0];
+	return &cache->shards[h >> (64 - cache->shard_shift)];
+}
+
 static void put_dns_entry(struct dns_cache_entry *e)
 {
 	int x = atomic_fetch_sub(&e->ref_cnt, 1);
@@ -168,6 +233,7 @@ static void dns_map_free(struct dns_hash_map *map)
 	free(map->table);
 	map->table = NULL;
 	map->nr_buckets = 0;
+	pthread_rwlock_destroy(&map->lock);
 }
 
 static void count_addrinfo(const struct addrinfo *ai, size_t *nr_i4,
@@ -247,31 +313,122 @@ static int alloc_dns_entry(struct dns_cache_entry **ep, const char *key,
 		return -ENOMEM;
 
 	de->expired_at = expired_at;
+	de->dead_at = expired_at;
+	de->refresh_at = expired_at;
+	atomic_init(&de->next_claim, expired_at);
 	de->e.name_len = name_len;
 	de->e.nr_i4 = nr_i4;
 	de->e.nr_i6 = nr_i6;
 	atomic_init(&de->ref_cnt, 1);
+	atomic_init(&de->clock, (uint8_t)1);
 	memcpy(de->e.block, key, name_len);
 	extract_i4i6(de, ai);
 	*ep = de;
 	return 0;
 }
 
-static int dns_map_insert(struct dns_hash_map *map, const char *key,
-			  const struct addrinfo *ai, time_t expired_at)
+/* Must be called with map->lock held for writing. */
+static size_t dns_map_scan_and_remove_expired(struct dns_hash_map *map,
+					      time_t now)
 {
-	struct dns_cache_entry *de, *cur, *prev = NULL, *next;
-	time_t now = time(NULL);
-	uint64_t hash, idx;
-	char lkey[256];
-	int r;
+	struct dns_cache_entry *next, *cur;
+	size_t i, nr = 0;
 
-	if (!normalize_key(key, lkey, sizeof(lkey)))
-		return -EINVAL;
+	for (i = 0; i < map->nr_buckets; i++) {
+		cur = map->table[i];
+		map->table[i] = NULL;
+		while (cur) {
+			next = cur->next;
+			if (cur->dead_at <= now) {
+				nr++;
+				put_dns_entry(cur);
+			} else {
+				cur->next = map->table[i];
+				map->table[i] = cur;
+			}
+			cur = next;
+		}
+	}
 
-	r = alloc_dns_entry(&de, lkey, ai, expired_at);
-	if (r)
-		return r;
+	map->nr_entries -= nr;
+	map->last_sweep = now;
+	return nr;
+}
+
+/*
+ * Must be called with map->lock held for writing. Lookups never sweep: an
+ * insert, which holds the shard's write lock anyway, reclaims the shard's
+ * expired entries at most once per GWP_DNS_HOUSEKEEP_MIN_INTERVAL. Shards
+ * nobody inserts into are left to gwp_dns_cache_housekeep().
+ */
+static void shard_housekeep(struct dns_hash_map *map, time_t now)
+{
+	if (now - map->last_sweep < GWP_DNS_HOUSEKEEP_MIN_INTERVAL)
+		return;
+
+	dns_map_scan_and_remove_expired(map, now);
+}
+
+/*
+ * A hit: one more round for the entry under the CLOCK hand. The store is
+ * skipped once the count saturates, so a hot name's line stays clean.
+ */
+static void clock_touch(struct dns_cache_entry *de)
+{
+	uint8_t c;
+
+	c = atomic_load_explicit(&de->clock, memory_order_relaxed);
+	if (c < GWP_DNS_CLOCK_MAX)
+		atomic_store_explicit(&de->clock, c + 1, memory_order_relaxed);
+}
+
+/*
+ * Must be called with map->lock held for writing, on a non-empty shard.
+ * Make room for one entry with CLOCK: the hand walks the shard's buckets,
+ * sparing an entry that was hit since it last came by (taking one hit off
+ * its count) and evicting the first one that was not, or that expired.
+ * Counts saturate at GWP_DNS_CLOCK_MAX, so the walk is bounded, and a name
+ * looked up once is gone long before the ones every client asks for.
+ */
+static void clock_evict(struct dns_hash_map *map, time_t now)
+{
+	struct dns_cache_entry **pp, *cur;
+	uint8_t c;
+
+	for (;;) {
+		pp = &map->table[map->hand];
+		while ((cur = *pp)) {
+			c = atomic_load_explicit(&cur->clock,
+						 memory_order_relaxed);
+			if (cur->dead_at > now && c) {
+				atomic_store_explicit(&cur->clock, c - 1,
+						      memory_order_relaxed);
+				pp = &cur->next;
+				continue;
+			}
+
+			*pp = cur->next;
+			if (cur->dead_at > now)
+				atomic_fetch_add_explicit(&map->nr_evict, 1,
+							  memory_order_relaxed);
+			put_dns_entry(cur);
+			map->nr_entries--;
+			return;
+		}
+		map->hand = (map->hand + 1) % map->nr_buckets;
+	}
+}
+
+/* Must be called with map->lock held for writing. */
+static int dns_map_insert(struct dns_hash_map *map, uint64_t hash,
+			  struct dns_cache_entry *de)
+{
+	struct dns_cache_entry *cur, *prev = NULL, *next;
+	time_t now = time(NULL);
+	uint64_t idx;
+	size_t nr_expired = 0;
+
+	shard_housekeep(map, now);
 
 	/*
 	 * There are three cases:
@@ -279,17 +436,15 @@ static int dns_map_insert(struct dns_hash_map *map, const char *key,
 	 *   2) Collision with the same key, replace the entry.
 	 *   3) Collision with a different key, chain the entry.
 	 */
-	hash = hash_key(map->seed, (const unsigned char *)lkey);
 	idx = hash % map->nr_buckets;
 	cur = map->table[idx];
 	if (!cur) {
 		/*
-		 * Case 1. Best case, no collision!
+		 * Case 1. Best case, no collision! At the cap, the entry
+		 * CLOCK evicts is in another bucket: this one is empty.
 		 */
-		if (map->max_entries && map->nr_entries >= map->max_entries) {
-			free(de);	/* fresh, unshared alloc (ref_cnt == 1) */
-			return -ENOSPC;
-		}
+		if (map->max_entries && map->nr_entries >= map->max_entries)
+			clock_evict(map, now);
 		map->table[idx] = de;
 		de->next = NULL;
 		map->nr_entries++;
@@ -338,11 +493,11 @@ static int dns_map_insert(struct dns_hash_map *map, const char *key,
 		 *		- If @cur is expired and prev is not NULL, set
 		 *		@prev->next to @cur->next. Then free @cur.
 		 */
-		while (cur && cur->expired_at <= now) {
+		while (cur && cur->dead_at <= now) {
 			/*
 			 * Remove expired entries.
 			 */
-			map->nr_entries--;
+			nr_expired++;
 			next = cur->next;
 			put_dns_entry(cur);
 			if (prev)
@@ -369,6 +524,7 @@ static int dns_map_insert(struct dns_hash_map *map, const char *key,
 
 			de->next = cur->next;
 			put_dns_entry(cur);
+			map->nr_entries -= nr_expired;
 			return 0;
 		}
 
@@ -382,46 +538,42 @@ static int dns_map_insert(struct dns_hash_map *map, const char *key,
 	 *
 	 * The collision walk above already reclaimed any expired entries in this
 	 * bucket, so the count reflects live + not-yet-swept entries. Bound the
-	 * cache: once at capacity, refuse new keys (resolution still works, it is
-	 * just not cached) rather than growing without limit.
+	 * cache: once at capacity, CLOCK evicts a cold entry to make room. It
+	 * may take @prev with it, so the new entry goes in at the head.
 	 */
-	if (map->max_entries && map->nr_entries >= map->max_entries) {
-		free(de);	/* fresh, unshared alloc (ref_cnt == 1) */
-		return -ENOSPC;
-	}
+	map->nr_entries -= nr_expired;
+	if (map->max_entries && map->nr_entries >= map->max_entries)
+		clock_evict(map, now);
+	de->next = map->table[idx];
+	map->table[idx] = de;
 	map->nr_entries++;
-	de->next = NULL;
-	if (prev)
-		prev->next = de;
-	else
-		map->table[idx] = de;
-
 	return 0;
 }
 
-static int dns_map_lookup_and_get(struct dns_hash_map *map, const char *key,
+/* Must be called with map->lock held. */
+static int dns_map_lookup_and_get(struct dns_hash_map *map, uint64_t hash,
+				  const char *lkey, size_t nl,
 				  struct dns_cache_entry **ep)
 {
 	struct dns_cache_entry *cur;
 	time_t now = time(NULL);
-	uint64_t hash, idx;
-	char lkey[256];
-	size_t nl;
+	uint64_t idx;
 
-	nl = normalize_key(key, lkey, sizeof(lkey));
-	if (nl <= 1 || nl > 255)
-		return -EINVAL;
-
-	hash = hash_key(map->seed, (const unsigned char *)lkey);
 	idx = hash % map->nr_buckets;
 	cur = map->table[idx];
 
 	while (cur) {
 		if (cur->e.name_len == nl && !memcmp(cur->e.block, lkey, nl)) {
 
+			if (cur->dead_at <= now)
+				break;
 			if (cur->expired_at <= now)
-				return -ETIMEDOUT;
+				atomic_fetch_add_explicit(&map->nr_stale, 1,
+							  memory_order_relaxed);
 
+			clock_touch(cur);
+			atomic_fetch_add_explicit(&map->nr_hit, 1,
+						  memory_order_relaxed);
 			get_dns_entry(cur);
 			*ep = cur;
 			return 0;
@@ -429,99 +581,150 @@ static int dns_map_lookup_and_get(struct dns_hash_map *map, const char *key,
 		cur = cur->next;
 	}
 
-	return -ENOENT;
+	atomic_fetch_add_explicit(&map->nr_miss, 1, memory_order_relaxed);
+	return cur ? -ETIMEDOUT : -ENOENT;
 }
 
 int gwp_dns_cache_init(struct gwp_dns_cache **cache_p, uint32_t nr_buckets,
 		       uint32_t max_entries)
 {
 	struct gwp_dns_cache *cache;
+	uint32_t i, nr_shards = 1, shift = 0;
+	size_t per_shard;
 	int r;
 
 	/* nr_buckets is used as a modulus; a zero would divide by zero. */
 	if (!nr_buckets)
 		return -EINVAL;
 
-	cache = malloc(sizeof(*cache));
+	while (nr_shards < GWP_DNS_CACHE_MAX_SHARDS && nr_shards * 2 <= nr_buckets &&
+	       (!max_entries ||
+		nr_shards * 2 * GWP_DNS_CACHE_MIN_PER_SHARD <= max_entries)) {
+		nr_shards *= 2;
+		shift++;
+	}
+	per_shard = (nr_buckets + nr_shards - 1) / nr_shards;
+
+	cache = calloc(1, sizeof(*cache));
 	if (!cache)
 		return -ENOMEM;
 
-	r = pthread_rwlock_init(&cache->lock, NULL);
-	if (r) {
-		r = -r;
-		goto out_free_cache;
+	cache->shards = aligned_alloc(64, sizeof(*cache->shards) * nr_shards);
+	if (!cache->shards) {
+		free(cache);
+		return -ENOMEM;
 	}
 
-	r = dns_map_init(&cache->map, nr_buckets, max_entries);
-	if (r)
-		goto out_destroy_lock;
+	for (i = 0; i < nr_shards; i++) {
+		/* The remainder goes to the first shards; the sum is the cap. */
+		size_t cap = max_entries / nr_shards +
+			     (i < max_entries % nr_shards);
+
+		r = dns_map_init(&cache->shards[i], per_shard, cap);
+		if (r)
+			goto out_free_shards;
+	}
 
-	atomic_init(&cache->last_housekeep, (uint32_t)0);
+	cache->nr_shards = nr_shards;
+	cache->shard_shift = shift;
+	cache->seed = gen_hash_seed();
+	atomic_init(&cache->nr_refresh, 0ul);
 	*cache_p = cache;
 	return 0;
 
-out_destroy_lock:
-	pthread_rwlock_destroy(&cache->lock);
-out_free_cache:
+out_free_shards:
+	while (i--)
+		dns_map_free(&cache->shards[i]);
+	free(cache->shards);
 	free(cache);
 	return r;
 }
 
 void gwp_dns_cache_free(struct gwp_dns_cache *cache)
 {
+	uint32_t i;
+
 	if (!cache)
 		return;
 
-	dns_map_free(&cache->map);
-	pthread_rwlock_destroy(&cache->lock);
+	for (i = 0; i < cache->nr_shards; i++)
+		dns_map_free(&cache->shards[i]);
+	free(cache->shards);
 	free(cache);
 }
 
+/*
+ * Refresh-ahead: a hit in the last refresh_pct percent of the entry's life
+ * asks for a new answer while the old one still serves. The stale window
+ * keeps a dead entry around so hits carry on during the refresh, or while
+ * the resolver is down.
+ */
+static void set_entry_times(struct gwp_dns_cache *cache,
+			    struct dns_cache_entry *de, time_t now)
+{
+	time_t life = de->expired_at - now;
+
+	de->dead_at = de->expired_at + cache->stale_secs;
+	if (life > 0)
+		de->refresh_at = de->expired_at - life * cache->refresh_pct / 100;
+	atomic_store_explicit(&de->next_claim, de->refresh_at,
+			      memory_order_relaxed);
+}
+
+void gwp_dns_cache_set_refresh(struct gwp_dns_cache *cache,
+			       uint32_t refresh_pct, uint32_t stale_secs)
+{
+	cache->refresh_pct = refresh_pct < 100 ? refresh_pct : 99;
+	cache->stale_secs = stale_secs;
+}
+
 int gwp_dns_cache_insert(struct gwp_dns_cache *cache, const char *key,
 			 const struct addrinfo *ai, time_t expired_at)
 {
+	struct dns_cache_entry *de;
+	struct dns_hash_map *map;
+	char lkey[256];
+	uint64_t hash;
 	int r;
-	pthread_rwlock_wrlock(&cache->lock);
-	r = dns_map_insert(&cache->map, key, ai, expired_at);
-	pthread_rwlock_unlock(&cache->lock);
-	return r;
-}
 
-/*
- * Sweep expired entries, but at most once per GWP_DNS_HOUSEKEEP_MIN_INTERVAL and
- * with only one sweeper at a time. Without this, a hot name expiring makes every
- * concurrent lookup that hits it (-ETIMEDOUT) launch its own O(total) full-table
- * sweep under the write lock -- a thundering-herd stall recurring at each TTL
- * boundary. The winner of the timestamp CAS performs the sweep; the rest skip.
- */
-static void throttled_housekeep(struct gwp_dns_cache *cache)
-{
-	uint32_t now = (uint32_t)time(NULL);
-	uint32_t last = atomic_load_explicit(&cache->last_housekeep,
-					     memory_order_relaxed);
+	if (!normalize_key(key, lkey, sizeof(lkey)))
+		return -EINVAL;
 
-	if (now - last < GWP_DNS_HOUSEKEEP_MIN_INTERVAL)
-		return;
-	if (!atomic_compare_exchange_strong_explicit(&cache->last_housekeep,
-			&last, now, memory_order_relaxed, memory_order_relaxed))
-		return;
+	/* Built outside the lock; readers of the shard only wait for the link. */
+	r = alloc_dns_entry(&de, lkey, ai, expired_at);
+	if (r)
+		return r;
+	set_entry_times(cache, de, time(NULL));
 
-	gwp_dns_cache_housekeep(cache);
+	hash = hash_key(cache->seed, (const unsigned char *)lkey);
+	map = key_shard(cache, hash);
+	pthread_rwlock_wrlock(&map->lock);
+	r = dns_map_insert(map, hash, de);
+	pthread_rwlock_unlock(&map->lock);
+	return r;
 }
 
 int gwp_dns_cache_getent(struct gwp_dns_cache *cache, const char *key,
 			 struct gwp_dns_cache_entry **ep)
 {
 	struct dns_cache_entry *de = NULL;
+	struct dns_hash_map *map;
+	char lkey[256];
+	uint64_t hash;
+	size_t nl;
 	int r;
 
-	pthread_rwlock_rdlock(&cache->lock);
-	r = dns_map_lookup_and_get(&cache->map, key, &de);
-	pthread_rwlock_unlock(&cache->lock);
+	nl = normalize_key(key, lkey, sizeof(lkey));
+	if (nl <= 1 || nl > 255)
+		return -EINVAL;
+
+	hash = hash_key(cache->seed, (const unsigned char *)lkey);
+	map = key_shard(cache, hash);
+	pthread_rwlock_rdlock(&map->lock);
+	r = dns_map_lookup_and_get(map, hash, lkey, nl, &de);
+	pthread_rwlock_unlock(&map->lock);
 	if (de)
 		*ep = &de->e;
-	else if (r == -ETIMEDOUT)
-		throttled_housekeep(cache);
 
 	return r;
 }
@@ -532,32 +735,84 @@ void gwp_dns_cache_putent(struct gwp_dns_cache_entry *e)
 		put_dns_entry(container_of(e, struct dns_cache_entry, e));
 }
 
-static void dns_map_scan_and_remove_expired(struct dns_hash_map *map)
+void gwp_dns_cache_entref(struct gwp_dns_cache_entry *e)
 {
-	struct dns_cache_entry *next, *cur;
+	get_dns_entry(container_of(e, struct dns_cache_entry, e));
+}
+
+void gwp_dns_cache_touch(struct gwp_dns_cache_entry *e)
+{
+	clock_touch(container_of(e, struct dns_cache_entry, e));
+}
+
+time_t gwp_dns_cache_entexp(const struct gwp_dns_cache_entry *e)
+{
+	return container_of(e, struct dns_cache_entry, e)->expired_at;
+}
+
+time_t gwp_dns_cache_entfresh(const struct gwp_dns_cache_entry *e)
+{
+	return container_of(e, struct dns_cache_entry, e)->refresh_at;
+}
+
+bool gwp_dns_cache_claim_refresh(struct gwp_dns_cache *cache,
+				 struct gwp_dns_cache_entry *e)
+{
+	struct dns_cache_entry *de = container_of(e, struct dns_cache_entry, e);
 	time_t now = time(NULL);
-	size_t i;
+	time_t t;
 
-	for (i = 0; i < map->nr_buckets; i++) {
-		cur = map->table[i];
-		map->table[i] = NULL;
-		while (cur) {
-			next = cur->next;
-			if (cur->expired_at <= now) {
-				map->nr_entries--;
-				put_dns_entry(cur);
-			} else {
-				cur->next = map->table[i];
-				map->table[i] = cur;
-			}
-			cur = next;
-		}
-	}
+	t = atomic_load_explicit(&de->next_claim, memory_order_relaxed);
+	if (now < t)
+		return false;
+
+	/* One winner per window; the rest keep using the entry as it is. */
+	if (!atomic_compare_exchange_strong_explicit(&de->next_claim, &t,
+						     now + GWP_DNS_REFRESH_RETRY_SECS,
+						     memory_order_relaxed,
+						     memory_order_relaxed))
+		return false;
+
+	atomic_fetch_add_explicit(&cache->nr_refresh, 1, memory_order_relaxed);
+	return true;
 }
 
 void gwp_dns_cache_housekeep(struct gwp_dns_cache *cache)
 {
-	pthread_rwlock_wrlock(&cache->lock);
-	dns_map_scan_and_remove_expired(&cache->map);
-	pthread_rwlock_unlock(&cache->lock);
+	time_t now = time(NULL);
+	uint32_t i;
+
+	/* One shard at a time; lookups elsewhere never wait for the sweep. */
+	for (i = 0; i < cache->nr_shards; i++) {
+		struct dns_hash_map *map = &cache->shards[i];
+
+		pthread_rwlock_wrlock(&map->lock);
+		dns_map_scan_and_remove_expired(map, now);
+		pthread_rwlock_unlock(&map->lock);
+	}
+}
+
+void gwp_dns_cache_stats(struct gwp_dns_cache *cache,
+			 struct gwp_dns_cache_stats *st)
+{
+	uint32_t i;
+
+	memset(st, 0, sizeof(*st));
+	st->nr_refresh = atomic_load_explicit(&cache->nr_refresh,
+					      memory_order_relaxed);
+	for (i = 0; i < cache->nr_shards; i++) {
+		struct dns_hash_map *map = &cache->shards[i];
+
+		st->nr_hit += atomic_load_explicit(&map->nr_hit,
+						   memory_order_relaxed);
+		st->nr_miss += atomic_load_explicit(&map->nr_miss,
+						    memory_order_relaxed);
+		st->nr_evict += atomic_load_explicit(&map->nr_evict,
+						     memory_order_relaxed);
+		st->nr_stale += atomic_load_explicit(&map->nr_stale,
+						     memory_order_relaxed);
+		pthread_rwlock_rdlock(&map->lock);
+		st->nr_entries += map->nr_entries;
+		pthread_rwlock_unlock(&map->lock);
+	}
 }
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <time.h>
 
 struct gwp_dns_cache_entry {
@@ -50,11 +51,15 @@ struct gwp_dns_cache;
  * instance. When the cache is no longer needed, it should be freed using
  * `gwp_dns_cache_free()`.
  *
+ * The hash map is split into up to 64 shards, each with its own lock, so
+ * lookups of different names from different threads do not contend.
+ *
  * @param cache_p	Pointer to the cache pointer that will be initialized.
- * @param nr_buckets	Number of buckets for the hash map.
- * @param max_entries	Maximum number of entries to hold; once reached, inserts
- *			of new keys are refused (returning -ENOSPC) to bound
- *			memory. 0 means unlimited.
+ * @param nr_buckets	Number of buckets for the hash map, across all shards.
+ * @param max_entries	Maximum number of entries to hold; once reached, a
+ *			new key evicts a cold entry of its shard (CLOCK: names
+ *			looked up since the hand last passed are spared). It is
+ *			split evenly across shards. 0 means unlimited.
  * @return int		0 on success, negative error code on failure.
  */
 int gwp_dns_cache_init(struct gwp_dns_cache **cache_p, uint32_t nr_buckets,
@@ -67,14 +72,51 @@ int gwp_dns_cache_init(struct gwp_dns_cache **cache_p, uint32_t nr_buckets,
  */
 void gwp_dns_cache_free(struct gwp_dns_cache *cache);
 
+/**
+ * Set up refresh-ahead and serve-stale. Call before the first insert; it
+ * applies to entries inserted from then on.
+ *
+ * @param cache		The DNS cache.
+ * @param refresh_pct	A hit within the last refresh_pct percent of an
+ *			entry's lifetime makes it due for a refresh (see
+ *			`gwp_dns_cache_claim_refresh()`). 0 waits for expiry.
+ * @param stale_secs	How long past its expiry an entry is still returned,
+ *			so that it keeps serving while it is being refreshed
+ *			or the resolver is unreachable. 0 for none.
+ */
+void gwp_dns_cache_set_refresh(struct gwp_dns_cache *cache,
+			       uint32_t refresh_pct, uint32_t stale_secs);
+
 /**
  * Scan and remove expired entries from the DNS cache. Expected to
  * be called periodically to reclaim memory from expired entries.
+ * Lookups never do this; inserts only sweep the shard they write to.
  *
  * @param cache	The DNS cache to perform housekeeping on.
  */
 void gwp_dns_cache_housekeep(struct gwp_dns_cache *cache);
 
+/* Counters since the cache was created. */
+struct gwp_dns_cache_stats {
+	unsigned long	nr_hit;
+	unsigned long	nr_miss;	/* not cached, or expired */
+	unsigned long	nr_evict;	/* live entries pushed out to make room */
+	unsigned long	nr_stale;	/* hits served past expiry */
+	unsigned long	nr_refresh;	/* refreshes claimed */
+	unsigned long	nr_entries;	/* held right now */
+	/* Lookups that joined one in flight; filled by the DNS context only. */
+	unsigned long	nr_coalesced;
+};
+
+/**
+ * Sum the per-shard counters.
+ *
+ * @param cache	The DNS cache.
+ * @param st	Filled with the totals.
+ */
+void gwp_dns_cache_stats(struct gwp_dns_cache *cache,
+			 struct gwp_dns_cache_stats *st);
+
 /**
  * Look up a DNS entry by its key and retrieve the corresponding
  * entry if it exists. It increments the reference count of the
@@ -91,12 +133,60 @@ void gwp_dns_cache_housekeep(struct gwp_dns_cache *cache);
  *
  * Error codes:
  * -ENOENT:    Entry not found.
- * -ETIMEDOUT: Entry found but expired (treated as a miss).
+ * -ETIMEDOUT: Entry found but expired past the stale window (a miss).
  * -EINVAL:    Invalid key (empty or too long).
  */
 int gwp_dns_cache_getent(struct gwp_dns_cache *cache, const char *key,
 			 struct gwp_dns_cache_entry **ep);
 
+/**
+ * Take another reference on an entry obtained from `gwp_dns_cache_getent()`;
+ * each one is released with `gwp_dns_cache_putent()`.
+ *
+ * @param e	The DNS cache entry to reference.
+ */
+void gwp_dns_cache_entref(struct gwp_dns_cache_entry *e);
+
+/**
+ * The time at which an entry expires. It never changes: a newer answer for
+ * the same key is a new entry.
+ *
+ * @param e	The DNS cache entry.
+ * @return	The expiry time passed to `gwp_dns_cache_insert()`.
+ */
+time_t gwp_dns_cache_entexp(const struct gwp_dns_cache_entry *e);
+
+/**
+ * Count a hit served from a copy of @e held outside the cache (a worker's
+ * L1), so the eviction hand sees the name as used as it is.
+ *
+ * @param e	An entry obtained from `gwp_dns_cache_getent()`.
+ */
+void gwp_dns_cache_touch(struct gwp_dns_cache_entry *e);
+
+/**
+ * Until when an entry can be used without asking for a refresh: its expiry,
+ * brought forward by the refresh-ahead share of its lifetime.
+ *
+ * @param e	The DNS cache entry.
+ * @return	The time from which `gwp_dns_cache_claim_refresh()` may
+ *		succeed.
+ */
+time_t gwp_dns_cache_entfresh(const struct gwp_dns_cache_entry *e);
+
+/**
+ * Called after a hit: returns true when the entry is due for a refresh and
+ * the caller is the one to resolve the name again. Only one caller wins
+ * per entry; if no new answer arrives, another may try a couple of seconds
+ * later, so a dead resolver is not hammered while stale entries serve.
+ *
+ * @param cache	The DNS cache the entry came from.
+ * @param e	An entry obtained from `gwp_dns_cache_getent()`.
+ * @return	True if the caller should refresh the entry's name.
+ */
+bool gwp_dns_cache_claim_refresh(struct gwp_dns_cache *cache,
+				 struct gwp_dns_cache_entry *e);
+
 /**
  * Decrement the reference count of a DNS cache entry. If the
  * reference count reaches zero, the entry is freed. This function
@@ -38,40 +38,35 @@ static ssize_t construct_qname(uint8_t *dst, size_t dst_len, const char *qname)
 	return total;
 }
 
-static int calculate_question_len(uint8_t *in, size_t in_len)
+/*
+ * Step over a (possibly compressed) domain name starting at @idx. Returns
+ * the offset just past it, or a negative error when it runs off the end.
+ */
+static int skip_name(const uint8_t *in, size_t in_len, size_t idx)
 {
-	const uint8_t *p = in;
-	int tot_len, advance_len;
-
-	tot_len = 0;
-	while (true) {
-		if (*p == 0x0) {
-			tot_len++;
-			break;
-		}
+	while (idx < in_len) {
+		uint8_t l = in[idx];
 
-		if (tot_len >= (int)in_len)
-			return -ENOBUFS;
+		if (!l)
+			return (int)(idx + 1);
 
-		advance_len = *p + 1;
-		tot_len += advance_len;
-		p += advance_len;
-	}
+		/* A compression pointer ends the name (RFC 1035 4.1.4). */
+		if ((l & 0xc0) == 0xc0)
+			return idx + 2 <= in_len ? (int)(idx + 2) : -EAGAIN;
 
-	if (tot_len > DOMAIN_NAME_LIMIT)
-		return -ENAMETOOLONG;
+		if (l & 0xc0)
+			return -EINVAL;
 
-	tot_len += 4;
-	if (tot_len >= (int)in_len)
-		return -ENOBUFS;
+		idx += 1u + l;
+	}
 
-	return  tot_len;
+	return -EAGAIN;
 }
 
 static int serialize_answ(uint16_t txid, uint8_t *in, size_t in_len, gwdns_answ_data *out)
 {
+	uint16_t raw_flags, ancount;
 	gwdns_header_pkt *hdr;
-	uint16_t raw_flags;
 	size_t idx, i;
 	void *ptr;
 	int ret;
@@ -98,83 +93,64 @@ static int serialize_answ(uint16_t txid, uint8_t *in, size_t in_len, gwdns_answ_
 	if (DNS_RCODE(raw_flags))
 		return -EPROTO;
 
-	// is it safe or recommended to alter the in buffer directly?
-	hdr->ancount = ntohs(hdr->ancount);
-	if (!hdr->ancount)
+	memcpy(&ancount, &hdr->ancount, sizeof(ancount));
+	ancount = ntohs(ancount);
+	if (!ancount)
 		return -ENODATA;
 
-	/*
-	 * Check the sizes upfront.
-	 *
-	 * 1 bytes for variable-length
-	 * in[idx] for the length of first name
-	 * 1 bytes for null terminator
-	 * 2 bytes for qtype
-	 * 2 bytes for qclass
-	 */
-	if ((size_t)(1 + in[idx] + 1 + 2 + 2) >= in_len)
-		return -EINVAL;
-
-	ret = calculate_question_len(&in[idx], in_len - idx);
-	if (ret <= 0)
+	/* The question we asked: QNAME, QTYPE and QCLASS. */
+	ret = skip_name(in, in_len, idx);
+	if (ret < 0)
 		return -EINVAL;
 
-	idx += ret;
+	idx = (size_t)ret + 4;
 	if (idx >= in_len)
 		return -EAGAIN;
 
 	out->hdr.ancount = 0;
-	ptr = malloc(hdr->ancount * sizeof(uint8_t *));
+	ptr = malloc(ancount * sizeof(uint8_t *));
 	if (!ptr)
 		return -ENOMEM;
 
 	out->rr_answ = ptr;
-	for (i = 0; i < hdr->ancount; i++) {
-		uint16_t is_compressed, rdlength;
-		gwdns_serialized_answ *item = malloc(sizeof(gwdns_serialized_answ));
-		if (!item) {
-			ret = -ENOMEM;
+	for (i = 0; i < ancount; i++) {
+		uint16_t rdlength;
+		gwdns_serialized_answ *item;
+
+		/* NAME, then TYPE, CLASS, TTL and RDLENGTH. */
+		ret = skip_name(in, in_len, idx);
+		if (ret < 0)
+			goto exit_free;
+		idx = (size_t)ret;
+		if (idx + 10 > in_len) {
+			ret = -EAGAIN;
 			goto exit_free;
 		}
 
-		memcpy(&is_compressed, &in[idx], sizeof(is_compressed));
-		is_compressed = ntohs(is_compressed);
-		is_compressed = DNS_IS_COMPRESSED(is_compressed);
-		assert(is_compressed);
-		idx += 2; // NAME
-		if (idx >= in_len) {
-			ret = -EAGAIN;
-			free(item);
+		item = malloc(sizeof(gwdns_serialized_answ));
+		if (!item) {
+			ret = -ENOMEM;
 			goto exit_free;
 		}
 
 		memcpy(&item->rr_type, &in[idx], 2);
 		item->rr_type = ntohs(item->rr_type);
 		idx += 2; // TYPE
-		if (idx >= in_len) {
-			ret = -EAGAIN;
-			free(item);
-			goto exit_free;
-		}
 		memcpy(&item->rr_class, &in[idx], 2);
 		item->rr_class = ntohs(item->rr_class);
 		idx += 2; // CLASS
-		if (idx >= in_len) {
-			ret = -EAGAIN;
-			free(item);
-			goto exit_free;
-		}
 		memcpy(&item->ttl, &in[idx], 4);
 		item->ttl = be32toh(item->ttl);
 		idx += 4; // TTL
-		if (idx >= in_len) {
+		memcpy(&rdlength, &in[idx], sizeof(rdlength));
+		rdlength = ntohs(rdlength);
+		idx += 2; // RDLENGTH
+		if (idx + rdlength > in_len) {
 			ret = -EAGAIN;
 			free(item);
 			goto exit_free;
 		}
 
-		memcpy(&rdlength, &in[idx], sizeof(rdlength));
-		rdlength = ntohs(rdlength);
 		switch (item->rr_type) {
 		case TYPE_AAAA:
 			if (rdlength != sizeof(struct in6_addr)) {
@@ -190,26 +166,23 @@ static int serialize_answ(uint16_t txid, uint8_t *in, size_t in_len, gwdns_answ_
 				goto exit_free;
 			}
 			break;
-		case TYPE_CNAME:
-			idx += 2 + rdlength;
-			free(item);
-			continue;
-
 		default:
-			ret = -EINVAL;
+			/*
+			 * CNAME chains, and anything else a server adds
+			 * (DNAME, RRSIG, ...): only the addresses matter.
+			 */
+			idx += rdlength;
 			free(item);
-			goto exit_free;
-			break;
+			continue;
 		}
 
-		item->rdlength = rdlength;
-		idx += 2;
-		if (idx >= in_len) {
-			ret = -EAGAIN;
+		if (item->rr_class != CLASS_IN) {
+			idx += rdlength;
 			free(item);
-			goto exit_free;
+			continue;
 		}
 
+		item->rdlength = rdlength;
 		ptr = malloc(rdlength);
 		if (!ptr) {
 			ret = -ENOMEM;
@@ -219,13 +192,6 @@ static int serialize_answ(uint16_t txid, uint8_t *in, size_t in_len, gwdns_answ_
 
 		memcpy(ptr, &in[idx], rdlength);
 		idx += rdlength;
-		if (idx > in_len) {
-			ret = -EINVAL;
-			free(item);
-			free(ptr);
-			goto exit_free;
-		}
-
 		item->rdata = ptr;
 		out->rr_answ[out->hdr.ancount] = item;
 		out->hdr.ancount++;
@@ -287,12 +253,13 @@ int gwdns_parse_query(uint16_t txid, const char *service,
 			r = -ENOMEM;
 			goto exit_free;
 		}
-		new_node->ai_next = NULL;
+		memset(new_node, 0, sizeof(*new_node));
+		new_node->ai_ttl = (int)(answ->ttl & 0x7fffffff);
 
 		if (answ->rr_type == TYPE_AAAA) {
 			i6 = &new_node->ai_addr.i6;
 			new_node->ai_family = AF_INET6;
-			new_node->ai_addrlen = sizeof(i6);
+			new_node->ai_addrlen = sizeof(*i6);
 			i6->sin6_port = port;
 			i6->sin6_family = AF_INET6;
 			assert(sizeof(i6->sin6_addr) == answ->rdlength);
@@ -300,12 +267,11 @@ int gwdns_parse_query(uint16_t txid, const char *service,
 		} else {
 			i4 = &new_node->ai_addr.i4;
 			new_node->ai_family = AF_INET;
-			new_node->ai_addrlen = sizeof(i4);
+			new_node->ai_addrlen = sizeof(*i4);
 			i4->sin_port = port;
 			i4->sin_family = AF_INET;
 			assert(sizeof(i4->sin_addr) == answ->rdlength);
 			memcpy(&i4->sin_addr, answ->rdata, answ->rdlength);
-			new_node->ai_ttl = answ->ttl;
 		}
 
 		if (!tail)
@@ -1,384 +1,815 @@
 /*
- * A new experimental DNS resolver that does not rely on getaddrinfo().
+ * A DNS stub resolver that runs in the worker's event loop and does not rely
+ * on getaddrinfo(). See dns_resolver.h.
  */
-
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <gwproxy/dns_resolver.h>
 #include <gwproxy/syscall.h>
 #include <gwproxy/net.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#ifdef CONFIG_HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
 
-struct gwp_dns_resolver_map {
-	uint32_t		cap;
-	uint32_t		sp;
-	uint16_t		*stack;
-	struct gwp_conn_pair	**sess_map;
+/*
+ * Bounds of one try's timeout. A recursive server answers from its cache in
+ * a millisecond or two but may need a few hundred to walk the tree, so the
+ * measured RTT alone would retransmit far too eagerly.
+ */
+#define GWP_DNS_RES_MIN_RTO	250u
+/* A server's srtt never grows past this many timeouts' worth. */
+#define GWP_DNS_RES_MAX_PENALTY	8u
+/*
+ * Once one family has answered, how long the other may still take before
+ * the query finishes without it (RFC 8305 section 3, Resolution Delay).
+ */
+#define GWP_DNS_RES_SETTLE_MS	50u
+
+/*
+ * Transaction ID -> in-flight query, open addressing with linear probing.
+ * IDs are random, so the low bits are as good a hash as any. The table is
+ * kept at most half full; with 16-bit IDs that caps a worker at 32768
+ * outstanding questions.
+ */
+struct res_slot {
+	struct gwp_dns_query	*q;
+	uint16_t		txid;
+	uint8_t			fam;
 };
 
-static int alloc_res_map(struct gwp_dns_resolver_map **map, uint32_t cap)
-{
-	struct gwp_dns_resolver_map *m;
-	uint32_t i, local_cap = 2;
+struct gwp_dns_res_map {
+	struct res_slot		*slots;
+	uint32_t		cap;
+	uint32_t		nr;
+};
 
-	/*
-	 * Keep the capacity a power of 2 for easier doubling to
-	 * max size of 65536.
-	 */
-	while (local_cap < cap)
-		local_cap *= 2;
+#define RES_MAP_MIN_CAP	64u
+#define RES_MAP_MAX_NR	32768u
 
-	if (local_cap > 65536)
-		return -EINVAL;
+static int map_init(struct gwp_dns_res_map **map_p)
+{
+	struct gwp_dns_res_map *m;
 
 	m = malloc(sizeof(*m));
 	if (!m)
 		return -ENOMEM;
 
-	m->sess_map = calloc(local_cap, sizeof(*m->sess_map));
-	if (!m->sess_map)
-		goto err_m;
-
-	m->stack = malloc(local_cap * sizeof(*m->stack));
-	if (!m->stack)
-		goto err_sess;
-
-	m->cap = local_cap;
-	m->sp = 0;
-
-	/*
-	 * Fill the stack with all available indexes.
-	 */
-	i = local_cap;
-	while (i--)
-		m->stack[m->sp++] = i;
+	m->slots = calloc(RES_MAP_MIN_CAP, sizeof(*m->slots));
+	if (!m->slots) {
+		free(m);
+		return -ENOMEM;
+	}
 
-	*map = m;
+	m->cap = RES_MAP_MIN_CAP;
+	m->nr = 0;
+	*map_p = m;
 	return 0;
+}
+
+static void map_free(struct gwp_dns_res_map *m)
+{
+	if (!m)
+		return;
 
-err_sess:
-	free(m->sess_map);
-err_m:
+	free(m->slots);
 	free(m);
-	return -ENOMEM;
 }
 
-static void free_res_map(struct gwp_dns_resolver_map *map)
+static struct res_slot *map_find(struct gwp_dns_res_map *m, uint16_t txid)
 {
-	if (!map)
-		return;
+	uint32_t mask = m->cap - 1, i = txid & mask;
 
-	free(map->stack);
-	free(map->sess_map);
-	free(map);
+	while (m->slots[i].q) {
+		if (m->slots[i].txid == txid)
+			return &m->slots[i];
+		i = (i + 1) & mask;
+	}
+	return NULL;
 }
 
-static int expand_res_map(struct gwp_dns_resolver_map *map)
+static void map_put(struct gwp_dns_res_map *m, uint16_t txid,
+		    struct gwp_dns_query *q, uint8_t fam)
 {
-	uint32_t new_cap, i, old_cap = map->cap;
-	struct gwp_conn_pair **new_sess_map;
-	uint16_t *new_stack;
+	uint32_t mask = m->cap - 1, i = txid & mask;
 
-	new_cap = old_cap * 2;
-	if (new_cap > 65536)
-		return -ENOSPC;
+	while (m->slots[i].q)
+		i = (i + 1) & mask;
 
-	new_sess_map = realloc(map->sess_map, new_cap * sizeof(*map->sess_map));
-	if (!new_sess_map)
-		return -ENOMEM;
-	map->sess_map = new_sess_map;
-	memset(&map->sess_map[old_cap], 0, old_cap * sizeof(*map->sess_map));
+	m->slots[i].q = q;
+	m->slots[i].txid = txid;
+	m->slots[i].fam = fam;
+	m->nr++;
+}
 
-	new_stack = realloc(map->stack, new_cap * sizeof(*map->stack));
-	if (!new_stack)
-		return -ENOMEM;
-	map->stack = new_stack;
+static int map_grow(struct gwp_dns_res_map *m)
+{
+	struct res_slot *old = m->slots;
+	uint32_t i, old_cap = m->cap;
 
-	i = new_cap;
-	while (i-- > old_cap)
-		map->stack[map->sp++] = i;
+	m->slots = calloc((size_t)old_cap * 2, sizeof(*m->slots));
+	if (!m->slots) {
+		m->slots = old;
+		return -ENOMEM;
+	}
 
-	map->cap = new_cap;
+	m->cap = old_cap * 2;
+	m->nr = 0;
+	for (i = 0; i < old_cap; i++) {
+		if (old[i].q)
+			map_put(m, old[i].txid, old[i].q, old[i].fam);
+	}
+	free(old);
 	return 0;
 }
 
-static int insert_map(struct gwp_dns_resolver_map *map,
-		      struct gwp_conn_pair *pair, uint16_t *txid)
+/* Remove @s and shift the rest of its probe run back over the hole. */
+static void map_del(struct gwp_dns_res_map *m, struct res_slot *s)
 {
-	uint32_t x;
-	int r;
+	uint32_t mask = m->cap - 1, i = (uint32_t)(s - m->slots), j = i, k;
+
+	m->nr--;
+	for (;;) {
+		m->slots[i].q = NULL;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (!m->slots[j].q)
+				return;
+
+			/* Where slot j wants to be; move it only if i is on its way. */
+			k = m->slots[j].txid & mask;
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+			break;
+		}
+		m->slots[i] = m->slots[j];
+		i = j;
+	}
+}
 
-	if (!map->sp) {
-		r = expand_res_map(map);
-		if (r)
-			return r;
+static uint64_t rnd_seed(void)
+{
+	struct timespec ts;
+	uint64_t s;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	s = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32);
+	s ^= (uint64_t)getpid() * 0x9e3779b97f4a7c15ULL;
+	s ^= (uint64_t)(uintptr_t)&s;
+	return s ? s : 0x9e3779b97f4a7c15ULL;
+}
+
+/*
+ * Transaction IDs are what keeps an off-path attacker from answering for
+ * the server, so they come from getrandom() in batches. The xorshift
+ * fallback covers libcs without it and a failing call.
+ */
+static void rnd_refill(struct gwp_dns_resolver *res)
+{
+	uint64_t x = res->rnd_state;
+	size_t i;
+
+#ifdef CONFIG_HAVE_GETRANDOM
+	if (getrandom(res->rnd, sizeof(res->rnd), GRND_NONBLOCK) ==
+	    (ssize_t)sizeof(res->rnd)) {
+		res->rnd_pos = 0;
+		return;
 	}
+#endif
 
-	x = map->stack[--map->sp];
-	map->sess_map[x] = pair;
-	*txid = x;
-	return 0;
+	for (i = 0; i < GWP_DNS_RES_NR_RND; i++) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		res->rnd[i] = (uint16_t)((x * 0x2545f4914f6cdd1dULL) >> 48);
+	}
+	res->rnd_state = x;
+	res->rnd_pos = 0;
 }
 
-static struct gwp_conn_pair *lookup_map(struct gwp_dns_resolver_map *map,
-					uint16_t txid)
+static uint16_t rnd_txid(struct gwp_dns_resolver *res)
 {
-	if (txid >= map->cap)
-		return NULL;
+	if (res->rnd_pos >= GWP_DNS_RES_NR_RND)
+		rnd_refill(res);
 
-	return map->sess_map[txid];
+	return res->rnd[res->rnd_pos++];
 }
 
-static void try_reset_map(struct gwp_dns_resolver_map *map)
+static int parse_server(const char *s, size_t len, struct gwp_sockaddr *addr)
 {
-	struct gwp_conn_pair **new_sess_map;
-	uint32_t i, new_cap = 16;
-	uint16_t *new_stack;
+	char host[INET6_ADDRSTRLEN + 1];
+	const char *port = NULL, *end = s + len;
+	unsigned long p = 53;
+	size_t hl;
+
+	if (*s == '[') {
+		const char *rb = memchr(s, ']', len);
+
+		if (!rb)
+			return -EINVAL;
+		if (rb + 1 < end) {
+			if (rb[1] != ':')
+				return -EINVAL;
+			port = rb + 2;
+		}
+		s++;
+		hl = (size_t)(rb - s);
+	} else {
+		const char *c = memchr(s, ':', len);
+
+		/* More than one colon is a bare IPv6 address, without a port. */
+		if (c && !memchr(c + 1, ':', (size_t)(end - c - 1))) {
+			hl = (size_t)(c - s);
+			port = c + 1;
+		} else {
+			hl = len;
+		}
+	}
 
-	if (map->cap <= 16)
-		return;
+	if (!hl || hl >= sizeof(host))
+		return -EINVAL;
+	memcpy(host, s, hl);
+	host[hl] = '\0';
 
-	/*
-	 * Try to allocate a smaller map first before freeing the
-	 * existing one so we don't lose the existing map if
-	 * one of reallocations fail.
-	 */
-	new_sess_map = calloc(new_cap, sizeof(*new_sess_map));
-	if (!new_sess_map)
-		return;
+	if (port) {
+		char *ep;
 
-	new_stack = malloc(new_cap * sizeof(*new_stack));
-	if (!new_stack) {
-		free(new_sess_map);
-		return;
+		if (port == end)
+			return -EINVAL;
+		p = strtoul(port, &ep, 10);
+		if (ep != end || !p || p > 65535)
+			return -EINVAL;
 	}
 
-	/*
-	 * Ok, we are good to go, free the old map and
-	 * replace with the new one.
-	 */
-	free(map->sess_map);
-	free(map->stack);
-	map->sess_map = new_sess_map;
-	map->stack = new_stack;
-	map->cap = new_cap;
-	map->sp = 0;
+	memset(addr, 0, sizeof(*addr));
+	if (inet_pton(AF_INET, host, &addr->i4.sin_addr) == 1) {
+		addr->i4.sin_family = AF_INET;
+		addr->i4.sin_port = htons((uint16_t)p);
+		return 0;
+	}
+
+	if (inet_pton(AF_INET6, host, &addr->i6.sin6_addr) == 1) {
+		addr->i6.sin6_family = AF_INET6;
+		addr->i6.sin6_port = htons((uint16_t)p);
+		return 0;
+	}
 
-	i = new_cap;
-	while (i--)
-		map->stack[map->sp++] = i;
+	return -EINVAL;
 }
 
-static void delete_map(struct gwp_dns_resolver_map *map, uint16_t txid)
+int gwp_dns_res_parse_servers(const char *str, struct gwp_sockaddr *addrs,
+			      uint32_t cap)
 {
-	if (txid >= map->cap)
-		return;
-
-	if (!map->sess_map[txid])
-		return;
+	uint32_t n = 0;
+	int r;
 
-	map->sess_map[txid] = NULL;
-	map->stack[map->sp++] = txid;
+	while (*str) {
+		size_t len = strcspn(str, ",");
+
+		if (len) {
+			if (n >= cap)
+				return -E2BIG;
+			r = parse_server(str, len, &addrs[n]);
+			if (r)
+				return r;
+			n++;
+		}
+
+		str += len;
+		if (*str == ',')
+			str++;
+	}
 
-	/*
-	 * If all slots are free, try to shrink the map.
-	 */
-	if (map->sp == map->cap)
-		try_reset_map(map);
+	return n ? (int)n : -EINVAL;
 }
 
-static int init_udp_sock(struct gwp_dns_resolver *gdr, const char *srv_addr)
+static int init_server(struct gwp_dns_server *s, const struct gwp_sockaddr *addr)
 {
 	static const int type = SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC;
-	struct gwp_sockaddr addr;
-	int f, r;
+	socklen_t len;
+	int fd, r;
 
-	r = convert_str_to_ssaddr(srv_addr, &addr, 53);
-	if (r)
-		return r;
+	s->addr = *addr;
+	len = addr->sa.sa_family == AF_INET6 ? sizeof(addr->i6) :
+					       sizeof(addr->i4);
 
-	f = __sys_socket(addr.sa.sa_family, type, 0);
-	if (f < 0)
-		return f;
+	fd = __sys_socket(addr->sa.sa_family, type, 0);
+	if (fd < 0)
+		return fd;
 
-	r = __sys_connect(f, &addr.sa, sizeof(addr));
+	/*
+	 * connect() binds an ephemeral port the kernel picks at random, so
+	 * every worker talks to every server from its own unguessable port,
+	 * and only datagrams from the server itself are delivered.
+	 */
+	r = __sys_connect(fd, &addr->sa, len);
 	if (r < 0) {
-		__sys_close(f);
+		__sys_close(fd);
 		return r;
 	}
 
-	gdr->udp_fd = f;
+	s->udp_fd = fd;
 	return 0;
 }
 
-int gwp_dns_res_init(struct gwp_ctx *ctx, struct gwp_dns_resolver *gdr,
-		     const char *srv_addr)
+int gwp_dns_res_init(struct gwp_dns_resolver **res_p,
+		     const struct gwp_dns_res_cfg *cfg,
+		     struct gwp_timer_wheel *tw)
 {
+	struct gwp_sockaddr addrs[GWP_DNS_RES_MAX_SERVERS];
+	struct gwp_dns_resolver *res;
+	uint32_t i;
 	int r;
 
-	r = alloc_res_map(&gdr->sess_map, 16);
-	if (r)
+	if (!cfg->timeout_ms || !cfg->nr_tries)
+		return -EINVAL;
+
+	r = gwp_dns_res_parse_servers(cfg->servers, addrs,
+				      GWP_DNS_RES_MAX_SERVERS);
+	if (r < 0)
 		return r;
 
-	gdr->srv_addr = strdup(srv_addr);
-	if (!gdr->srv_addr) {
+	res = calloc(1, sizeof(*res));
+	if (!res)
+		return -ENOMEM;
+
+	res->servers = calloc((size_t)r, sizeof(*res->servers));
+	if (!res->servers) {
 		r = -ENOMEM;
-		goto err_map;
+		goto out_free;
 	}
 
-	r = init_udp_sock(gdr, gdr->srv_addr);
+	res->nr_servers = (uint32_t)r;
+	for (i = 0; i < res->nr_servers; i++)
+		res->servers[i].udp_fd = -1;
+
+	r = map_init(&res->map);
 	if (r)
-		goto err_srv;
+		goto out_free;
 
-	(void)ctx;
+	for (i = 0; i < res->nr_servers; i++) {
+		res->servers[i].res = res;
+		r = init_server(&res->servers[i], &addrs[i]);
+		if (r)
+			goto out_free;
+	}
+
+	res->timeout_ms = cfg->timeout_ms;
+	res->nr_tries = cfg->nr_tries;
+	res->tw = tw;
+	res->rnd_state = rnd_seed();
+	res->rnd_pos = GWP_DNS_RES_NR_RND;
+	*res_p = res;
 	return 0;
 
-err_srv:
-	free(gdr->srv_addr);
-err_map:
-	free_res_map(gdr->sess_map);
+out_free:
+	gwp_dns_res_free(res);
 	return r;
 }
 
 void gwp_dns_res_free(struct gwp_dns_resolver *res)
 {
+	uint32_t i;
+
 	if (!res)
 		return;
 
-	free_res_map(res->sess_map);
-	free(res->srv_addr);
-	__sys_close(res->udp_fd);
-	memset(res, 0, sizeof(*res));
+	for (i = 0; res->servers && i < res->nr_servers; i++) {
+		if (res->servers[i].udp_fd >= 0)
+			__sys_close(res->servers[i].udp_fd);
+	}
+
+	map_free(res->map);
+	free(res->servers);
+	free(res);
 }
 
-int gwp_dns_res_prep_query(struct gwp_dns_resolver *res,
-			   struct gwp_dns_packet *gdp)
+static uint32_t server_rto(struct gwp_dns_resolver *res,
+			   const struct gwp_dns_server *s, uint8_t nr_tries)
 {
-	int af, ret;
-	ssize_t tmp;
+	uint32_t rto, min = GWP_DNS_RES_MIN_RTO;
 
-	assert(gdp->gcp);
+	if (min > res->timeout_ms)
+		min = res->timeout_ms;
 
-	if (!gdp->__in_fallback_attempt) {
-		ret = insert_map(res->sess_map, gdp->gcp, &gdp->txid);
-		if (ret)
-			return ret;
-	} else {
-		assert(gdp->gcp == lookup_map(res->sess_map, gdp->txid));
-	}
-
-	ret = 0;
-	if (gdp->restyp == GWP_DNS_RESTYP_PREFER_IPV6) {
-		af = AF_INET6;
-		gdp->restyp = GWP_DNS_RESTYP_IPV4_ONLY;
-		gdp->__in_fallback_attempt = true;
-	} else if (gdp->restyp == GWP_DNS_RESTYP_PREFER_IPV4) {
-		af = AF_INET;
-		gdp->restyp = GWP_DNS_RESTYP_IPV6_ONLY;
-		gdp->__in_fallback_attempt = true;
-	} else if (gdp->restyp == GWP_DNS_RESTYP_IPV6_ONLY) {
-		ret = 0;
-		af = AF_INET6;
-	} else if (gdp->restyp == GWP_DNS_RESTYP_IPV4_ONLY) {
-		ret = 0;
-		af = AF_INET;
-	} else {
-		ret = -EINVAL;
-		goto err;
+	if (!s->has_rtt)
+		return res->timeout_ms;
+
+	rto = s->srtt + 4 * s->rttvar;
+	if (rto < min)
+		rto = min;
+
+	/* Back off on every retransmit, whichever server it goes to. */
+	while (--nr_tries && rto < res->timeout_ms)
+		rto *= 2;
+
+	return rto < res->timeout_ms ? rto : res->timeout_ms;
+}
+
+/*
+ * The server with the lowest srtt. The others drift down a little each time
+ * they are passed over, so one that was slow or dead for a while is asked
+ * again eventually (BIND ages its server list the same way).
+ */
+static uint8_t pick_server(struct gwp_dns_resolver *res)
+{
+	uint32_t i, best = 0;
+
+	for (i = 1; i < res->nr_servers; i++) {
+		if (res->servers[i].srtt < res->servers[best].srtt)
+			best = i;
 	}
 
-	tmp = gwdns_build_query(gdp->txid, gdp->host, af, gdp->buf, gdp->buf_len);
-	if (tmp < 0) {
-		ret = (int)tmp;
-		goto err;
+	for (i = 0; i < res->nr_servers; i++) {
+		if (i != best)
+			res->servers[i].srtt -= res->servers[i].srtt >> 5;
 	}
 
-	gdp->buf_len = (uint16_t)tmp;
-	return ret;
+	return (uint8_t)best;
+}
 
-err:
-	delete_map(res->sess_map, gdp->txid);
-	return ret;
+static void update_rtt(struct gwp_dns_server *s, uint32_t rtt)
+{
+	uint32_t d;
+
+	if (!s->has_rtt) {
+		s->srtt = rtt;
+		s->rttvar = rtt / 2;
+		s->has_rtt = true;
+		return;
+	}
+
+	d = s->srtt > rtt ? s->srtt - rtt : rtt - s->srtt;
+	s->rttvar = (3 * s->rttvar + d) / 4;
+	s->srtt = (7 * s->srtt + rtt) / 8;
 }
 
-void gwp_dns_res_drop_query(struct gwp_dns_resolver *res,
-			    struct gwp_conn_pair *gcp, uint16_t txid)
+static void penalize_server(struct gwp_dns_resolver *res,
+			    struct gwp_dns_server *s, uint32_t rto)
 {
-	assert(gcp);
+	uint32_t max = res->timeout_ms * GWP_DNS_RES_MAX_PENALTY;
+
+	s->srtt = s->srtt + rto < max ? s->srtt + rto : max;
+	if (!s->has_rtt) {
+		s->rttvar = rto / 2;
+		s->has_rtt = true;
+	}
+}
+
+static int send_one(struct gwp_dns_resolver *res, struct gwp_dns_query *q,
+		    uint8_t fam)
+{
+	struct gwp_dns_server *s = &res->servers[q->srv];
+	int af = fam == GWP_DNS_FAM_AAAA ? AF_INET6 : AF_INET;
+	uint8_t buf[UDP_MSG_LIMIT];
+	ssize_t len;
+
+	len = gwdns_build_query(q->txid[fam], q->host, af, buf, sizeof(buf));
+	if (len < 0)
+		return (int)len;
 
 	/*
-	 * Idempotent: only drop the slot if it still maps to @gcp. The query
-	 * may already have been completed (and thus dropped), so this is safe
-	 * to call again from connection teardown.
+	 * A lost datagram, a full socket buffer and an ICMP error queued
+	 * from an earlier send all look the same from here: the retransmit
+	 * timer takes care of them.
 	 */
-	if (lookup_map(res->sess_map, txid) != gcp)
+	__sys_send(s->udp_fd, buf, (size_t)len, MSG_NOSIGNAL);
+	return 0;
+}
+
+static void send_pending(struct gwp_dns_resolver *res, struct gwp_dns_query *q)
+{
+	uint8_t fam;
+
+	q->nr_tries++;
+	q->srv_mask |= (uint8_t)(1u << q->srv);
+	q->rto = server_rto(res, &res->servers[q->srv], q->nr_tries);
+	q->sent_at = res->tw->now;
+	for (fam = 0; fam < 2; fam++) {
+		if (q->pending & (1u << fam))
+			send_one(res, q, fam);
+	}
+
+	gwp_timer_arm(res->tw, &q->timer, q->rto);
+}
+
+static void drop_txid(struct gwp_dns_resolver *res, struct gwp_dns_query *q,
+		      uint8_t fam)
+{
+	struct res_slot *s;
+
+	if (!(q->mapped & (1u << fam)))
 		return;
 
-	delete_map(res->sess_map, txid);
+	s = map_find(res->map, q->txid[fam]);
+	if (s && s->q == q)
+		map_del(res->map, s);
+	q->mapped &= (uint8_t)~(1u << fam);
+}
+
+void gwp_dns_res_cancel(struct gwp_dns_resolver *res, struct gwp_dns_query *q)
+{
+	drop_txid(res, q, GWP_DNS_FAM_A);
+	drop_txid(res, q, GWP_DNS_FAM_AAAA);
+	gwp_timer_del(res->tw, &q->timer);
 }
 
-int gwp_dns_res_fetch_gcp_by_payload(struct gwp_dns_resolver *res,
-				     const uint8_t buf[UDP_MSG_LIMIT],
-				     uint16_t len,
-				     struct gwp_conn_pair **gcp_p)
+static int add_txid(struct gwp_dns_resolver *res, struct gwp_dns_query *q,
+		    uint8_t fam)
 {
+	struct gwp_dns_res_map *m = res->map;
 	uint16_t txid;
+	int r;
 
-	if (len < 38)
-		return -EINVAL;
+	if (m->nr >= RES_MAP_MAX_NR)
+		return -EAGAIN;
 
-	memcpy(&txid, buf, 2);
-	if (txid >= res->sess_map->cap)
-		return -EINVAL;
+	if ((m->nr + 1) * 2 > m->cap) {
+		r = map_grow(m);
+		if (r)
+			return r;
+	}
+
+	/* At most half the IDs are taken, so this ends quickly. */
+	do {
+		txid = rnd_txid(res);
+	} while (map_find(m, txid));
+
+	map_put(m, txid, q, fam);
+	q->txid[fam] = txid;
+	q->mapped |= (uint8_t)(1u << fam);
+	return 0;
+}
+
+int gwp_dns_res_start(struct gwp_dns_resolver *res, struct gwp_dns_query *q)
+{
+	uint8_t buf[UDP_MSG_LIMIT], fam;
+	ssize_t len;
+	int r;
+
+	/* Refuse a name that does not fit a query before taking any ID. */
+	len = gwdns_build_query(0, q->host, AF_INET, buf, sizeof(buf));
+	if (len < 0)
+		return (int)len;
+
+	switch (q->restyp) {
+	case GWP_DNS_RESTYP_IPV4_ONLY:
+		q->pending = 1u << GWP_DNS_FAM_A;
+		break;
+	case GWP_DNS_RESTYP_IPV6_ONLY:
+		q->pending = 1u << GWP_DNS_FAM_AAAA;
+		break;
+	default:
+		q->pending = (1u << GWP_DNS_FAM_A) | (1u << GWP_DNS_FAM_AAAA);
+		break;
+	}
+
+	q->mapped = 0;
+	q->srv_mask = 0;
+	q->nr_tries = 0;
+	q->err = 0;
+	q->ttl = UINT32_MAX;
+	q->nr_addrs[0] = q->nr_addrs[1] = 0;
+	for (fam = 0; fam < 2; fam++) {
+		if (!(q->pending & (1u << fam)))
+			continue;
+		r = add_txid(res, q, fam);
+		if (r) {
+			gwp_dns_res_cancel(res, q);
+			return r;
+		}
+	}
+
+	q->srv = pick_server(res);
+	send_pending(res, q);
+	return 0;
+}
+
+static bool has_addrs(const struct gwp_dns_query *q)
+{
+	return q->nr_addrs[0] || q->nr_addrs[1];
+}
+
+static int finish(struct gwp_dns_resolver *res, struct gwp_dns_query *q)
+{
+	gwp_dns_res_cancel(res, q);
+	if (has_addrs(q))
+		q->err = 0;
+	else if (!q->err)
+		q->err = -EHOSTUNREACH;
+	return 1;
+}
 
-	*gcp_p = lookup_map(res->sess_map, txid);
-	if (!*gcp_p)
-		return -ENOENT;
+/* Move on to the next server, or finish when the query is out of tries. */
+static int retry(struct gwp_dns_resolver *res, struct gwp_dns_query *q,
+		 int err)
+{
+	if (!q->err)
+		q->err = err;
+
+	if (q->nr_tries >= res->nr_tries)
+		return finish(res, q);
 
+	q->srv = (uint8_t)((q->srv + 1) % res->nr_servers);
+	send_pending(res, q);
 	return 0;
 }
 
-int gwp_dns_res_complete_query(struct gwp_dns_resolver *res,
-				struct gwp_dns_packet *gdp,
-				uint8_t buf[UDP_MSG_LIMIT],
-				uint16_t len,
-				struct gwp_sockaddr *addr)
+int gwp_dns_res_on_timeout(struct gwp_dns_resolver *res,
+			   struct gwp_dns_query *q)
+{
+	/* The other family answered; the settle delay ran out. */
+	if (has_addrs(q))
+		return finish(res, q);
+
+	penalize_server(res, &res->servers[q->srv], q->rto);
+	return retry(res, q, -ETIMEDOUT);
+}
+
+static bool label_eq(const char *h, const uint8_t *p, uint8_t l)
+{
+	uint8_t i, a, b;
+
+	for (i = 0; i < l; i++) {
+		a = (uint8_t)h[i];
+		b = p[i];
+		if (a >= 'A' && a <= 'Z')
+			a |= 0x20;
+		if (b >= 'A' && b <= 'Z')
+			b |= 0x20;
+		if (a != b)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Compare the question section of @buf with what @q asked. The ID alone is
+ * 16 bits; the name and type make a stale or forged answer much less likely
+ * to stick. Returns the offset past the question, or 0 on mismatch.
+ */
+static size_t match_question(const uint8_t *buf, size_t len,
+			     const char *host, uint16_t qtype)
+{
+	const char *h = host;
+	size_t i = sizeof(gwdns_header_pkt);
+	uint16_t t, c;
+
+	while (i < len && buf[i]) {
+		uint8_t l = buf[i++];
+
+		if (l > DOMAIN_LABEL_LIMIT || i + l > len)
+			return 0;
+		if (h != host) {
+			if (*h != '.')
+				return 0;
+			h++;
+		}
+		/*
+		 * A label is raw bytes and may hold a NUL, which would end a
+		 * string compare early and walk @h past the end of @host.
+		 */
+		if (strnlen(h, l) != l || !label_eq(h, &buf[i], l))
+			return 0;
+		h += l;
+		i += l;
+	}
+
+	if (*h || i + 5 > len)
+		return 0;
+
+	i++;
+	memcpy(&t, &buf[i], 2);
+	memcpy(&c, &buf[i + 2], 2);
+	if (ntohs(t) != qtype || ntohs(c) != CLASS_IN)
+		return 0;
+
+	return i + 4;
+}
+
+static void take_answer(struct gwp_dns_query *q, uint8_t fam, uint8_t *buf,
+			size_t len)
 {
-	struct gwdns_addrinfo_node *ai = NULL;
+	struct gwdns_addrinfo_node *ai = NULL, *n;
+	int af = fam == GWP_DNS_FAM_AAAA ? AF_INET6 : AF_INET;
 	char port[sizeof("65535")];
-	uint16_t txid;
-	ssize_t r;
+	int r;
 
-	if (len < 38)
-		return -EINVAL;
+	snprintf(port, sizeof(port), "%hu", q->port);
+	r = gwdns_parse_query(q->txid[fam], port, buf, len, &ai);
+	if (r) {
+		/* NXDOMAIN, no records, or nothing we can read. */
+		if (!q->err)
+			q->err = r == -ENOMEM ? r : -EHOSTUNREACH;
+		return;
+	}
 
-	memcpy(&txid, buf, 2);
-	if (txid >= res->sess_map->cap)
-		return -EINVAL;
+	for (n = ai; n; n = n->ai_next) {
+		if (n->ai_family != af || q->nr_addrs[fam] >= GWP_DNS_MAX_ADDRS)
+			continue;
+		q->addrs[fam][q->nr_addrs[fam]++] = n->ai_addr;
+		if ((uint32_t)n->ai_ttl < q->ttl)
+			q->ttl = (uint32_t)n->ai_ttl;
+	}
 
-	if (gdp->txid != txid)
-		return -EINVAL;
+	if (!q->nr_addrs[fam] && !q->err)
+		q->err = -EHOSTUNREACH;
+	gwdns_free_parsed_query(ai);
+}
 
-	if (gdp->gcp != res->sess_map->sess_map[txid])
-		return -EINVAL;
+int gwp_dns_res_on_reply(struct gwp_dns_resolver *res,
+			 struct gwp_dns_server *srv, uint8_t *buf, size_t len,
+			 struct gwp_dns_query **q_p)
+{
+	uint8_t idx = (uint8_t)(srv - res->servers), fam;
+	struct gwp_dns_query *q;
+	gwdns_header_pkt hdr;
+	struct res_slot *s;
+	uint16_t flags;
 
-	snprintf(port, sizeof(port), "%hu", gdp->port);
-	r = gwdns_parse_query(txid, port, buf, len, &ai);
-	if (!r) {
-		*addr = ai->ai_addr;
-		gwdns_free_parsed_query(ai);
-		gwp_dns_res_drop_query(res, gdp->gcp, txid);
+	if (len < sizeof(hdr))
 		return 0;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	s = map_find(res->map, hdr.id);
+	if (!s)
+		return 0;
+
+	q = s->q;
+	fam = s->fam;
+	flags = ntohs(hdr.flags);
+	if (!DNS_QR(flags) || DNS_OPCODE(flags) || ntohs(hdr.qdcount) != 1)
+		return 0;
+
+	/* Only the servers this query went to may answer it. */
+	if (!(q->srv_mask & (1u << idx)))
+		return 0;
+
+	if (!match_question(buf, len, q->host,
+			    fam == GWP_DNS_FAM_AAAA ? TYPE_AAAA : TYPE_A))
+		return 0;
+
+	/* Karn: a retransmitted query's answer says nothing about the RTT. */
+	if (q->nr_tries == 1 && idx == q->srv)
+		update_rtt(srv, (uint32_t)(res->tw->now - q->sent_at));
+
+	switch (DNS_RCODE(flags)) {
+	case 0:	/* NOERROR */
+	case 3:	/* NXDOMAIN: the name does not exist, asking again won't help */
+		break;
+	default:
+		/* SERVFAIL, REFUSED, ...: another server may do better. */
+		if (q->nr_tries < res->nr_tries && res->nr_servers > 1) {
+			*q_p = q;
+			return retry(res, q, -EHOSTUNREACH);
+		}
+		break;
+	}
+
+	take_answer(q, fam, buf, len);
+	drop_txid(res, q, fam);
+	q->pending &= (uint8_t)~(1u << fam);
+	if (!q->pending) {
+		*q_p = q;
+		return finish(res, q);
+	}
+
+	/*
+	 * One family is in; give the other a moment, but no more, so that a
+	 * server that never answers AAAA does not hold up a working A.
+	 */
+	if (has_addrs(q)) {
+		uint64_t now = res->tw->now, end = q->sent_at + q->rto;
+
+		if (end > now + GWP_DNS_RES_SETTLE_MS)
+			gwp_timer_arm(res->tw, &q->timer, GWP_DNS_RES_SETTLE_MS);
 	}
 
-	if (gdp->__in_fallback_attempt) {
-		int tmp = gwp_dns_res_prep_query(res, gdp);
-		if (!tmp)
-			return -EAGAIN;
+	return 0;
+}
 
-		r = tmp;
+uint8_t gwp_dns_res_collect(const struct gwp_dns_query *q,
+			    struct gwp_sockaddr *addrs, uint8_t cap)
+{
+	uint8_t first = GWP_DNS_FAM_A, i, n = 0;
+
+	if (q->restyp == GWP_DNS_RESTYP_PREFER_IPV6 ||
+	    q->restyp == GWP_DNS_RESTYP_IPV6_ONLY)
+		first = GWP_DNS_FAM_AAAA;
+
+	/* Preferred family first, then alternate, as collect_addr_list() does. */
+	for (i = 0; i < GWP_DNS_MAX_ADDRS && n < cap; i++) {
+		if (i < q->nr_addrs[first])
+			addrs[n++] = q->addrs[first][i];
+		if (i < q->nr_addrs[!first] && n < cap)
+			addrs[n++] = q->addrs[!first][i];
 	}
 
-	gwp_dns_res_drop_query(res, gdp->gcp, txid);
-	return (int)r;
+	return n;
 }
@@ -2,48 +2,156 @@
 #define GWPROXY__DNS_RESOLVER_H
 
 #include <gwproxy/dns_parser.h>
-#include <gwproxy/gwproxy.h>
+#include <gwproxy/timer.h>
 #include <gwproxy/dns.h>
 
-struct gwp_ctx;
-struct gwp_dns_resolver_map;
+/*
+ * --raw-dns: a stub resolver that runs inside each worker's event loop
+ * instead of on the getaddrinfo() threads.
+ *
+ * Every worker has its own resolver: one connected UDP socket per
+ * --dns-server (so the kernel drops datagrams from anyone else, and each
+ * socket gets its own randomized ephemeral port), a map from transaction
+ * ID to query, and the worker's timer wheel for retransmits. A query asks
+ * for A and AAAA at once, each with its own random transaction ID, and
+ * merges both answers into one candidate list. The event loop only reads
+ * the sockets and hands each datagram to gwp_dns_res_on_reply(); sends
+ * are plain non-blocking send(2)s from here.
+ *
+ * Not thread-safe: a resolver and its queries belong to one worker.
+ */
+#define GWP_DNS_RES_MAX_SERVERS	8u
+#define GWP_DNS_RES_NR_RND	64u
+
+struct gwp_dns_resolver;
+struct gwp_dns_res_map;
+
+struct gwp_dns_server {
+	struct gwp_dns_resolver	*res;
+	int			udp_fd;
+	struct gwp_sockaddr	addr;
+	/*
+	 * Smoothed round-trip time and its mean deviation in ms, kept as for
+	 * TCP (RFC 6298). A timeout inflates @srtt so the next query prefers
+	 * another server; servers that are not picked drift back down, so a
+	 * slow one gets tried again later.
+	 */
+	uint32_t		srtt;
+	uint32_t		rttvar;
+	bool			has_rtt;
+	/* io_uring: the recv kept armed on @udp_fd lands here. */
+	uint8_t			rx_buf[UDP_MSG_LIMIT];
+};
 
 struct gwp_dns_resolver {
-	int				udp_fd;
-	char				*srv_addr;
-	struct gwp_dns_resolver_map	*sess_map;
+	struct gwp_dns_server	*servers;
+	uint32_t		nr_servers;
+	/* Ceiling for one try, in ms, and tries per query. */
+	uint32_t		timeout_ms;
+	uint32_t		nr_tries;
+	struct gwp_timer_wheel	*tw;
+	struct gwp_dns_res_map	*map;
+	/* Transaction IDs are drawn from here; refilled from getrandom(). */
+	uint16_t		rnd[GWP_DNS_RES_NR_RND];
+	uint32_t		rnd_pos;
+	uint64_t		rnd_state;
 };
 
-struct gwp_dns_packet {
-	bool			__in_fallback_attempt;
-	uint8_t			restyp;
-	uint16_t		txid;
-	uint16_t		buf_len;
-	uint16_t		port;
-	uint8_t			buf[UDP_MSG_LIMIT];
+/* Index into gwp_dns_query's per-family arrays. */
+enum {
+	GWP_DNS_FAM_A		= 0,
+	GWP_DNS_FAM_AAAA	= 1,
+};
+
+struct gwp_dns_query {
+	/* The owner, handed back untouched. */
+	void			*udata;
 	char			*host;
-	struct gwp_conn_pair	*gcp;
+	uint16_t		port;
+	/* GWP_DNS_RESTYP_*; decides which families are asked and the order. */
+	uint8_t			restyp;
+	/* Bit (1 << GWP_DNS_FAM_*): still waiting for that family's answer. */
+	uint8_t			pending;
+	/* Bit (1 << GWP_DNS_FAM_*): @txid[] of that family is in the map. */
+	uint8_t			mapped;
+	/* The server the current try went to, and every server asked so far. */
+	uint8_t			srv;
+	uint8_t			srv_mask;
+	uint8_t			nr_tries;
+	uint16_t		txid[2];
+	/* The first error that ended a family; reported when nothing resolved. */
+	int			err;
+	/* Lowest TTL among the answers, in seconds. */
+	uint32_t		ttl;
+	/* When the current try went out and how long it may take, in ms. */
+	uint64_t		sent_at;
+	uint32_t		rto;
+	/* Armed by the resolver; the owner sets its event word. */
+	struct gwp_timer	timer;
+	uint8_t			nr_addrs[2];
+	struct gwp_sockaddr	addrs[2][GWP_DNS_MAX_ADDRS];
+};
+
+struct gwp_dns_res_cfg {
+	/* "addr[:port]" list separated by commas; the port defaults to 53. */
+	const char	*servers;
+	uint32_t	timeout_ms;
+	uint32_t	nr_tries;
 };
 
-int gwp_dns_res_init(struct gwp_ctx *ctx, struct gwp_dns_resolver *gdr,
-		     const char *srv_addr);
-void gwp_dns_res_free(struct gwp_dns_resolver *gdr);
+/*
+ * Parse a --dns-server list into @addrs. Returns how many servers it holds,
+ * or a negative error when an entry does not parse or there are more than
+ * @cap.
+ */
+int gwp_dns_res_parse_servers(const char *str, struct gwp_sockaddr *addrs,
+			      uint32_t cap);
+
+/*
+ * Create a resolver for one worker. Its retransmit timers go on @tw, which
+ * must outlive it.
+ */
+int gwp_dns_res_init(struct gwp_dns_resolver **res_p,
+		     const struct gwp_dns_res_cfg *cfg,
+		     struct gwp_timer_wheel *tw);
+void gwp_dns_res_free(struct gwp_dns_resolver *res);
+
+/*
+ * Start resolving @q: q->udata, q->host, q->port, q->restyp and the event
+ * word of q->timer must be set. The queries go out right away. Returns 0,
+ * or a negative error when the name cannot be queried or too many queries
+ * are in flight.
+ */
+int gwp_dns_res_start(struct gwp_dns_resolver *res, struct gwp_dns_query *q);
 
-int gwp_dns_res_prep_query(struct gwp_dns_resolver *res,
-			   struct gwp_dns_packet *gdp);
+/*
+ * Feed a datagram received on @srv's socket. Returns 1 when it finished a
+ * query, stored in *@q_p; 0 when the datagram was not for us, was stale,
+ * or the query still waits for another answer.
+ */
+int gwp_dns_res_on_reply(struct gwp_dns_resolver *res,
+			 struct gwp_dns_server *srv, uint8_t *buf, size_t len,
+			 struct gwp_dns_query **q_p);
 
-void gwp_dns_res_drop_query(struct gwp_dns_resolver *res,
-			    struct gwp_conn_pair *gcp, uint16_t txid);
+/*
+ * q->timer fired. Returns 1 when the query is finished (out of tries, or
+ * one family answered and the other was not worth waiting for), 0 when it
+ * went out again.
+ */
+int gwp_dns_res_on_timeout(struct gwp_dns_resolver *res,
+			   struct gwp_dns_query *q);
 
-int gwp_dns_res_fetch_gcp_by_payload(struct gwp_dns_resolver *res,
-				     const uint8_t buf[UDP_MSG_LIMIT],
-				     uint16_t len,
-				     struct gwp_conn_pair **gcp_p);
+/*
+ * Forget @q: drop its transaction IDs and its timer. Harmless on a finished
+ * query and safe to call more than once.
+ */
+void gwp_dns_res_cancel(struct gwp_dns_resolver *res, struct gwp_dns_query *q);
 
-int gwp_dns_res_complete_query(struct gwp_dns_resolver *res,
-				struct gwp_dns_packet *gdp,
-				uint8_t buf[UDP_MSG_LIMIT],
-				uint16_t len,
-				struct gwp_sockaddr *addr);
+/*
+ * The addresses of a finished query in the order they should be tried (see
+ * struct gwp_dns_entry). Returns how many were written to @addrs.
+ */
+uint8_t gwp_dns_res_collect(const struct gwp_dns_query *q,
+			    struct gwp_sockaddr *addrs, uint8_t cap);
 
 #endif /* #ifndef GWPROXY__DNS_RESOLVER_H */
@@ -8,6 +8,7 @@
 #include <gwproxy/ev/epoll.h>
 #include <gwproxy/common.h>
 #include <gwproxy/acl.h>
+#include <gwproxy/qsbr.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <sys/epoll.h>
@@ -17,48 +18,53 @@
 #include <assert.h>
 #include <limits.h>
 #include <sys/inotify.h>
+#include <linux/errqueue.h>
 #ifdef CONFIG_HTTPS
 #include <gwproxy/ssl.h>
+#include <gwproxy/tls_pool.h>
 #endif
 
 
-static int arm_poll_for_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+static void handle_dns_queries(struct gwp_wrk *w);
 #ifdef CONFIG_HTTPS
 static int tls_flush_hs(struct gwp_conn *c);
+static void handle_tls_jobs(struct gwp_wrk *w);
 #endif
 
+static int handle_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+static int free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+static int dns_query_failed(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    int err);
+
 #ifdef CONFIG_NEW_DNS_RESOLVER
 #include <gwproxy/dns_resolver.h>
 static int register_dns_to_epoll(struct gwp_wrk *w)
 {
-	struct gwp_wrk_dns *dns = w->dns;
+	struct gwp_dns_resolver *res = w->dns;
 	uint32_t i;
 
-	if (!dns)
+	if (!res)
 		return 0;
 
-	for (i = 0; i < dns->nr; i++) {
-		struct gwp_dns_resolver *res = &dns->resolvers[i];
+	for (i = 0; i < res->nr_servers; i++) {
+		struct gwp_dns_server *srv = &res->servers[i];
 		struct epoll_event ev;
 		int r;
 
-		if (res->udp_fd < 0)
-			continue;
-
 		/*
-		 * The only tagged payload that is not a gwp_conn_pair, so it
-		 * needs its own check against the same 48-bit budget.
+		 * Not a gwp_conn_pair, so it needs its own check against the
+		 * same 48-bit budget.
 		 */
-		if (unlikely(!EV_PTR_OK(res))) {
+		if (unlikely(!EV_PTR_OK(srv))) {
 			pr_err(&w->ctx->lh,
-			       "BUG: DNS resolver %p has bits 48..63 set; the event word cannot carry it",
-			       (void *)res);
+			       "BUG: DNS server %p has bits 48..63 set; the event word cannot carry it",
+			       (void *)srv);
 			return -EOVERFLOW;
 		}
 
 		ev.events = EPOLLIN;
-		ev.data.u64 = PTR_TO_U64(res) | EV_BIT_RAW_DNS_QUERY;
-		r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, res->udp_fd, &ev);
+		ev.data.u64 = PTR_TO_U64(srv) | EV_BIT_RAW_DNS_QUERY;
+		r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, srv->udp_fd, &ev);
 		if (r < 0) {
 			pr_err(&w->ctx->lh,
 			       "Failed to add raw DNS UDP socket to epoll: %s\n",
@@ -67,86 +73,69 @@ static int register_dns_to_epoll(struct gwp_wrk *w)
 		}
 
 		pr_dbg(&w->ctx->lh,
-			"Worker %u registered raw DNS UDP socket to epoll (fd=%d)",
-			w->idx, res->udp_fd);
+			"Worker %u registered raw DNS UDP socket to epoll (fd=%d; server=%s)",
+			w->idx, srv->udp_fd, ip_to_str(&srv->addr));
 	}
 
 	return 0;
 }
 
-static int send_dns_payload(struct gwp_dns_resolver *res,
-			    struct gwp_conn_pair *gcp)
+static int raw_dns_query_done(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct gwp_dns_packet *gdp = gcp->gdp;
-	const void *b = gdp->buf;
-	size_t l = gdp->buf_len;
-	ssize_t sr;
+	int r = gwp_raw_dns_finish(w, gcp);
 
-	sr = __sys_sendto(res->udp_fd, b, l, MSG_NOSIGNAL, NULL, 0);
-	if (unlikely(sr < 0))
-		return (int)sr;
+	if (likely(!r))
+		return handle_connect(w, gcp);
 
-	return 0;
+	return dns_query_failed(w, gcp, r);
 }
 
-static int chk_handle_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+/*
+ * Drain one server socket. Replies for many pairs share it, so a pair that
+ * fails is freed here and the loop goes on; the socket itself never fails
+ * the worker.
+ */
+static int handle_ev_raw_dns_query(struct gwp_wrk *w,
+				   struct gwp_dns_server *srv)
 {
-	struct gwp_cfg *cfg = &w->ctx->cfg;
+	struct gwp_dns_query *q;
+	struct gwp_conn_pair *gcp;
+	ssize_t ret;
+	int i, r;
+
+	for (i = 0; i < 64; i++) {
+		ret = __sys_recv(srv->udp_fd, srv->rx_buf, sizeof(srv->rx_buf),
+				 MSG_DONTWAIT);
+		if (ret < 0) {
+			if (ret != -EAGAIN && ret != -EINTR)
+				pr_dbg(&w->ctx->lh, "Raw DNS recv (server=%s): %s",
+					ip_to_str(&srv->addr), strerror((int)-ret));
+			/* ICMP errors are left to the retransmit timer. */
+			if (ret == -EAGAIN)
+				break;
+			continue;
+		}
+
+		r = gwp_dns_res_on_reply(w->dns, srv, srv->rx_buf,
+					 (size_t)ret, &q);
+		if (r <= 0)
+			continue;
 
-	if (cfg->use_raw_dns) {
-		struct gwp_dns_resolver *res = &w->dns->resolvers[0];
-		return send_dns_payload(res, gcp);
+		gcp = q->udata;
+		if (raw_dns_query_done(w, gcp))
+			free_conn_pair(w, gcp);
 	}
 
-	return arm_poll_for_dns_query(w, gcp);
+	return 0;
 }
 
-static int prep_and_send_socks5_rep_connect(struct gwp_wrk *w,
-					    struct gwp_conn_pair *gcp,
-					    int err);
-
-static int handle_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
-
-static int handle_ev_raw_dns_query(struct gwp_wrk *w)
+static int handle_ev_raw_dns_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct gwp_dns_resolver *res = &w->dns->resolvers[0];
-	struct gwp_conn_pair *gcp = NULL;
-	struct gwp_ctx *ctx = w->ctx;
-	uint8_t buf[UDP_MSG_LIMIT];
-	uint16_t len;
-	ssize_t ret;
-	int r;
-
-	ret = __sys_recv(res->udp_fd, buf, sizeof(buf), 0);
-	if (unlikely(ret < 0))
-		return (int)ret;
-
-	len = (uint16_t)ret;
-	ret = gwp_dns_res_fetch_gcp_by_payload(res, buf, len, &gcp);
-	if (unlikely(ret < 0))
+	assert(gcp->gdq);
+	if (!gwp_dns_res_on_timeout(w->dns, gcp->gdq))
 		return 0;
 
-	ret = gwp_dns_res_complete_query(res, gcp->gdp, buf, len,
-					 &gcp->target_addr);
-	if (ret == -EAGAIN)
-		return send_dns_payload(res, gcp);
-
-	if (likely(!ret)) {
-		pr_dbg(&ctx->lh, "Resolved DNS query for %s to %s (gcp_idx=%u)",
-			gcp->gdp->host, ip_to_str(&gcp->target_addr), gcp->idx);
-		/*
-		 * The raw resolver still yields one address per reply, so
-		 * there is nothing to fall back to here yet.
-		 */
-		gwp_conn_set_single_candidate(gcp, &gcp->target_addr);
-		r = handle_connect(w, gcp);
-	} else {
-		if (gcp->conn_state == CONN_STATE_SOCKS5_DNS_QUERY)
-			r = prep_and_send_socks5_rep_connect(w, gcp, (int)ret);
-		else
-			r = -EIO;
-	}
-	return r;
+	return raw_dns_query_done(w, gcp);
 }
 #else
 static int register_dns_to_epoll(struct gwp_wrk __unused *w)
@@ -154,12 +143,14 @@ static int register_dns_to_epoll(struct gwp_wrk __unused *w)
 	return 0;
 }
 
-static int chk_handle_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+static int handle_ev_raw_dns_query(struct gwp_wrk __unused *w,
+				   void __unused *srv)
 {
-	return arm_poll_for_dns_query(w, gcp);
+	return -ENOSYS;
 }
 
-static int handle_ev_raw_dns_query(struct gwp_wrk __unused *w)
+static int handle_ev_raw_dns_timer(struct gwp_wrk __unused *w,
+				   struct gwp_conn_pair __unused *gcp)
 {
 	return -ENOSYS;
 }
@@ -168,6 +159,7 @@ static int handle_ev_raw_dns_query(struct gwp_wrk __unused *w)
 static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 				  int err);
 static bool has_inflight_attempt(const struct gwp_conn_pair *gcp);
+static bool zc_linger(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
 
 __cold
 int gwp_ctx_init_thread_epoll(struct gwp_wrk *w)
@@ -203,6 +195,14 @@ int gwp_ctx_init_thread_epoll(struct gwp_wrk *w)
 	w->ev_fd = ev_fd;
 	w->ep_fd = ep_fd;
 	w->events = events;
+#ifdef CONFIG_HTTPS
+	/* --tls-hs-threads: finished handshake steps ring the same eventfd. */
+	if (ctx->tls_pool)
+		gwp_tls_pool_set_cq_fd(ctx->tls_pool, w->idx, ev_fd);
+#endif
+	/* So do resolved DNS queries. */
+	if (ctx->dns)
+		gwp_dns_set_cq_fd(ctx->dns, w->idx, ev_fd);
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = EPOLLIN;
@@ -264,6 +264,12 @@ out_close_ep_fd:
 __cold
 void gwp_ctx_free_thread_epoll(struct gwp_wrk *w)
 {
+#ifdef CONFIG_HTTPS
+	if (w->ctx->tls_pool)
+		gwp_tls_pool_set_cq_fd(w->ctx->tls_pool, w->idx, -1);
+#endif
+	if (w->ctx->dns)
+		gwp_dns_set_cq_fd(w->ctx->dns, w->idx, -1);
 	if (w->ev_fd >= 0) {
 		__sys_close(w->ev_fd);
 		pr_dbg(&w->ctx->lh, "Worker %u eventfd closed (fd=%d)", w->idx,
@@ -291,16 +297,16 @@ static int rearm_accept(struct gwp_wrk *w, int nr_fd_closed)
 	int x, r;
 
 	/*
-	 * Each connection pair consists of at least 3 file descriptors:
+	 * Each connection pair consists of at least 2 file descriptors:
 	 *
 	 *   1. TCP socket for the client connection.
 	 *   2. TCP socket for the target connection.
-	 *   3. Timer file descriptor (if used).
 	 *
-	 * Before rearming the main TCP socket, wait until we have free
-	 * space for at least 3 connection pairs per worker thread.
+	 * Its timers live on the worker's timer wheel and cost none. Before
+	 * rearming the main TCP socket, wait until we have free space for at
+	 * least 3 connection pairs per worker thread.
 	 */
-	if (nr_fd_closed <= ((3 * ctx->cfg.nr_workers) * 3))
+	if (nr_fd_closed <= ((2 * ctx->cfg.nr_workers) * 3))
 		return 0;
 
 	ev.events = EPOLLIN;
@@ -324,26 +330,19 @@ static int rearm_accept(struct gwp_wrk *w, int nr_fd_closed)
 __hot
 static int free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct gwp_dns_entry *gde = gcp->gde;
 	struct gwp_ctx *ctx = w->ctx;
 	int nr_fd_closed = 0;
 	int r;
 
-	if (!w->ctx->cfg.use_raw_dns) {
-		if (gde) {
-			r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_DEL, gde->ev_fd, NULL);
-			if (unlikely(r))
-				return r;
-		}
-	}
+	if (unlikely(gcp->client.zc_pinned || gcp->target.zc_pinned) &&
+	    zc_linger(w, gcp))
+		return 0;
 
 	if (gcp->client.fd >= 0) {
 		nr_fd_closed++;
 		w->ev_need_reload = true;
 	}
 
-	if (gcp->timer_fd >= 0)
-		nr_fd_closed++;
 	if (gcp->target.fd >= 0)
 		nr_fd_closed++;
 	if (gcp->udp_fd >= 0)
@@ -353,16 +352,18 @@ static int free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	 * A race that was still running when the pair went away: those sockets
 	 * count too, or the accept path under-credits them and stays throttled.
 	 */
-	{
+	if (gcp->hs) {
 		uint8_t i;
 
 		for (i = 0; i < GWP_MAX_CONN_CAND; i++)
-			if (gcp->attempt_fd[i] >= 0)
+			if (gcp->hs->attempt_fd[i] >= 0)
 				nr_fd_closed++;
-		if (gcp->attempt_timer_fd >= 0)
-			nr_fd_closed++;
 	}
 
+	nr_fd_closed += gwp_pipe_put(w, gcp->client.pipe);
+	nr_fd_closed += gwp_pipe_put(w, gcp->target.pipe);
+	gcp->client.pipe = gcp->target.pipe = NULL;
+
 	r = gwp_free_conn_pair(w, gcp);
 	if (unlikely(r)) {
 		pr_err(&ctx->lh, "Failed to free connection pair: %s", strerror(-r));
@@ -388,7 +389,7 @@ static int free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 __hot
 static int handle_new_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	int target_fd, timer_fd, timeout, r;
+	int target_fd, timeout, r;
 	struct gwp_ctx *ctx = w->ctx;
 	struct gwp_cfg *cfg = &ctx->cfg;
 	struct epoll_event ev;
@@ -423,7 +424,7 @@ static int handle_new_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		 * SOCKS5/HTTP handshake, hence no reply): enforce the OUTPUT
 		 * chain here and drop the connection if the target is denied.
 		 */
-		if (!gwp_ctx_acl_target_allowed(ctx, gcp)) {
+		if (!gwp_ctx_acl_target_allowed(ctx, &w->acl_memo, gcp)) {
 			pr_info(&ctx->lh, "ACL denied target %s for client %s",
 				ip_to_str(&gcp->target_addr),
 				ip_to_str(&gcp->client_addr));
@@ -434,7 +435,7 @@ static int handle_new_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		if (ctx->upstream.enabled)
 			ca = &ctx->upstream.addr;
 
-		target_fd = gwp_create_sock_target(w, ca, &gcp->acl_sockopt, p,
+		target_fd = gwp_create_sock_target(w, ca, &gcp->hs->acl_sockopt, p,
 						   true);
 		if (target_fd < 0) {
 			pr_err(&ctx->lh, "Failed to create target socket: %s",
@@ -453,16 +454,7 @@ static int handle_new_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 			gcp->is_target_alive = false;
 	}
 
-	if (timeout > 0) {
-		timer_fd = gwp_create_timer(-1, timeout, 0);
-		if (unlikely(timer_fd < 0)) {
-			__sys_close(target_fd);
-			return timer_fd;
-		}
-		gcp->timer_fd = timer_fd;
-	} else {
-		gcp->timer_fd = -1;
-	}
+	gwp_conn_arm_timer(w, gcp, timeout);
 
 	/*
 	 * If epoll_ctl() fails, don't bother closing the target socket
@@ -488,14 +480,6 @@ static int handle_new_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	if (unlikely(r))
 		return r;
 
-	if (gcp->timer_fd >= 0) {
-		ev.events = EPOLLIN;
-		ev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_TIMER;
-		r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, gcp->timer_fd, &ev);
-		if (unlikely(r))
-			return r;
-	}
-
 	if (gcp->target.fd >= 0)
 		log_conn_pair_created(w, gcp);
 
@@ -581,9 +565,13 @@ static int __handle_ev_accept(struct gwp_wrk *w)
 			free_conn_pair(w, gcp);
 			return 0;
 		}
-		gwp_conn_set_single_candidate(gcp, &gcp->target_addr);
+		r = gwp_conn_set_single_candidate(w, gcp, &gcp->target_addr);
+		if (unlikely(r))
+			goto out_err;
 	} else if (!cfg->as_socks5 && !cfg->as_http) {
-		gwp_conn_set_single_candidate(gcp, &ctx->target_addr);
+		r = gwp_conn_set_single_candidate(w, gcp, &ctx->target_addr);
+		if (unlikely(r))
+			goto out_err;
 	}
 
 	r = handle_new_client(w, gcp);
@@ -641,18 +629,25 @@ static int handle_ev_accept(struct gwp_wrk *w, struct epoll_event *ev)
 static int handle_ev_eventfd(struct gwp_wrk *w, struct epoll_event *ev)
 {
 	eventfd_t val;
+	int r;
 
 	if (unlikely(ev->events & EPOLLERR)) {
 		pr_err(&w->ctx->lh, "EPOLLERR on eventfd event");
 		return -EIO;
 	}
 
-	return eventfd_read(w->ev_fd, &val);
+	r = eventfd_read(w->ev_fd, &val);
+	/* After the read: a completion from here on rings again. */
+	handle_dns_queries(w);
+#ifdef CONFIG_HTTPS
+	handle_tls_jobs(w);
+#endif
+	return r;
 }
 
 static bool adj_epl_out(struct gwp_conn *src, struct gwp_conn *dst)
 {
-	bool want_out = src->len > 0;
+	bool want_out = gwp_conn_pending(src) > 0;
 
 #ifdef CONFIG_HTTPS
 	/*
@@ -687,11 +682,12 @@ static bool adj_epl_in(struct gwp_conn *src)
 	/*
 	 * Once this fd's read side is at EOF, stop listening for EPOLLIN and
 	 * EPOLLRDHUP on it. While the buffer is full, keep RDHUP but drop IN
-	 * so we still learn of a peer close under backpressure.
+	 * so we still learn of a peer close under backpressure. A spliced
+	 * endpoint reads into its pipe, so only the pipe's room counts.
 	 */
 	if (src->rd_eof)
 		desired = 0;
-	else if (src->cap - src->len)
+	else if (src->pipe ? !src->pipe->full : gwp_conn_free_len(src) != 0)
 		desired = EPOLLIN | EPOLLRDHUP;
 	else
 		desired = EPOLLRDHUP;
@@ -757,12 +753,11 @@ static ssize_t do_recv_tls(struct gwp_conn *src)
 	 * not a correctness, matter.
 	 */
 	unsigned char cbuf[4096];
-	size_t space, got;
 	ssize_t n;
+	size_t got;
 	int sr;
 
-	space = src->cap - src->len;
-	if (unlikely(space == 0))
+	if (unlikely(src->len == src->cap))
 		return 0;
 
 	n = __sys_recv(src->fd, cbuf, sizeof(cbuf), MSG_NOSIGNAL);
@@ -776,10 +771,11 @@ static ssize_t do_recv_tls(struct gwp_conn *src)
 	}
 
 	got = 0;
-	while (space) {
+	while (src->len < src->cap) {
 		size_t out = 0;
 
-		sr = gwp_ssl_read(src->tls, src->buf + src->len, space, &out);
+		sr = gwp_ssl_read(src->tls, gwp_conn_room(src),
+				  gwp_conn_room_len(src), &out);
 		if (sr == GWP_SSL_OK) {
 			if (out == 0) {		/* clean close_notify */
 				src->rd_eof = true;
@@ -787,7 +783,6 @@ static ssize_t do_recv_tls(struct gwp_conn *src)
 			}
 			src->len += (uint32_t)out;
 			got += out;
-			space -= out;
 			continue;
 		}
 		if (sr == GWP_SSL_WANT_READ || sr == GWP_SSL_WANT_WRITE)
@@ -815,7 +810,8 @@ static ssize_t do_send_tls(struct gwp_conn *src, struct gwp_conn *dst)
 	while (src->len) {
 		size_t consumed = 0;
 
-		sr = gwp_ssl_write(dst->tls, src->buf, src->len, &consumed);
+		sr = gwp_ssl_write(dst->tls, gwp_conn_data(src),
+				   gwp_conn_data_len(src), &consumed);
 		if (sr == GWP_SSL_OK) {
 			gwp_conn_buf_advance(src, consumed);
 			if (consumed == 0)
@@ -847,25 +843,304 @@ static ssize_t do_send_tls(struct gwp_conn *src, struct gwp_conn *dst)
 }
 #endif /* CONFIG_HTTPS */
 
+/*
+ * Upper bound for one splice(2) call; the kernel clamps it to the room left in
+ * the pipe anyway, so this only has to be at least the largest pipe size.
+ */
+#define GWP_SPLICE_MAX	(1u << 20u)
+
+/*
+ * --splice receive: move whatever the socket has into the pipe, leaving the
+ * bytes in the kernel. -EAGAIN is ambiguous here: the socket may be empty, or
+ * the pipe may be out of room. With bytes already queued in the pipe assume
+ * the latter and mark it full, which makes adj_epl_in() drop EPOLLIN until
+ * do_send_splice() drains some of it; being wrong only delays the next read
+ * until that drain, whereas leaving EPOLLIN armed on a full pipe would spin.
+ */
+static ssize_t do_recv_splice(struct gwp_conn *src)
+{
+	struct gwp_pipe *p = src->pipe;
+	ssize_t ret;
+
+	ret = __sys_splice(src->fd, NULL, p->fd[1], NULL, GWP_SPLICE_MAX,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (unlikely(ret < 0)) {
+		/* kTLS: a close_notify or an alert, not data (see __do_recv()). */
+		if (src->ktls && (ret == -EINVAL || ret == -EIO)) {
+			src->rd_eof = true;
+			return 0;
+		}
+		if (ret != -EAGAIN && ret != -EINTR)
+			return ret;
+		if (ret == -EAGAIN && p->len)
+			p->full = true;
+		return 0;
+	} else if (!ret) {
+		src->rd_eof = true;
+		return 0;
+	}
+
+	p->len += (uint32_t)ret;
+	return ret;
+}
+
+/* --splice send: move queued pipe bytes out to the peer socket. */
+static ssize_t do_send_splice(struct gwp_conn *src, struct gwp_conn *dst)
+{
+	struct gwp_pipe *p = src->pipe;
+	ssize_t ret;
+
+	if (!p->len)
+		return 0;
+
+	ret = __sys_splice(p->fd[0], NULL, dst->fd, NULL, p->len,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN && ret != -EINTR)
+			return ret;
+		return 0;
+	} else if (!ret) {
+		return -ECONNRESET;
+	}
+
+	p->len -= (uint32_t)ret;
+	p->full = false;
+	return ret;
+}
+
+/*
+ * Switch a forwarding pair over to splice(2) the first time it moves data with
+ * --splice on. TLS endpoints need the bytes in user space and stay on the
+ * buffered path, as does a pair for which no pipe could be had (typically
+ * EMFILE): the buffers still work, so that is not worth failing the pair for.
+ */
+static void splice_attach(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	int r = 0;
+
+	if (likely(gcp->client.pipe) || (gcp->flags & GWP_CONN_FLAG_NO_SPLICE))
+		return;
+
+	if (!w->ctx->cfg.use_splice || !gcp->is_target_alive ||
+	    gcp->conn_state != CONN_STATE_FORWARDING)
+		return;
+
+	if (gcp->client.tls || gcp->target.tls) {
+		gcp->flags |= GWP_CONN_FLAG_NO_SPLICE;
+		return;
+	}
+
+	gcp->client.pipe = gwp_pipe_get(w, &r);
+	if (gcp->client.pipe)
+		gcp->target.pipe = gwp_pipe_get(w, &r);
+
+	if (unlikely(!gcp->target.pipe)) {
+		pr_dbg(&w->ctx->lh, "No pipe for splice, copying instead (idx=%u): %s",
+			gcp->idx, strerror(-r));
+		gwp_pipe_put(w, gcp->client.pipe);
+		gcp->client.pipe = NULL;
+		gcp->flags |= GWP_CONN_FLAG_NO_SPLICE;
+	}
+}
+
+/*
+ * --zerocopy-min: a forwarded chunk at least that big goes out with
+ * MSG_ZEROCOPY, and the kernel transmits it straight from the buffer instead
+ * of copying it into socket memory first. The bytes must stay put until the
+ * kernel says it is done with them, which it does through the socket's error
+ * queue (so EPOLLERR). Only one such send per buffer is outstanding: its
+ * completion hands back the whole pinned region, and sends made meanwhile
+ * copy as usual (see gwp_conn_buf_advance_zc()).
+ */
+#define GWP_ZC_LINGER_POLL_MS	10u
+#define GWP_ZC_LINGER_MAX_MS	5000u
+
+/*
+ * Turn SO_ZEROCOPY on for a pair the first time it forwards. Without it the
+ * kernel silently ignores MSG_ZEROCOPY and no completion ever comes. TLS
+ * endpoints encrypt into scratch buffers and stay on copies, and a kTLS
+ * socket refuses MSG_ZEROCOPY outright.
+ */
+static void zc_attach(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	static const int one = 1;
+
+	if (likely(gcp->flags & (GWP_CONN_FLAG_ZC | GWP_CONN_FLAG_NO_ZC)))
+		return;
+
+	if (!w->ctx->cfg.zerocopy_min || !gcp->is_target_alive ||
+	    gcp->conn_state != CONN_STATE_FORWARDING)
+		return;
+
+	if (gcp->client.tls || gcp->target.tls || gcp->client.ktls ||
+	    __sys_setsockopt(gcp->client.fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+			     sizeof(one)) ||
+	    __sys_setsockopt(gcp->target.fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+			     sizeof(one))) {
+		gcp->flags |= GWP_CONN_FLAG_NO_ZC;
+		return;
+	}
+
+	gcp->flags |= GWP_CONN_FLAG_ZC;
+}
+
+/* The chunk size from which @gcp sends zero-copy, or 0 when it never does. */
+static uint32_t zc_threshold(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	if ((gcp->flags & (GWP_CONN_FLAG_ZC | GWP_CONN_FLAG_NO_ZC)) !=
+	    GWP_CONN_FLAG_ZC)
+		return 0;
+
+	return (uint32_t)w->ctx->cfg.zerocopy_min;
+}
+
+/*
+ * Collect the zero-copy completions queued on @dst's socket, which are all
+ * for sends out of @src's buffer. Returns true if there were any.
+ */
+static bool zc_reap(struct gwp_conn_pair *gcp, struct gwp_conn *src,
+		    struct gwp_conn *dst)
+{
+	union {
+		char		buf[CMSG_SPACE(sizeof(struct sock_extended_err))];
+		struct cmsghdr	align;
+	} ctl;
+	struct sock_extended_err *ee;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	bool found = false;
+
+	if (!src->zc_pinned)
+		return false;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+		if (__sys_recvmsg(dst->fd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+
+		cm = CMSG_FIRSTHDR(&msg);
+		if (!cm)
+			continue;
+
+		ee = (struct sock_extended_err *)(void *)CMSG_DATA(cm);
+		if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno)
+			continue;
+
+		found = true;
+		if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			gcp->flags |= GWP_CONN_FLAG_NO_ZC;
+	}
+
+	if (found)
+		gwp_conn_zc_done(src);
+	return found;
+}
+
+/*
+ * The pair is finished, but the kernel may still be transmitting a zero-copy
+ * send out of one of its buffers. Closing the socket would not stop that, and
+ * handing the buffer back to the pool would let its next owner overwrite
+ * bytes that are not on the wire yet. So the pair lingers off epoll while its
+ * timer polls the error queues. A peer that stops acknowledging must not keep
+ * it forever: after GWP_ZC_LINGER_MAX_MS the sockets are reset on close,
+ * which drops their unsent data and the pages with it.
+ *
+ * Returns true while the pair lingers.
+ */
+static bool zc_linger(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	static const struct linger rst = { .l_onoff = 1, .l_linger = 0 };
+
+	zc_reap(gcp, &gcp->client, &gcp->target);
+	zc_reap(gcp, &gcp->target, &gcp->client);
+	if (!gcp->client.zc_pinned && !gcp->target.zc_pinned)
+		return false;
+
+	if (!(gcp->flags & GWP_CONN_FLAG_ZC_LINGER)) {
+		gcp->flags |= GWP_CONN_FLAG_ZC_LINGER;
+		gcp->last_active = w->tw.now;
+		__sys_epoll_ctl(w->ep_fd, EPOLL_CTL_DEL, gcp->client.fd, NULL);
+		__sys_epoll_ctl(w->ep_fd, EPOLL_CTL_DEL, gcp->target.fd, NULL);
+		/* This batch may still hold events for those fds. */
+		w->ev_need_reload = true;
+	} else if (w->tw.now - gcp->last_active >= GWP_ZC_LINGER_MAX_MS) {
+		pr_warn(&w->ctx->lh, "Zero-copy send still pending, resetting (idx=%u, cfd=%d, tfd=%d)",
+			gcp->idx, gcp->client.fd, gcp->target.fd);
+		__sys_setsockopt(gcp->client.fd, SOL_SOCKET, SO_LINGER, &rst,
+				 sizeof(rst));
+		__sys_setsockopt(gcp->target.fd, SOL_SOCKET, SO_LINGER, &rst,
+				 sizeof(rst));
+		return false;
+	}
+
+	gwp_timer_arm(&w->tw, &gcp->timer, GWP_ZC_LINGER_POLL_MS);
+	return true;
+}
+
+/*
+ * The ring hands out one segment unless it wraps, so the plain recv()/send()
+ * stays the common case and recvmsg()/sendmsg() only covers the wrap.
+ */
+static ssize_t sys_recv_iov(int fd, struct iovec *iov, int nr)
+{
+	struct msghdr msg;
+
+	if (nr == 1)
+		return __sys_recv(fd, iov[0].iov_base, iov[0].iov_len,
+				  MSG_NOSIGNAL);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (size_t)nr;
+	return __sys_recvmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+static ssize_t sys_send_iov(int fd, struct iovec *iov, int nr, int flags)
+{
+	struct msghdr msg;
+
+	flags |= MSG_NOSIGNAL;
+	if (nr == 1)
+		return __sys_send(fd, iov[0].iov_base, iov[0].iov_len, flags);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (size_t)nr;
+	return __sys_sendmsg(fd, &msg, flags);
+}
+
 __hot
 static ssize_t __do_recv(struct gwp_conn *src)
 {
+	struct iovec iov[2];
 	ssize_t ret;
-	size_t len;
-	char *buf;
+	int nr;
 
 #ifdef CONFIG_HTTPS
 	if (src->tls)
 		return do_recv_tls(src);
 #endif
 
-	len = src->cap - src->len;
-	if (unlikely(len == 0))
+	if (src->pipe)
+		return do_recv_splice(src);
+
+	nr = gwp_conn_room_iov(src, iov);
+	if (unlikely(nr == 0))
 		return 0;
 
-	buf = src->buf + src->len;
-	ret = __sys_recv(src->fd, buf, len, MSG_NOSIGNAL);
+	ret = sys_recv_iov(src->fd, iov, nr);
 	if (unlikely(ret < 0)) {
+		/*
+		 * kTLS fails a read that reaches a non-data record (the client's
+		 * close_notify, or an alert) with EIO. There is nothing left to
+		 * forward from it either way, so it is this side's EOF.
+		 */
+		if (ret == -EIO && src->ktls) {
+			src->rd_eof = true;
+			return 0;
+		}
 		if (ret != -EAGAIN && ret != -EINTR)
 			return ret;
 		ret = 0;
@@ -884,10 +1159,18 @@ static ssize_t __do_recv(struct gwp_conn *src)
 	return ret;
 }
 
+/*
+ * Flush @src's buffered bytes to @dst. A chunk of at least @zc_min bytes
+ * (0 = never) goes out zero-copy unless one is already outstanding.
+ */
 __hot
-static ssize_t __do_send(struct gwp_conn *src, struct gwp_conn *dst)
+static ssize_t __do_send_zc(struct gwp_conn *src, struct gwp_conn *dst,
+			    uint32_t zc_min)
 {
+	struct iovec iov[2];
 	ssize_t ret;
+	bool zc;
+	int nr;
 
 #ifdef CONFIG_HTTPS
 	/*
@@ -900,9 +1183,18 @@ static ssize_t __do_send(struct gwp_conn *src, struct gwp_conn *dst)
 #endif
 
 	if (unlikely(src->len == 0))
-		return 0;
+		return src->pipe ? do_send_splice(src, dst) : 0;
+
+	nr = gwp_conn_data_iov(src, iov);
+	zc = zc_min && !src->zc_pinned && src->len >= zc_min;
+	ret = sys_send_iov(dst->fd, iov, nr, zc ? MSG_ZEROCOPY : 0);
+
+	/* Over the socket's budget for pinned pages: copy this one. */
+	if (unlikely(zc && ret == -ENOBUFS)) {
+		zc = false;
+		ret = sys_send_iov(dst->fd, iov, nr, 0);
+	}
 
-	ret = __sys_send(dst->fd, src->buf, src->len, MSG_NOSIGNAL);
 	if (unlikely(ret < 0)) {
 		if (ret != -EAGAIN && ret != -EINTR)
 			return ret;
@@ -911,13 +1203,34 @@ static ssize_t __do_send(struct gwp_conn *src, struct gwp_conn *dst)
 		return -ECONNRESET;
 	}
 
-	gwp_conn_buf_advance(src, (size_t)ret);
+	if (zc)
+		gwp_conn_buf_advance_zc(src, (size_t)ret);
+	else
+		gwp_conn_buf_advance(src, (size_t)ret);
+
+	/*
+	 * Whatever was buffered before the pipe was attached is older than
+	 * what sits in the pipe, so the pipe only drains once @buf is empty.
+	 */
+	if (src->pipe && !src->len) {
+		ssize_t sr = do_send_splice(src, dst);
+
+		if (unlikely(sr < 0))
+			return sr;
+		ret += sr;
+	}
+
 	return ret;
 }
 
+static ssize_t __do_send(struct gwp_conn *src, struct gwp_conn *dst)
+{
+	return __do_send_zc(src, dst, 0);
+}
+
 __hot
 static int do_splice(struct gwp_conn *src, struct gwp_conn *dst, bool do_recv,
-		     bool do_send)
+		     bool do_send, uint32_t zc_min)
 {
 	ssize_t ret;
 
@@ -928,7 +1241,7 @@ static int do_splice(struct gwp_conn *src, struct gwp_conn *dst, bool do_recv,
 	}
 
 	if (do_send) {
-		ret = __do_send(src, dst);
+		ret = __do_send_zc(src, dst, zc_min);
 		if (unlikely(ret < 0))
 			return (int)ret;
 	}
@@ -1009,12 +1322,7 @@ static int upstream_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	struct gwp_ctx *ctx = w->ctx;
 	ssize_t sr;
 
-	if (gcp->timer_fd >= 0) {
-		__sys_close(gcp->timer_fd);
-		gcp->timer_fd = -1;
-	}
-
-	gcp->up_tx = false;
+	gwp_conn_start_idle_timer(w, gcp);
 	gcp->is_target_alive = true;
 	gcp->conn_state = CONN_STATE_FORWARDING;
 	gcp->target.ep_mask = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
@@ -1022,6 +1330,7 @@ static int upstream_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	pr_info(&ctx->lh, "Upstream tunnel established (idx=%u, ca=%s, dst=%s)",
 		gcp->idx, ip_to_str(&gcp->client_addr),
 		gwp_upstream_dst_str(gcp));
+	gwp_conn_hs_release(w, gcp);
 
 	/* Flush downstream reply (+ early data) to the client. */
 	if (gcp->target.len) {
@@ -1060,16 +1369,16 @@ static int handle_ev_upstream(struct gwp_wrk *w,
 	int r;
 
 	/* Transmit phase: flush the pending request to the proxy. */
-	if (gcp->up_tx) {
+	if (gcp->hs->up_tx) {
 		if (ev->events & EPOLLOUT) {
 			sr = __do_send(&gcp->target, &gcp->target);
 			if (unlikely(sr < 0))
 				return (int)sr;
 			if (gcp->target.len == 0)
-				gcp->up_tx = false;
+				gcp->hs->up_tx = false;
 		}
 
-		if (gcp->up_tx) {
+		if (gcp->hs->up_tx) {
 			if (ev->events & (EPOLLRDHUP | EPOLLHUP))
 				return -ECONNRESET;
 			return upstream_arm(w, gcp, EPOLLOUT | EPOLLRDHUP);
@@ -1112,11 +1421,11 @@ static int adopt_winning_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 				 uint8_t slot)
 {
 	struct epoll_event ev;
-	int fd = gcp->attempt_fd[slot];
+	int fd = gcp->hs->attempt_fd[slot];
 	int closed;
 
-	gcp->attempt_fd[slot] = -1;
-	closed = gwp_conn_close_attempts(gcp);
+	gcp->hs->attempt_fd[slot] = -1;
+	closed = gwp_conn_close_attempts(w, gcp);
 	if (closed) {
 		/*
 		 * Losing sockets are descriptors returned to the process; the
@@ -1149,10 +1458,8 @@ static int handle_ev_target_conn_result(struct gwp_wrk *w,
 	if (ctx->upstream.enabled)
 		return upstream_start(w, gcp);
 
-	if (gcp->timer_fd >= 0) {
-		__sys_close(gcp->timer_fd);
-		gcp->timer_fd = -1;
-	}
+	gwp_conn_start_idle_timer(w, gcp);
+	gwp_conn_hs_release(w, gcp);
 
 	if (gcp->conn_state == CONN_STATE_SOCKS5_CONNECT) {
 		r = prep_and_send_socks5_rep_connect(w, gcp, 0);
@@ -1169,6 +1476,7 @@ static int handle_ev_target_conn_result(struct gwp_wrk *w,
 						 gcp->target.cap);
 		if (r < 0)
 			return r;
+		gcp->target.head = 0;
 		gcp->target.len = (uint32_t)r;
 	}
 
@@ -1201,7 +1509,11 @@ static int handle_ev_target_attempt(struct gwp_wrk *w,
 	if (unlikely(slot >= GWP_MAX_CONN_CAND))
 		return -EINVAL;
 
-	fd = gcp->attempt_fd[slot];
+	/* A loser reported in the same batch the winner was adopted in. */
+	if (unlikely(!gcp->hs))
+		return 0;
+
+	fd = gcp->hs->attempt_fd[slot];
 	if (unlikely(fd < 0))
 		return 0;		/* already retired */
 
@@ -1217,7 +1529,7 @@ static int handle_ev_target_attempt(struct gwp_wrk *w,
 			ip_to_str(&gcp->target_addr));
 
 		__sys_close(fd);
-		gcp->attempt_fd[slot] = -1;
+		gcp->hs->attempt_fd[slot] = -1;
 		atomic_fetch_add(&ctx->nr_fd_closed, 1);
 
 		/*
@@ -1238,7 +1550,7 @@ static int handle_ev_target_attempt(struct gwp_wrk *w,
 	 * recorded address also keeps a -j DNAT rewrite intact, which
 	 * re-deriving from cand[] would silently undo.
 	 */
-	gcp->target_addr = gcp->attempt_addr[slot];
+	gcp->target_addr = gcp->hs->attempt_addr[slot];
 	pr_info(&ctx->lh, "Target socket connected (fd=%d, idx=%u, ca=%s, ta=%s)",
 		fd, gcp->idx, ip_to_str(&gcp->client_addr),
 		ip_to_str(&gcp->target_addr));
@@ -1259,7 +1571,8 @@ static int handle_ev_target_attempt(struct gwp_wrk *w,
  */
 static int forward_progress(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	if (gcp->target.rd_eof && gcp->target.len == 0 && !gcp->client.wr_shut) {
+	if (gcp->target.rd_eof && !gwp_conn_pending(&gcp->target) &&
+	    !gcp->client.wr_shut) {
 #ifdef CONFIG_HTTPS
 		/* Best-effort close_notify before closing the write side. */
 		if (gcp->client.tls) {
@@ -1271,7 +1584,8 @@ static int forward_progress(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		gcp->client.wr_shut = true;
 	}
 
-	if (gcp->client.rd_eof && gcp->client.len == 0 && !gcp->target.wr_shut) {
+	if (gcp->client.rd_eof && !gwp_conn_pending(&gcp->client) &&
+	    !gcp->target.wr_shut) {
 		__sys_shutdown(gcp->target.fd, SHUT_WR);
 		gcp->target.wr_shut = true;
 	}
@@ -1305,20 +1619,9 @@ __hot
  */
 static int handle_ev_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	uint64_t val;
-
-	if (gcp->attempt_timer_fd < 0)
+	if (gcp->hs->next_cand >= gcp->hs->nr_cand)
 		return 0;
 
-	/* Drain the timerfd or it stays readable and spins the loop. */
-	__sys_read(gcp->attempt_timer_fd, &val, sizeof(val));
-
-	if (gcp->next_cand >= gcp->nr_cand) {
-		__sys_close(gcp->attempt_timer_fd);
-		gcp->attempt_timer_fd = -1;
-		return 0;
-	}
-
 	/*
 	 * -EINPROGRESS is not a failure to report: attempts are still running,
 	 * and connect_next_candidate() only speaks to the client once nothing
@@ -1330,6 +1633,7 @@ static int handle_ev_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 static int handle_ev_target(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			    struct epoll_event *ev)
 {
+	uint32_t zc_min;
 	int r;
 
 	if (unlikely(ev->events & EPOLLERR)) {
@@ -1342,8 +1646,14 @@ static int handle_ev_target(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		if (!gcp->is_target_alive)
 			return handle_ev_target_conn_result(w, gcp);
 
-		pr_err(&w->ctx->lh, "EPOLLERR on target connection event");
-		return -ECONNRESET;
+		/*
+		 * It is also how a zero-copy send to the target completes. A
+		 * real error still surfaces in the recv or send below.
+		 */
+		if (!zc_reap(gcp, &gcp->client, &gcp->target)) {
+			pr_err(&w->ctx->lh, "EPOLLERR on target connection event");
+			return -ECONNRESET;
+		}
 	}
 
 	if (!gcp->is_target_alive) {
@@ -1357,6 +1667,15 @@ static int handle_ev_target(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	}
 
 	assert(gcp->conn_state == CONN_STATE_FORWARDING);
+	gwp_conn_touch(w, gcp);
+#ifdef CONFIG_HTTPS
+	r = gwp_conn_ktls_attach(w, gcp);
+	if (r)
+		return r;
+#endif
+	splice_attach(w, gcp);
+	zc_attach(w, gcp);
+	zc_min = zc_threshold(w, gcp);
 
 	/*
 	 * Drain on EPOLLHUP as well as EPOLLIN: a hung-up socket can still have
@@ -1364,13 +1683,13 @@ static int handle_ev_target(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	 * triggered) until recv() returns 0 and sets rd_eof.
 	 */
 	if (ev->events & (EPOLLIN | EPOLLHUP)) {
-		r = do_splice(&gcp->target, &gcp->client, true, true);
+		r = do_splice(&gcp->target, &gcp->client, true, true, zc_min);
 		if (r)
 			return r;
 	}
 
 	if (ev->events & EPOLLOUT) {
-		r = do_splice(&gcp->client, &gcp->target, true, true);
+		r = do_splice(&gcp->client, &gcp->target, true, true, zc_min);
 		if (r)
 			return r;
 	}
@@ -1385,21 +1704,35 @@ __hot
 static int handle_ev_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			    struct epoll_event *ev)
 {
+	uint32_t zc_min;
 	int r;
 
-	if (unlikely(ev->events & EPOLLERR)) {
+	/* As on the target, possibly just a zero-copy completion. */
+	if (unlikely(ev->events & EPOLLERR) &&
+	    !zc_reap(gcp, &gcp->target, &gcp->client)) {
 		pr_err(&w->ctx->lh, "EPOLLERR on client connection event");
 		return -ECONNRESET;
 	}
 
+	gwp_conn_touch(w, gcp);
+#ifdef CONFIG_HTTPS
+	r = gwp_conn_ktls_attach(w, gcp);
+	if (r)
+		return r;
+#endif
+	splice_attach(w, gcp);
+	zc_attach(w, gcp);
+	zc_min = zc_threshold(w, gcp);
+
 	if (ev->events & (EPOLLIN | EPOLLHUP)) {
-		r = do_splice(&gcp->client, &gcp->target, true, gcp->is_target_alive);
+		r = do_splice(&gcp->client, &gcp->target, true,
+			      gcp->is_target_alive, zc_min);
 		if (r)
 			return r;
 	}
 
 	if (ev->events & EPOLLOUT) {
-		r = do_splice(&gcp->target, &gcp->client, true, true);
+		r = do_splice(&gcp->target, &gcp->client, true, true, zc_min);
 		if (r)
 			return r;
 	}
@@ -1415,8 +1748,16 @@ static int handle_ev_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_ctx *ctx = w->ctx;
 
-	if (gcp->timer_fd < 0)
-		return 0;
+	/*
+	 * A lingering pair (zc_linger()) polls for its zero-copy completions:
+	 * back to free_conn_pair(), which frees it once they are in.
+	 */
+	if (unlikely(gcp->flags & GWP_CONN_FLAG_ZC_LINGER))
+		return -ECONNRESET;
+
+	/* Past the connect, the same timer only ever bounds idleness. */
+	if (gcp->is_target_alive && gcp->conn_state == CONN_STATE_FORWARDING)
+		return gwp_conn_idle_expired(w, gcp);
 
 	pr_warn(&ctx->lh, "Connection timeout! (idx=%u, cfd=%d, tfd=%d, ca=%s, ta=%s)",
 		gcp->idx, gcp->client.fd, gcp->target.fd,
@@ -1476,8 +1817,11 @@ static bool has_inflight_attempt(const struct gwp_conn_pair *gcp)
 {
 	uint8_t i;
 
+	if (!gcp->hs)
+		return false;
+
 	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
-		if (gcp->attempt_fd[i] >= 0)
+		if (gcp->hs->attempt_fd[i] >= 0)
 			return true;
 	}
 	return false;
@@ -1500,17 +1844,17 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	if (w->ctx->upstream.enabled) {
 		/* Connect to the upstream proxy, not the real destination. */
 		tfd = gwp_create_sock_target(w, &w->ctx->upstream.addr,
-					     &gcp->acl_sockopt, &alive, true);
+					     &gcp->hs->acl_sockopt, &alive, true);
 	} else {
 		tfd = gwp_create_sock_target(w, &gcp->target_addr,
-					     &gcp->acl_sockopt, &alive, true);
+					     &gcp->hs->acl_sockopt, &alive, true);
 	}
 	if (unlikely(tfd < 0))
 		return tfd;
 
-	gcp->attempt_fd[slot] = tfd;
+	gcp->hs->attempt_fd[slot] = tfd;
 	/* Post-ACL, so a -j DNAT rewrite is what gets recorded. */
-	gcp->attempt_addr[slot] = gcp->target_addr;
+	gcp->hs->attempt_addr[slot] = gcp->target_addr;
 
 	/*
 	 * Even a connect that completed synchronously is reported through the
@@ -1522,7 +1866,7 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, tfd, &ev);
 	if (unlikely(r)) {
 		__sys_close(tfd);
-		gcp->attempt_fd[slot] = -1;
+		gcp->hs->attempt_fd[slot] = -1;
 		return r;
 	}
 
@@ -1534,39 +1878,17 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
  * makes a black-holed address cheap: without it a target that silently drops
  * SYNs costs the whole connect timeout before anything else is tried.
  */
-static int arm_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+static void arm_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct epoll_event ev;
-	int r, ms;
-
-	if (gcp->next_cand >= gcp->nr_cand)
-		return 0;			/* nothing left to start */
+	if (gcp->hs->next_cand >= gcp->hs->nr_cand)
+		return;			/* nothing left to start */
 	if (w->ctx->cfg.connect_attempt_delay <= 0)
-		return 0;			/* racing disabled: fall back only */
+		return;			/* racing disabled: fall back only */
 	if (w->ctx->upstream.enabled)
-		return 0;			/* one proxy, nothing to race */
+		return;			/* one proxy, nothing to race */
 
-	ms = w->ctx->cfg.connect_attempt_delay;
-	if (gcp->attempt_timer_fd < 0) {
-		r = gwp_create_timer(-1, ms / 1000, (ms % 1000) * 1000000);
-		if (unlikely(r < 0))
-			return r;
-		gcp->attempt_timer_fd = r;
-
-		ev.events = EPOLLIN;
-		ev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_ATTEMPT_TIMER;
-		r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD,
-				    gcp->attempt_timer_fd, &ev);
-		if (unlikely(r))
-			return r;
-	} else {
-		r = gwp_create_timer(gcp->attempt_timer_fd, ms / 1000,
-				     (ms % 1000) * 1000000);
-		if (unlikely(r < 0))
-			return r;
-	}
-
-	return 0;
+	gwp_timer_arm(&w->tw, &gcp->hs->attempt_timer,
+		      (uint64_t)w->ctx->cfg.connect_attempt_delay);
 }
 
 /*
@@ -1584,7 +1906,9 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 				  int err)
 {
 	bool acl_denied = false;
-	int r;
+
+	if (unlikely(!gwp_conn_hs_get(w, gcp)))
+		return -ENOMEM;
 
 	/*
 	 * No candidate list at all: socks5h:// hands the hostname to the
@@ -1593,12 +1917,12 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	 * Attempt it once, leaving target_addr untouched so the ACL keeps
 	 * seeing "no resolved IP" and matches on -m domain as before.
 	 */
-	if (!gcp->nr_cand) {
-		if (gcp->next_cand)
+	if (!gcp->hs->nr_cand) {
+		if (gcp->hs->next_cand)
 			goto exhausted;
 
-		gcp->next_cand = 1;
-		if (!gwp_ctx_acl_target_allowed(w->ctx, gcp))
+		gcp->hs->next_cand = 1;
+		if (!gwp_ctx_acl_target_allowed(w->ctx, &w->acl_memo, gcp))
 			return acl_reject_target(w, gcp);
 
 		err = start_connect_attempt(w, gcp, 0);
@@ -1607,12 +1931,12 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		goto exhausted;
 	}
 
-	while (gcp->next_cand < gcp->nr_cand) {
-		uint8_t slot = gcp->next_cand;
+	while (gcp->hs->next_cand < gcp->hs->nr_cand) {
+		uint8_t slot = gcp->hs->next_cand;
 
-		gcp->target_addr = gcp->cand[gcp->next_cand++];
+		gcp->target_addr = gcp->hs->cand[gcp->hs->next_cand++];
 
-		if (!gwp_ctx_acl_target_allowed(w->ctx, gcp)) {
+		if (!gwp_ctx_acl_target_allowed(w->ctx, &w->acl_memo, gcp)) {
 			acl_denied = true;
 			continue;
 		}
@@ -1624,9 +1948,7 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			 * Racing: do not wait for this attempt to resolve
 			 * before queueing the next one.
 			 */
-			r = arm_attempt_timer(w, gcp);
-			if (unlikely(r))
-				return r;
+			arm_attempt_timer(w, gcp);
 			return 0;
 		}
 
@@ -1677,41 +1999,14 @@ static int handle_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	int r;
 
-	if (gcp->timer_fd >= 0) {
-		/*
-		 * If we already have a timer fd, close it and use the new
-		 * timer fd instead. There are two timers used in the socks5
-		 * case:
-		 *
-		 *    1. Timer for waiting socks5 auth and command.
-		 *    2. Timer for waiting target connect().
-		 *
-		 * If we've reached this point. Timer no (1) has already
-		 * served its purpose and we can close it.
-		 */
-		__sys_close(gcp->timer_fd);
-		gcp->timer_fd = -1;
-	}
-
 	/*
-	 * The connect timeout bounds the whole operation, across every
-	 * candidate address, so it is armed once here rather than per attempt.
+	 * In the socks5 and http cases the pair timer is still counting the
+	 * protocol handshake; that has served its purpose, so re-arm it for
+	 * the connect. The connect timeout bounds the whole operation, across
+	 * every candidate address, so it is armed once here rather than per
+	 * attempt.
 	 */
-	r = w->ctx->cfg.connect_timeout;
-	if (r > 0) {
-		struct epoll_event tev;
-
-		r = gwp_create_timer(-1, r, 0);
-		if (unlikely(r < 0))
-			return r;
-		gcp->timer_fd = r;
-
-		tev.events = EPOLLIN;
-		tev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_TIMER;
-		r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, gcp->timer_fd, &tev);
-		if (unlikely(r))
-			return r;
-	}
+	gwp_conn_arm_timer(w, gcp, w->ctx->cfg.connect_timeout);
 
 	/*
 	 * If epoll_ctl() calls fail, don't bother closing the
@@ -1747,26 +2042,6 @@ static int handle_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	return 0;
 }
 
-static int arm_poll_for_dns_query(struct gwp_wrk *w,
-					struct gwp_conn_pair *gcp)
-{
-	struct gwp_dns_entry *gde = gcp->gde;
-	struct epoll_event ev;
-	int r;
-
-	assert(gde);
-	assert(gde->ev_fd >= 0);
-
-	ev.events = EPOLLIN;
-	ev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_DNS_QUERY;
-
-	r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_ADD, gde->ev_fd, &ev);
-	if (unlikely(r))
-		return r;
-
-	return 0;
-}
-
 static void log_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			  struct gwp_dns_entry *gde)
 {
@@ -1786,6 +2061,28 @@ static void log_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		ip_to_str(&gcp->client_addr));
 }
 
+/*
+ * The name did not resolve, so the origin is unreachable: answer in whatever
+ * protocol the client speaks (SOCKS5 REP, or HTTP 502) instead of hanging up
+ * silently. Always returns an error, so the caller frees the pair.
+ */
+static int dns_query_failed(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    int err)
+{
+	int r;
+
+	r = gwp_conn_fail_reply(w, gcp, err);
+	if (!r && gcp->target.len) {
+		ssize_t sr = __do_send(&gcp->target, &gcp->client);
+
+		if (unlikely(sr < 0))
+			r = (int)sr;
+	}
+	if (!r)
+		r = err ? err : -EIO;
+	return r;
+}
+
 __hot
 static int handle_ev_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
@@ -1793,33 +2090,16 @@ static int handle_ev_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	int r;
 
 	assert(gde);
-	assert(gde->ev_fd >= 0);
 	assert(gcp->conn_state == CONN_STATE_SOCKS5_DNS_QUERY ||
 	       gcp->conn_state == CONN_STATE_HTTP_DNS_QUERY);
 
-	r = __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_DEL, gde->ev_fd, NULL);
-	if (unlikely(r))
-		return r;
-
 	log_dns_query(w, gcp, gde);
 	if (likely(!gde->res)) {
-		gwp_conn_set_candidates(gcp, gde->addrs, gde->nr_addrs);
-		r = handle_connect(w, gcp);
+		r = gwp_conn_set_candidates(w, gcp, gde->addrs, gde->nr_addrs);
+		if (likely(!r))
+			r = handle_connect(w, gcp);
 	} else {
-		/*
-		 * The name did not resolve, so the origin is unreachable:
-		 * answer in whatever protocol the client speaks (SOCKS5 REP,
-		 * or HTTP 502) instead of hanging up silently.
-		 */
-		r = gwp_conn_fail_reply(w, gcp, gde->res);
-		if (!r && gcp->target.len) {
-			ssize_t sr = __do_send(&gcp->target, &gcp->client);
-
-			if (unlikely(sr < 0))
-				r = (int)sr;
-		}
-		if (!r)
-			r = gde->res ? gde->res : -EIO;
+		r = dns_query_failed(w, gcp, gde->res);
 	}
 
 	gwp_dns_entry_put(gde);
@@ -1827,6 +2107,31 @@ static int handle_ev_dns_query(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	return r;
 }
 
+/*
+ * Pick up every query the DNS threads resolved for this worker. An entry
+ * comes back only while its pair still holds it, so the pair is alive.
+ */
+static void handle_dns_queries(struct gwp_wrk *w)
+{
+	struct gwp_dns_entry *gde, *next;
+	struct gwp_conn_pair *gcp;
+	int r;
+
+	if (!w->ctx->dns)
+		return;
+
+	gde = gwp_dns_reap(w->ctx->dns, w->idx);
+	for (; gde; gde = next) {
+		next = gde->next;
+		gcp = gde->udata;
+		assert(gcp->gde == gde);
+		r = handle_ev_dns_query(w, gcp);
+		gwp_dns_entry_put(gde);
+		if (r)
+			free_conn_pair(w, gcp);
+	}
+}
+
 static int handle_ev_auth_file(struct gwp_wrk *w)
 {
 	static const size_t l = sizeof(struct inotify_event) + NAME_MAX + 1;
@@ -1870,14 +2175,7 @@ static int handle_ev_acl_file(struct gwp_wrk *w)
 		return (int)r;
 	}
 
-	if (!gwp_inotify_event_matches(ctx->acl_ino_buf, (size_t)r,
-				       ctx->cfg.acl_file))
-		return 0;
-
-	if (gwp_acl_reload(ctx->acl))
-		pr_warn(&ctx->lh, "Failed to reload ACL file; keeping current rules");
-	else
-		pr_info(&ctx->lh, "Reloaded ACL file");
+	gwp_ctx_acl_files_changed(ctx, ctx->acl_ino_buf, (size_t)r);
 	return 0;
 }
 
@@ -1894,8 +2192,8 @@ static bool is_ev_bit_conn_pair(uint64_t ev_bit)
 	case EV_BIT_TARGET:
 	case EV_BIT_TIMER:
 	case EV_BIT_ATTEMPT_TIMER:
+	case EV_BIT_RAW_DNS_TIMER:
 	case EV_BIT_CLIENT_SOCKS5:
-	case EV_BIT_DNS_QUERY:
 	case EV_BIT_CLIENT_PROT:
 	case EV_BIT_UDP_RELAY:
 		return true;
@@ -1978,12 +2276,9 @@ static int handle_udp_associate(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	/*
 	 * The association is long-lived, so drop the protocol-handshake timeout
 	 * that was armed for the negotiation; otherwise it would fire and tear
-	 * the relay down mid-session. Closing the timerfd removes it from epoll.
+	 * the relay down mid-session.
 	 */
-	if (gcp->timer_fd >= 0) {
-		__sys_close(gcp->timer_fd);
-		gcp->timer_fd = -1;
-	}
+	gwp_timer_del(&w->tw, &gcp->timer);
 
 	ev.events = EPOLLIN;
 	ev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_UDP_RELAY;
@@ -1992,8 +2287,9 @@ static int handle_udp_associate(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 
 static int chk_socks5(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int r)
 {
+	/* handle_dns_queries(), or the raw resolver's socket, picks it up. */
 	if (r == -EINPROGRESS && gcp->conn_state == CONN_STATE_SOCKS5_DNS_QUERY)
-		return chk_handle_dns_query(w, gcp);
+		return 0;
 
 	if (r == 0 && gcp->conn_state == CONN_STATE_SOCKS5_CONNECT)
 		return handle_connect(w, gcp);
@@ -2012,7 +2308,7 @@ static int handle_conn_state_socks5(struct gwp_wrk *w, struct gwp_conn_pair *gcp
 static int chk_http(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int r)
 {
 	if (r == -EINPROGRESS && gcp->conn_state == CONN_STATE_HTTP_DNS_QUERY)
-		return arm_poll_for_dns_query(w, gcp);
+		return 0;	/* as in chk_socks5() */
 
 	if (r == 0 && gcp->conn_state == CONN_STATE_HTTP_CONNECT)
 		return handle_connect(w, gcp);
@@ -2066,7 +2362,7 @@ static int handle_ev_client_prot_in(struct gwp_wrk *w, struct gwp_conn_pair *gcp
 		 * a peer close was already turned into -ECONNRESET above and
 		 * tears the association down.
 		 */
-		gcp->client.len = 0;
+		gwp_conn_buf_advance(&gcp->client, gcp->client.len);
 		return 0;
 	}
 	if (ct == CONN_STATE_PROT) {
@@ -2118,16 +2414,16 @@ static int handle_ev_client_prot_out(struct gwp_wrk *w, struct gwp_conn_pair *gc
 }
 
 #ifdef CONFIG_HTTPS
-/* Re-arm the client fd under EV_BIT_CLIENT_PROT with @mask. */
+/* Re-arm (@op EPOLL_CTL_MOD) or re-add the client fd under EV_BIT_CLIENT_PROT. */
 static int tls_arm_client(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
-			  uint32_t mask)
+			  int op, uint32_t mask)
 {
 	struct epoll_event ev;
 
 	gcp->client.ep_mask = mask;
 	ev.events = mask;
 	ev.data.u64 = PTR_TO_U64(gcp) | EV_BIT_CLIENT_PROT;
-	return __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_MOD, gcp->client.fd, &ev);
+	return __sys_epoll_ctl(w->ep_fd, op, gcp->client.fd, &ev);
 }
 
 /* Flush queued handshake/alert ciphertext to the client, best effort. */
@@ -2154,34 +2450,21 @@ static int tls_flush_hs(struct gwp_conn *c)
 }
 
 /*
- * Drive the server-side TLS handshake: feed available ciphertext, step the
- * handshake, flush any records it produced. On completion, switch to
+ * Act on the handshake step result @hs: flush any records it produced, then
+ * wait for the peer's next flight or, on completion, switch to
  * CONN_STATE_PROT and process any application data the same recv() already
- * buffered inside the engine (no further EPOLLIN would surface it).
+ * buffered inside the engine (no further EPOLLIN would surface it). @op is
+ * EPOLL_CTL_ADD for a connection coming back from the handshake threads.
  */
-static int handle_ev_tls_handshake(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+static int tls_hs_done_step(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    int hs, int op)
 {
 	struct gwp_conn *c = &gcp->client;
-	unsigned char cbuf[4096];	/* see do_recv_tls() on the sizing */
 	uint32_t mask;
-	ssize_t n;
-	int hs, r;
-
-	n = __sys_recv(c->fd, cbuf, sizeof(cbuf), MSG_NOSIGNAL);
-	if (n > 0) {
-		if (gwp_ssl_bio_write(c->tls, cbuf, (size_t)n) < 0)
-			return -EIO;
-	} else if (n == 0) {
-		return -ECONNRESET;		/* peer closed mid-handshake */
-	} else if (n != -EAGAIN && n != -EINTR) {
-		return (int)n;
-	}
+	int r;
 
-	hs = gwp_ssl_handshake(c->tls);
-	if (hs == GWP_SSL_ERROR) {
-		pr_dbg(&w->ctx->lh, "TLS handshake failed: %s", gwp_ssl_errstr());
+	if (hs == GWP_SSL_ERROR)
 		return -ECONNRESET;
-	}
 
 	r = tls_flush_hs(c);
 	if (r)
@@ -2192,22 +2475,82 @@ static int handle_ev_tls_handshake(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		mask = EPOLLIN | EPOLLRDHUP;
 		if (gwp_ssl_bio_pending(c->tls) > 0)
 			mask |= EPOLLOUT;
-		return tls_arm_client(w, gcp, mask);
+		return tls_arm_client(w, gcp, op, mask);
 	}
 
 	pr_dbg(&w->ctx->lh, "TLS handshake complete (cfd=%d, alpn=%s)", c->fd,
 	       gwp_ssl_alpn(c->tls) ?: "none");
 	gcp->conn_state = CONN_STATE_PROT;
+	r = gwp_conn_ktls_attach(w, gcp);
+	if (r)
+		return r;
+
 	mask = EPOLLIN | EPOLLRDHUP;
-	if (gwp_ssl_bio_pending(c->tls) > 0)
+	if (c->tls && gwp_ssl_bio_pending(c->tls) > 0)
 		mask |= EPOLLOUT;
-	r = tls_arm_client(w, gcp, mask);
+	r = tls_arm_client(w, gcp, op, mask);
 	if (r)
 		return r;
 
 	return handle_ev_client_prot_in(w, gcp);
 }
 
+/*
+ * Drive the server-side TLS handshake: feed available ciphertext and step the
+ * handshake. With --tls-hs-threads a step that has new ciphertext to chew on
+ * goes to a crypto thread instead; the client fd leaves the epoll set until
+ * it comes back (see handle_tls_jobs()), so nothing touches client.tls in
+ * the meantime.
+ */
+static int handle_ev_tls_handshake(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn *c = &gcp->client;
+	unsigned char cbuf[4096];	/* see do_recv_tls() on the sizing */
+	ssize_t n;
+	int hs, r;
+
+	n = __sys_recv(c->fd, cbuf, sizeof(cbuf), MSG_NOSIGNAL);
+	if (n > 0) {
+		if (gwp_ssl_bio_write(c->tls, cbuf, (size_t)n) < 0)
+			return -EIO;
+	} else if (n == 0) {
+		return -ECONNRESET;		/* peer closed mid-handshake */
+	} else if (n != -EAGAIN && n != -EINTR) {
+		return (int)n;
+	}
+
+	if (n > 0) {
+		r = gwp_conn_tls_offload(w, gcp);
+		if (r < 0)
+			return r;
+		if (r > 0)
+			return __sys_epoll_ctl(w->ep_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	}
+
+	hs = gwp_ssl_handshake(c->tls);
+	if (hs == GWP_SSL_ERROR)
+		pr_dbg(&w->ctx->lh, "TLS handshake failed: %s", gwp_ssl_errstr());
+
+	return tls_hs_done_step(w, gcp, hs, EPOLL_CTL_MOD);
+}
+
+/* --tls-hs-threads: pick up the handshake steps the crypto threads finished. */
+static void handle_tls_jobs(struct gwp_wrk *w)
+{
+	struct gwp_tls_job *job, *next;
+	struct gwp_conn_pair *gcp;
+	int hs, r;
+
+	for (job = gwp_conn_tls_reap(w); job; job = next) {
+		next = job->next;
+		gcp = job->udata;
+		hs = gwp_conn_tls_finish(w, job);
+		r = tls_hs_done_step(w, gcp, hs, EPOLL_CTL_ADD);
+		if (r)
+			free_conn_pair(w, gcp);
+	}
+}
+
 /*
  * First-byte probe on a TLS-capable listener. A TLS record begins with 0x16
  * (handshake); SOCKS5 starts 0x05, SOCKS4 0x04 and HTTP with an ASCII letter,
@@ -2294,7 +2637,16 @@ static int handle_ev_client_prot(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 #endif
 	}
 
+#ifdef CONFIG_HTTPS
+	/*
+	 * The records that came with the handshake's last flight (typically
+	 * the proxy request) are consumed by now, which is usually the first
+	 * point the session can move into the kernel.
+	 */
+	return gwp_conn_ktls_attach(w, gcp);
+#else
 	return 0;
+#endif
 }
 
 static int handle_event(struct gwp_wrk *w, struct epoll_event *ev)
@@ -2344,9 +2696,6 @@ static int handle_event(struct gwp_wrk *w, struct epoll_event *ev)
 	case EV_BIT_TIMER:
 		r = handle_ev_timer(w, udata);
 		break;
-	case EV_BIT_DNS_QUERY:
-		r = handle_ev_dns_query(w, udata);
-		break;
 	case EV_BIT_SOCKS5_AUTH_FILE:
 		r = handle_ev_auth_file(w);
 		break;
@@ -2354,7 +2703,10 @@ static int handle_event(struct gwp_wrk *w, struct epoll_event *ev)
 		r = handle_ev_acl_file(w);
 		break;
 	case EV_BIT_RAW_DNS_QUERY:
-		r = handle_ev_raw_dns_query(w);
+		r = handle_ev_raw_dns_query(w, udata);
+		break;
+	case EV_BIT_RAW_DNS_TIMER:
+		r = handle_ev_raw_dns_timer(w, udata);
 		break;
 	default:
 		pr_err(&w->ctx->lh, "Unknown event bit: %" PRIu64, ev_bit);
@@ -2391,12 +2743,38 @@ static int handle_events(struct gwp_wrk *w, int nr_events)
 	return r;
 }
 
+/*
+ * Dispatch every wheel timer that is due. An expired timer carries the
+ * same event word an fd would, so it goes through handle_event() and a
+ * failing handler frees its pair on the usual path.
+ */
+static int handle_timers(struct gwp_wrk *w)
+{
+	struct gwp_timer *t;
+	int r;
+
+	while ((t = gwp_tw_expire(&w->tw, w->tw.now))) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.u64 = t->udata };
+
+		if (unlikely(w->ctx->stop))
+			break;
+
+		r = handle_event(w, &ev);
+		if (unlikely(r < 0))
+			return r;
+	}
+
+	return 0;
+}
+
 static int fish_events(struct gwp_wrk *w)
 {
 	int r;
 
 	w->ev_need_reload = false;
-	r = __sys_epoll_wait(w->ep_fd, w->events, w->evsz, -1);
+	r = __sys_epoll_wait(w->ep_fd, w->events, w->evsz,
+			     gwp_tw_next_ms(&w->tw));
+	gwp_tw_set_now(&w->tw, gwp_tw_clock_ms());
 	if (unlikely(r < 0)) {
 		if (r != -EINTR)
 			pr_err(&w->ctx->lh, "epoll_wait failed: %s", strerror(-r));
@@ -2415,15 +2793,26 @@ int gwp_ctx_thread_entry_epoll(struct gwp_wrk *w)
 	pr_info(&ctx->lh, "Worker %u started (epoll)", w->idx);
 
 	while (!ctx->stop) {
+		/*
+		 * No ACL or auth snapshot is held across the wait, so a
+		 * reload need not wait for this worker while it sleeps.
+		 */
+		gwp_qsbr_offline(ctx->qsbr, w->idx);
 		r = fish_events(w);
+		gwp_qsbr_online(ctx->qsbr, w->idx);
 		if (unlikely(r < 0))
 			break;
 
 		r = handle_events(w, r);
 		if (unlikely(r < 0))
 			break;
+
+		r = handle_timers(w);
+		if (unlikely(r < 0))
+			break;
 	}
 
+	gwp_qsbr_offline(ctx->qsbr, w->idx);
 	return r;
 }
 
@@ -12,6 +12,7 @@
 #include <gwproxy/gwproxy.h>
 #include <gwproxy/common.h>
 #include <gwproxy/acl.h>
+#include <gwproxy/qsbr.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <sys/eventfd.h>
@@ -21,13 +22,14 @@
 #include <limits.h>
 #include <sys/inotify.h>
 #include <liburing.h>
-#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
 #ifdef CONFIG_HTTPS
 #include <gwproxy/ssl.h>
+#include <gwproxy/tls_pool.h>
 #endif
 
-#define USE_SEND_ZC 0
-
 #ifdef CONFIG_HTTPS
 /*
  * Per-connection ciphertext scratch for a TLS client. The io_uring recv/send
@@ -83,6 +85,245 @@ struct gwp_iou_udp {
 	unsigned char		buf[GWP_UDP_RELAY_BUFSZ];
 };
 
+/*
+ * Buffer group id of the per-worker provided-buffer ring (--iou-buf-ring).
+ * Each worker has its own io_uring instance, so one group per ring suffices.
+ */
+#define GWP_IOU_PBUF_BGID 0
+
+/*
+ * Register this worker's provided-buffer ring. Every buffer is large enough
+ * for either side of a pair, so one ring serves client and target recvs
+ * alike. Failure is not fatal: the worker keeps forwarding through the
+ * per-connection buffers, as it does without --iou-buf-ring.
+ */
+__cold
+static void init_pbuf_ring(struct gwp_wrk *w)
+{
+	struct gwp_cfg *cfg = &w->ctx->cfg;
+	struct iou *iou = w->iou;
+	uint32_t nr = (uint32_t)cfg->iou_buf_ring, i;
+	uint32_t size;
+	int r;
+
+	size = (uint32_t)cfg->client_buf_size;
+	if ((uint32_t)cfg->target_buf_size > size)
+		size = (uint32_t)cfg->target_buf_size;
+
+	if (posix_memalign((void **)&iou->pbuf_mem, 4096, (size_t)nr * size)) {
+		iou->pbuf_mem = NULL;
+		pr_warn(&w->ctx->lh, "Worker %u: no memory for the io_uring buffer ring, not using it", w->idx);
+		return;
+	}
+
+	iou->pbuf_br = io_uring_setup_buf_ring(&iou->ring, nr,
+					       GWP_IOU_PBUF_BGID, 0, &r);
+	if (!iou->pbuf_br) {
+		pr_warn(&w->ctx->lh, "Worker %u: io_uring_setup_buf_ring(): %s, not using a buffer ring",
+			w->idx, strerror(-r));
+		free(iou->pbuf_mem);
+		iou->pbuf_mem = NULL;
+		return;
+	}
+
+	for (i = 0; i < nr; i++)
+		io_uring_buf_ring_add(iou->pbuf_br, iou->pbuf_mem + (size_t)i * size,
+				      size, (unsigned short)i,
+				      io_uring_buf_ring_mask(nr), (int)i);
+	io_uring_buf_ring_advance(iou->pbuf_br, (int)nr);
+
+	iou->pbuf_nr = nr;
+	iou->pbuf_size = size;
+	pr_dbg(&w->ctx->lh, "Worker %u io_uring buffer ring: %u x %u bytes",
+	       w->idx, nr, size);
+}
+
+/*
+ * Optional setup flags, in the order they are given up when the kernel
+ * refuses a ring: the newest feature first, so an older kernel keeps as much
+ * of the request as it understands. A flag that only qualifies another one
+ * (R_DISABLED, SQ_AFF) goes together with it.
+ */
+static const struct {
+	uint32_t	flags;
+	const char	*name;
+} iou_setup_flags[] = {
+	{ IORING_SETUP_DEFER_TASKRUN,				"defer-taskrun" },
+	{ IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_R_DISABLED,	"single-issuer" },
+	{ IORING_SETUP_COOP_TASKRUN,				"coop-taskrun" },
+	{ IORING_SETUP_ATTACH_WQ,				"attach-wq" },
+	{ IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF,		"sqpoll" },
+	{ IORING_SETUP_CQSIZE,					"cq-size" },
+};
+
+#define NR_IOU_SETUP_FLAGS (sizeof(iou_setup_flags) / sizeof(iou_setup_flags[0]))
+
+static void iou_setup_params(struct gwp_wrk *w, struct io_uring_params *p)
+{
+	struct gwp_cfg *cfg = &w->ctx->cfg;
+
+	memset(p, 0, sizeof(*p));
+	if (cfg->iou_cq_entries) {
+		p->flags |= IORING_SETUP_CQSIZE;
+		p->cq_entries = (uint32_t)cfg->iou_cq_entries;
+	}
+
+	switch (cfg->iou_taskrun) {
+	case GWP_IOU_TASKRUN_COOP:
+		p->flags |= IORING_SETUP_COOP_TASKRUN;
+		break;
+	case GWP_IOU_TASKRUN_DEFER:
+		/*
+		 * Created disabled: the ring belongs to whichever task enables
+		 * it, and the worker thread does that when it starts.
+		 */
+		p->flags |= IORING_SETUP_SINGLE_ISSUER |
+			    IORING_SETUP_DEFER_TASKRUN |
+			    IORING_SETUP_R_DISABLED;
+		break;
+	}
+
+	if (cfg->iou_sqpoll) {
+		p->flags |= IORING_SETUP_SQPOLL;
+		if (cfg->iou_sqpoll_cpu >= 0) {
+			long nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+			if (nr_cpu < 1)
+				nr_cpu = 1;
+			p->flags |= IORING_SETUP_SQ_AFF;
+			p->sq_thread_cpu = (uint32_t)(((long)cfg->iou_sqpoll_cpu +
+						       (long)w->idx) % nr_cpu);
+		}
+	}
+
+	/* Workers are set up in order, so worker 0's ring already exists. */
+	if (cfg->iou_attach_wq && w->idx > 0) {
+		p->flags |= IORING_SETUP_ATTACH_WQ;
+		p->wq_fd = (uint32_t)w->ctx->workers[0].iou->ring.ring_fd;
+	}
+}
+
+static void log_iou_setup(struct gwp_wrk *w, const struct io_uring_params *p)
+{
+	char buf[128] = "none";
+	size_t i, n = 0;
+
+	for (i = 0; i < NR_IOU_SETUP_FLAGS; i++) {
+		if (!(p->flags & iou_setup_flags[i].flags))
+			continue;
+		n += (size_t)snprintf(buf + n, sizeof(buf) - n, "%s%s",
+				      n ? "," : "", iou_setup_flags[i].name);
+		if (n >= sizeof(buf))
+			break;
+	}
+
+	pr_info(&w->ctx->lh, "Worker %u io_uring: sq=%u cq=%u flags=%s",
+		w->idx, p->sq_entries, p->cq_entries, buf);
+}
+
+/*
+ * Create the worker's ring with what --iou-* asked for. A kernel that
+ * refuses a flag (too old, or SQPOLL without the privilege) gets the ring
+ * again without it, one optional flag at a time; only a ring with none of
+ * them failing is fatal.
+ */
+__cold
+static int iou_queue_init(struct gwp_wrk *w, struct io_uring *ring)
+{
+	unsigned entries = (unsigned)w->ctx->cfg.iou_entries;
+	struct io_uring_params p;
+	size_t i;
+	int r;
+
+	iou_setup_params(w, &p);
+	for (;;) {
+		uint32_t flags = p.flags;
+
+		r = io_uring_queue_init_params(entries, ring, &p);
+		if (!r)
+			break;
+
+		p.flags = flags;
+		for (i = 0; i < NR_IOU_SETUP_FLAGS; i++) {
+			if (p.flags & iou_setup_flags[i].flags)
+				break;
+		}
+		if (i == NR_IOU_SETUP_FLAGS)
+			return r;
+
+		pr_warn(&w->ctx->lh, "Worker %u: io_uring refused %s (%s), retrying without it",
+			w->idx, iou_setup_flags[i].name, strerror(-r));
+		p.flags &= ~iou_setup_flags[i].flags;
+		/* DEFER_TASKRUN is only valid with SINGLE_ISSUER. */
+		if (!(p.flags & IORING_SETUP_SINGLE_ISSUER))
+			p.flags &= ~IORING_SETUP_DEFER_TASKRUN;
+	}
+
+	log_iou_setup(w, &p);
+	return 0;
+}
+
+/*
+ * Worker 0 keeps a second, tiny ring that only gwp_ctx_signal_all_io_uring()
+ * submits to. The stop message can come from a signal handler or any worker
+ * thread, and neither may touch a worker's own submission queue: it is not
+ * locked, and with --iou-taskrun=defer the kernel refuses any other task.
+ */
+__cold
+static int init_sig_ring(struct gwp_wrk *w)
+{
+	struct iou *iou = w->iou;
+	int r;
+
+	iou->sig_ring = calloc(1, sizeof(*iou->sig_ring));
+	if (!iou->sig_ring)
+		return -ENOMEM;
+
+	r = io_uring_queue_init(8, iou->sig_ring, 0);
+	if (r < 0) {
+		free(iou->sig_ring);
+		iou->sig_ring = NULL;
+	}
+	return r;
+}
+
+/*
+ * The eventfd the DNS threads, and the crypto threads with --tls-hs-threads,
+ * ring for this worker. The loop keeps a read armed on it instead of polling
+ * the completion queues.
+ */
+__cold
+static int init_cq_fd(struct gwp_wrk *w)
+{
+	struct gwp_ctx *ctx = w->ctx;
+	struct iou *iou = w->iou;
+	bool need = !!ctx->dns;
+	int fd;
+
+#ifdef CONFIG_HTTPS
+	need = need || ctx->tls_pool;
+#endif
+	iou->cq_ev_fd = -1;
+	if (!need)
+		return 0;
+
+	fd = __sys_eventfd(0, EFD_CLOEXEC);
+	if (fd < 0) {
+		pr_err(&ctx->lh, "Worker %u: failed to create the completion eventfd: %s",
+		       w->idx, strerror(-fd));
+		return fd;
+	}
+
+	iou->cq_ev_fd = fd;
+	if (ctx->dns)
+		gwp_dns_set_cq_fd(ctx->dns, w->idx, fd);
+#ifdef CONFIG_HTTPS
+	if (ctx->tls_pool)
+		gwp_tls_pool_set_cq_fd(ctx->tls_pool, w->idx, fd);
+#endif
+	return 0;
+}
+
 __cold
 int gwp_ctx_init_thread_io_uring(struct gwp_wrk *w)
 {
@@ -93,18 +334,119 @@ int gwp_ctx_init_thread_io_uring(struct gwp_wrk *w)
 	if (!iou)
 		return -ENOMEM;
 
-	r = io_uring_queue_init(1024, &iou->ring, 0);
+	r = iou_queue_init(w, &iou->ring);
 	if (r < 0)
 		goto err_free_iou;
 
 	w->iou = iou;
+	if (!w->idx) {
+		r = init_sig_ring(w);
+		if (r < 0)
+			goto err_exit_ring;
+	}
+
+	r = init_cq_fd(w);
+	if (r < 0)
+		goto err_exit_sig_ring;
+
+	if (w->ctx->cfg.iou_buf_ring > 0)
+		init_pbuf_ring(w);
 	return 0;
 
+err_exit_sig_ring:
+	if (iou->sig_ring) {
+		io_uring_queue_exit(iou->sig_ring);
+		free(iou->sig_ring);
+	}
+err_exit_ring:
+	io_uring_queue_exit(&iou->ring);
+	w->iou = NULL;
 err_free_iou:
 	free(iou);
 	return r;
 }
 
+/*
+ * Register the sparse file table for --iou-fixed-files. It is capped at
+ * RLIMIT_NOFILE, which the kernel enforces too and beyond which no fd (and so
+ * no slot) can exist. Failure is not fatal: the worker uses plain fds.
+ */
+__cold
+static void init_fixed_files(struct gwp_wrk *w)
+{
+	uint32_t nr = (uint32_t)w->ctx->cfg.iou_fixed_files;
+	struct iou *iou = w->iou;
+	struct rlimit rl;
+	uint32_t i;
+	int r;
+
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < nr)
+		nr = (uint32_t)rl.rlim_cur;
+
+	iou->ff_map = calloc((nr + 63u) / 64u, sizeof(*iou->ff_map));
+	iou->ff_fds = malloc(nr * sizeof(*iou->ff_fds));
+	if (!iou->ff_map || !iou->ff_fds) {
+		pr_warn(&w->ctx->lh, "Worker %u: no memory for the io_uring file table, not using it", w->idx);
+		goto out_free;
+	}
+	for (i = 0; i < nr; i++)
+		iou->ff_fds[i] = (int)i;
+
+	r = io_uring_register_files_sparse(&iou->ring, nr);
+	if (r < 0) {
+		pr_warn(&w->ctx->lh, "Worker %u: io_uring_register_files_sparse(): %s, not using fixed files",
+			w->idx, strerror(-r));
+		goto out_free;
+	}
+
+	iou->nr_ff = nr;
+	pr_dbg(&w->ctx->lh, "Worker %u io_uring file table: %u slots", w->idx, nr);
+	return;
+
+out_free:
+	free(iou->ff_map);
+	free(iou->ff_fds);
+	iou->ff_map = NULL;
+	iou->ff_fds = NULL;
+}
+
+/*
+ * Runs on the worker thread before its first submission: a ring created
+ * disabled becomes this thread's, and the io-wq cap applies to the calling
+ * task's async workers, which only this thread can name.
+ */
+__cold
+static int iou_thread_setup(struct gwp_wrk *w)
+{
+	struct gwp_cfg *cfg = &w->ctx->cfg;
+	struct iou *iou = w->iou;
+	int r;
+
+	if (iou->ring.flags & IORING_SETUP_R_DISABLED) {
+		r = io_uring_enable_rings(&iou->ring);
+		if (unlikely(r < 0)) {
+			pr_err(&w->ctx->lh, "Worker %u: io_uring_enable_rings(): %s",
+			       w->idx, strerror(-r));
+			return r;
+		}
+	}
+
+	if (cfg->iou_fixed_files > 0)
+		init_fixed_files(w);
+
+	if (cfg->iou_wq_max > 0) {
+		unsigned int vals[2] = { (unsigned)cfg->iou_wq_max,
+					 (unsigned)cfg->iou_wq_max };
+
+		r = io_uring_register_iowq_max_workers(&iou->ring, vals);
+		if (r < 0)
+			pr_warn(&w->ctx->lh, "Worker %u: io_uring_register_iowq_max_workers(): %s",
+				w->idx, strerror(-r));
+	}
+
+	return 0;
+}
+
 static void log_submit_err(struct gwp_wrk *w, int r)
 {
 	pr_err(&w->ctx->lh, "io_uring_submit(): %s", strerror(-r));
@@ -155,7 +497,33 @@ static struct io_uring_sqe *get_sqe_nofail(struct gwp_wrk *w)
 __cold
 void gwp_ctx_free_thread_io_uring(struct gwp_wrk *w)
 {
-	io_uring_queue_exit(&w->iou->ring);
+	struct iou *iou = w->iou;
+
+	/*
+	 * On a single-issuer ring this runs on the wrong thread and the
+	 * unregister is refused; the ring's teardown drops the registration
+	 * anyway, and only the ring's small descriptor array stays mapped.
+	 */
+	if (iou->pbuf_br)
+		io_uring_free_buf_ring(&iou->ring, iou->pbuf_br, iou->pbuf_nr,
+				       GWP_IOU_PBUF_BGID);
+	io_uring_queue_exit(&iou->ring);
+	if (iou->sig_ring) {
+		io_uring_queue_exit(iou->sig_ring);
+		free(iou->sig_ring);
+	}
+	free(iou->ff_map);
+	free(iou->ff_fds);
+	free(iou->pbuf_mem);
+	if (iou->cq_ev_fd >= 0) {
+		if (w->ctx->dns)
+			gwp_dns_set_cq_fd(w->ctx->dns, w->idx, -1);
+#ifdef CONFIG_HTTPS
+		if (w->ctx->tls_pool)
+			gwp_tls_pool_set_cq_fd(w->ctx->tls_pool, w->idx, -1);
+#endif
+		__sys_close(iou->cq_ev_fd);
+	}
 	pr_dbg(&w->ctx->lh, "Worker %u io_uring queue exited", w->idx);
 	free(w->iou);
 	w->iou = NULL;
@@ -174,16 +542,45 @@ static int prep_nr_sqes(struct gwp_wrk *w, unsigned nr)
 	return 0;
 }
 
-static void arm_accept(struct gwp_wrk *w)
+/*
+ * GWP_IOU_NR_ACCEPT single-shot accepts stay armed on the listener, so a burst
+ * of connections does not wait on a re-arm per client. Each has a buffer of
+ * its own for the peer's address, which the kernel fills in with the accept;
+ * a multishot accept would write every peer into the same one.
+ */
+static void arm_accept(struct gwp_wrk *w, uint32_t i)
 {
+	struct gwp_iou_accept *a = &w->iou->accept[i];
 	struct io_uring_sqe *s = get_sqe_nofail(w);
-	struct iou *iou = w->iou;
-	struct sockaddr *addr = &iou->accept_addr.sa;
-	socklen_t *addr_len = &iou->accept_addr_len;
 
-	*addr_len = sizeof(iou->accept_addr);
-	io_uring_prep_accept(s, w->tcp_fd, addr, addr_len, SOCK_CLOEXEC);
-	s->user_data = EV_BIT_IOU_ACCEPT;
+	a->addr_len = sizeof(a->addr);
+	io_uring_prep_accept(s, w->tcp_fd, &a->addr.sa, &a->addr_len,
+			     SOCK_CLOEXEC);
+	s->user_data = EV_BIT_IOU_ACCEPT | i;
+	a->armed = true;
+}
+
+static void arm_accepts(struct gwp_wrk *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < GWP_IOU_NR_ACCEPT; i++) {
+		if (!w->iou->accept[i].armed)
+			arm_accept(w, i);
+	}
+}
+
+/*
+ * Pausing accept while accepts are still armed: cancel them all. Their
+ * -ECANCELED CQEs come back through handle_ev_accept(), which leaves them
+ * unarmed until the retry timer fires.
+ */
+static void cancel_accept(struct gwp_wrk *w)
+{
+	struct io_uring_sqe *s = get_sqe_nofail(w);
+
+	io_uring_prep_cancel_fd(s, w->tcp_fd, IORING_ASYNC_CANCEL_ALL);
+	s->user_data = EV_BIT_IOU_ACCEPT_CANCEL;
 }
 
 /*
@@ -194,18 +591,97 @@ static void arm_accept(struct gwp_wrk *w)
  */
 static void arm_accept_retry(struct gwp_wrk *w)
 {
-	struct io_uring_sqe *s = get_sqe_nofail(w);
 	struct iou *iou = w->iou;
+	struct io_uring_sqe *s;
+
+	if (iou->accept_retry_armed)
+		return;
 
+	s = get_sqe_nofail(w);
 	iou->accept_retry_ts.tv_sec = 0;
 	iou->accept_retry_ts.tv_nsec = 100000000L;	/* 100 ms */
 	io_uring_prep_timeout(s, &iou->accept_retry_ts, 0, 0);
 	s->user_data = EV_BIT_IOU_ACCEPT_RETRY;
+	iou->accept_retry_armed = true;
+}
+
+/*
+ * --iou-fixed-files: the worker's ring has a sparse registered file table in
+ * which a client or target socket sits at the slot numbered like its fd. Its
+ * recvs and sends then name the slot (IOSQE_FIXED_FILE), so the kernel takes
+ * the file from the ring instead of looking it up, and reference-counting it,
+ * in the process-wide fd table every worker shares. The fd itself stays open
+ * for the socket-option and peer-address calls that have no io_uring form.
+ *
+ * @ff_map has a bit per slot that holds this worker's socket. An fd past the
+ * table is simply used as a plain fd.
+ */
+static inline bool iou_fd_is_fixed(const struct iou *iou, int fd)
+{
+	return (uint32_t)fd < iou->nr_ff &&
+	       (iou->ff_map[(uint32_t)fd / 64u] & (1ull << ((uint32_t)fd % 64u)));
+}
+
+static inline void sqe_fixed_fd(struct gwp_wrk *w, struct io_uring_sqe *s,
+				int fd)
+{
+	if (iou_fd_is_fixed(w->iou, fd))
+		s->flags |= IOSQE_FIXED_FILE;
+}
+
+/*
+ * Slot updates are queued with the rest of the batch rather than made with
+ * io_uring_register_files_update(), a syscall of its own per socket. The
+ * kernel runs a files-update SQE inline as the batch is submitted, before the
+ * SQEs queued after it, so those may name the slot already. It only posts a
+ * CQE when it fails, in which case the recvs and sends naming the slot fail
+ * with -EBADF and the pair is torn down like on any other socket error.
+ */
+static void prep_files_update(struct io_uring_sqe *s, int fd, int *fds)
+{
+	io_uring_prep_files_update(s, fds, 1, fd);
+	s->flags |= IOSQE_CQE_SKIP_SUCCESS;
+	s->user_data = EV_BIT_IOU_FILES_UPDATE | (unsigned)fd;
+}
+
+static void iou_fd_register(struct gwp_wrk *w, int fd)
+{
+	struct iou *iou = w->iou;
+
+	if ((uint32_t)fd >= iou->nr_ff)
+		return;
+
+	prep_files_update(get_sqe_nofail(w), fd, &iou->ff_fds[fd]);
+	iou->ff_map[(uint32_t)fd / 64u] |= 1ull << ((uint32_t)fd % 64u);
 }
 
 static void prep_close(struct gwp_wrk *w, int fd)
 {
-	struct io_uring_sqe *s = get_sqe_nofail(w);
+	static int none = -1;
+	struct iou *iou = w->iou;
+	struct io_uring_sqe *s;
+
+	/*
+	 * Empty the slot before the fd is closed: the table holds its own
+	 * reference to the socket, and the fd number may be handed out again
+	 * as soon as the close runs. The update is hard-linked ahead of the
+	 * close, so the close runs after it even if it fails; with no room
+	 * for both in this batch, fall back to emptying it right away.
+	 * Requests already issued keep the file they resolved.
+	 */
+	if (iou_fd_is_fixed(iou, fd)) {
+		if (likely(!prep_nr_sqes(w, 2))) {
+			s = get_sqe_nofail(w);
+			prep_files_update(s, fd, &none);
+			s->flags |= IOSQE_IO_HARDLINK;
+		} else {
+			io_uring_register_files_update(&iou->ring, (unsigned)fd,
+						       &none, 1);
+		}
+		iou->ff_map[(uint32_t)fd / 64u] &= ~(1ull << ((uint32_t)fd % 64u));
+	}
+
+	s = get_sqe_nofail(w);
 	if (unlikely(!s)) {
 		pr_err(&w->ctx->lh, "Failed to get io_uring sqe for close");
 		__sys_close(fd);
@@ -223,17 +699,121 @@ static void get_gcp(struct gwp_conn_pair *gcp)
 	gcp->ref_cnt++;
 }
 
+/*
+ * ------------------------------------------------------------------------
+ * --iou-buf-ring: provided-buffer recvs for plaintext forwarding.
+ *
+ * A pair that has nothing buffered in one direction does not need a buffer
+ * for it at all; it only needs one once bytes arrive. So when @c is empty
+ * its private buffer is dropped and the recv selects a buffer from the
+ * worker's ring. The buffer stays lent to @c while its bytes are in flight
+ * to the peer (a short send just advances within it) and goes back to the
+ * ring the moment it drains. Idle pairs therefore pin no buffer memory.
+ *
+ * The recv stays single-shot rather than multishot: a multishot recv would
+ * keep pulling ring buffers for a fast sender whose peer is not keeping up,
+ * starving every other pair on the worker. Single-shot keeps the existing
+ * one-buffer-per-direction backpressure.
+ * ------------------------------------------------------------------------
+ */
+static bool pbuf_usable(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			struct gwp_conn *c)
+{
+	if (!w->iou->pbuf_br || c->len || c->zc_pinned)
+		return false;
+#ifdef CONFIG_HTTPS
+	/* TLS decrypts into client.buf and encrypts out of target.buf. */
+	if (client_is_tls(gcp))
+		return false;
+#else
+	(void)gcp;
+#endif
+	return true;
+}
+
+static void pbuf_release(struct gwp_wrk *w, struct gwp_conn *c)
+{
+	struct iou *iou = w->iou;
+
+	if (!c->pbuf_ref)
+		return;
+
+	io_uring_buf_ring_add(iou->pbuf_br, c->buf, iou->pbuf_size,
+			      (unsigned short)(c->pbuf_ref - 1),
+			      io_uring_buf_ring_mask(iou->pbuf_nr), 0);
+	io_uring_buf_ring_advance(iou->pbuf_br, 1);
+	c->pbuf_ref = 0;
+	c->buf = NULL;
+}
+
+/*
+ * Take ownership of the ring buffer a recv completion picked, if any. A
+ * completion that carried no data gives it straight back.
+ */
+static void pbuf_adopt(struct gwp_wrk *w, struct gwp_conn *c,
+		       struct io_uring_cqe *cqe)
+{
+	struct iou *iou = w->iou;
+	unsigned bid;
+
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return;
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	c->buf = iou->pbuf_mem + (size_t)bid * iou->pbuf_size;
+	c->pbuf_ref = (uint16_t)(bid + 1);
+	if (cqe->res <= 0)
+		pbuf_release(w, c);
+}
+
+/*
+ * The ring ran dry (-ENOBUFS): every buffer is lent to data waiting on a
+ * slow peer. Rather than stall this pair, give it a private buffer again
+ * for the next recv; it is dropped once that data has been sent.
+ */
+static int pbuf_exhausted(struct gwp_wrk *w, struct gwp_conn *c)
+{
+	pr_dbg(&w->ctx->lh, "io_uring buffer ring exhausted, fd=%d falls back to a private buffer",
+	       c->fd);
+	c->buf = gwp_conn_buf_get(w, c->cap);
+	return c->buf ? 0 : -ENOMEM;
+}
+
+static struct io_uring_sqe *prep_recv_pbuf(struct gwp_wrk *w,
+					   struct gwp_conn_pair *gcp,
+					   struct gwp_conn *c, uint64_t ev_bit)
+{
+	struct io_uring_sqe *s;
+
+	if (c->pbuf_ref)
+		pbuf_release(w, c);
+	gwp_conn_buf_put(w, c->buf, c->cap);
+	c->buf = NULL;
+
+	s = get_sqe_nofail(w);
+	io_uring_prep_recv(s, c->fd, NULL, c->cap, MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, c->fd);
+	s->flags |= IOSQE_BUFFER_SELECT;
+	s->buf_group = GWP_IOU_PBUF_BGID;
+	io_uring_sqe_set_data(s, gcp);
+	s->user_data |= ev_bit;
+	get_gcp(gcp);
+	pr_dbg(&w->ctx->lh,
+		"Prepared buffer-select recv for fd=%d, len=%u, ref_cnt=%d",
+		c->fd, c->cap, gcp->ref_cnt);
+	return s;
+}
+
 static bool put_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	int x = gcp->ref_cnt--;
 	int tg_fd, cl_fd, ud_fd;
 
 	pr_dbg(&w->ctx->lh,
-		"Put connection pair (idx=%u, cfd=%d, tfd=%d, tmfd=%d, ca=%s, ta=%s, ref_cnt=%d)",
+		"Put connection pair (idx=%u, cfd=%d, tfd=%d, ca=%s, ta=%s, ref_cnt=%d)",
 		gcp->idx,
 		gcp->client.fd,
 		gcp->target.fd,
-		gcp->timer_fd,
 		ip_to_str(&gcp->client_addr),
 		ip_to_str(&gcp->target_addr),
 		x - 1);
@@ -247,10 +827,11 @@ static bool put_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	gcp->flags |= GWP_CONN_FLAG_NO_CLOSE_FD;
 	/*
 	 * All relay SQEs have drained (ref_cnt hit 0), so the async recvmsg /
-	 * sendmsg no longer touch the scratch or the fd; free/close them here.
+	 * sendmsg no longer touch the scratch or the fd; gwp_free_conn_pair()
+	 * frees the one and the other is closed below.
 	 */
-	free(gcp->udp_iou);
-	gcp->udp_iou = NULL;
+	pbuf_release(w, &gcp->target);
+	pbuf_release(w, &gcp->client);
 	gwp_free_conn_pair(w, gcp);
 
 	if (tg_fd >= 0)
@@ -267,8 +848,11 @@ static bool has_inflight_attempt(const struct gwp_conn_pair *gcp)
 {
 	uint8_t i;
 
+	if (!gcp->hs)
+		return false;
+
 	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
-		if (gcp->attempt_fd[i] >= 0)
+		if (gcp->hs->attempt_fd[i] >= 0)
 			return true;
 	}
 	return false;
@@ -292,7 +876,7 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 
 	ca = ctx->upstream.enabled ? &ctx->upstream.addr : &gcp->target_addr;
 
-	fd = gwp_create_sock_target(w, ca, &gcp->acl_sockopt, NULL, false);
+	fd = gwp_create_sock_target(w, ca, &gcp->hs->acl_sockopt, NULL, false);
 	if (unlikely(fd < 0))
 		return fd;
 
@@ -302,9 +886,9 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		return r;
 	}
 
-	gcp->attempt_fd[slot] = fd;
+	gcp->hs->attempt_fd[slot] = fd;
 	/* Post-ACL, so a -j DNAT rewrite is what gets recorded. */
-	gcp->attempt_addr[slot] = gcp->target_addr;
+	gcp->hs->attempt_addr[slot] = gcp->target_addr;
 
 	/*
 	 * The kernel reads the address out of this pointer after submission,
@@ -313,7 +897,7 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	 * per-slot and stays put for as long as the attempt is in flight.
 	 */
 	if (!ctx->upstream.enabled)
-		ca = &gcp->attempt_addr[slot];
+		ca = &gcp->hs->attempt_addr[slot];
 
 	if (ca->sa.sa_family == AF_INET)
 		addr_len = sizeof(struct sockaddr_in);
@@ -331,11 +915,11 @@ static int start_connect_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	return 0;
 }
 
-static struct io_uring_sqe *prep_recv_target(struct gwp_wrk *w,
-					     struct gwp_conn_pair *gcp)
+static struct io_uring_sqe *__prep_recv_target(struct gwp_wrk *w,
+					       struct gwp_conn_pair *gcp)
 {
-	size_t len = gcp->target.cap - gcp->target.len;
-	char *buf = gcp->target.buf + gcp->target.len;
+	size_t len = gwp_conn_room_len(&gcp->target);
+	char *buf = gwp_conn_room(&gcp->target);
 	int fd = gcp->target.fd;
 	struct io_uring_sqe *s;
 
@@ -343,6 +927,7 @@ static struct io_uring_sqe *prep_recv_target(struct gwp_wrk *w,
 	io_uring_prep_recv(s, fd, buf, len, MSG_NOSIGNAL);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_TARGET_RECV;
+	sqe_fixed_fd(w, s, fd);
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh,
 		"Prepared recv for target fd=%d, len=%zu, buf=%p, ref_cnt=%d",
@@ -350,11 +935,11 @@ static struct io_uring_sqe *prep_recv_target(struct gwp_wrk *w,
 	return s;
 }
 
-static struct io_uring_sqe *prep_recv_client(struct gwp_wrk *w,
-					     struct gwp_conn_pair *gcp)
+static struct io_uring_sqe *__prep_recv_client(struct gwp_wrk *w,
+					       struct gwp_conn_pair *gcp)
 {
-	size_t len = gcp->client.cap - gcp->client.len;
-	char *buf = gcp->client.buf + gcp->client.len;
+	size_t len = gwp_conn_room_len(&gcp->client);
+	char *buf = gwp_conn_room(&gcp->client);
 	int fd = gcp->client.fd;
 	struct io_uring_sqe *s;
 
@@ -374,6 +959,7 @@ static struct io_uring_sqe *prep_recv_client(struct gwp_wrk *w,
 	io_uring_prep_recv(s, fd, buf, len, MSG_NOSIGNAL);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_CLIENT_RECV;
+	sqe_fixed_fd(w, s, fd);
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh,
 		"Prepared recv for client fd=%d, len=%zu, buf=%p, ref_cnt=%d",
@@ -381,22 +967,95 @@ static struct io_uring_sqe *prep_recv_client(struct gwp_wrk *w,
 	return s;
 }
 
+/*
+ * Forwarding recvs. These take a ring buffer when --iou-buf-ring allows it;
+ * the protocol phase uses the __ variants, which always read into the
+ * connection's own buffer.
+ */
+static struct io_uring_sqe *prep_recv_target(struct gwp_wrk *w,
+					     struct gwp_conn_pair *gcp)
+{
+	if (pbuf_usable(w, gcp, &gcp->target))
+		return prep_recv_pbuf(w, gcp, &gcp->target,
+				      EV_BIT_IOU_TARGET_RECV);
+	return __prep_recv_target(w, gcp);
+}
+
+static struct io_uring_sqe *prep_recv_client(struct gwp_wrk *w,
+					     struct gwp_conn_pair *gcp)
+{
+	if (pbuf_usable(w, gcp, &gcp->client))
+		return prep_recv_pbuf(w, gcp, &gcp->client,
+				      EV_BIT_IOU_CLIENT_RECV);
+	return __prep_recv_client(w, gcp);
+}
+
+/*
+ * --zerocopy-min: whether a send of @len bytes out of @src goes zero-copy
+ * (IORING_OP_SEND_ZC), so the kernel transmits straight from the buffer and
+ * posts a notification once it no longer needs it. Only plain forwarding out
+ * of the pair's own buffer qualifies -- a lent ring buffer goes back to the
+ * ring as soon as its bytes are sent -- and only while no earlier zero-copy
+ * send from it still owes its notification (@notif_bit). Sends made meanwhile
+ * copy as usual and are handed back with it (gwp_conn_buf_advance_zc()).
+ */
+static bool zc_usable(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+		      struct gwp_conn *src, size_t len, uint64_t notif_bit)
+{
+	int min = w->ctx->cfg.zerocopy_min;
+
+	if (!min || len < (size_t)min || w->iou->no_send_zc)
+		return false;
+	if (gcp->flags & (GWP_CONN_FLAG_NO_ZC | notif_bit))
+		return false;
+	if (gcp->conn_state != CONN_STATE_FORWARDING || !gcp->is_target_alive)
+		return false;
+#ifdef CONFIG_HTTPS
+	/* A kTLS socket refuses zero-copy sends. */
+	if (client_is_tls(gcp) || gcp->client.ktls)
+		return false;
+#endif
+	return !src->pbuf_ref;
+}
+
+/*
+ * Prepare @s as the send of @len bytes at @buf out of @src, zero-copy if it
+ * qualifies. Returns the selector for it: @ev_bit, or @zc_bit for a zero-copy
+ * send, whose notification holds a pair reference of its own.
+ */
+static uint64_t prep_send_buf(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			      struct io_uring_sqe *s, struct gwp_conn *src,
+			      int fd, char *buf, size_t len, uint64_t ev_bit,
+			      uint64_t zc_bit, uint64_t notif_bit)
+{
+	if (!zc_usable(w, gcp, src, len, notif_bit)) {
+		io_uring_prep_send(s, fd, buf, len, MSG_NOSIGNAL);
+		return ev_bit;
+	}
+
+	io_uring_prep_send_zc(s, fd, buf, len, MSG_NOSIGNAL,
+			      IORING_SEND_ZC_REPORT_USAGE);
+	gcp->flags |= notif_bit;
+	get_gcp(gcp);
+	return zc_bit;
+}
+
 static struct io_uring_sqe *prep_send_target(struct gwp_wrk *w,
 					     struct gwp_conn_pair *gcp)
 {
-	size_t len = gcp->client.len;
-	char *buf = gcp->client.buf;
+	size_t len = gwp_conn_data_len(&gcp->client);
+	char *buf = gwp_conn_data(&gcp->client);
 	int fd = gcp->target.fd;
 	struct io_uring_sqe *s;
+	uint64_t ev_bit;
 
 	s = get_sqe_nofail(w);
-#if USE_SEND_ZC
-	io_uring_prep_send_zc(s, fd, buf, len, MSG_NOSIGNAL, 0);
-#else
-	io_uring_prep_send(s, fd, buf, len, MSG_NOSIGNAL);
-#endif
+	ev_bit = prep_send_buf(w, gcp, s, &gcp->client, fd, buf, len,
+			       EV_BIT_IOU_TARGET_SEND, EV_BIT_IOU_TARGET_SEND_ZC,
+			       GWP_CONN_FLAG_ZC_NOTIF_C);
+	sqe_fixed_fd(w, s, fd);
 	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_TARGET_SEND;
+	s->user_data |= ev_bit;
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh,
 		"Prepared send for target fd=%d, len=%zu, buf=%p, ref_cnt=%d",
@@ -407,18 +1066,19 @@ static struct io_uring_sqe *prep_send_target(struct gwp_wrk *w,
 static struct io_uring_sqe *__prep_send_client(struct gwp_wrk *w,
 					       struct gwp_conn_pair *gcp)
 {
-	size_t len = gcp->target.len;
-	char *buf = gcp->target.buf;
+	size_t len = gwp_conn_data_len(&gcp->target);
+	char *buf = gwp_conn_data(&gcp->target);
 	int fd = gcp->client.fd;
 	struct io_uring_sqe *s;
+	uint64_t ev_bit;
 
 	s = get_sqe_nofail(w);
-#if USE_SEND_ZC
-	io_uring_prep_send_zc(s, fd, buf, len, MSG_NOSIGNAL, 0);
-#else
-	io_uring_prep_send(s, fd, buf, len, MSG_NOSIGNAL);
-#endif
+	ev_bit = prep_send_buf(w, gcp, s, &gcp->target, fd, buf, len,
+			       EV_BIT_IOU_CLIENT_SEND, EV_BIT_IOU_CLIENT_SEND_ZC,
+			       GWP_CONN_FLAG_ZC_NOTIF_T);
+	sqe_fixed_fd(w, s, fd);
 	io_uring_sqe_set_data(s, gcp);
+	s->user_data |= ev_bit;
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh,
 		"Prepared send for client fd=%d, len=%zu, buf=%p, ref_cnt=%d",
@@ -429,8 +1089,6 @@ static struct io_uring_sqe *__prep_send_client(struct gwp_wrk *w,
 static struct io_uring_sqe *prep_send_client(struct gwp_wrk *w,
 					     struct gwp_conn_pair *gcp)
 {
-	struct io_uring_sqe *s;
-
 #ifdef CONFIG_HTTPS
 	/*
 	 * A TLS client is fed encrypted bytes: send_client_tls() encrypts
@@ -443,57 +1101,105 @@ static struct io_uring_sqe *prep_send_client(struct gwp_wrk *w,
 	}
 #endif
 
-	s = __prep_send_client(w, gcp);
-	s->user_data |= EV_BIT_IOU_CLIENT_SEND;
-	return s;
+	return __prep_send_client(w, gcp);
 }
 
-static struct io_uring_sqe *prep_timer_target(struct gwp_wrk *w,
-					      struct gwp_conn_pair *gcp,
-					      int sec)
+/*
+ * ------------------------------------------------------------------------
+ * --iou-link-forward: one completion per forwarded chunk.
+ *
+ * Unlinked, a chunk costs two trips through handle_event(): the recv, then
+ * the send. Here the send of everything @src holds is queued with
+ * IOSQE_IO_LINK ahead of the next recv into the same (then empty) buffer,
+ * and with IOSQE_CQE_SKIP_SUCCESS, so the recv completion is the only one
+ * and also says the send went out whole.
+ *
+ * The link is send -> recv, not recv -> send: a short recv does not break
+ * a link, so a send prepared ahead of it would forward whatever the buffer
+ * held past the short read. MSG_WAITALL makes a short send fail the link
+ * instead; the recv then completes with -ECANCELED and the pair is torn
+ * down, as a failed unlinked send would be.
+ *
+ * The send holds no pair reference, since it posts nothing on success. The
+ * recv's reference covers it: the recv cannot complete before the send has.
+ * ------------------------------------------------------------------------
+ */
+static bool link_usable(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			struct gwp_conn *src, struct gwp_conn *dst)
 {
-	struct io_uring_sqe *s = get_sqe_nofail(w);
+	if (!w->ctx->cfg.iou_link_forward)
+		return false;
+	if (gcp->conn_state != CONN_STATE_FORWARDING || !gcp->is_target_alive)
+		return false;
+	if (gcp->flags & GWP_CONN_FLAG_IS_CANCEL)
+		return false;
+#ifdef CONFIG_HTTPS
+	/* ... and MSG_WAITALL sends. */
+	if (client_is_tls(gcp) || gcp->client.ktls)
+		return false;
+#endif
+	/*
+	 * The recv behind the send reads into @src's own buffer, which would
+	 * keep a pair off the --iou-buf-ring for good.
+	 */
+	if (w->iou->pbuf_br || src->zc_pinned || dst->wr_shut)
+		return false;
 
-	gcp->ts.tv_nsec = 0;
-	gcp->ts.tv_sec = sec;
-	io_uring_prep_timeout(s, &gcp->ts, 0, 0);
-	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_TIMER;
-	get_gcp(gcp);
-	pr_dbg(&w->ctx->lh,
-		"Prepared timer for target fd=%d, ts=%lld.%09lld, ref_cnt=%d",
-		gcp->target.fd, gcp->ts.tv_sec, gcp->ts.tv_nsec, gcp->ref_cnt);
-	return s;
+	return gwp_conn_data_len(src) == src->len;
 }
 
-static void prep_timer_del_target(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+/*
+ * Queue the send of all of @src to @dst linked to the next recv from @src.
+ * Returns false, having queued nothing, if this chunk is sent unlinked.
+ */
+static bool prep_send_linked(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			     struct gwp_conn *src, struct gwp_conn *dst,
+			     uint64_t recv_bit, uint64_t link_flag,
+			     uint64_t notif_bit)
 {
-	struct io_uring_sqe *s = get_sqe_nofail(w);
+	struct io_uring_sqe *s;
 
-	io_uring_prep_timeout_remove(s, EV_BIT_IOU_TIMER | PTR_TO_U64(gcp), 0);
+	if (!link_usable(w, gcp, src, dst))
+		return false;
+	if (zc_usable(w, gcp, src, src->len, notif_bit))
+		return false;
+	/* Both halves must go in one submission, or the link is cut. */
+	if (prep_nr_sqes(w, 2))
+		return false;
+
+	s = get_sqe_nofail(w);
+	io_uring_prep_send(s, dst->fd, gwp_conn_data(src), src->len,
+			   MSG_NOSIGNAL | MSG_WAITALL);
+	sqe_fixed_fd(w, s, dst->fd);
+	s->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+	s->user_data = EV_BIT_IOU_LINK_SEND | (unsigned)dst->fd;
+
+	s = get_sqe_nofail(w);
+	io_uring_prep_recv(s, src->fd, src->buf, src->cap, MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, src->fd);
 	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_TIMER_DEL;
+	s->user_data |= recv_bit;
+	gcp->flags |= link_flag;
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh,
-		"Prepared del timer for target fd=%d, ref_cnt=%d",
-		gcp->target.fd, gcp->ref_cnt);
+		"Prepared linked send fd=%d -> recv fd=%d, len=%u, ref_cnt=%d",
+		dst->fd, src->fd, src->len, gcp->ref_cnt);
+	return true;
 }
 
-static void prep_attempt_timer_del(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+/*
+ * The recv behind a linked send completed, so unless the link was broken
+ * (-ECANCELED) the send took all of @src and the recv wrote from its start.
+ */
+static void link_sent(struct gwp_conn_pair *gcp, struct gwp_conn *src,
+		      uint64_t link_flag, int res)
 {
-	struct io_uring_sqe *s;
-
-	if (!gcp->attempt_timer_armed)
+	if (!(gcp->flags & link_flag))
 		return;
 
-	s = get_sqe_nofail(w);
-	io_uring_prep_timeout_remove(s,
-				     EV_BIT_IOU_ATTEMPT_TIMER | PTR_TO_U64(gcp),
-				     0);
-	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_ATTEMPT_TIMER_DEL;
-	get_gcp(gcp);
-	gcp->attempt_timer_armed = false;
+	gcp->flags &= ~link_flag;
+	if (res != -ECANCELED)
+		gwp_conn_buf_advance(src, src->len);
 }
 
 /*
@@ -501,39 +1207,26 @@ static void prep_attempt_timer_del(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
  * makes a black-holed address cheap: without it a target that silently drops
  * SYNs costs the whole connect timeout before anything else is tried.
  *
- * At most one attempt timeout is outstanding per pair -- it owns gcp->ats for
- * as long as it is armed, and a second one would be indistinguishable from the
- * first at removal time. An already-armed timer is left alone: it fires no
- * later than the deadline a fresh one would have had.
+ * An already-armed timer is left alone: it fires no later than the deadline a
+ * fresh one would have had.
  */
 static void arm_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_ctx *ctx = w->ctx;
-	struct io_uring_sqe *s;
-	int ms;
 
-	if (gcp->attempt_timer_armed)
+	if (gwp_timer_pending(&gcp->hs->attempt_timer))
 		return;
-	if (gcp->next_cand >= gcp->nr_cand)
+	if (gcp->hs->next_cand >= gcp->hs->nr_cand)
 		return;			/* nothing left to start */
 	if (ctx->cfg.connect_attempt_delay <= 0)
 		return;			/* racing disabled: fall back only */
 	if (ctx->upstream.enabled)
 		return;			/* one proxy, nothing to race */
 
-	ms = ctx->cfg.connect_attempt_delay;
-	gcp->ats.tv_sec = ms / 1000;
-	gcp->ats.tv_nsec = (long long)(ms % 1000) * 1000000LL;
-
-	s = get_sqe_nofail(w);
-	io_uring_prep_timeout(s, &gcp->ats, 0, 0);
-	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_ATTEMPT_TIMER;
-	get_gcp(gcp);
-	gcp->attempt_timer_armed = true;
-	pr_dbg(&ctx->lh,
-		"Prepared attempt timer (idx=%u, ts=%lld.%09lld, ref_cnt=%d)",
-		gcp->idx, gcp->ats.tv_sec, gcp->ats.tv_nsec, gcp->ref_cnt);
+	gwp_timer_arm(&w->tw, &gcp->hs->attempt_timer,
+		      (uint64_t)ctx->cfg.connect_attempt_delay);
+	pr_dbg(&ctx->lh, "Armed attempt timer (idx=%u, ms=%d)", gcp->idx,
+		ctx->cfg.connect_attempt_delay);
 }
 
 /*
@@ -548,13 +1241,13 @@ static void cancel_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 {
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
-	io_uring_prep_cancel_fd(s, gcp->attempt_fd[slot],
+	io_uring_prep_cancel_fd(s, gcp->hs->attempt_fd[slot],
 				IORING_ASYNC_CANCEL_ALL);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_ATTEMPT_CANCEL;
 	get_gcp(gcp);
 	pr_dbg(&w->ctx->lh, "Cancelling losing attempt %u (fd=%d, idx=%u)",
-		slot, gcp->attempt_fd[slot], gcp->idx);
+		slot, gcp->hs->attempt_fd[slot], gcp->idx);
 }
 
 static void shutdown_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
@@ -569,14 +1262,16 @@ static void shutdown_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	/*
 	 * Racing attempts that never resolved: their connects still hold a
 	 * reference each, so the pair cannot be freed until they are reaped.
-	 * The attempt timeout is dropped for the same reason -- unlike the
-	 * connect timer it is not otherwise waited on.
+	 * The wheel timers hold no reference; drop them so nothing fires for
+	 * a pair that is on its way out.
 	 */
-	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
-		if (gcp->attempt_fd[i] >= 0)
+	for (i = 0; gcp->hs && i < GWP_MAX_CONN_CAND; i++) {
+		if (gcp->hs->attempt_fd[i] >= 0)
 			cancel_attempt(w, gcp, i);
 	}
-	prep_attempt_timer_del(w, gcp);
+	gwp_timer_del(&w->tw, &gcp->timer);
+	if (gcp->hs)
+		gwp_timer_del(&w->tw, &gcp->hs->attempt_timer);
 
 	/*
 	 * IORING_ASYNC_CANCEL_ALL: an fd can carry more than one in-flight
@@ -619,7 +1314,7 @@ static void shutdown_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 static struct io_uring_sqe *prep_recv_client_prot(struct gwp_wrk *w,
 						  struct gwp_conn_pair *gcp)
 {
-	struct io_uring_sqe *s = prep_recv_client(w, gcp);
+	struct io_uring_sqe *s = __prep_recv_client(w, gcp);
 	s->user_data &= ~EV_BIT_ALL;
 	s->user_data |= EV_BIT_IOU_CLIENT_PROT;
 	return s;
@@ -647,6 +1342,7 @@ static void prep_recv_client_cipher(struct gwp_wrk *w, struct gwp_conn_pair *gcp
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
 	io_uring_prep_recv(s, gcp->client.fd, t->rx, sizeof(t->rx), MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, gcp->client.fd);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= ev_bit;
 	get_gcp(gcp);
@@ -660,6 +1356,7 @@ static void prep_send_client_cipher(struct gwp_wrk *w, struct gwp_conn_pair *gcp
 
 	io_uring_prep_send(s, gcp->client.fd, t->tx + t->tx_sent,
 			   t->tx_len - t->tx_sent, MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, gcp->client.fd);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= ev_bit;
 	get_gcp(gcp);
@@ -680,7 +1377,8 @@ static void send_client_tls(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 
 	while (gcp->target.len) {
 		size_t consumed = 0;
-		int sr = gwp_ssl_write(ssl, gcp->target.buf, gcp->target.len,
+		int sr = gwp_ssl_write(ssl, gwp_conn_data(&gcp->target),
+				       gwp_conn_data_len(&gcp->target),
 				       &consumed);
 
 		if (sr == GWP_SSL_OK) {
@@ -702,6 +1400,30 @@ static void send_client_tls(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		prep_recv_target(w, gcp);
 }
 
+/*
+ * --tls-ktls: try to move the client's TLS into the kernel, which leaves it a
+ * plain socket. Only while no ciphertext is in flight either way: the caller
+ * is about to post the client recv, and a send out of the tx scratch must be
+ * complete, or its completion would run down the plaintext path. The scratch
+ * is not needed after a switch.
+ */
+static int tls_ktls_attach(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_iou_tls *t = gcp->tls_io;
+	int r;
+
+	if (t->tx_sent < t->tx_len)
+		return 0;
+
+	r = gwp_conn_ktls_attach(w, gcp);
+	if (r || client_is_tls(gcp))
+		return r;
+
+	free(t);
+	gcp->tls_io = NULL;
+	return 0;
+}
+
 /*
  * Post-recv forwarding pump: decrypt buffered plaintext into client.buf and
  * send it to the target; if the engine has none ready, read more ciphertext.
@@ -711,11 +1433,11 @@ static void send_client_tls(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 static int tls_forward_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_conn *c = &gcp->client;
-	size_t space = c->cap - c->len, got = 0;
-	int sr;
+	size_t space = gwp_conn_room_len(c), got = 0;
+	int sr, r;
 
 	if (space) {
-		sr = gwp_ssl_read(c->tls, c->buf + c->len, space, &got);
+		sr = gwp_ssl_read(c->tls, gwp_conn_room(c), space, &got);
 		if (sr == GWP_SSL_ERROR)
 			return -EIO;
 		if (sr == GWP_SSL_OK && got == 0) {	/* clean close_notify */
@@ -725,10 +1447,16 @@ static int tls_forward_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		c->len += (uint32_t)got;
 	}
 
-	if (c->len)
+	if (c->len) {
 		prep_send_target(w, gcp);
-	else
-		prep_recv_client(w, gcp);
+		return 0;
+	}
+
+	r = tls_ktls_attach(w, gcp);
+	if (r)
+		return r;
+
+	prep_recv_client(w, gcp);
 	return 0;
 }
 
@@ -736,15 +1464,15 @@ static int tls_forward_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 static int tls_prot_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_conn *c = &gcp->client;
-	size_t space = c->cap - c->len, got = 0;
-	int sr;
+	size_t space = gwp_conn_room_len(c), got = 0;
+	int sr, r;
 
 	if (!space) {
 		/* Buffer full mid-handshake: let the protocol drain it. */
 		return process_client_prot(w, gcp);
 	}
 
-	sr = gwp_ssl_read(c->tls, c->buf + c->len, space, &got);
+	sr = gwp_ssl_read(c->tls, gwp_conn_room(c), space, &got);
 	if (sr == GWP_SSL_ERROR)
 		return -EIO;
 	if (sr == GWP_SSL_OK && got == 0) {	/* client sent close_notify */
@@ -754,6 +1482,9 @@ static int tls_prot_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 
 	if (got == 0) {
 		/* Need more ciphertext to complete a record. */
+		r = tls_ktls_attach(w, gcp);
+		if (r)
+			return r;
 		prep_recv_client_prot(w, gcp);
 		return 0;
 	}
@@ -765,30 +1496,38 @@ static int tls_prot_pump(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 /* Handshake done: switch to the plaintext protocol path on the decrypted stream. */
 static int tls_hs_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
+	int r;
+
 	pr_dbg(&w->ctx->lh, "TLS handshake complete (cfd=%d, alpn=%s)",
 	       gcp->client.fd, gwp_ssl_alpn(gcp->client.tls) ?: "none");
 	gcp->tls_io->hs_done = true;
 	gcp->conn_state = CONN_STATE_PROT;
+
+	r = tls_ktls_attach(w, gcp);
+	if (r)
+		return r;
+	if (!client_is_tls(gcp)) {
+		prep_recv_client_prot(w, gcp);
+		return 0;
+	}
+
 	/* App data may already sit in the engine from the last handshake recv. */
 	return tls_prot_pump(w, gcp);
 }
 
 /*
- * Advance the handshake: step it, flush any records it produced, and either
- * finish or wait for the peer's next flight. Called after each handshake recv
- * or send completes.
+ * Act on the handshake step result @hs: flush any records it produced, and
+ * either finish or wait for the peer's next flight.
  */
-static int tls_hs_step(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+static int tls_hs_done_step(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    int hs)
 {
 	struct gwp_iou_tls *t = gcp->tls_io;
 	struct gwp_ssl *ssl = gcp->client.tls;
-	int hs, n;
+	int n;
 
-	hs = gwp_ssl_handshake(ssl);
-	if (hs == GWP_SSL_ERROR) {
-		pr_dbg(&w->ctx->lh, "TLS handshake failed: %s", gwp_ssl_errstr());
+	if (hs == GWP_SSL_ERROR)
 		return -ECONNRESET;
-	}
 
 	if (gwp_ssl_bio_pending(ssl) > 0) {
 		n = gwp_ssl_bio_read(ssl, t->tx, sizeof(t->tx));
@@ -807,6 +1546,45 @@ static int tls_hs_step(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	return 0;
 }
 
+/* Step the handshake. Called after each handshake recv or send completes. */
+static int tls_hs_step(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	int hs = gwp_ssl_handshake(gcp->client.tls);
+
+	if (hs == GWP_SSL_ERROR)
+		pr_dbg(&w->ctx->lh, "TLS handshake failed: %s", gwp_ssl_errstr());
+
+	return tls_hs_done_step(w, gcp, hs);
+}
+
+/*
+ * --tls-hs-threads: pick up the handshake steps the crypto threads finished.
+ * Each held a reference on its pair, so the pair is still here even if it was
+ * shut down in the meantime; then the result is dropped along with the
+ * reference.
+ */
+static void handle_tls_jobs(struct gwp_wrk *w)
+{
+	struct gwp_tls_job *job, *next;
+	struct gwp_conn_pair *gcp;
+	int hs, r;
+
+	for (job = gwp_conn_tls_reap(w); job; job = next) {
+		next = job->next;
+		gcp = job->udata;
+		hs = gwp_conn_tls_finish(w, job);
+		if (gcp->flags & GWP_CONN_FLAG_IS_CANCEL) {
+			put_gcp(w, gcp);
+			continue;
+		}
+
+		r = tls_hs_done_step(w, gcp, hs);
+		if (r)
+			shutdown_gcp(w, gcp);
+		put_gcp(w, gcp);
+	}
+}
+
 static int handle_ev_tls_hs_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 				 struct io_uring_cqe *cqe)
 {
@@ -825,6 +1603,15 @@ static int handle_ev_tls_hs_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	if (gwp_ssl_bio_write(gcp->client.tls, gcp->tls_io->rx, (size_t)r) < 0)
 		return -EIO;
 
+	/* The step holds a reference until handle_tls_jobs() picks it up. */
+	r = gwp_conn_tls_offload(w, gcp);
+	if (r < 0)
+		return r;
+	if (r > 0) {
+		get_gcp(gcp);
+		return 0;
+	}
+
 	return tls_hs_step(w, gcp);
 }
 
@@ -859,6 +1646,7 @@ static void prep_tls_detect(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	gcp->conn_state = CONN_STATE_TLS_DETECT;
 	io_uring_prep_recv(s, gcp->client.fd, gcp->client.buf, 1,
 			   MSG_PEEK | MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, gcp->client.fd);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_TLS_DETECT;
 	get_gcp(gcp);
@@ -931,9 +1719,7 @@ static int arm_gcp_prot(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 #endif
 		prep_recv_client_prot(w, gcp);
 
-	if (ctx->cfg.protocol_timeout > 0)
-		prep_timer_target(w, gcp, ctx->cfg.protocol_timeout);
-
+	gwp_conn_arm_timer(w, gcp, ctx->cfg.protocol_timeout);
 	return 0;
 }
 
@@ -966,13 +1752,9 @@ static int do_prep_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	/*
 	 * The connect timeout bounds the whole operation, across every
 	 * candidate address, so it is armed once here rather than per attempt.
-	 * Armed only after an attempt is actually running: on the failure path
-	 * the pair is torn down immediately and a live timeout would pin it
-	 * until it expired.
+	 * It replaces the protocol timeout, which has served its purpose.
 	 */
-	if (ctx->cfg.connect_timeout > 0)
-		prep_timer_target(w, gcp, ctx->cfg.connect_timeout);
-
+	gwp_conn_arm_timer(w, gcp, ctx->cfg.connect_timeout);
 	return 0;
 }
 
@@ -991,7 +1773,8 @@ static int arm_gcp(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		return arm_gcp_no_socks5(w, gcp);
 }
 
-static int __handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
+static int __handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe,
+			      const struct gwp_sockaddr *peer)
 {
 	bool transparent = w->ctx->cfg.as_transparent;
 	struct gwp_ctx *ctx = w->ctx;
@@ -1010,20 +1793,20 @@ static int __handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 		return fd;
 	}
 
-	if (!gwp_ctx_acl_client_allowed(ctx, &w->iou->accept_addr,
+	if (!gwp_ctx_acl_client_allowed(ctx, peer,
 					GWP_ACL_PROTO_TCP)) {
 		pr_info(&ctx->lh, "ACL denied client %s",
-			ip_to_str(&w->iou->accept_addr));
+			ip_to_str(peer));
 		prep_close(w, fd);
 		return 0;
 	}
 
 	/* Transparent proxy: take the target from SO_ORIGINAL_DST. */
 	if (transparent) {
-		r = gwp_get_orig_dst(fd, &w->iou->accept_addr, &tdst);
+		r = gwp_get_orig_dst(fd, peer, &tdst);
 		if (r) {
 			pr_warn(&ctx->lh, "No original destination for %s: %s (not a redirected connection?)",
-				ip_to_str(&w->iou->accept_addr), strerror(-r));
+				ip_to_str(peer), strerror(-r));
 			prep_close(w, fd);
 			return 0;
 		}
@@ -1048,9 +1831,12 @@ static int __handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 	gcp->ref_cnt = 0;
 
 	gcp->client.fd = fd;
-	gcp->client_addr = w->iou->accept_addr;
-	gwp_conn_set_single_candidate(gcp, &fwd_target);
+	iou_fd_register(w, fd);
+	gcp->client_addr = *peer;
 	gcp->is_target_alive = false;
+	r = gwp_conn_set_single_candidate(w, gcp, &fwd_target);
+	if (unlikely(r))
+		goto out_free_pair;
 	r = arm_gcp(w, gcp);
 	if (unlikely(r)) {
 		/*
@@ -1080,7 +1866,7 @@ static int __handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 	return r;
 
 out_free_pair:
-	gcp->client.fd = gcp->target.fd = gcp->timer_fd = -1;
+	gcp->client.fd = gcp->target.fd = -1;
 	gwp_free_conn_pair(w, gcp);
 out_close:
 	if (fd >= 0)
@@ -1088,16 +1874,26 @@ out_close:
 	return r ? r : -ENOMEM;
 }
 
-static int handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
+static int handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe,
+			    uint32_t i)
 {
-	int r = __handle_ev_accept(w, cqe);
+	struct gwp_iou_accept *a = &w->iou->accept[i];
+	int r;
+
+	a->armed = false;
+
+	/* -ECANCELED is cancel_accept() ending it: the retry timer re-arms. */
+	if (cqe->res == -ECANCELED)
+		return 0;
 
+	r = __handle_ev_accept(w, cqe, &a->addr);
 	if (unlikely(r < 0)) {
 		/*
 		 * Resource exhaustion is transient: pause accepting instead of
 		 * killing the worker, and retry via a timer (arm_accept_retry())
 		 * until descriptors free up. Analogous to the epoll
-		 * handle_accept_error().
+		 * handle_accept_error(). The other accepts would only fail the
+		 * same way, so they are cancelled.
 		 */
 		if (r == -EMFILE || r == -ENFILE || r == -ENOMEM) {
 			if (!w->accept_is_stopped) {
@@ -1105,22 +1901,29 @@ static int handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 				pr_warn(&w->ctx->lh,
 					"Too many open files, pausing accept (tidx=%u)",
 					w->idx);
+				cancel_accept(w);
 			}
 			arm_accept_retry(w);
 			return 0;
 		}
 
-		pr_err(&w->ctx->lh, "Failed to handle accept event: %s", strerror(-r));
+		pr_err(&w->ctx->lh, "Failed to handle accept event: %s",
+		       strerror(-r));
 		return r;
 	}
 
 	if (unlikely(w->accept_is_stopped)) {
+		/* A retry went through; another may still be racing it. */
+		if (cqe->res < 0)
+			return 0;
 		w->accept_is_stopped = false;
 		pr_info(&w->ctx->lh, "Resumed accepting new connections (tidx=%u)",
 			w->idx);
+		arm_accepts(w);
+		return 0;
 	}
 
-	arm_accept(w);
+	arm_accept(w, i);
 	return 0;
 }
 
@@ -1132,8 +1935,8 @@ static int handle_ev_accept(struct gwp_wrk *w, struct io_uring_cqe *cqe)
  * proxy; we drive greeting -> [auth] -> CONNECT before starting to forward.
  * The normal client/target recv/send SQEs are NOT armed during the handshake
  * (see do_prep_connect); the handshake uses dedicated SQEs tagged with
- * EV_BIT_IOU_UPSTREAM_S5. gcp->up_tx distinguishes a send completion (request
- * still being flushed) from a recv completion (reply being read).
+ * EV_BIT_IOU_UPSTREAM_S5. gcp->hs->up_tx distinguishes a send completion
+ * (request still being flushed) from a recv completion (reply being read).
  * ------------------------------------------------------------------------
  */
 
@@ -1144,8 +1947,9 @@ static struct io_uring_sqe *prep_upstream_send(struct gwp_wrk *w,
 {
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
-	io_uring_prep_send(s, gcp->target.fd, gcp->target.buf, gcp->target.len,
-			   MSG_NOSIGNAL);
+	io_uring_prep_send(s, gcp->target.fd, gwp_conn_data(&gcp->target),
+			   gwp_conn_data_len(&gcp->target), MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, gcp->target.fd);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_UPSTREAM_S5;
 	get_gcp(gcp);
@@ -1155,11 +1959,12 @@ static struct io_uring_sqe *prep_upstream_send(struct gwp_wrk *w,
 static struct io_uring_sqe *prep_upstream_recv(struct gwp_wrk *w,
 					       struct gwp_conn_pair *gcp)
 {
-	size_t len = gcp->target.cap - gcp->target.len;
-	char *buf = gcp->target.buf + gcp->target.len;
+	size_t len = gwp_conn_room_len(&gcp->target);
+	char *buf = gwp_conn_room(&gcp->target);
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
 	io_uring_prep_recv(s, gcp->target.fd, buf, len, MSG_NOSIGNAL);
+	sqe_fixed_fd(w, s, gcp->target.fd);
 	io_uring_sqe_set_data(s, gcp);
 	s->user_data |= EV_BIT_IOU_UPSTREAM_S5;
 	get_gcp(gcp);
@@ -1171,13 +1976,13 @@ static int upstream_iou_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_ctx *ctx = w->ctx;
 
-	prep_timer_del_target(w, gcp);
-	gcp->up_tx = false;
+	gwp_conn_start_idle_timer(w, gcp);
 	gcp->is_target_alive = true;
 	gcp->conn_state = CONN_STATE_FORWARDING;
 
 	pr_info(&ctx->lh, "Upstream tunnel established (idx=%u, ca=%s)",
 		gcp->idx, ip_to_str(&gcp->client_addr));
+	gwp_conn_hs_release(w, gcp);
 
 	/* Start forwarding. */
 	if (gcp->target.len)
@@ -1218,7 +2023,7 @@ static int handle_ev_upstream_s5(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	if (r < 0)
 		return r;
 
-	if (gcp->up_tx) {
+	if (gcp->hs->up_tx) {
 		/* A request send completed. */
 		if (r > 0)
 			gwp_conn_buf_advance(&gcp->target, (size_t)r);
@@ -1228,7 +2033,7 @@ static int handle_ev_upstream_s5(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			return 0;
 		}
 
-		gcp->up_tx = false;
+		gcp->hs->up_tx = false;
 		prep_upstream_recv(w, gcp);
 		return 0;
 	}
@@ -1263,8 +2068,9 @@ static void adopt_winning_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 {
 	uint8_t i;
 
-	gcp->target.fd = gcp->attempt_fd[slot];
-	gcp->attempt_fd[slot] = -1;
+	gcp->target.fd = gcp->hs->attempt_fd[slot];
+	gcp->hs->attempt_fd[slot] = -1;
+	iou_fd_register(w, gcp->target.fd);
 	/*
 	 * Restore the address this attempt actually dialled: with a race the
 	 * winner is often not the last one started, and target_addr currently
@@ -1272,16 +2078,16 @@ static void adopt_winning_attempt(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	 * recorded address also keeps a -j DNAT rewrite intact, which
 	 * re-deriving from cand[] would silently undo.
 	 */
-	gcp->target_addr = gcp->attempt_addr[slot];
+	gcp->target_addr = gcp->hs->attempt_addr[slot];
 
 	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
-		if (gcp->attempt_fd[i] >= 0)
+		if (gcp->hs->attempt_fd[i] >= 0)
 			cancel_attempt(w, gcp, i);
 	}
 
 	/* The race is over; no further candidate should join it. */
-	gcp->next_cand = gcp->nr_cand;
-	prep_attempt_timer_del(w, gcp);
+	gcp->hs->next_cand = gcp->hs->nr_cand;
+	gwp_timer_del(&w->tw, &gcp->hs->attempt_timer);
 }
 
 /*
@@ -1302,7 +2108,7 @@ static int finish_target_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	if (w->ctx->upstream.enabled)
 		return upstream_iou_start(w, gcp);
 
-	prep_timer_del_target(w, gcp);
+	gwp_conn_start_idle_timer(w, gcp);
 	gcp->is_target_alive = true;
 	pr_info(&w->ctx->lh,
 		"Target socket connected (fd=%d, idx=%u, ca=%s, ta=%s)",
@@ -1310,6 +2116,9 @@ static int finish_target_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		ip_to_str(&gcp->client_addr),
 		ip_to_str(&gcp->target_addr));
 
+	/* Losers still being reaped keep it alive until the last one is. */
+	gwp_conn_hs_release(w, gcp);
+
 	http_fwd = (gcp->prot_type == GWP_PROT_TYPE_HTTP && gcp->http_conn &&
 		    gwp_http_conn_is_forward(gcp->http_conn));
 
@@ -1349,6 +2158,7 @@ static int finish_target_connect(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 						 gcp->target.cap);
 		if (r < 0)
 			return r;
+		gcp->target.head = 0;
 		gcp->target.len = (uint32_t)r;
 	}
 
@@ -1374,8 +2184,10 @@ static int handle_ev_target_attempt(struct gwp_wrk *w, void *udata,
 
 	if (unlikely(slot >= GWP_MAX_CONN_CAND))
 		return -EINVAL;
+	if (unlikely(!gcp->hs))
+		return 0;
 
-	fd = gcp->attempt_fd[slot];
+	fd = gcp->hs->attempt_fd[slot];
 	if (unlikely(fd < 0))
 		return 0;		/* already retired */
 
@@ -1385,14 +2197,18 @@ static int handle_ev_target_attempt(struct gwp_wrk *w, void *udata,
 	 */
 	if (res < 0 || gcp->target.fd >= 0 ||
 	    (gcp->flags & GWP_CONN_FLAG_IS_CANCEL)) {
-		gcp->attempt_fd[slot] = -1;
+		gcp->hs->attempt_fd[slot] = -1;
 		prep_close(w, fd);
 
 		if (res < 0 && res != -ECANCELED)
 			pr_dbg(&ctx->lh,
 				"Target attempt %u failed: %s (fd=%d, idx=%u, ta=%s)",
 				slot, strerror(-res), fd, gcp->idx,
-				ip_to_str(&gcp->attempt_addr[slot]));
+				ip_to_str(&gcp->hs->attempt_addr[slot]));
+
+		/* The last loser of a finished race frees what it shared. */
+		if (gcp->flags & GWP_CONN_FLAG_HS_DONE)
+			gwp_conn_hs_release(w, gcp);
 
 		if (gcp->target.fd >= 0 || (gcp->flags & GWP_CONN_FLAG_IS_CANCEL))
 			return 0;
@@ -1412,39 +2228,32 @@ static int handle_ev_target_attempt(struct gwp_wrk *w, void *udata,
 	return finish_target_connect(w, gcp, res);
 }
 
-static int handle_ev_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
-			   bool is_timer_del, int res)
+static int handle_ev_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_ctx *ctx = w->ctx;
-	int r = 0;
-
-	if (!gcp->is_target_alive && res == -ETIME) {
-		assert(is_timer_del == false);
-		r = -ETIME;
-		pr_warn(&ctx->lh,
-			"Connection timeout! (idx=%u, cfd=%d, tfd=%d, ca=%s, ta=%s)",
-			gcp->idx, gcp->client.fd, gcp->target.fd,
-			ip_to_str(&gcp->client_addr),
-			ip_to_str(&gcp->target_addr));
+	int r = -ETIME;
 
-		/*
-		 * Tell the client the origin timed out (SOCKS5 REP 0x06, HTTP
-		 * 504) rather than hanging up silently. Only once a target
-		 * socket exists -- the other user of this timer is the protocol
-		 * handshake, where nothing has been requested yet. During a
-		 * race there is no target fd yet, so the in-flight attempts
-		 * count as one.
-		 */
-		if ((gcp->target.fd >= 0 || has_inflight_attempt(gcp)) &&
-		    !gwp_conn_fail_reply(w, gcp, r) && gcp->target.len)
-			prep_send_client(w, gcp);
-	}
+	/* Past the connect, the same timer only ever bounds idleness. */
+	if (gcp->is_target_alive && gcp->conn_state == CONN_STATE_FORWARDING)
+		return gwp_conn_idle_expired(w, gcp);
 
-	pr_dbg(&ctx->lh,
-		"Timer event handled (idx=%u, cfd=%d, tfd=%d, tmfd=%d, ca=%s, ta=%s, itd=(b)%d, res=%d)",
+	pr_warn(&ctx->lh,
+		"Connection timeout! (idx=%u, cfd=%d, tfd=%d, ca=%s, ta=%s)",
 		gcp->idx, gcp->client.fd, gcp->target.fd,
-		gcp->timer_fd, ip_to_str(&gcp->client_addr),
-		ip_to_str(&gcp->target_addr), is_timer_del, res);
+		ip_to_str(&gcp->client_addr),
+		ip_to_str(&gcp->target_addr));
+
+	/*
+	 * Tell the client the origin timed out (SOCKS5 REP 0x06, HTTP 504)
+	 * rather than hanging up silently. Only once a target socket exists --
+	 * the other user of this timer is the protocol handshake, where nothing
+	 * has been requested yet. During a race there is no target fd yet, so
+	 * the in-flight attempts count as one.
+	 */
+	if ((gcp->target.fd >= 0 || has_inflight_attempt(gcp)) &&
+	    !gcp->is_target_alive &&
+	    !gwp_conn_fail_reply(w, gcp, r) && gcp->target.len)
+		prep_send_client(w, gcp);
 
 	return r;
 }
@@ -1494,14 +2303,27 @@ static int handle_ev_client_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 {
 	int r = cqe->res;
 
+	link_sent(gcp, &gcp->client, GWP_CONN_FLAG_LINK_C, r);
+	pbuf_adopt(w, &gcp->client, cqe);
 	if (r < 0) {
 		if (r == -EAGAIN || r == -EINTR) {
 			prep_recv_client(w, gcp);
 			return 0;
 		}
+		/* kTLS: a close_notify or an alert where data was expected. */
+		if (r == -EIO && gcp->client.ktls) {
+			gcp->client.rd_eof = true;
+			return iou_forward_progress(gcp);
+		}
+		if (r == -ENOBUFS) {
+			r = pbuf_exhausted(w, &gcp->client);
+			if (!r)
+				__prep_recv_client(w, gcp);
+		}
 		return r;
 	}
 
+	gwp_conn_touch(w, gcp);
 #ifdef CONFIG_HTTPS
 	if (client_is_tls(gcp)) {
 		if (r == 0) {
@@ -1526,7 +2348,10 @@ static int handle_ev_client_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	}
 
 	gcp->client.len += (uint32_t)r;
-	prep_send_target(w, gcp);
+	if (!prep_send_linked(w, gcp, &gcp->client, &gcp->target,
+			      EV_BIT_IOU_CLIENT_RECV, GWP_CONN_FLAG_LINK_C,
+			      GWP_CONN_FLAG_ZC_NOTIF_C))
+		prep_send_target(w, gcp);
 	return 0;
 }
 
@@ -1535,11 +2360,18 @@ static int handle_ev_target_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 {
 	int r = cqe->res;
 
+	link_sent(gcp, &gcp->target, GWP_CONN_FLAG_LINK_T, r);
+	pbuf_adopt(w, &gcp->target, cqe);
 	if (r < 0) {
 		if (r == -EAGAIN || r == -EINTR) {
 			prep_recv_target(w, gcp);
 			return 0;
 		}
+		if (r == -ENOBUFS) {
+			r = pbuf_exhausted(w, &gcp->target);
+			if (!r)
+				__prep_recv_target(w, gcp);
+		}
 		return r;
 	}
 
@@ -1548,16 +2380,75 @@ static int handle_ev_target_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		return iou_forward_progress(gcp);
 	}
 
+	gwp_conn_touch(w, gcp);
 	gcp->target.len += (uint32_t)r;
-	prep_send_client(w, gcp);
+	if (!prep_send_linked(w, gcp, &gcp->target, &gcp->client,
+			      EV_BIT_IOU_TARGET_RECV, GWP_CONN_FLAG_LINK_T,
+			      GWP_CONN_FLAG_ZC_NOTIF_T))
+		prep_send_client(w, gcp);
 	return 0;
 }
 
+/*
+ * The result of a zero-copy send. IORING_CQE_F_MORE means the notification is
+ * still to come and owns the reference prep_send_buf() took for it. Without
+ * it the request failed before sending anything, so that reference goes now;
+ * -EINVAL then is a kernel without zero-copy sends or usage reports, and the
+ * worker copies from here on. Returns the result to carry on with.
+ */
+static int zc_send_result(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			  uint64_t notif_bit, struct io_uring_cqe *cqe)
+{
+	struct iou *iou = w->iou;
+
+	if (cqe->flags & IORING_CQE_F_MORE)
+		return cqe->res;
+
+	gcp->flags &= ~notif_bit;
+	put_gcp(w, gcp);
+	if (cqe->res == -EINVAL && !iou->no_send_zc) {
+		pr_warn(&w->ctx->lh, "io_uring zero-copy send not supported, copying instead");
+		iou->no_send_zc = true;
+		return -EAGAIN;
+	}
+
+	return cqe->res;
+}
+
+/*
+ * The kernel is done with the buffer of a zero-copy send. A direction whose
+ * buffer was pinned whole had no room to receive into after its last send
+ * (see handle_ev_target_send()) and waits for this to read again.
+ */
+static void handle_ev_zc_notif(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			       uint64_t ev_bit, struct io_uring_cqe *cqe)
+{
+	bool to_target = (ev_bit == EV_BIT_IOU_TARGET_SEND_ZC);
+	struct gwp_conn *src = to_target ? &gcp->client : &gcp->target;
+	bool stalled = !src->len && !gwp_conn_room_len(src);
+
+	gcp->flags &= ~(to_target ? GWP_CONN_FLAG_ZC_NOTIF_C :
+				    GWP_CONN_FLAG_ZC_NOTIF_T);
+	if ((uint32_t)cqe->res & IORING_NOTIF_USAGE_ZC_COPIED)
+		gcp->flags |= GWP_CONN_FLAG_NO_ZC;
+	gwp_conn_zc_done(src);
+
+	if (!stalled || src->rd_eof || (gcp->flags & GWP_CONN_FLAG_IS_CANCEL))
+		return;
+
+	if (to_target)
+		prep_recv_client(w, gcp);
+	else if (gcp->target.fd >= 0)
+		prep_recv_target(w, gcp);
+}
+
 static int handle_ev_client_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
-				 struct io_uring_cqe *cqe)
+				 struct io_uring_cqe *cqe, bool zc)
 {
-	int r = cqe->res;
+	bool pinned = zc && (cqe->flags & IORING_CQE_F_MORE);
+	int r;
 
+	r = zc ? zc_send_result(w, gcp, GWP_CONN_FLAG_ZC_NOTIF_T, cqe) : cqe->res;
 	r = handle_sock_ret(r);
 	if (r < 0)
 		return r;
@@ -1581,7 +2472,9 @@ static int handle_ev_client_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	}
 #endif
 
-	if (r > 0)
+	if (r > 0 && pinned)
+		gwp_conn_buf_advance_zc(&gcp->target, (size_t)r);
+	else if (r > 0)
 		gwp_conn_buf_advance(&gcp->target, (size_t)r);
 
 	/*
@@ -1594,21 +2487,26 @@ static int handle_ev_client_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		return 0;
 	}
 
-	if (gcp->target.fd >= 0)
+	pbuf_release(w, &gcp->target);
+	if (gcp->target.fd >= 0 && gwp_conn_room_len(&gcp->target))
 		prep_recv_target(w, gcp);
 	return 0;
 }
 
 static int handle_ev_target_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
-				 struct io_uring_cqe *cqe)
+				 struct io_uring_cqe *cqe, bool zc)
 {
-	int r = cqe->res;
+	bool pinned = zc && (cqe->flags & IORING_CQE_F_MORE);
+	int r;
 
+	r = zc ? zc_send_result(w, gcp, GWP_CONN_FLAG_ZC_NOTIF_C, cqe) : cqe->res;
 	r = handle_sock_ret(r);
 	if (r < 0)
 		return r;
 
-	if (r > 0)
+	if (r > 0 && pinned)
+		gwp_conn_buf_advance_zc(&gcp->client, (size_t)r);
+	else if (r > 0)
 		gwp_conn_buf_advance(&gcp->client, (size_t)r);
 
 	/* Short send: flush the rest before reading more from the client. */
@@ -1617,12 +2515,18 @@ static int handle_ev_target_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		return 0;
 	}
 
+	pbuf_release(w, &gcp->client);
+
 #ifdef CONFIG_HTTPS
 	/* Drain plaintext still buffered in the engine before reading the wire. */
 	if (client_is_tls(gcp))
 		return tls_forward_pump(w, gcp);
 #endif
 
+	/* Pinned whole by zero-copy sends: handle_ev_zc_notif() reads on. */
+	if (!gwp_conn_room_len(&gcp->client))
+		return 0;
+
 	prep_recv_client(w, gcp);
 	return 0;
 }
@@ -1657,6 +2561,9 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 {
 	bool acl_denied = false;
 
+	if (unlikely(!gwp_conn_hs_get(w, gcp)))
+		return -ENOMEM;
+
 	/*
 	 * No candidate list at all: socks5h:// hands the hostname to the
 	 * upstream proxy and never resolves it here, so target_addr stays
@@ -1664,12 +2571,12 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	 * Attempt it once, leaving target_addr untouched so the ACL keeps
 	 * seeing "no resolved IP" and matches on -m domain as before.
 	 */
-	if (!gcp->nr_cand) {
-		if (gcp->next_cand)
+	if (!gcp->hs->nr_cand) {
+		if (gcp->hs->next_cand)
 			goto exhausted;
 
-		gcp->next_cand = 1;
-		if (!gwp_ctx_acl_target_allowed(w->ctx, gcp))
+		gcp->hs->next_cand = 1;
+		if (!gwp_ctx_acl_target_allowed(w->ctx, &w->acl_memo, gcp))
 			return acl_reject_target(w, gcp);
 
 		err = start_connect_attempt(w, gcp, 0);
@@ -1678,12 +2585,12 @@ static int connect_next_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 		goto exhausted;
 	}
 
-	while (gcp->next_cand < gcp->nr_cand) {
-		uint8_t slot = gcp->next_cand;
+	while (gcp->hs->next_cand < gcp->hs->nr_cand) {
+		uint8_t slot = gcp->hs->next_cand;
 
-		gcp->target_addr = gcp->cand[gcp->next_cand++];
+		gcp->target_addr = gcp->hs->cand[gcp->hs->next_cand++];
 
-		if (!gwp_ctx_acl_target_allowed(w->ctx, gcp)) {
+		if (!gwp_ctx_acl_target_allowed(w->ctx, &w->acl_memo, gcp)) {
 			acl_denied = true;
 			continue;
 		}
@@ -1750,16 +2657,9 @@ exhausted:
  * alongside the ones already running. Nothing is cancelled here -- an attempt
  * that is merely slow may still win.
  */
-static int handle_ev_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
-				   int res)
+static int handle_ev_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	gcp->attempt_timer_armed = false;
-
-	/* Removed by adopt_winning_attempt() or shutdown_gcp(); nothing to do. */
-	if (res != -ETIME)
-		return 0;
-
-	if (gcp->next_cand >= gcp->nr_cand)
+	if (gcp->hs->next_cand >= gcp->hs->nr_cand)
 		return 0;
 
 	/*
@@ -1772,19 +2672,27 @@ static int handle_ev_attempt_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 
 static int prep_domain_resolution(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct gwp_dns_entry *gde = gcp->gde;
+	struct gwp_dns_entry *gde;
 	struct gwp_ctx *ctx = w->ctx;
-	struct io_uring_sqe *s;
 
+	/*
+	 * A --raw-dns query is already on the wire. It holds no reference:
+	 * freeing the pair cancels it, and a reply or timeout for a pair
+	 * being shut down is dropped.
+	 */
+	if (ctx->cfg.use_raw_dns)
+		return 0;
+
+	/*
+	 * The query is already queued and completes onto this worker's queue;
+	 * it holds a reference until handle_dns_queries() picks it up.
+	 */
+	gde = gcp->gde;
 	assert(gde);
-	s = get_sqe_nofail(w);
-	io_uring_prep_poll_add(s, gde->ev_fd, POLLIN);
-	io_uring_sqe_set_data(s, gcp);
-	s->user_data |= EV_BIT_IOU_DNS_QUERY;
 	get_gcp(gcp);
 	pr_dbg(&ctx->lh,
-		"Prepared DNS query for domain '%s' (fd=%d, idx=%u, ref_cnt=%d)",
-		gde->name, gde->ev_fd, gcp->idx, gcp->ref_cnt);
+		"Prepared DNS query for domain '%s' (idx=%u, ref_cnt=%d)",
+		gde->name, gcp->idx, gcp->ref_cnt);
 
 	return 0;
 }
@@ -1792,7 +2700,7 @@ static int prep_domain_resolution(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 /* Arm the next relay recvmsg into the front-padded scratch buffer. */
 static void prep_udp_recv(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
-	struct gwp_iou_udp *u = gcp->udp_iou;
+	struct gwp_iou_udp *u = gcp->udp->iou;
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
 	u->iov.iov_base = u->buf + GWP_SOCKS5_UDP_HDR_MAX;
@@ -1813,7 +2721,7 @@ static void prep_udp_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			  unsigned char *buf, size_t len,
 			  const struct gwp_sockaddr *dst, socklen_t dstlen)
 {
-	struct gwp_iou_udp *u = gcp->udp_iou;
+	struct gwp_iou_udp *u = gcp->udp->iou;
 	struct io_uring_sqe *s = get_sqe_nofail(w);
 
 	u->dst = *dst;
@@ -1842,7 +2750,7 @@ static void prep_udp_send(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 static int handle_ev_udp_relay(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 			       struct io_uring_cqe *cqe)
 {
-	struct gwp_iou_udp *u = gcp->udp_iou;
+	struct gwp_iou_udp *u = gcp->udp->iou;
 	unsigned char *base = u->buf + GWP_SOCKS5_UDP_HDR_MAX;
 	int n = cqe->res;
 	struct gwp_udp_out out;
@@ -1892,23 +2800,19 @@ static int arm_udp_relay(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	int r;
 
-	gcp->udp_iou = calloc(1, sizeof(*gcp->udp_iou));
-	if (unlikely(!gcp->udp_iou))
+	gcp->udp->iou = calloc(1, sizeof(*gcp->udp->iou));
+	if (unlikely(!gcp->udp->iou))
 		return -ENOMEM;
 
 	r = prep_nr_sqes(w, 3);
 	if (unlikely(r < 0))
 		return r;
 
-	if (w->ctx->cfg.protocol_timeout > 0) {
-		/*
-		 * Mark the pair alive before removing the timer so a timeout
-		 * that fires in the race window is treated as benign by
-		 * handle_ev_timer() (mirrors the TCP connect path).
-		 */
-		gcp->is_target_alive = true;
-		prep_timer_del_target(w, gcp);
-	}
+	/*
+	 * The association is long-lived: drop the protocol-handshake timeout
+	 * so it cannot tear the relay down mid-session.
+	 */
+	gwp_timer_del(&w->tw, &gcp->timer);
 
 	prep_recv_client_prot(w, gcp);
 	prep_udp_recv(w, gcp);
@@ -1917,9 +2821,9 @@ static int arm_udp_relay(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 
 /*
  * Act on the result of a protocol handler (SOCKS5 or HTTP), mirroring the epoll
- * chk_socks5()/chk_http(): a pending DNS lookup arms a poll; a fully-decoded
- * destination creates and connects the target socket; anything else means the
- * handshake needs more client data.
+ * chk_socks5()/chk_http(): a pending DNS lookup waits for the worker's
+ * completion queue; a fully-decoded destination creates and connects the
+ * target socket; anything else means the handshake needs more client data.
  */
 static int chk_prot_result(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int r)
 {
@@ -1988,7 +2892,7 @@ static int handle_ev_client_prot(struct gwp_wrk *w,
 	 * bytes and keep watching.
 	 */
 	if (gcp->conn_state == CONN_STATE_SOCKS5_UDP_ASSOCIATE) {
-		gcp->client.len = 0;
+		gwp_conn_buf_advance(&gcp->client, gcp->client.len);
 		prep_recv_client_prot(w, gcp);
 		return 0;
 	}
@@ -2007,11 +2911,26 @@ static int handle_ev_client_prot(struct gwp_wrk *w,
 	return process_client_prot(w, gcp);
 }
 
+/*
+ * Answer before hanging up; without a reply the client cannot tell a name
+ * that does not resolve from a proxy that died. SOCKS5 gets a REP (RFC 1928
+ * s6), HTTP a 502. The send is queued before the error return tears the pair
+ * down, exactly as acl_reject_target() does.
+ */
+static int dns_query_failed(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    int err)
+{
+	if (!gwp_conn_fail_reply(w, gcp, err) && gcp->target.len)
+		prep_send_client(w, gcp);
+	return err ? err : -EIO;
+}
+
 static int handle_ev_dns_query(struct gwp_wrk *w, void *udata)
 {
 	struct gwp_conn_pair *gcp = udata;
 	struct gwp_ctx *ctx = w->ctx;
 	struct gwp_dns_entry *gde = gcp->gde;
+	int r;
 
 	if (gde->res) {
 		int res = gde->res;
@@ -2020,22 +2939,18 @@ static int handle_ev_dns_query(struct gwp_wrk *w, void *udata)
 			gde->name, res);
 		gwp_dns_entry_put(gde);
 		gcp->gde = NULL;
+		return dns_query_failed(w, gcp, res);
+	}
 
-		/*
-		 * Answer before hanging up; without a reply the client cannot
-		 * tell a name that does not resolve from a proxy that died.
-		 * SOCKS5 gets a REP (RFC 1928 s6), HTTP a 502. The send is
-		 * queued before the error return tears the pair down, exactly
-		 * as acl_reject_target() does.
-		 */
-		if (!gwp_conn_fail_reply(w, gcp, res) && gcp->target.len)
-			prep_send_client(w, gcp);
-		return res;
+	r = gwp_conn_set_candidates(w, gcp, gde->addrs, gde->nr_addrs);
+	if (unlikely(r)) {
+		gwp_dns_entry_put(gde);
+		gcp->gde = NULL;
+		return r;
 	}
 
-	gwp_conn_set_candidates(gcp, gde->addrs, gde->nr_addrs);
 	pr_info(&ctx->lh, "Domain '%s' resolved to %s (%u addr, fd=%d, idx=%u)",
-		gde->name, ip_to_str(&gcp->target_addr), gcp->nr_cand,
+		gde->name, ip_to_str(&gcp->target_addr), gcp->hs->nr_cand,
 		gcp->target.fd, gcp->idx);
 
 	gwp_dns_entry_put(gde);
@@ -2043,6 +2958,160 @@ static int handle_ev_dns_query(struct gwp_wrk *w, void *udata)
 	return do_prep_connect(w, gcp);
 }
 
+/*
+ * Pick up every query the DNS threads resolved for this worker. Each held a
+ * reference on its pair (see prep_domain_resolution()), so the pair is still
+ * here even if it was shut down in the meantime.
+ */
+static void handle_dns_queries(struct gwp_wrk *w)
+{
+	struct gwp_dns_entry *gde, *next;
+	struct gwp_conn_pair *gcp;
+	int r;
+
+	if (!w->ctx->dns)
+		return;
+
+	gde = gwp_dns_reap(w->ctx->dns, w->idx);
+	for (; gde; gde = next) {
+		next = gde->next;
+		gcp = gde->udata;
+		assert(gcp->gde == gde);
+		if (!(gcp->flags & GWP_CONN_FLAG_IS_CANCEL)) {
+			r = handle_ev_dns_query(w, gcp);
+			if (r)
+				shutdown_gcp(w, gcp);
+		}
+		gwp_dns_entry_put(gde);
+		put_gcp(w, gcp);
+	}
+}
+
+#ifdef CONFIG_NEW_DNS_RESOLVER
+/* Keep a recv armed on each --raw-dns server socket. */
+static void prep_raw_dns_recv(struct gwp_wrk *w, struct gwp_dns_server *srv)
+{
+	struct io_uring_sqe *s = get_sqe_nofail(w);
+
+	io_uring_prep_recv(s, srv->udp_fd, srv->rx_buf, sizeof(srv->rx_buf), 0);
+	s->user_data = PTR_TO_U64(srv) | EV_BIT_IOU_RAW_DNS_RECV;
+}
+
+__cold
+static int arm_raw_dns(struct gwp_wrk *w)
+{
+	struct gwp_dns_resolver *res = w->dns;
+	uint32_t i;
+
+	for (i = 0; res && i < res->nr_servers; i++) {
+		if (unlikely(!EV_PTR_OK(&res->servers[i]))) {
+			pr_err(&w->ctx->lh,
+			       "BUG: DNS server %p has bits 48..63 set; the event word cannot carry it",
+			       (void *)&res->servers[i]);
+			return -EOVERFLOW;
+		}
+		prep_raw_dns_recv(w, &res->servers[i]);
+	}
+	return 0;
+}
+
+static int raw_dns_query_done(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	int r = gwp_raw_dns_finish(w, gcp);
+
+	if (likely(!r))
+		return do_prep_connect(w, gcp);
+
+	return dns_query_failed(w, gcp, r);
+}
+
+/*
+ * A datagram from a DNS server. The replies of many pairs share the socket:
+ * a pair that fails is shut down here, and the recv is always re-armed.
+ */
+static int handle_ev_raw_dns_recv(struct gwp_wrk *w,
+				  struct gwp_dns_server *srv, int res)
+{
+	struct gwp_conn_pair *gcp;
+	struct gwp_dns_query *q;
+	int r;
+
+	if (res == -ECANCELED)
+		return 0;
+
+	if (res > 0 && gwp_dns_res_on_reply(w->dns, srv, srv->rx_buf,
+					    (size_t)res, &q) > 0) {
+		gcp = q->udata;
+		if (!(gcp->flags & GWP_CONN_FLAG_IS_CANCEL)) {
+			get_gcp(gcp);
+			r = raw_dns_query_done(w, gcp);
+			if (r && !(gcp->flags & GWP_CONN_FLAG_IS_CANCEL))
+				shutdown_gcp(w, gcp);
+			put_gcp(w, gcp);
+		}
+	} else if (res < 0) {
+		/* ICMP errors are left to the retransmit timer. */
+		pr_dbg(&w->ctx->lh, "Raw DNS recv (server=%s): %s",
+			ip_to_str(&srv->addr), strerror(-res));
+	}
+
+	prep_raw_dns_recv(w, srv);
+	return 0;
+}
+
+static int handle_ev_raw_dns_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	assert(gcp->gdq);
+	if (!gwp_dns_res_on_timeout(w->dns, gcp->gdq))
+		return 0;
+
+	return raw_dns_query_done(w, gcp);
+}
+#else
+static int arm_raw_dns(struct gwp_wrk __unused *w)
+{
+	return 0;
+}
+
+static int handle_ev_raw_dns_recv(struct gwp_wrk __unused *w,
+				  void __unused *srv, int __unused res)
+{
+	return -ENOSYS;
+}
+
+static int handle_ev_raw_dns_timer(struct gwp_wrk __unused *w,
+				   struct gwp_conn_pair __unused *gcp)
+{
+	return -ENOSYS;
+}
+#endif
+
+/* Keep a read armed on the worker's completion eventfd. */
+static void prep_cq_read(struct gwp_wrk *w)
+{
+	struct iou *iou = w->iou;
+	struct io_uring_sqe *s = get_sqe_nofail(w);
+
+	io_uring_prep_read(s, iou->cq_ev_fd, &iou->cq_ev_val,
+			   sizeof(iou->cq_ev_val), 0);
+	s->user_data = EV_BIT_IOU_WRK_CQ;
+}
+
+static int handle_ev_wrk_cq(struct gwp_wrk *w, int res)
+{
+	if (unlikely(res < 0 && res != -EINTR && res != -EAGAIN))
+		pr_warn(&w->ctx->lh, "Worker %u: completion eventfd read: %s",
+			w->idx, strerror(-res));
+
+	/* The eventfd is drained; a completion from here on rings again. */
+	prep_cq_read(w);
+	handle_dns_queries(w);
+#ifdef CONFIG_HTTPS
+	handle_tls_jobs(w);
+#endif
+	return 0;
+}
+
 static void prep_auth_reload(struct gwp_wrk *w)
 {
 	static const size_t l = sizeof(struct inotify_event) + NAME_MAX + 1;
@@ -2086,14 +3155,8 @@ static int handle_ev_acl_file(struct gwp_wrk *w, int res)
 	struct gwp_ctx *ctx = w->ctx;
 
 	prep_acl_reload(w);
-	if (res <= 0 || !gwp_inotify_event_matches(ctx->acl_ino_buf, (size_t)res,
-						   ctx->cfg.acl_file))
-		return 0;
-
-	if (gwp_acl_reload(ctx->acl))
-		pr_warn(&ctx->lh, "Failed to reload ACL file; keeping current rules");
-	else
-		pr_info(&ctx->lh, "Reloaded ACL file");
+	if (res > 0)
+		gwp_ctx_acl_files_changed(ctx, ctx->acl_ino_buf, (size_t)res);
 	return 0;
 }
 
@@ -2106,6 +3169,17 @@ static int handle_event(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 	const char *inv_op;
 	int r;
 
+	/*
+	 * The second completion of a zero-copy send repeats the send's own
+	 * selector; only the flag tells them apart.
+	 */
+	if (cqe->flags & IORING_CQE_F_NOTIF) {
+		pr_dbg(&ctx->lh, "Handling zero-copy notification: %d", cqe->res);
+		handle_ev_zc_notif(w, udata, ev_bit, cqe);
+		put_gcp(w, udata);
+		return 0;
+	}
+
 	/*
 	 * A racing connect carries its attempt slot in the selector, so the
 	 * completion is attributable while the conn-pair pointer stays where
@@ -2126,31 +3200,28 @@ static int handle_event(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 	switch (ev_bit) {
 	case EV_BIT_IOU_ACCEPT:
 		pr_dbg(&ctx->lh, "Handling accept event: %d", cqe->res);
-		return handle_ev_accept(w, cqe);
+		return handle_ev_accept(w, cqe, (uint32_t)PTR_TO_U64(udata));
 	case EV_BIT_IOU_ACCEPT_RETRY:
 		pr_dbg(&ctx->lh, "Handling accept retry timer: %d", cqe->res);
-		arm_accept(w);
+		w->iou->accept_retry_armed = false;
+		arm_accepts(w);
+		return 0;
+	case EV_BIT_IOU_ACCEPT_CANCEL:
+		pr_dbg(&ctx->lh, "Handling accept cancel event: %d", cqe->res);
 		return 0;
-	case EV_BIT_IOU_ATTEMPT_TIMER:
-		pr_dbg(&ctx->lh, "Handling attempt timer event: %d", cqe->res);
-		r = handle_ev_attempt_timer(w, udata, cqe->res);
-		break;
-	case EV_BIT_IOU_ATTEMPT_TIMER_DEL:
-		pr_dbg(&ctx->lh, "Handling attempt timer delete: %d", cqe->res);
-		r = 0;
-		break;
 	case EV_BIT_IOU_ATTEMPT_CANCEL:
 		pr_dbg(&ctx->lh, "Handling attempt cancel event: %d", cqe->res);
 		r = 0;
 		break;
 	case EV_BIT_IOU_TIMER:
-		pr_dbg(&ctx->lh, "Handling timer event: %d", cqe->res);
-		r = handle_ev_timer(w, udata, false, cqe->res);
-		break;
+		pr_dbg(&ctx->lh, "Handling wheel timeout: %d", cqe->res);
+		/* An update re-arms it in place; only a real expiry retires it. */
+		if (cqe->res == -ETIME)
+			w->iou->tw_armed = false;
+		return 0;
 	case EV_BIT_IOU_TIMER_DEL:
-		pr_dbg(&ctx->lh, "Handling timer event delete: %d", cqe->res);
-		r = handle_ev_timer(w, udata, true, cqe->res);
-		break;
+		pr_dbg(&ctx->lh, "Handling wheel timeout update: %d", cqe->res);
+		return 0;
 	case EV_BIT_IOU_CLIENT_RECV:
 		pr_dbg(&ctx->lh, "Handling client recv event: %d", cqe->res);
 		r = handle_ev_client_recv(w, udata, cqe);
@@ -2160,12 +3231,16 @@ static int handle_event(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 		r = handle_ev_target_recv(w, udata, cqe);
 		break;
 	case EV_BIT_IOU_CLIENT_SEND:
+	case EV_BIT_IOU_CLIENT_SEND_ZC:
 		pr_dbg(&ctx->lh, "Handling client send event: %d", cqe->res);
-		r = handle_ev_client_send(w, udata, cqe);
+		r = handle_ev_client_send(w, udata, cqe,
+					  ev_bit == EV_BIT_IOU_CLIENT_SEND_ZC);
 		break;
 	case EV_BIT_IOU_TARGET_SEND:
+	case EV_BIT_IOU_TARGET_SEND_ZC:
 		pr_dbg(&ctx->lh, "Handling target send event: %d", cqe->res);
-		r = handle_ev_target_send(w, udata, cqe);
+		r = handle_ev_target_send(w, udata, cqe,
+					  ev_bit == EV_BIT_IOU_TARGET_SEND_ZC);
 		break;
 	case EV_BIT_IOU_CLIENT_PROT:
 		pr_dbg(&ctx->lh, "Handling client protocol event: %d", cqe->res);
@@ -2221,12 +3296,23 @@ static int handle_event(struct gwp_wrk *w, struct io_uring_cqe *cqe)
 		assert(gcp->flags & GWP_CONN_FLAG_IS_CANCEL);
 		r = 0;
 		break;
-	case EV_BIT_IOU_DNS_QUERY:
-		pr_dbg(&ctx->lh, "Handling DNS query event: %d", cqe->res);
-		r = handle_ev_dns_query(w, udata);
-		break;
+	case EV_BIT_IOU_WRK_CQ:
+		pr_dbg(&ctx->lh, "Handling worker completion event: %d", cqe->res);
+		return handle_ev_wrk_cq(w, cqe->res);
+	case EV_BIT_IOU_RAW_DNS_RECV:
+		pr_dbg(&ctx->lh, "Handling raw DNS recv event: %d", cqe->res);
+		return handle_ev_raw_dns_recv(w, udata, cqe->res);
 	case EV_BIT_IOU_MSG_RING:
 		return 0;
+	case EV_BIT_IOU_LINK_SEND:
+		/* The linked recv completes with -ECANCELED and tears down. */
+		pr_dbg(&ctx->lh, "Handling failed linked send (fd=%u): %d",
+			(unsigned)PTR_TO_U64(udata), cqe->res);
+		return 0;
+	case EV_BIT_IOU_FILES_UPDATE:
+		pr_dbg(&ctx->lh, "Update io_uring file table slot %u: %s",
+			(unsigned)PTR_TO_U64(udata), strerror(-cqe->res));
+		return 0;
 	case EV_BIT_IOU_CLOSE:
 		inv_op = "close";
 		goto out_bug;
@@ -2269,12 +3355,91 @@ static int handle_events(struct gwp_wrk *w)
 	return r;
 }
 
+/*
+ * The timer wheel needs one kernel timer for the whole worker. Keep a single
+ * io_uring timeout set no later than the wheel's next deadline; pairs arm and
+ * cancel their own timers without touching the ring.
+ */
+static void arm_wheel_timeout(struct gwp_wrk *w)
+{
+	struct iou *iou = w->iou;
+	struct io_uring_sqe *s;
+	uint64_t deadline;
+	int ms;
+
+	ms = gwp_tw_next_ms(&w->tw);
+	if (ms < 0)
+		return;
+
+	deadline = w->tw.now + (uint64_t)ms;
+	if (iou->tw_armed && iou->tw_deadline <= deadline)
+		return;
+
+	iou->tw_ts.tv_sec = ms / 1000;
+	iou->tw_ts.tv_nsec = (long long)(ms % 1000) * 1000000LL;
+	s = get_sqe_nofail(w);
+	if (iou->tw_armed) {
+		io_uring_prep_timeout_update(s, &iou->tw_ts, EV_BIT_IOU_TIMER, 0);
+		s->user_data = EV_BIT_IOU_TIMER_DEL;
+	} else {
+		io_uring_prep_timeout(s, &iou->tw_ts, 0, 0);
+		s->user_data = EV_BIT_IOU_TIMER;
+		iou->tw_armed = true;
+	}
+	iou->tw_deadline = deadline;
+}
+
+/*
+ * Dispatch every wheel timer that is due. The timers hold no reference on
+ * their pair, so take one for the handler and tear the pair down on error,
+ * the same as a failed completion in handle_event().
+ */
+static int handle_timers(struct gwp_wrk *w)
+{
+	struct gwp_conn_pair *gcp;
+	struct gwp_timer *t;
+	uint64_t ev_bit;
+	int r;
+
+	while ((t = gwp_tw_expire(&w->tw, w->tw.now))) {
+		gcp = U64_TO_PTR(CLEAR_EV_BIT(t->udata));
+		ev_bit = GET_EV_BIT(t->udata);
+		if (gcp->flags & GWP_CONN_FLAG_IS_CANCEL)
+			continue;
+
+		get_gcp(gcp);
+		switch (ev_bit) {
+		case EV_BIT_TIMER:
+			r = handle_ev_timer(w, gcp);
+			break;
+		case EV_BIT_ATTEMPT_TIMER:
+			r = handle_ev_attempt_timer(w, gcp);
+			break;
+		case EV_BIT_RAW_DNS_TIMER:
+			r = handle_ev_raw_dns_timer(w, gcp);
+			break;
+		default:
+			pr_err(&w->ctx->lh, "Unknown timer bit: %" PRIu64, ev_bit);
+			put_gcp(w, gcp);
+			return -EINVAL;
+		}
+
+		if (r && !(gcp->flags & GWP_CONN_FLAG_IS_CANCEL))
+			shutdown_gcp(w, gcp);
+		put_gcp(w, gcp);
+	}
+
+	return 0;
+}
+
 static int fish_events(struct gwp_wrk *w)
 {
 	struct iou *iou = w->iou;
 	int r;
 
+	arm_wheel_timeout(w);
 	r = io_uring_submit_and_wait(&iou->ring, 1);
+	gwp_tw_set_now(&w->tw, gwp_tw_clock_ms());
 	if (unlikely(r < 0)) {
 		if (r != -EINTR) {
 			log_submit_err(w, r);
@@ -2305,23 +3470,42 @@ int gwp_ctx_thread_entry_io_uring(struct gwp_wrk *w)
 
 	pr_info(&ctx->lh, "Worker %u started (io_uring)", w->idx);
 
+	r = iou_thread_setup(w);
+	if (unlikely(r < 0))
+		return r;
+
 	if (w->idx == 0 && ctx->ino_fd >= 0)
 		prep_auth_reload(w);
 
 	if (w->idx == 0 && ctx->acl_ino_fd >= 0)
 		prep_acl_reload(w);
 
+	if (w->iou->cq_ev_fd >= 0)
+		prep_cq_read(w);
+
+	r = arm_raw_dns(w);
+	if (unlikely(r < 0))
+		return r;
+
 	io_uring_set_iowait(&w->iou->ring, false);
-	arm_accept(w);
+	arm_accepts(w);
 	while (!ctx->stop) {
+		/* As in the epoll loop: no snapshot is held across the wait. */
+		gwp_qsbr_offline(ctx->qsbr, w->idx);
 		r = fish_events(w);
+		gwp_qsbr_online(ctx->qsbr, w->idx);
 		if (unlikely(r < 0))
 			break;
 
 		r = handle_events(w);
 		if (unlikely(r < 0))
 			break;
+
+		r = handle_timers(w);
+		if (unlikely(r < 0))
+			break;
 	}
+	gwp_qsbr_offline(ctx->qsbr, w->idx);
 
 	/*
 	 * Just in case we errored out before prep_close() SQEs
@@ -2332,22 +3516,36 @@ int gwp_ctx_thread_entry_io_uring(struct gwp_wrk *w)
 	return r;
 }
 
+/*
+ * Wake every worker so it sees ctx->stop. Only the first caller sends: the
+ * flag never goes back, so one message per worker is all it takes, and the
+ * signal ring is then never used by two callers at once.
+ */
 __cold
 void gwp_ctx_signal_all_io_uring(struct gwp_ctx *ctx)
 {
-	struct gwp_wrk *we = &ctx->workers[0];
+	struct iou *iou = ctx->workers[0].iou;
+	struct io_uring *sr;
 	int i;
 
 	ctx->stop = true;
+	if (!iou || !iou->sig_ring || atomic_exchange(&iou->sig_sent, true))
+		return;
+
+	sr = iou->sig_ring;
 	for (i = 0; i < ctx->cfg.nr_workers; i++) {
-		struct io_uring_sqe *s = __get_sqe_nofail(&we->iou->ring);
+		struct io_uring_sqe *s = __get_sqe_nofail(sr);
 		struct gwp_wrk *wo = &ctx->workers[i];
-		int fd = wo->iou->ring.ring_fd;
+		int fd;
+
+		if (!s || !wo->iou)
+			continue;
+		fd = wo->iou->ring.ring_fd;
 		io_uring_prep_msg_ring(s, fd, 0, EV_BIT_IOU_MSG_RING, 0);
 		s->user_data = EV_BIT_IOU_MSG_RING;
 	}
 
-	io_uring_submit_eintr(&we->iou->ring, 8);
+	io_uring_submit_eintr(sr, 8);
 }
 
 #endif // CONFIG_IO_URING
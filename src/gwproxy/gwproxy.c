@@ -7,13 +7,16 @@
 #include <gwproxy/gwproxy.h>
 #include <gwproxy/common.h>
 #include <gwproxy/log.h>
+#include <gwproxy/dns_cache.h>
 #include <gwproxy/acl.h>
+#include <gwproxy/qsbr.h>
 #include <gwproxy/ev/epoll.h>
 #ifdef CONFIG_IO_URING
 #include <gwproxy/ev/io_uring.h>
 #endif
 #ifdef CONFIG_HTTPS
 #include <gwproxy/ssl.h>
+#include <gwproxy/tls_pool.h>
 #endif
 
 #include <stdio.h>
@@ -42,7 +45,6 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <netinet/tcp.h>
-#include <sys/timerfd.h>
 #include <sys/resource.h>
 #include <sys/inotify.h>
 
@@ -51,6 +53,28 @@
 enum {
 	OPT_ACL_ALLOW_ALL = 0x100,
 	OPT_DNS_CACHE_MAX_ENTRIES,
+	OPT_DNS_CACHE_REFRESH,
+	OPT_DNS_CACHE_STALE_SECS,
+	OPT_SPLICE,
+	OPT_IOU_BUF_RING,
+	OPT_IDLE_TIMEOUT,
+	OPT_POOL_MAX,
+	OPT_IOU_ENTRIES,
+	OPT_IOU_CQ_ENTRIES,
+	OPT_IOU_TASKRUN,
+	OPT_IOU_SQPOLL,
+	OPT_IOU_SQPOLL_CPU,
+	OPT_IOU_ATTACH_WQ,
+	OPT_IOU_WQ_MAX,
+	OPT_IOU_FIXED_FILES,
+	OPT_IOU_LINK_FORWARD,
+	OPT_ZEROCOPY_MIN,
+	OPT_TLS_KTLS,
+	OPT_TLS_TICKET_SECS,
+	OPT_TLS_SESSION_CACHE,
+	OPT_TLS_HS_THREADS,
+	OPT_RAW_DNS_TIMEOUT,
+	OPT_RAW_DNS_TRIES,
 };
 
 static const struct option long_opts[] = {
@@ -63,11 +87,14 @@ static const struct option long_opts[] = {
 	{ "udp-associate",	required_argument,	NULL,	'U' },
 	{ "prefer-ipv6",	required_argument,	NULL,	'Q' },
 	{ "protocol-timeout",	required_argument,	NULL,	'o' },
+	{ "idle-timeout",	required_argument,	NULL,	OPT_IDLE_TIMEOUT },
 	{ "auth-file",		required_argument,	NULL,	'A' },
 	{ "acl-file",		required_argument,	NULL,	'a' },
 	{ "acl-allow-all",	no_argument,		NULL,	OPT_ACL_ALLOW_ALL },
 	{ "dns-cache-secs",	required_argument,	NULL,	'L' },
 	{ "dns-cache-max-entries", required_argument,	NULL,	OPT_DNS_CACHE_MAX_ENTRIES },
+	{ "dns-cache-refresh",	required_argument,	NULL,	OPT_DNS_CACHE_REFRESH },
+	{ "dns-cache-stale-secs", required_argument,	NULL,	OPT_DNS_CACHE_STALE_SECS },
 	{ "nr-workers",		required_argument,	NULL,	'w' },
 	{ "nr-dns-workers",	required_argument,	NULL,	'W' },
 	{ "connect-timeout",	required_argument,	NULL,	'c' },
@@ -88,13 +115,34 @@ static const struct option long_opts[] = {
 	{ "bind-source",	required_argument,	NULL,	'B' },
 	{ "bind-iface",		required_argument,	NULL,	'I' },
 	{ "as-transparent",	required_argument,	NULL,	'R' },
+	{ "splice",		required_argument,	NULL,	OPT_SPLICE },
+	{ "pool-max",		required_argument,	NULL,	OPT_POOL_MAX },
+	{ "zerocopy-min",	required_argument,	NULL,	OPT_ZEROCOPY_MIN },
+#ifdef CONFIG_IO_URING
+	{ "iou-buf-ring",	required_argument,	NULL,	OPT_IOU_BUF_RING },
+	{ "iou-entries",	required_argument,	NULL,	OPT_IOU_ENTRIES },
+	{ "iou-cq-entries",	required_argument,	NULL,	OPT_IOU_CQ_ENTRIES },
+	{ "iou-taskrun",	required_argument,	NULL,	OPT_IOU_TASKRUN },
+	{ "iou-sqpoll",		required_argument,	NULL,	OPT_IOU_SQPOLL },
+	{ "iou-sqpoll-cpu",	required_argument,	NULL,	OPT_IOU_SQPOLL_CPU },
+	{ "iou-attach-wq",	required_argument,	NULL,	OPT_IOU_ATTACH_WQ },
+	{ "iou-wq-max",		required_argument,	NULL,	OPT_IOU_WQ_MAX },
+	{ "iou-fixed-files",	required_argument,	NULL,	OPT_IOU_FIXED_FILES },
+	{ "iou-link-forward",	required_argument,	NULL,	OPT_IOU_LINK_FORWARD },
+#endif
 #ifdef CONFIG_HTTPS
 	{ "tls-cert",		required_argument,	NULL,	'E' },
 	{ "tls-key",		required_argument,	NULL,	'Y' },
+	{ "tls-ktls",		required_argument,	NULL,	OPT_TLS_KTLS },
+	{ "tls-ticket-secs",	required_argument,	NULL,	OPT_TLS_TICKET_SECS },
+	{ "tls-session-cache",	required_argument,	NULL,	OPT_TLS_SESSION_CACHE },
+	{ "tls-hs-threads",	required_argument,	NULL,	OPT_TLS_HS_THREADS },
 #endif
 #ifdef CONFIG_NEW_DNS_RESOLVER
 	{ "dns-server",		required_argument,	NULL,	'j' },
 	{ "raw-dns",		required_argument,	NULL,	'r' },
+	{ "raw-dns-timeout",	required_argument,	NULL,	OPT_RAW_DNS_TIMEOUT },
+	{ "raw-dns-tries",	required_argument,	NULL,	OPT_RAW_DNS_TRIES },
 #endif
 	{ NULL,			0,			NULL,	0 }
 };
@@ -109,10 +157,13 @@ static const struct gwp_cfg default_opts = {
 	.prefer_ipv6		= false,
 	.use_raw_dns		= false,
 	.protocol_timeout	= 10,
+	.idle_timeout		= 0,
 	.auth_file		= NULL,
 	.acl_file		= NULL,
 	.dns_cache_secs		= 0,
 	.dns_cache_max_entries	= 65536,
+	.dns_cache_refresh	= 10,
+	.dns_cache_stale_secs	= 0,
 	.nr_workers		= 4,
 	.nr_dns_workers		= 4,
 	.connect_timeout	= 5,
@@ -129,11 +180,30 @@ static const struct gwp_cfg default_opts = {
 	.log_file		= "/dev/stdout",
 	.pid_file		= NULL,
 	.dns_servers		= "1.1.1.1",
+	.raw_dns_timeout	= 2000,
+	.raw_dns_tries		= 3,
 	.upstream_proxy	= NULL,
 	.mark			= 0,
 	.bind_source		= NULL,
 	.bind_iface		= NULL,
-	.as_transparent		= false
+	.as_transparent		= false,
+	.tls_ktls		= false,
+	.tls_ticket_secs	= 3600,
+	.tls_session_cache	= 0,
+	.tls_hs_threads		= 0,
+	.use_splice		= false,
+	.zerocopy_min		= 0,
+	.iou_buf_ring		= 0,
+	.iou_entries		= 1024,
+	.iou_cq_entries		= 0,
+	.iou_taskrun		= GWP_IOU_TASKRUN_COOP,
+	.iou_sqpoll		= false,
+	.iou_sqpoll_cpu		= -1,
+	.iou_attach_wq		= false,
+	.iou_wq_max		= 0,
+	.iou_fixed_files	= 0,
+	.iou_link_forward	= false,
+	.pool_max		= 256
 };
 
 __cold
@@ -151,19 +221,37 @@ static void show_help(const char *app)
 	printf("  -U, --udp-associate=0|1         Allow SOCKS5 UDP ASSOCIATE; 0 rejects it with REP 0x07 (default: %d)\n", default_opts.udp_associate);
 	printf("  -Q, --prefer-ipv6=0|1           Prefer IPv6 for proxy DNS queries (default: %d)\n", default_opts.prefer_ipv6);
 	printf("  -o, --protocol-timeout=sec      Timeout for protocol handshake process (default: %d)\n", default_opts.protocol_timeout);
+	printf("      --idle-timeout=sec          Close a forwarding connection idle this long; 0 = never (default: %d)\n", default_opts.idle_timeout);
 	printf("  -A, --auth-file=file            File with username:password credentials for SOCKS5 and HTTP auth (default: no auth)\n");
 	printf("  -a, --acl-file=file             iptables-style ACL rule file for target/client filtering\n");
 	printf("                                  (default: a built-in ACL that rejects private/loopback target ranges)\n");
 	printf("      --acl-allow-all             Do not apply the built-in default ACL (allow all; ignored with --acl-file)\n");
 	printf("  -L, --dns-cache-secs=sec        Proxy DNS cache duration in seconds (default: %d)\n", default_opts.dns_cache_secs);
 	printf("                                  Set to 0 or a negative number to disable DNS caching.\n");
-	printf("      --dns-cache-max-entries=nr  Max DNS cache entries; 0 = unlimited (default: %d)\n", default_opts.dns_cache_max_entries);
+	printf("      --dns-cache-max-entries=nr  Max DNS cache entries, then evict cold ones; 0 = unlimited (default: %d)\n", default_opts.dns_cache_max_entries);
+	printf("      --dns-cache-refresh=pct     Re-resolve a name in the background when it is hit in the last pct%% of its cache lifetime; 0 = off (default: %d)\n", default_opts.dns_cache_refresh);
+	printf("      --dns-cache-stale-secs=sec  Keep serving an expired entry this long while it is refreshed or DNS is down (default: %d)\n", default_opts.dns_cache_stale_secs);
 	printf("  -w, --nr-workers=nr             Number of worker threads (default: %d)\n", default_opts.nr_workers);
 	printf("  -W, --nr-dns-workers=nr         Number of DNS worker threads for SOCKS5 (default: %d)\n", default_opts.nr_dns_workers);
 	printf("  -c, --connect-timeout=sec       Connection to target timeout in seconds (default: %d)\n", default_opts.connect_timeout);
 	printf("  -D, --connect-attempt-delay=ms  Delay before racing the next target address (Happy Eyeballs); 0 disables racing (default: %d)\n", default_opts.connect_attempt_delay);
 	printf("  -T, --target-buf-size=nr        Target buffer size in bytes (default: %d)\n", default_opts.target_buf_size);
 	printf("  -C, --client-buf-size=nr        Client buffer size in bytes (default: %d)\n", default_opts.client_buf_size);
+	printf("      --splice=0|1                Forward plaintext connections with splice(2), epoll only (default: %d)\n", default_opts.use_splice);
+	printf("      --pool-max=nr               Free connection pairs each worker keeps for reuse; 0 = off (default: %d)\n", default_opts.pool_max);
+	printf("      --zerocopy-min=bytes        Send forwarded chunks of at least this size zero-copy; 0 = off (default: %d)\n", default_opts.zerocopy_min);
+#ifdef CONFIG_IO_URING
+	printf("      --iou-buf-ring=nr           Share a ring of nr recv buffers per worker, io_uring only; power of two, 0 = off (default: %d)\n", default_opts.iou_buf_ring);
+	printf("      --iou-entries=nr            io_uring submission queue size per worker; power of two (default: %d)\n", default_opts.iou_entries);
+	printf("      --iou-cq-entries=nr         io_uring completion queue size; power of two, 0 = twice --iou-entries (default: %d)\n", default_opts.iou_cq_entries);
+	printf("      --iou-taskrun=mode          How io_uring runs completion work: off, coop or defer (default: coop)\n");
+	printf("      --iou-sqpoll=0|1            Submit through a kernel SQPOLL thread per worker (default: %d)\n", default_opts.iou_sqpoll);
+	printf("      --iou-sqpoll-cpu=cpu        Pin worker N's SQPOLL thread to cpu + N; -1 = unpinned (default: %d)\n", default_opts.iou_sqpoll_cpu);
+	printf("      --iou-attach-wq=0|1         Attach every worker's ring to worker 0's async backend (default: %d)\n", default_opts.iou_attach_wq);
+	printf("      --iou-wq-max=nr             Cap each worker's io_uring async threads; 0 = kernel default (default: %d)\n", default_opts.iou_wq_max);
+	printf("      --iou-fixed-files=nr        Register sockets in a per-worker io_uring file table of nr slots; 0 = off (default: %d)\n", default_opts.iou_fixed_files);
+	printf("      --iou-link-forward=0|1      Link each forwarded send to the next recv, one completion per chunk (default: %d)\n", default_opts.iou_link_forward);
+#endif
 	printf("  -d, --tcp-nodelay=0|1           Enable/disable TCP_NODELAY (default: %d)\n", default_opts.tcp_nodelay);
 	printf("  -K, --tcp-quickack=0|1          Enable/disable TCP_QUICKACK (default: %d)\n", default_opts.tcp_quickack);
 	printf("  -k, --tcp-keepalive=0|1         Enable/disable TCP_KEEPALIVE (default: %d)\n", default_opts.tcp_keepalive);
@@ -187,10 +275,16 @@ static void show_help(const char *app)
 #ifdef CONFIG_HTTPS
 	printf("  -E, --tls-cert=file             PEM certificate chain; enables TLS termination on the listener (auto-detected per connection)\n");
 	printf("  -Y, --tls-key=file              PEM private key matching --tls-cert\n");
+	printf("      --tls-ktls=0|1              Hand TLS records to the kernel after the handshake when it supports the cipher (default: %d)\n", default_opts.tls_ktls);
+	printf("      --tls-ticket-secs=sec       Rotate the session ticket key every sec seconds; 0 disables tickets (default: %d)\n", default_opts.tls_ticket_secs);
+	printf("      --tls-session-cache=nr      Cache up to nr TLS sessions for ID-based resumption, shared by all workers; 0 disables (default: %d)\n", default_opts.tls_session_cache);
+	printf("      --tls-hs-threads=nr         Run TLS handshake steps on nr crypto threads instead of the workers; 0 runs them inline (default: %d)\n", default_opts.tls_hs_threads);
 #endif
 #ifdef CONFIG_NEW_DNS_RESOLVER
-	printf("  -j, --dns-server=addr:port      DNS server address (default: system resolver)\n");
-	printf("  -r, --raw-dns=0|1               Use raw DNS for SOCKS5 (default: %d)\n", default_opts.use_raw_dns);
+	printf("  -j, --dns-server=addr[:port],.. DNS servers for --raw-dns, comma separated, tried in turn (default: %s)\n", default_opts.dns_servers);
+	printf("  -r, --raw-dns=0|1               Resolve in the workers' event loops instead of the getaddrinfo() threads (default: %d)\n", default_opts.use_raw_dns);
+	printf("      --raw-dns-timeout=ms        Longest a --raw-dns try waits before asking again (default: %d)\n", default_opts.raw_dns_timeout);
+	printf("      --raw-dns-tries=nr          Tries per --raw-dns query, rotating through the servers (default: %d)\n", default_opts.raw_dns_tries);
 #endif
 	printf("\n");
 }
@@ -263,6 +357,9 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		case 'o':
 			cfg->protocol_timeout = atoi(optarg);
 			break;
+		case OPT_IDLE_TIMEOUT:
+			cfg->idle_timeout = atoi(optarg);
+			break;
 		case 'A':
 			cfg->auth_file = optarg;
 			break;
@@ -278,6 +375,12 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		case OPT_DNS_CACHE_MAX_ENTRIES:
 			cfg->dns_cache_max_entries = atoi(optarg);
 			break;
+		case OPT_DNS_CACHE_REFRESH:
+			cfg->dns_cache_refresh = atoi(optarg);
+			break;
+		case OPT_DNS_CACHE_STALE_SECS:
+			cfg->dns_cache_stale_secs = atoi(optarg);
+			break;
 		case 'w':
 			cfg->nr_workers = atoi(optarg);
 			break;
@@ -338,6 +441,54 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		case 'R':
 			cfg->as_transparent = !!atoi(optarg);
 			break;
+		case OPT_SPLICE:
+			cfg->use_splice = !!atoi(optarg);
+			break;
+		case OPT_POOL_MAX:
+			cfg->pool_max = atoi(optarg);
+			break;
+		case OPT_ZEROCOPY_MIN:
+			cfg->zerocopy_min = atoi(optarg);
+			break;
+		case OPT_IOU_BUF_RING:
+			cfg->iou_buf_ring = atoi(optarg);
+			break;
+		case OPT_IOU_ENTRIES:
+			cfg->iou_entries = atoi(optarg);
+			break;
+		case OPT_IOU_CQ_ENTRIES:
+			cfg->iou_cq_entries = atoi(optarg);
+			break;
+		case OPT_IOU_TASKRUN:
+			if (!strcmp(optarg, "off")) {
+				cfg->iou_taskrun = GWP_IOU_TASKRUN_OFF;
+			} else if (!strcmp(optarg, "coop")) {
+				cfg->iou_taskrun = GWP_IOU_TASKRUN_COOP;
+			} else if (!strcmp(optarg, "defer")) {
+				cfg->iou_taskrun = GWP_IOU_TASKRUN_DEFER;
+			} else {
+				fprintf(stderr, ERR_WRAP "Error: --iou-taskrun must be off, coop or defer\n" ERR_WRAP);
+				goto einval;
+			}
+			break;
+		case OPT_IOU_SQPOLL:
+			cfg->iou_sqpoll = !!atoi(optarg);
+			break;
+		case OPT_IOU_SQPOLL_CPU:
+			cfg->iou_sqpoll_cpu = atoi(optarg);
+			break;
+		case OPT_IOU_ATTACH_WQ:
+			cfg->iou_attach_wq = !!atoi(optarg);
+			break;
+		case OPT_IOU_WQ_MAX:
+			cfg->iou_wq_max = atoi(optarg);
+			break;
+		case OPT_IOU_FIXED_FILES:
+			cfg->iou_fixed_files = atoi(optarg);
+			break;
+		case OPT_IOU_LINK_FORWARD:
+			cfg->iou_link_forward = !!atoi(optarg);
+			break;
 #ifdef CONFIG_HTTPS
 		case 'E':
 			cfg->tls_cert = optarg;
@@ -345,6 +496,18 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		case 'Y':
 			cfg->tls_key = optarg;
 			break;
+		case OPT_TLS_KTLS:
+			cfg->tls_ktls = !!atoi(optarg);
+			break;
+		case OPT_TLS_TICKET_SECS:
+			cfg->tls_ticket_secs = atoi(optarg);
+			break;
+		case OPT_TLS_SESSION_CACHE:
+			cfg->tls_session_cache = atoi(optarg);
+			break;
+		case OPT_TLS_HS_THREADS:
+			cfg->tls_hs_threads = atoi(optarg);
+			break;
 #endif
 		case 'j':
 			cfg->dns_servers = optarg;
@@ -352,6 +515,14 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		case 'r':
 			cfg->use_raw_dns = !!atoi(optarg);
 			break;
+#ifdef CONFIG_NEW_DNS_RESOLVER
+		case OPT_RAW_DNS_TIMEOUT:
+			cfg->raw_dns_timeout = atoi(optarg);
+			break;
+		case OPT_RAW_DNS_TRIES:
+			cfg->raw_dns_tries = atoi(optarg);
+			break;
+#endif
 		default:
 			fprintf(stderr, "Unknown option: %c\n", c);
 			show_help(argv[0]);
@@ -360,21 +531,126 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 	}
 
 
-	if (cfg->use_raw_dns && ev_is_io_uring(cfg)) {
-		fprintf(stderr, ERR_WRAP "Error: The raw DNS feature is currently not supported with the io_uring event loop\n" ERR_WRAP);
+	if (cfg->use_splice && ev_is_io_uring(cfg)) {
+		fprintf(stderr, ERR_WRAP "Error: --splice is currently not supported with the io_uring event loop\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->zerocopy_min < 0) {
+		fprintf(stderr, ERR_WRAP "Error: --zerocopy-min must not be negative\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->zerocopy_min && cfg->use_splice) {
+		fprintf(stderr, ERR_WRAP "Error: --zerocopy-min cannot be combined with --splice=1\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_buf_ring && !ev_is_io_uring(cfg)) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-buf-ring requires the io_uring event loop\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_buf_ring < 0 || cfg->iou_buf_ring > 32768 ||
+	    (cfg->iou_buf_ring & (cfg->iou_buf_ring - 1))) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-buf-ring must be 0 or a power of two up to 32768\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if ((cfg->iou_sqpoll || cfg->iou_attach_wq || cfg->iou_wq_max ||
+	     cfg->iou_fixed_files || cfg->iou_link_forward) &&
+	    !ev_is_io_uring(cfg)) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-sqpoll, --iou-attach-wq, --iou-wq-max, --iou-fixed-files and --iou-link-forward require the io_uring event loop\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_fixed_files < 0 || cfg->iou_fixed_files > (1 << 20)) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-fixed-files must be between 0 and 1048576\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_entries < 1 || cfg->iou_entries > 32768 ||
+	    (cfg->iou_entries & (cfg->iou_entries - 1))) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-entries must be a power of two up to 32768\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_cq_entries &&
+	    (cfg->iou_cq_entries < cfg->iou_entries ||
+	     cfg->iou_cq_entries > 65536 ||
+	     (cfg->iou_cq_entries & (cfg->iou_cq_entries - 1)))) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-cq-entries must be 0 or a power of two from --iou-entries up to 65536\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_sqpoll && cfg->iou_taskrun == GWP_IOU_TASKRUN_DEFER) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-taskrun=defer cannot be combined with --iou-sqpoll=1\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->iou_sqpoll_cpu < -1 || cfg->iou_wq_max < 0) {
+		fprintf(stderr, ERR_WRAP "Error: --iou-sqpoll-cpu must be -1 or a CPU number, and --iou-wq-max must not be negative\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->dns_cache_refresh < 0 || cfg->dns_cache_refresh > 90) {
+		fprintf(stderr, ERR_WRAP "Error: --dns-cache-refresh must be between 0 and 90\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->dns_cache_stale_secs < 0 || cfg->dns_cache_stale_secs > 86400) {
+		fprintf(stderr, ERR_WRAP "Error: --dns-cache-stale-secs must be between 0 and 86400\n" ERR_WRAP);
+		goto einval;
+	}
+
+#ifdef CONFIG_NEW_DNS_RESOLVER
+	if (cfg->raw_dns_timeout < 50 || cfg->raw_dns_timeout > 60000) {
+		fprintf(stderr, ERR_WRAP "Error: --raw-dns-timeout must be between 50 and 60000\n" ERR_WRAP);
 		goto einval;
 	}
 
-	if (cfg->use_raw_dns && cfg->dns_cache_secs) {
-		fprintf(stderr, ERR_WRAP "Error: The -L/--dns-cache-secs option is not supported with the raw DNS feature\n" ERR_WRAP);
+	if (cfg->raw_dns_tries < 1 || cfg->raw_dns_tries > 16) {
+		fprintf(stderr, ERR_WRAP "Error: --raw-dns-tries must be between 1 and 16\n" ERR_WRAP);
 		goto einval;
 	}
 
+	if (cfg->use_raw_dns) {
+		struct gwp_sockaddr srv[GWP_DNS_RES_MAX_SERVERS];
+
+		if (gwp_dns_res_parse_servers(cfg->dns_servers, srv,
+					      GWP_DNS_RES_MAX_SERVERS) < 0) {
+			fprintf(stderr, ERR_WRAP "Error: Invalid --dns-server list '%s' (IP addresses, at most %u)\n" ERR_WRAP,
+				cfg->dns_servers, GWP_DNS_RES_MAX_SERVERS);
+			goto einval;
+		}
+	}
+#endif
+
 #ifdef CONFIG_HTTPS
 	if ((cfg->tls_cert != NULL) != (cfg->tls_key != NULL)) {
 		fprintf(stderr, ERR_WRAP "Error: --tls-cert and --tls-key must be provided together\n" ERR_WRAP);
 		goto einval;
 	}
+
+	if (cfg->tls_ktls && !cfg->tls_cert) {
+		fprintf(stderr, ERR_WRAP "Error: --tls-ktls needs --tls-cert and --tls-key\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->tls_ticket_secs < 0 || cfg->tls_session_cache < 0) {
+		fprintf(stderr, ERR_WRAP "Error: --tls-ticket-secs and --tls-session-cache must not be negative\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->tls_hs_threads < 0 || cfg->tls_hs_threads > 1024) {
+		fprintf(stderr, ERR_WRAP "Error: --tls-hs-threads must be between 0 and 1024\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->tls_hs_threads && !cfg->tls_cert) {
+		fprintf(stderr, ERR_WRAP "Error: --tls-hs-threads needs --tls-cert and --tls-key\n" ERR_WRAP);
+		goto einval;
+	}
 #endif
 
 	if (cfg->as_transparent && (cfg->as_socks5 || cfg->as_http)) {
@@ -392,6 +668,16 @@ static int parse_options(int argc, char *argv[], struct gwp_cfg *cfg)
 		goto einval;
 	}
 
+	if (cfg->idle_timeout < 0) {
+		fprintf(stderr, ERR_WRAP "Error: --idle-timeout must not be negative.\n" ERR_WRAP);
+		goto einval;
+	}
+
+	if (cfg->pool_max < 0) {
+		fprintf(stderr, ERR_WRAP "Error: --pool-max must not be negative.\n" ERR_WRAP);
+		goto einval;
+	}
+
 	if (cfg->nr_workers <= 0) {
 		fprintf(stderr, ERR_WRAP "Error: --nr-workers must be at least 1.\n" ERR_WRAP);
 		goto einval;
@@ -431,73 +717,49 @@ einval:
 static int gwp_ctx_init_raw_dns(struct gwp_wrk *w)
 {
 	struct gwp_ctx *ctx = w->ctx;
+	const struct gwp_dns_res_cfg cfg = {
+		.servers = ctx->cfg.dns_servers,
+		.timeout_ms = (uint32_t)ctx->cfg.raw_dns_timeout,
+		.nr_tries = (uint32_t)ctx->cfg.raw_dns_tries,
+	};
 	int r;
 
-	w->dns = calloc(1, sizeof(*w->dns));
-	if (!w->dns)
-		return -ENOMEM;
-
-	/*
-	 * TODO(Viro_SSFS): Support multiple DNS servers by splitting
-	 *                  ctx->cfg.dns_servers by comma.
-	 *
-	 * For now, support only one DNS server.
-	 */
-	w->dns->nr = 1;
-	w->dns->resolvers = calloc(w->dns->nr, sizeof(*w->dns->resolvers));
-	if (!w->dns->resolvers) {
-		r = -ENOMEM;
-		goto err_dns;
-	}
-
-	r = gwp_dns_res_init(ctx, &w->dns->resolvers[0], ctx->cfg.dns_servers);
+	r = gwp_dns_res_init(&w->dns, &cfg, &w->tw);
 	if (r < 0)
-		goto err_resolvers;
+		return r;
 
-	pr_dbg(&ctx->lh, "Worker %u initialized raw DNS resolver: %s (fd=%d)",
-		w->idx, ctx->cfg.dns_servers, w->dns->resolvers[0].udp_fd);
+	pr_dbg(&ctx->lh, "Worker %u initialized raw DNS resolver: %s (%u servers)",
+		w->idx, ctx->cfg.dns_servers, w->dns->nr_servers);
 	return 0;
-
-err_resolvers:
-	free(w->dns->resolvers);
-	w->dns->resolvers = NULL;
-err_dns:
-	free(w->dns);
-	w->dns = NULL;
-	return r;
 }
 
 static void gwp_ctx_free_raw_dns(struct gwp_wrk *w)
 {
-	size_t i;
-
-	if (!w->dns)
-		return;
-
-	if (w->dns->resolvers) {
-		for (i = 0; i < w->dns->nr; i++)
-			gwp_dns_res_free(&w->dns->resolvers[i]);
-		free(w->dns->resolvers);
-		w->dns->resolvers = NULL;
-	}
-
-	free(w->dns);
+	gwp_dns_res_free(w->dns);
 	w->dns = NULL;
 }
 
-static int gwp_alloc_dns_packet(struct gwp_conn_pair *gcp)
-{
-	gcp->gdp = calloc(1, sizeof(*gcp->gdp));
-	return gcp->gdp ? 0 : -ENOMEM;
-}
-
-static void gwp_free_dns_packet(struct gwp_conn_pair *gcp)
+/*
+ * A literal address needs no query. The threaded path gets this from
+ * getaddrinfo(); here it saves a round trip to the DNS server.
+ */
+static int raw_dns_literal(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			   const char *host, uint16_t port)
 {
-	if (gcp->gdp) {
-		free(gcp->gdp->host);
-		free(gcp->gdp);
-		gcp->gdp = NULL;
+	struct gwp_sockaddr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	if (inet_pton(AF_INET, host, &addr.i4.sin_addr) == 1) {
+		addr.i4.sin_family = AF_INET;
+		addr.i4.sin_port = htons(port);
+	} else if (inet_pton(AF_INET6, host, &addr.i6.sin6_addr) == 1) {
+		addr.i6.sin6_family = AF_INET6;
+		addr.i6.sin6_port = htons(port);
+	} else {
+		return -EAGAIN;
 	}
+
+	return gwp_conn_set_single_candidate(w, gcp, &addr);
 }
 
 static int gwp_raw_dns_resolve(struct gwp_wrk *w,
@@ -505,39 +767,80 @@ static int gwp_raw_dns_resolve(struct gwp_wrk *w,
 			       const char *host,
 			       const char *port)
 {
-	struct gwp_dns_resolver *res;
-	struct gwp_dns_packet *gdp;
+	struct gwp_dns_query *q;
 	int r;
 
 	assert(w->dns);
 
-	res = &w->dns->resolvers[0];
-	r = gwp_alloc_dns_packet(gcp);
-	if (r < 0)
+	r = raw_dns_literal(w, gcp, host, (uint16_t)atoi(port));
+	if (r != -EAGAIN)
 		return r;
 
-	gdp = gcp->gdp;
-	gdp->host = strdup(host);
-	if (!gdp->host) {
-		r = -ENOMEM;
-		goto out_err;
+	q = calloc(1, sizeof(*q));
+	if (unlikely(!q))
+		return -ENOMEM;
+
+	q->host = strdup(host);
+	if (unlikely(!q->host)) {
+		free(q);
+		return -ENOMEM;
 	}
 
-	gdp->restyp = w->ctx->cfg.prefer_ipv6 ?
+	q->udata = gcp;
+	q->port = (uint16_t)atoi(port);
+	q->restyp = w->ctx->cfg.prefer_ipv6 ?
 		GWP_DNS_RESTYP_PREFER_IPV6 :
 		GWP_DNS_RESTYP_PREFER_IPV4;
+	gwp_timer_init(&q->timer, PTR_TO_U64(gcp) | EV_BIT_RAW_DNS_TIMER);
 
-	gdp->port = (uint16_t)atoi(port);
-	gdp->buf_len = sizeof(gdp->buf);
-	gdp->gcp = gcp;
-	r = gwp_dns_res_prep_query(res, gdp);
-	if (r < 0)
-		goto out_err;
+	r = gwp_dns_res_start(w->dns, q);
+	if (r < 0) {
+		free(q->host);
+		free(q);
+		return r;
+	}
 
+	gcp->gdq = q;
 	return -EINPROGRESS;
+}
 
-out_err:
-	gwp_free_dns_packet(gcp);
+static void gwp_raw_dns_free_query(struct gwp_wrk *w,
+				   struct gwp_conn_pair *gcp)
+{
+	struct gwp_dns_query *q = gcp->gdq;
+
+	if (!q)
+		return;
+
+	gwp_dns_res_cancel(w->dns, q);
+	free(q->host);
+	free(q);
+	gcp->gdq = NULL;
+}
+
+int gwp_raw_dns_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_sockaddr addrs[GWP_MAX_CONN_CAND];
+	struct gwp_dns_query *q = gcp->gdq;
+	uint8_t nr;
+	int r;
+
+	assert(q);
+	nr = gwp_dns_res_collect(q, addrs, GWP_MAX_CONN_CAND);
+	r = q->err;
+	if (!r && !nr)
+		r = -EHOSTUNREACH;
+
+	/* Only a complete answer (both families) goes into the cache. */
+	if (!r && !q->pending && w->ctx->dns)
+		gwp_dns_cache_store(w->ctx->dns, q->host, addrs, nr, q->ttl);
+
+	if (!r)
+		r = gwp_conn_set_candidates(w, gcp, addrs, nr);
+
+	pr_dbg(&w->ctx->lh, "Raw DNS %s: %s (%u addr, ttl=%u)", q->host,
+		r ? strerror(-r) : ip_to_str(&gcp->target_addr), nr, q->ttl);
+	gwp_raw_dns_free_query(w, gcp);
 	return r;
 }
 #else /* #ifdef CONFIG_NEW_DNS_RESOLVER */
@@ -730,6 +1033,9 @@ static void gwp_ctx_free_thread_event(struct gwp_wrk *w)
 	}
 }
 
+static void gwp_ctx_init_thread_pools(struct gwp_wrk *w);
+static void gwp_ctx_free_thread_pools(struct gwp_wrk *w);
+
 __cold
 static int gwp_ctx_init_thread(struct gwp_wrk *w,
 			       const struct gwp_sockaddr *bind_addr)
@@ -744,6 +1050,8 @@ static int gwp_ctx_init_thread(struct gwp_wrk *w,
 		return r;
 	}
 
+	gwp_tw_init(&w->tw, gwp_tw_clock_ms());
+	gwp_ctx_init_thread_pools(w);
 
 	if (cfg->use_raw_dns) {
 		r = gwp_ctx_init_raw_dns(w);
@@ -769,7 +1077,11 @@ out_err:
 	return r;
 }
 
-static void free_conn(struct gwp_conn *conn);
+static void free_conn(struct gwp_wrk *w, struct gwp_conn *conn);
+static void gwp_pipe_pool_free(struct gwp_wrk *w);
+#ifdef CONFIG_HTTPS
+static void gwp_conn_tls_orphan(struct gwp_conn_pair *gcp);
+#endif
 
 static void log_conn_pair_close(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
@@ -795,14 +1107,20 @@ static void gwp_ctx_free_thread_sock_pairs(struct gwp_wrk *w)
 			continue;
 
 		log_conn_pair_close(w, gcp);
-		free_conn(&gcp->target);
-		free_conn(&gcp->client);
-		if (gcp->timer_fd >= 0)
-			__sys_close(gcp->timer_fd);
+		gwp_pipe_put(w, gcp->target.pipe);
+		gwp_pipe_put(w, gcp->client.pipe);
+		free_conn(w, &gcp->target);
+		free_conn(w, &gcp->client);
 		if (gcp->udp_fd >= 0)
 			__sys_close(gcp->udp_fd);
-		gwp_conn_close_attempts(gcp);
-		free(gcp->udp_iou);	/* io_uring relay scratch, else NULL */
+		gwp_conn_close_attempts(w, gcp);
+#ifdef CONFIG_HTTPS
+		gwp_conn_tls_orphan(gcp);
+#endif
+		gwp_pool_put(&w->hs_pool, gcp->hs);
+		if (gcp->udp)
+			free(gcp->udp->iou);
+		free(gcp->udp);
 
 		/*
 		 * s5_conn and http_conn share a union, so the protocol object
@@ -825,7 +1143,7 @@ static void gwp_ctx_free_thread_sock_pairs(struct gwp_wrk *w)
 #endif
 #endif
 
-		free(gcp);
+		gwp_pool_put(&w->pair_pool, gcp);
 	}
 
 	free(gcs->pairs);
@@ -854,12 +1172,18 @@ static void gwp_ctx_free_thread(struct gwp_wrk *w)
 {
 	struct gwp_cfg *cfg = &w->ctx->cfg;
 
-	if (cfg->use_raw_dns)
-		gwp_ctx_free_raw_dns(w);
-
 	gwp_ctx_free_thread_sock_pairs(w);
+	gwp_pipe_pool_free(w);
+	gwp_ctx_free_thread_pools(w);
 	gwp_ctx_free_thread_sock(w);
 	gwp_ctx_free_thread_event(w);
+
+	/*
+	 * Last: freeing the pairs cancels their queries, and on io_uring the
+	 * ring may write into the servers' receive buffers until it is gone.
+	 */
+	if (cfg->use_raw_dns)
+		gwp_ctx_free_raw_dns(w);
 }
 
 __cold
@@ -1031,6 +1355,7 @@ static int gwp_ctx_init_auth(struct gwp_ctx *ctx)
 			cfg->auth_file, strerror(-r));
 		return r;
 	}
+	gwp_auth_set_qsbr(ctx->auth, ctx->qsbr);
 
 	r = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 	if (r < 0) {
@@ -1102,9 +1427,136 @@ static const char gwp_acl_default_rules[] =
 	"-A OUTPUT -d fc00::/7 -j REJECT\n"
 	"-P OUTPUT ACCEPT\n";
 
+/* Directory watches collected by watch_acl_set(), each listed once. */
+struct acl_set_watches {
+	struct gwp_ctx	*ctx;
+	int		*wds;
+	uint32_t	nr;
+	uint32_t	cap;
+};
+
+static int acl_set_watches_add(struct acl_set_watches *sw, int wd)
+{
+	uint32_t i;
+	int *wds;
+
+	for (i = 0; i < sw->nr; i++) {
+		if (sw->wds[i] == wd)
+			return 0;
+	}
+
+	if (sw->nr == sw->cap) {
+		uint32_t cap = sw->cap ? sw->cap * 2 : 4;
+
+		wds = realloc(sw->wds, cap * sizeof(*wds));
+		if (!wds)
+			return -ENOMEM;
+		sw->wds = wds;
+		sw->cap = cap;
+	}
+	sw->wds[sw->nr++] = wd;
+	return 0;
+}
+
+/* gwp_acl_for_each_set() callback: watch an address set's file as well. */
+static int watch_acl_set(const char *path, void *arg)
+{
+	struct acl_set_watches *sw = arg;
+	struct gwp_ctx *ctx = sw->ctx;
+	int r;
+
+	r = add_reload_watch(ctx->acl_ino_fd, path);
+	if (r < 0) {
+		pr_err(&ctx->lh, "Failed to add ACL set inotify watch for '%s': %s",
+			path, strerror(-r));
+		return r;
+	}
+
+	r = acl_set_watches_add(sw, r);
+	if (r < 0)
+		pr_err(&ctx->lh, "Failed to track ACL set inotify watch for '%s': %s",
+			path, strerror(-r));
+	return r;
+}
+
+/*
+ * Watch the directories of the current rules' set files and remove the
+ * watches of directories no set lives in anymore, so sets dropped by rule
+ * reloads do not pile up watches for the life of the process. Watching a
+ * directory twice hands back the same descriptor, so the list is simply
+ * rebuilt. On failure nothing is removed: a set the walk did not reach may
+ * still need its old watch.
+ */
+static int watch_acl_sets(struct gwp_ctx *ctx)
+{
+	struct acl_set_watches sw = { .ctx = ctx };
+	uint32_t i, j;
+	int r, wd;
+
+	r = gwp_acl_for_each_set(ctx->acl, watch_acl_set, &sw);
+	for (i = 0; i < ctx->nr_acl_set_wds; i++) {
+		wd = ctx->acl_set_wds[i];
+		if (r < 0) {
+			if (acl_set_watches_add(&sw, wd) < 0) {
+				/* Keep the old list rather than lose part of it. */
+				free(sw.wds);
+				return r;
+			}
+			continue;
+		}
+
+		for (j = 0; j < sw.nr && sw.wds[j] != wd; j++)
+			;
+		if (j == sw.nr && wd != ctx->acl_wd)
+			inotify_rm_watch(ctx->acl_ino_fd, wd);
+	}
+
+	free(ctx->acl_set_wds);
+	ctx->acl_set_wds = sw.wds;
+	ctx->nr_acl_set_wds = sw.nr;
+	return r;
+}
+
+struct acl_ino_events {
+	const void	*buf;
+	size_t		len;
+};
+
+static bool acl_set_changed(const char *path, void *arg)
+{
+	struct acl_ino_events *ev = arg;
+
+	return gwp_inotify_event_matches(ev->buf, ev->len, path);
+}
+
+void gwp_ctx_acl_files_changed(struct gwp_ctx *ctx, const void *buf,
+			       size_t len)
+{
+	struct acl_ino_events ev = { buf, len };
+	int r;
+
+	if (gwp_inotify_event_matches(buf, len, ctx->cfg.acl_file)) {
+		if (gwp_acl_reload(ctx->acl)) {
+			pr_warn(&ctx->lh, "Failed to reload ACL file; keeping current rules");
+			return;
+		}
+		pr_info(&ctx->lh, "Reloaded ACL file");
+		/* The new rules may load sets from other directories. */
+		watch_acl_sets(ctx);
+		return;
+	}
+
+	r = gwp_acl_reload_sets(ctx->acl, acl_set_changed, &ev);
+	if (r < 0)
+		pr_warn(&ctx->lh, "Failed to reload an ACL set; keeping its current contents");
+	else if (r > 0)
+		pr_info(&ctx->lh, "Reloaded %d ACL set(s)", r);
+}
+
 /*
  * Load the ACL rule file (--acl-file) and watch it for changes so it is
- * hot-reloaded, mirroring the auth store. Unlike auth (prot-only), the ACL is
+ * hot-reloaded, mirroring the auth store. The address sets it loads are
+ * watched on the same inotify fd and reloaded on their own. Unlike auth (prot-only), the ACL is
  * global to every proxy mode, so this is initialised from gwp_ctx_init()
  * regardless of SOCKS5/HTTP/transparent/plain forwarding. With no file it
  * applies the built-in default ACL, unless --acl-allow-all leaves it disabled
@@ -1118,6 +1570,9 @@ static int gwp_ctx_init_acl(struct gwp_ctx *ctx)
 	ctx->acl = NULL;
 	ctx->acl_ino_fd = -1;
 	ctx->acl_ino_buf = NULL;
+	ctx->acl_wd = -1;
+	ctx->nr_acl_set_wds = 0;
+	ctx->acl_set_wds = NULL;
 
 	if (!cfg->acl_file || !*cfg->acl_file) {
 		if (cfg->acl_allow_all) {
@@ -1144,6 +1599,7 @@ static int gwp_ctx_init_acl(struct gwp_ctx *ctx)
 			cfg->acl_file, strerror(-r));
 		return r;
 	}
+	gwp_acl_set_qsbr(ctx->acl, ctx->qsbr);
 
 	r = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 	if (r < 0) {
@@ -1159,6 +1615,11 @@ static int gwp_ctx_init_acl(struct gwp_ctx *ctx)
 			strerror(-r));
 		goto out_err;
 	}
+	ctx->acl_wd = r;
+
+	r = watch_acl_sets(ctx);
+	if (r < 0)
+		goto out_err;
 
 	ctx->acl_ino_buf = malloc(sizeof(struct inotify_event) + NAME_MAX + 1);
 	if (!ctx->acl_ino_buf) {
@@ -1170,6 +1631,9 @@ static int gwp_ctx_init_acl(struct gwp_ctx *ctx)
 	return 0;
 
 out_err:
+	free(ctx->acl_set_wds);
+	ctx->acl_set_wds = NULL;
+	ctx->nr_acl_set_wds = 0;
 	if (ctx->acl_ino_fd >= 0) {
 		__sys_close(ctx->acl_ino_fd);
 		ctx->acl_ino_fd = -1;
@@ -1185,6 +1649,9 @@ static void gwp_ctx_free_acl(struct gwp_ctx *ctx)
 		free(ctx->acl_ino_buf);
 		ctx->acl_ino_buf = NULL;
 	}
+	free(ctx->acl_set_wds);
+	ctx->acl_set_wds = NULL;
+	ctx->nr_acl_set_wds = 0;
 	if (ctx->acl_ino_fd >= 0) {
 		__sys_close(ctx->acl_ino_fd);
 		ctx->acl_ino_fd = -1;
@@ -1212,14 +1679,16 @@ static int upstream_dst_from_sockaddr(const struct gwp_sockaddr *sa,
 
 /*
  * Evaluate the ACL OUTPUT chain for a connection to @target from @client (with
- * an optional requested @domain / @user). Returns the verdict; allows (with no
- * eval) when there is no ACL, or nothing to match on. When @do_dnat is set and a
+ * an optional requested @domain / @user), through @memo when one is given.
+ * Returns the verdict; allows (with no eval) when there is no ACL, or nothing
+ * to match on. When @do_dnat is set and a
  * matching -j DNAT rule produced a concrete address, the rewritten destination
  * is written back to *@target (for the direct connection and, via the caller,
  * the upstream) and *@dnat_out (when non-NULL) is set true. Composable -j MARK /
  * -j BIND modifiers are surfaced in *@so_out.
  */
 static enum gwp_acl_verdict acl_out(struct gwp_ctx *ctx,
+				    struct gwp_acl_memo *memo,
 				    const struct gwp_sockaddr *client,
 				    struct gwp_sockaddr *target,
 				    const char *domain, const char *user,
@@ -1252,7 +1721,7 @@ static enum gwp_acl_verdict acl_out(struct gwp_ctx *ctx,
 	req.dport = have_ip ? sa_port_h(target) : 0;
 	req.sport = client ? sa_port_h(client) : 0;
 
-	v = gwp_acl_eval_output(ctx->acl, &req);
+	v = gwp_acl_eval_output_memo(ctx->acl, memo, &req);
 	if (v != GWP_ACL_ACCEPT)
 		return v;
 
@@ -1285,13 +1754,14 @@ static enum gwp_acl_verdict acl_out(struct gwp_ctx *ctx,
 
 /* Verdict only (no DNAT), for the UDP relay's per-datagram target. */
 bool gwp_ctx_acl_output_allowed(struct gwp_ctx *ctx,
+				struct gwp_acl_memo *memo,
 				const struct gwp_sockaddr *client,
 				const struct gwp_sockaddr *target,
 				const char *user, enum gwp_acl_proto proto)
 {
 	struct gwp_sockaddr tmp = *target;
 
-	return acl_out(ctx, client, &tmp, NULL, user, NULL, NULL, proto,
+	return acl_out(ctx, memo, client, &tmp, NULL, user, NULL, NULL, proto,
 		       false) == GWP_ACL_ACCEPT;
 }
 
@@ -1303,7 +1773,7 @@ bool gwp_ctx_acl_output_dnat(struct gwp_ctx *ctx,
 			     struct gwp_conn_sockopt *so,
 			     enum gwp_acl_proto proto)
 {
-	return acl_out(ctx, client, target, NULL, NULL, so, NULL, proto,
+	return acl_out(ctx, NULL, client, target, NULL, NULL, so, NULL, proto,
 		       true) == GWP_ACL_ACCEPT;
 }
 
@@ -1318,13 +1788,17 @@ static const char *gcp_req_user(const struct gwp_conn_pair *gcp)
 	return NULL;
 }
 
-bool gwp_ctx_acl_target_allowed(struct gwp_ctx *ctx, struct gwp_conn_pair *gcp)
+bool gwp_ctx_acl_target_allowed(struct gwp_ctx *ctx, struct gwp_acl_memo *memo,
+				struct gwp_conn_pair *gcp)
 {
 	bool dnat = false;
 	enum gwp_acl_verdict v;
 
-	v = acl_out(ctx, &gcp->client_addr, &gcp->target_addr, gcp->req_domain,
-		    gcp_req_user(gcp), &gcp->acl_sockopt, &dnat,
+	struct gwp_conn_hs *hs = gcp->hs;
+
+	assert(hs);
+	v = acl_out(ctx, memo, &gcp->client_addr, &gcp->target_addr,
+		    hs->req_domain, gcp_req_user(gcp), &hs->acl_sockopt, &dnat,
 		    GWP_ACL_PROTO_TCP, true);
 	if (v != GWP_ACL_ACCEPT)
 		return false;
@@ -1337,18 +1811,18 @@ bool gwp_ctx_acl_target_allowed(struct gwp_ctx *ctx, struct gwp_conn_pair *gcp)
 	 * up_dst is still unset here (ver == 0) and is finalised from the
 	 * (already rewritten) target_addr after the upstream connects.
 	 */
-	if (dnat && ctx->upstream.enabled && gcp->up_dst.ver != 0) {
-		__be16 orig_port = gcp->up_dst.port;
+	if (dnat && hs->up_dst && hs->up_dst->ver != 0) {
+		__be16 orig_port = hs->up_dst->port;
 
-		upstream_dst_from_sockaddr(&gcp->target_addr, &gcp->up_dst);
+		upstream_dst_from_sockaddr(&gcp->target_addr, hs->up_dst);
 		/*
 		 * An address-only DNAT (--to <ip> with no port) has no port to
 		 * apply for a domain request (the target IP was unknown at eval
 		 * time), so target_addr carries port 0. Keep the client's
 		 * original requested port instead of connecting to :0.
 		 */
-		if (gcp->up_dst.port == 0)
-			gcp->up_dst.port = orig_port;
+		if (hs->up_dst->port == 0)
+			hs->up_dst->port = orig_port;
 	}
 
 	return true;
@@ -1406,20 +1880,36 @@ static void gwp_ctx_free_socks5(struct gwp_ctx *ctx)
 static int gwp_ctx_init_dns(struct gwp_ctx *ctx)
 {
 	struct gwp_cfg *cfg = &ctx->cfg;
-	const struct gwp_dns_cfg dns_cfg = {
+	struct gwp_dns_cfg dns_cfg = {
 		.cache_expiry = cfg->dns_cache_secs,
 		.max_entries = cfg->dns_cache_max_entries > 0 ?
 			       (uint32_t)cfg->dns_cache_max_entries : 0,
 		.restyp = cfg->prefer_ipv6 ? GWP_DNS_RESTYP_PREFER_IPV6 : 0,
-		.nr_workers = cfg->nr_dns_workers
+		.nr_workers = cfg->nr_dns_workers,
+		/* One completion queue per worker, indexed by w->idx. */
+		.nr_cq = (uint32_t)cfg->nr_workers,
+		.refresh_pct = (uint32_t)cfg->dns_cache_refresh,
+		.stale_secs = (uint32_t)cfg->dns_cache_stale_secs
 	};
 	int r;
 
-	if ((!cfg->as_socks5 && !cfg->as_http) || cfg->use_raw_dns) {
+	if (!cfg->as_socks5 && !cfg->as_http) {
 		ctx->dns = NULL;
 		return 0;
 	}
 
+	/*
+	 * --raw-dns resolves in the workers; all it may want from here is the
+	 * cache, which needs no threads.
+	 */
+	if (cfg->use_raw_dns) {
+		if (!cfg->dns_cache_secs) {
+			ctx->dns = NULL;
+			return 0;
+		}
+		dns_cfg.nr_workers = 0;
+	}
+
 	r = gwp_dns_ctx_init(&ctx->dns, &dns_cfg);
 	if (r < 0) {
 		pr_err(&ctx->lh, "Failed to initialize DNS context: %s", strerror(-r));
@@ -1429,11 +1919,37 @@ static int gwp_ctx_init_dns(struct gwp_ctx *ctx)
 	return 0;
 }
 
+/*
+ * How well the cache holds the working set. Many evictions next to a low hit
+ * rate mean --dns-cache-max-entries is too small for the names in use.
+ */
+__cold
+static void log_dns_cache_stats(struct gwp_ctx *ctx)
+{
+	struct gwp_dns_cache_stats st;
+	unsigned long total, pct;
+
+	if (gwp_dns_ctx_cache_stats(ctx->dns, &st))
+		return;
+
+	total = st.nr_hit + st.nr_miss;
+	if (!total)
+		return;
+
+	pct = st.nr_hit * 100ul / total;
+	pr_info(&ctx->lh,
+		"DNS cache: hit=%lu/%lu (%lu%%) stale=%lu refresh=%lu evict=%lu entries=%lu coalesced=%lu",
+		st.nr_hit, total, pct, st.nr_stale, st.nr_refresh,
+		st.nr_evict, st.nr_entries, st.nr_coalesced);
+}
+
 static void gwp_ctx_free_dns(struct gwp_ctx *ctx)
 {
 	if (!ctx->dns)
 		return;
 
+	log_dns_cache_stats(ctx);
+
 	gwp_dns_ctx_free(ctx->dns);
 	ctx->dns = NULL;
 	pr_dbg(&ctx->lh, "DNS context freed");
@@ -1680,24 +2196,212 @@ static int gwp_ctx_init_tls(struct gwp_ctx *ctx)
 		return r;
 	}
 
+	r = gwp_ssl_ctx_set_resumption(ctx->ssl_ctx,
+				       (unsigned int)cfg->tls_ticket_secs,
+				       (unsigned int)cfg->tls_session_cache);
+	if (r < 0) {
+		pr_err(&ctx->lh, "Failed to set up TLS session resumption: %s",
+		       strerror(-r));
+		gwp_ssl_ctx_free(ctx->ssl_ctx);
+		ctx->ssl_ctx = NULL;
+		return r;
+	}
+
+	if (cfg->tls_hs_threads > 0) {
+		r = gwp_tls_pool_init(&ctx->tls_pool,
+				      (uint32_t)cfg->tls_hs_threads,
+				      (uint32_t)cfg->nr_workers);
+		if (r < 0) {
+			pr_err(&ctx->lh, "Failed to start the TLS handshake threads: %s",
+			       strerror(-r));
+			gwp_ssl_ctx_free(ctx->ssl_ctx);
+			ctx->ssl_ctx = NULL;
+			return r;
+		}
+		pr_info(&ctx->lh, "TLS handshakes run on %d crypto threads",
+			cfg->tls_hs_threads);
+	}
+
 	pr_info(&ctx->lh, "TLS termination enabled on the listener (cert=%s)",
 		cfg->tls_cert);
 	return 0;
 }
 
+/*
+ * How often returning clients skip the full handshake. Many bad tickets mean
+ * --tls-ticket-secs is shorter than clients' reconnect interval; many cache
+ * evictions, that --tls-session-cache is too small for the client count.
+ */
 __cold
-static void gwp_ctx_free_tls(struct gwp_ctx *ctx)
+static void log_tls_resume_stats(struct gwp_ctx *ctx)
 {
-	gwp_ssl_ctx_free(ctx->ssl_ctx);
-	ctx->ssl_ctx = NULL;
+	struct gwp_ssl_resume_stats st;
+	unsigned long total, pct;
+
+	gwp_ssl_ctx_resume_stats(ctx->ssl_ctx, &st);
+	total = st.nr_full + st.nr_resumed;
+	if (!total)
+		return;
+
+	pct = st.nr_resumed * 100ul / total;
+	pr_info(&ctx->lh,
+		"TLS resumption: resumed=%lu/%lu (%lu%%) bad_ticket=%lu cache_hit=%lu cache_miss=%lu cache_evict=%lu",
+		st.nr_resumed, total, pct, st.nr_ticket_bad, st.nr_cache_hit,
+		st.nr_cache_miss, st.nr_cache_evict);
 }
-#else /* !CONFIG_HTTPS */
-static int gwp_ctx_init_tls(struct gwp_ctx *ctx)
+
+/*
+ * The crypto threads write the workers' eventfds, so they have to be gone
+ * before the workers close them. Jobs they leave behind are freed with the
+ * pool, once the workers have let go of them.
+ */
+__cold
+static void gwp_ctx_stop_tls(struct gwp_ctx *ctx)
+{
+	gwp_tls_pool_stop(ctx->tls_pool);
+}
+
+__cold
+static void gwp_ctx_free_tls(struct gwp_ctx *ctx)
+{
+	gwp_tls_pool_free(ctx->tls_pool);
+	ctx->tls_pool = NULL;
+	if (ctx->ssl_ctx)
+		log_tls_resume_stats(ctx);
+	gwp_ssl_ctx_free(ctx->ssl_ctx);
+	ctx->ssl_ctx = NULL;
+}
+
+int gwp_conn_ktls_attach(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn *c = &gcp->client;
+	int r;
+
+	if (likely(!c->tls || (gcp->flags & GWP_CONN_FLAG_NO_KTLS)))
+		return 0;
+
+	if (!w->ctx->cfg.tls_ktls || w->no_ktls) {
+		gcp->flags |= GWP_CONN_FLAG_NO_KTLS;
+		return 0;
+	}
+
+	/* Mid-record or mid-handshake: try again on the next event. */
+	if (!gwp_ssl_ktls_ready(c->tls))
+		return 0;
+
+	r = gwp_ssl_ktls_start(c->tls, c->fd);
+	if (r == -ENOENT) {
+		pr_warn(&w->ctx->lh, "Kernel TLS is not available (no \"tls\" ULP), worker %u keeps TLS in user space",
+			w->idx);
+		w->no_ktls = true;
+		gcp->flags |= GWP_CONN_FLAG_NO_KTLS;
+		return 0;
+	}
+
+	if (r == -EOPNOTSUPP) {
+		pr_dbg(&w->ctx->lh, "Kernel TLS refused this session (cfd=%d), keeping it in user space",
+		       c->fd);
+		gcp->flags |= GWP_CONN_FLAG_NO_KTLS;
+		return 0;
+	}
+
+	if (r)
+		return r;
+
+	pr_dbg(&w->ctx->lh, "TLS handed to the kernel (cfd=%d)", c->fd);
+	gwp_ssl_free(c->tls);
+	c->tls = NULL;
+	c->ktls = true;
+	return 0;
+}
+
+int gwp_conn_tls_offload(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn_hs *hs;
+	struct gwp_tls_job *job;
+
+	if (!w->ctx->tls_pool)
+		return 0;
+
+	/* The job is only tracked while the handshake runs; not in the pair. */
+	hs = gwp_conn_hs_get(w, gcp);
+	if (unlikely(!hs))
+		return -ENOMEM;
+
+	job = malloc(sizeof(*job));
+	if (unlikely(!job))
+		return -ENOMEM;
+
+	job->ssl = gcp->client.tls;
+	job->udata = gcp;
+	job->cq = w->idx;
+	hs->tls_job = job;
+	gwp_tls_pool_submit(w->ctx->tls_pool, job);
+	return 1;
+}
+
+struct gwp_tls_job *gwp_conn_tls_reap(struct gwp_wrk *w)
+{
+	struct gwp_tls_job *job, *next, *head = NULL, **tail = &head;
+
+	if (!w->ctx->tls_pool)
+		return NULL;
+
+	job = gwp_tls_pool_reap(w->ctx->tls_pool, w->idx);
+	for (; job; job = next) {
+		next = job->next;
+		if (!job->udata) {
+			gwp_tls_job_free(job);
+			continue;
+		}
+		*tail = job;
+		tail = &job->next;
+	}
+	*tail = NULL;
+	return head;
+}
+
+int gwp_conn_tls_finish(struct gwp_wrk *w, struct gwp_tls_job *job)
+{
+	struct gwp_conn_pair *gcp = job->udata;
+	int res = job->res;
+
+	if (res == GWP_SSL_ERROR)
+		pr_dbg(&w->ctx->lh, "TLS handshake failed: %s", job->err);
+
+	assert(gcp->hs && gcp->hs->tls_job == job);
+	gcp->hs->tls_job = NULL;
+	gwp_tls_job_free(job);
+	return res;
+}
+
+/*
+ * The pair goes away while a crypto thread still steps its handshake: the job
+ * takes over client.tls and frees it when it is reaped.
+ */
+static void gwp_conn_tls_orphan(struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn_hs *hs = gcp->hs;
+
+	if (likely(!hs || !hs->tls_job))
+		return;
+
+	hs->tls_job->udata = NULL;
+	hs->tls_job = NULL;
+	gcp->client.tls = NULL;
+}
+#else /* !CONFIG_HTTPS */
+static int gwp_ctx_init_tls(struct gwp_ctx *ctx)
 {
 	ctx->ssl_ctx = NULL;
 	return 0;
 }
 
+static void gwp_ctx_stop_tls(struct gwp_ctx *ctx)
+{
+	(void)ctx;
+}
+
 static void gwp_ctx_free_tls(struct gwp_ctx *ctx)
 {
 	(void)ctx;
@@ -1784,10 +2488,14 @@ static int gwp_ctx_init(struct gwp_ctx *ctx)
 	if (r < 0)
 		goto out_free_log;
 
-	r = gwp_ctx_init_prot(ctx);
+	r = gwp_qsbr_init(&ctx->qsbr, (uint32_t)ctx->cfg.nr_workers);
 	if (r < 0)
 		goto out_free_tls;
 
+	r = gwp_ctx_init_prot(ctx);
+	if (r < 0)
+		goto out_free_qsbr;
+
 	r = gwp_ctx_init_acl(ctx);
 	if (r < 0)
 		goto out_free_prot;
@@ -1810,6 +2518,8 @@ out_free_acl:
 	gwp_ctx_free_acl(ctx);
 out_free_prot:
 	gwp_ctx_free_prot(ctx);
+out_free_qsbr:
+	gwp_qsbr_free(ctx->qsbr);
 out_free_tls:
 	gwp_ctx_free_tls(ctx);
 out_free_log:
@@ -1828,41 +2538,268 @@ __cold
 static void gwp_ctx_free(struct gwp_ctx *ctx)
 {
 	gwp_ctx_stop(ctx);
+	gwp_ctx_stop_tls(ctx);
+	/*
+	 * The DNS threads write the workers' eventfds; stop them before
+	 * the workers close those.
+	 */
+	if (ctx->dns)
+		gwp_dns_ctx_stop(ctx->dns);
 	gwp_ctx_free_threads(ctx);
 	gwp_ctx_free_dns(ctx);
 	gwp_ctx_free_acl(ctx);
 	gwp_ctx_free_prot(ctx);
+	gwp_qsbr_free(ctx->qsbr);
 	gwp_ctx_free_tls(ctx);
 	gwp_ctx_free_log(ctx);
 }
 
-__cold
-static int init_conn(struct gwp_conn *conn, uint32_t buf_size)
+__hot
+static int init_conn(struct gwp_wrk *w, struct gwp_conn *conn,
+		     uint32_t buf_size)
 {
 	conn->fd = -1;
 	conn->len = 0;
 	conn->cap = buf_size;
+	conn->head = 0;
 	conn->ep_mask = 0;
-	conn->buf = NULL;
-	return posix_memalign((void **)&conn->buf, 4096, buf_size) ? -ENOMEM : 0;
+	conn->pipe = NULL;
+	conn->buf = gwp_conn_buf_get(w, buf_size);
+	return conn->buf ? 0 : -ENOMEM;
 }
 
-static void free_conn(struct gwp_conn *conn)
+static void free_conn(struct gwp_wrk *w, struct gwp_conn *conn)
 {
 	if (!conn)
 		return;
 
-	if (conn->buf)
-		free(conn->buf);
+#ifdef CONFIG_IO_URING
+	/* A buffer lent from the worker's ring is not ours to free. */
+	if (conn->pbuf_ref) {
+		conn->buf = NULL;
+		conn->pbuf_ref = 0;
+	}
+#endif
+
+	if (conn->buf) {
+		gwp_conn_buf_put(w, conn->buf, conn->cap);
+		conn->buf = NULL;
+	}
 
 	if (conn->fd >= 0)
 		__sys_close(conn->fd);
 
 	conn->len = 0;
 	conn->cap = 0;
+	conn->head = 0;
 	conn->ep_mask = 0;
 }
 
+static void buf_reverse(char *p, uint32_t n)
+{
+	char *q = p + n, c;
+
+	while (p < --q) {
+		c = *p;
+		*p++ = *q;
+		*q = c;
+	}
+}
+
+__cold
+void __gwp_conn_linearize(struct gwp_conn *conn)
+{
+	uint32_t h = conn->head;
+
+	/* Parsers only run before forwarding, and zero-copy only after. */
+	assert(!conn->zc_pinned);
+	if (h + conn->len <= conn->cap) {
+		memmove(conn->buf, conn->buf + h, conn->len);
+	} else {
+		/*
+		 * The bytes wrap: rotate the whole ring left by @head in
+		 * place. Slow, but only a parser that was handed a wrapped
+		 * buffer ever gets here.
+		 */
+		buf_reverse(conn->buf, h);
+		buf_reverse(conn->buf + h, conn->cap - h);
+		buf_reverse(conn->buf, conn->cap);
+	}
+	conn->head = 0;
+}
+
+__hot
+struct gwp_pipe *gwp_pipe_get(struct gwp_wrk *w, int *err)
+{
+	struct gwp_pipe *p;
+	int r;
+
+	if (w->nr_pipe_pool)
+		return w->pipe_pool[--w->nr_pipe_pool];
+
+	p = malloc(sizeof(*p));
+	if (unlikely(!p)) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	r = __sys_pipe2(p->fd, O_NONBLOCK | O_CLOEXEC);
+	if (unlikely(r < 0)) {
+		free(p);
+		*err = r;
+		return NULL;
+	}
+
+	p->len = 0;
+	p->full = false;
+	return p;
+}
+
+__hot
+int gwp_pipe_put(struct gwp_wrk *w, struct gwp_pipe *p)
+{
+	if (!p)
+		return 0;
+
+	/*
+	 * Bytes left in the pipe belong to the pair that just died; only an
+	 * empty pipe can be handed to the next one.
+	 */
+	if (!p->len) {
+		if (!w->pipe_pool)
+			w->pipe_pool = calloc(GWP_PIPE_POOL_MAX,
+					      sizeof(*w->pipe_pool));
+
+		if (w->pipe_pool && w->nr_pipe_pool < GWP_PIPE_POOL_MAX) {
+			p->full = false;
+			w->pipe_pool[w->nr_pipe_pool++] = p;
+			return 0;
+		}
+	}
+
+	__sys_close(p->fd[0]);
+	__sys_close(p->fd[1]);
+	free(p);
+	return 2;
+}
+
+__cold
+static void gwp_pipe_pool_free(struct gwp_wrk *w)
+{
+	while (w->nr_pipe_pool) {
+		struct gwp_pipe *p = w->pipe_pool[--w->nr_pipe_pool];
+
+		__sys_close(p->fd[0]);
+		__sys_close(p->fd[1]);
+		free(p);
+	}
+
+	free(w->pipe_pool);
+	w->pipe_pool = NULL;
+}
+
+static struct gwp_pool *conn_buf_pool(struct gwp_wrk *w, uint32_t size)
+{
+	uint8_t i;
+
+	for (i = 0; i < w->nr_buf_pool; i++) {
+		if (w->buf_pool[i].size == size)
+			return &w->buf_pool[i];
+	}
+	return NULL;
+}
+
+__hot
+void *gwp_conn_buf_get(struct gwp_wrk *w, uint32_t size)
+{
+	struct gwp_pool *p = conn_buf_pool(w, size);
+	void *buf;
+
+	if (likely(p))
+		return gwp_pool_get(p);
+
+	return posix_memalign(&buf, 4096, size) ? NULL : buf;
+}
+
+__hot
+void gwp_conn_buf_put(struct gwp_wrk *w, void *buf, uint32_t size)
+{
+	struct gwp_pool *p = conn_buf_pool(w, size);
+
+	if (likely(p))
+		gwp_pool_put(p, buf);
+	else
+		free(buf);
+}
+
+/*
+ * Each pair takes one buffer of each size, so a class shared by both sides
+ * caches twice as many buffers as there are cached pairs.
+ */
+__cold
+static void gwp_ctx_init_thread_pools(struct gwp_wrk *w)
+{
+	struct gwp_cfg *cfg = &w->ctx->cfg;
+	uint32_t max = (uint32_t)cfg->pool_max;
+	uint32_t csz = (uint32_t)cfg->client_buf_size;
+	uint32_t tsz = (uint32_t)cfg->target_buf_size;
+
+	size_t hsz = sizeof(struct gwp_conn_hs);
+
+	if (w->ctx->upstream.enabled)
+		hsz += sizeof(struct gwp_socks5_addr);
+
+	gwp_pool_init(&w->pair_pool, sizeof(struct gwp_conn_pair), 0, max);
+	gwp_pool_init(&w->hs_pool, hsz, 0, max);
+	if (csz == tsz) {
+		gwp_pool_init(&w->buf_pool[0], csz, 4096, max * 2);
+		w->nr_buf_pool = 1;
+	} else {
+		gwp_pool_init(&w->buf_pool[0], csz, 4096, max);
+		gwp_pool_init(&w->buf_pool[1], tsz, 4096, max);
+		w->nr_buf_pool = 2;
+	}
+}
+
+static void log_one_pool(struct gwp_wrk *w, const char *name,
+			 const struct gwp_pool *p)
+{
+	const struct gwp_pool_stats *st = &p->st;
+
+	pr_info(&w->ctx->lh,
+		"Worker %u pool %s: size=%zu get=%" PRIu64 " hit=%" PRIu64 " released=%" PRIu64 " peak=%u cached=%u/%u",
+		w->idx, name, p->size, st->nr_get, st->nr_hit, st->nr_release,
+		st->peak_in_use, p->nr_free, p->max_free);
+}
+
+/*
+ * How well --pool-max fits the load: a hit rate well below 100% with many
+ * releases means the mark is too low for the connection churn; a peak far
+ * below the mark means memory is being held for nothing.
+ */
+__cold
+static void log_pool_stats(struct gwp_wrk *w)
+{
+	uint8_t i;
+
+	log_one_pool(w, "pair", &w->pair_pool);
+	log_one_pool(w, "hs", &w->hs_pool);
+	for (i = 0; i < w->nr_buf_pool; i++)
+		log_one_pool(w, "buf", &w->buf_pool[i]);
+}
+
+__cold
+static void gwp_ctx_free_thread_pools(struct gwp_wrk *w)
+{
+	uint8_t i;
+
+	gwp_pool_destroy(&w->pair_pool);
+	gwp_pool_destroy(&w->hs_pool);
+	for (i = 0; i < w->nr_buf_pool; i++)
+		gwp_pool_destroy(&w->buf_pool[i]);
+	w->nr_buf_pool = 0;
+}
+
 static int expand_conn_slot(struct gwp_wrk *w)
 {
 	struct gwp_conn_slot *gcs = &w->conn_slot;
@@ -1897,9 +2834,10 @@ struct gwp_conn_pair *gwp_alloc_conn_pair(struct gwp_wrk *w)
 	if (unlikely(r))
 		return NULL;
 
-	gcp = calloc(1, sizeof(*gcp));
+	gcp = gwp_pool_get(&w->pair_pool);
 	if (!gcp)
 		return NULL;
+	memset(gcp, 0, sizeof(*gcp));
 
 	/*
 	 * Both event loops carry this pointer in the low 48 bits of the event
@@ -1911,23 +2849,21 @@ struct gwp_conn_pair *gwp_alloc_conn_pair(struct gwp_wrk *w)
 		pr_err(&ctx->lh,
 		       "BUG: connection pair %p has bits 48..63 set; the event word cannot carry it",
 		       (void *)gcp);
-		free(gcp);
+		gwp_pool_put(&w->pair_pool, gcp);
 		return NULL;
 	}
 
 	assert(cfg->target_buf_size > 1);
 	assert(cfg->client_buf_size > 1);
-	r = init_conn(&gcp->target, cfg->target_buf_size);
+	r = init_conn(w, &gcp->target, cfg->target_buf_size);
 	if (r)
 		goto out_free_gcp;
-	r = init_conn(&gcp->client, cfg->client_buf_size);
+	r = init_conn(w, &gcp->client, cfg->client_buf_size);
 	if (r)
 		goto out_free_target_conn;
 
-	gcp->timer_fd = -1;
 	gcp->udp_fd = -1;
-	gcp->attempt_timer_fd = -1;
-	memset(gcp->attempt_fd, 0xff, sizeof(gcp->attempt_fd));	/* all -1 */
+	gwp_timer_init(&gcp->timer, PTR_TO_U64(gcp) | EV_BIT_TIMER);
 	gcp->idx = gcs->nr;
 	gcp->conn_state = CONN_STATE_INIT;
 	gcs->pairs[gcs->nr++] = gcp;
@@ -1936,9 +2872,9 @@ struct gwp_conn_pair *gwp_alloc_conn_pair(struct gwp_wrk *w)
 	return gcp;
 
 out_free_target_conn:
-	free_conn(&gcp->target);
+	free_conn(w, &gcp->target);
 out_free_gcp:
-	free(gcp);
+	gwp_pool_put(&w->pair_pool, gcp);
 	pr_err(&ctx->lh, "Failed to allocate connection pair: %s", strerror(-r));
 	return NULL;
 }
@@ -1953,18 +2889,16 @@ static int shrink_conn_slot(struct gwp_wrk *w)
 	if (!gcs->pairs)
 		return 0;
 
-	if (!gcs->nr) {
-		free(gcs->pairs);
-		gcs->pairs = NULL;
-		gcs->cap = 0;
-		pr_dbg(&ctx->lh, "Connection slot capacity shrunk to 0");
-		return 0;
-	}
-
-	if (gcs->cap <= 16 || (gcs->cap - gcs->nr) < 16)
+	/*
+	 * Halve only once three quarters are unused, so a worker hovering
+	 * around a power of two does not realloc on every accept and close.
+	 * The first 16 slots are kept even when idle; the array is freed with
+	 * the worker.
+	 */
+	if (gcs->cap <= 16 || gcs->nr > gcs->cap / 4)
 		return 0;
 
-	new_cap = gcs->nr;
+	new_cap = gcs->cap / 2;
 	new_pairs = realloc(gcs->pairs, new_cap * sizeof(*new_pairs));
 	if (!new_pairs) {
 		pr_err(&ctx->lh, "Failed to shrink connection slot!");
@@ -1991,32 +2925,40 @@ int gwp_free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	log_conn_pair_close(w, gcp);
 
 	if (gcp->flags & GWP_CONN_FLAG_NO_CLOSE_FD)
-		gcp->target.fd = gcp->client.fd = gcp->timer_fd = gcp->udp_fd = -1;
+		gcp->target.fd = gcp->client.fd = gcp->udp_fd = -1;
 
 	tmp = gcs->pairs[--gcs->nr];
 	gcs->pairs[gcs->nr] = NULL;
 	gcs->pairs[i] = tmp;
 	tmp->idx = i;
 
-	free_conn(&gcp->target);
-	free_conn(&gcp->client);
+	gwp_pipe_put(w, gcp->target.pipe);
+	gwp_pipe_put(w, gcp->client.pipe);
+	free_conn(w, &gcp->target);
+	free_conn(w, &gcp->client);
 
-	if (gcp->timer_fd >= 0)
-		__sys_close(gcp->timer_fd);
+	gwp_timer_del(&w->tw, &gcp->timer);
 	if (gcp->udp_fd >= 0)
 		__sys_close(gcp->udp_fd);
-	gwp_conn_close_attempts(gcp);
+	gwp_conn_close_attempts(w, gcp);
+#ifdef CONFIG_HTTPS
+	/* Before @hs goes: it tracks a handshake step still in flight. */
+	gwp_conn_tls_orphan(gcp);
+#endif
+	gwp_pool_put(&w->hs_pool, gcp->hs);
+	if (gcp->udp)
+		free(gcp->udp->iou);
+	free(gcp->udp);
 
 #ifdef CONFIG_NEW_DNS_RESOLVER
-	if (w->ctx->cfg.use_raw_dns && gcp->gdp) {
+	if (w->ctx->cfg.use_raw_dns) {
 		/*
-		 * A raw DNS query may still be outstanding in the resolver's
-		 * session map (connection torn down before the reply arrived);
-		 * drop it so the map slot is not left dangling at this freed
-		 * gcp, then free the packet (including gdp->host).
+		 * A raw DNS query may still be in flight (connection torn down
+		 * before the reply arrived); take its transaction IDs out of
+		 * the resolver's map and its timer off the wheel so neither
+		 * points at this freed gcp.
 		 */
-		gwp_dns_res_drop_query(&w->dns->resolvers[0], gcp, gcp->gdp->txid);
-		gwp_free_dns_packet(gcp);
+		gwp_raw_dns_free_query(w, gcp);
 	} else if (gcp->gde) {
 		gwp_dns_entry_put(gcp->gde);
 	}
@@ -2041,7 +2983,7 @@ int gwp_free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 #endif
 #endif
 
-	free(gcp);
+	gwp_pool_put(&w->pair_pool, gcp);
 	shrink_conn_slot(w);
 	return 0;
 }
@@ -2268,34 +3210,36 @@ int gwp_create_sock_target(struct gwp_wrk *w, struct gwp_sockaddr *addr,
 }
 
 __hot
-int gwp_create_timer(int fd, int sec, int nsec)
-{
-	static const int flags = TFD_CLOEXEC | TFD_NONBLOCK;
-	const struct itimerspec its = {
-		.it_value.tv_sec = sec,
-		.it_value.tv_nsec = nsec,
-		.it_interval.tv_sec = 0,
-		.it_interval.tv_nsec = 0,
-	};
-	bool need_close = false;
-	int r;
+void gwp_conn_arm_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int sec)
+{
+	if (sec > 0)
+		gwp_timer_arm(&w->tw, &gcp->timer, (uint64_t)sec * 1000ull);
+	else
+		gwp_timer_del(&w->tw, &gcp->timer);
+}
 
-	if (fd < 0) {
-		fd = __sys_timerfd_create(CLOCK_MONOTONIC, flags);
-		if (fd < 0)
-			return fd;
+__hot
+void gwp_conn_start_idle_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	gwp_conn_touch(w, gcp);
+	gwp_conn_arm_timer(w, gcp, w->ctx->cfg.idle_timeout);
+}
 
-		need_close = true;
-	}
+__hot
+int gwp_conn_idle_expired(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	uint64_t limit = (uint64_t)w->ctx->cfg.idle_timeout * 1000ull;
+	uint64_t idle = w->tw.now - gcp->last_active;
 
-	r = __sys_timerfd_settime(fd, 0, &its, NULL);
-	if (r < 0) {
-		if (need_close)
-			__sys_close(fd);
-		return r;
+	if (idle < limit) {
+		gwp_timer_arm(&w->tw, &gcp->timer, limit - idle);
+		return 0;
 	}
 
-	return fd;
+	pr_info(&w->ctx->lh, "Idle timeout (idx=%u, cfd=%d, tfd=%d, ca=%s, ta=%s)",
+		gcp->idx, gcp->client.fd, gcp->target.fd,
+		ip_to_str(&gcp->client_addr), ip_to_str(&gcp->target_addr));
+	return -ETIMEDOUT;
 }
 
 static int socks5_translate_err(int err)
@@ -2379,10 +3323,13 @@ __hot
 int gwp_socks5_prep_connect_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 				  int err)
 {
-	size_t out_len = gcp->target.cap - gcp->target.len;
-	void *out = gcp->target.buf + gcp->target.len;
+	size_t out_len;
+	void *out;
 	int r;
 
+	gwp_conn_linearize(&gcp->target);
+	out_len = gcp->target.cap - gcp->target.len;
+	out = gcp->target.buf + gcp->target.len;
 	r = gwp_socks5_build_connect_reply(w, gcp, err, out, &out_len);
 	if (r < 0)
 		return r;
@@ -2394,10 +3341,10 @@ int gwp_socks5_prep_connect_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 int gwp_conn_fail_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int err)
 {
 	/*
-	 * The two event loops report a connect timeout with different errnos:
-	 * epoll's timerfd path uses -ETIMEDOUT, io_uring's timeout CQE gives
-	 * -ETIME. Normalise, or the SOCKS5 mapping below would answer the
-	 * generic REP 0x01 on io_uring instead of 0x06 (TTL expired).
+	 * A connect timeout is reported as -ETIMEDOUT, but accept -ETIME too
+	 * (what an io_uring timeout CQE carries). Normalise, or the SOCKS5
+	 * mapping below would answer the generic REP 0x01 instead of 0x06
+	 * (TTL expired).
 	 */
 	bool timed_out = (err == -ETIMEDOUT || err == -ETIME);
 
@@ -2408,10 +3355,13 @@ int gwp_conn_fail_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int err)
 		return gwp_socks5_prep_connect_reply(w, gcp, err);
 
 	if (gcp->prot_type == GWP_PROT_TYPE_HTTP) {
-		void *out = gcp->target.buf + gcp->target.len;
-		size_t cap = gcp->target.cap - gcp->target.len;
+		void *out;
+		size_t cap;
 		int r;
 
+		gwp_conn_linearize(&gcp->target);
+		out = gcp->target.buf + gcp->target.len;
+		cap = gcp->target.cap - gcp->target.len;
 		if (timed_out)
 			r = gwp_http_build_gateway_timeout_reply(out, cap);
 		else
@@ -2437,7 +3387,10 @@ int gwp_acl_reject_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		if (r)
 			return r;
 	} else if (gcp->prot_type == GWP_PROT_TYPE_HTTP) {
-		int r = gwp_http_build_forbidden_reply(
+		int r;
+
+		gwp_conn_linearize(&gcp->target);
+		r = gwp_http_build_forbidden_reply(
 				gcp->target.buf + gcp->target.len,
 				gcp->target.cap - gcp->target.len);
 
@@ -2454,7 +3407,7 @@ static int queue_dns_resolution(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	struct gwp_dns_ctx *dns = w->ctx->dns;
 	struct gwp_dns_entry *gde;
 
-	gde = gwp_dns_queue(dns, host, port);
+	gde = gwp_dns_queue(dns, host, port, w->idx, gcp);
 	if (unlikely(!gde)) {
 		pr_err(&w->ctx->lh, "Failed to allocate DNS entry for %s:%s", host, port);
 		return -ENOMEM;
@@ -2543,14 +3496,14 @@ static int upstream_dst_from_hostport(const char *hostport,
 }
 
 /*
- * Finalize gcp->up_dst (the destination requested from the upstream proxy)
+ * Finalize gcp->hs->up_dst (the destination requested from the upstream proxy)
  * right before the client handshake. If a socks5h domain was already captured
  * during protocol parsing, keep it; otherwise derive it from the resolved
  * target IP (socks5://), or from the configured --target host for plain mode
  * with socks5h://.
  */
 /*
- * Format gcp->up_dst as an HTTP authority ("host:port" or "[ipv6]:port") for an
+ * Format @dst as an HTTP authority ("host:port" or "[ipv6]:port") for an
  * upstream CONNECT request. Returns 0 on success, -EINVAL on a bad address.
  */
 int gwp_upstream_authority(const struct gwp_socks5_addr *dst, char *buf,
@@ -2586,60 +3539,118 @@ int gwp_upstream_authority(const struct gwp_socks5_addr *dst, char *buf,
 int gwp_upstream_finalize_dst(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 {
 	struct gwp_ctx *ctx = w->ctx;
+	struct gwp_socks5_addr *dst;
+
+	if (unlikely(!gcp->hs || !gcp->hs->up_dst))
+		return -EINVAL;
 
-	if (gcp->up_dst.ver != 0)
+	dst = gcp->hs->up_dst;
+	if (dst->ver != 0)
 		return 0;
 
 	if (ctx->upstream.remote_dns && !ctx->cfg.as_socks5 && !ctx->cfg.as_http)
-		return upstream_dst_from_hostport(ctx->cfg.target, &gcp->up_dst);
+		return upstream_dst_from_hostport(ctx->cfg.target, dst);
 
-	return upstream_dst_from_sockaddr(&gcp->target_addr, &gcp->up_dst);
+	return upstream_dst_from_sockaddr(&gcp->target_addr, dst);
 }
 
-int gwp_conn_close_attempts(struct gwp_conn_pair *gcp)
+__hot
+struct gwp_conn_hs *gwp_conn_hs_get(struct gwp_wrk *w,
+				    struct gwp_conn_pair *gcp)
 {
-	int n = 0;
+	struct gwp_conn_hs *hs = gcp->hs;
+
+	if (likely(hs))
+		return hs;
+
+	hs = gwp_pool_get(&w->hs_pool);
+	if (unlikely(!hs))
+		return NULL;
+
+	memset(hs, 0, w->hs_pool.size);
+	gwp_timer_init(&hs->attempt_timer,
+		       PTR_TO_U64(gcp) | EV_BIT_ATTEMPT_TIMER);
+	memset(hs->attempt_fd, 0xff, sizeof(hs->attempt_fd));	/* all -1 */
+	if (w->ctx->upstream.enabled)
+		hs->up_dst = (struct gwp_socks5_addr *)(hs + 1);
+	gcp->hs = hs;
+	return hs;
+}
+
+__hot
+void gwp_conn_hs_release(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn_hs *hs = gcp->hs;
 	uint8_t i;
 
+	gcp->flags |= GWP_CONN_FLAG_HS_DONE;
+	if (!hs)
+		return;
+
+#ifdef CONFIG_HTTPS
+	if (hs->tls_job)
+		return;
+#endif
+
 	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
-		if (gcp->attempt_fd[i] < 0)
-			continue;
-		__sys_close(gcp->attempt_fd[i]);
-		gcp->attempt_fd[i] = -1;
-		n++;
+		if (hs->attempt_fd[i] >= 0)
+			return;
 	}
 
-	if (gcp->attempt_timer_fd >= 0) {
-		__sys_close(gcp->attempt_timer_fd);
-		gcp->attempt_timer_fd = -1;
+	gwp_timer_del(&w->tw, &hs->attempt_timer);
+	gwp_pool_put(&w->hs_pool, hs);
+	gcp->hs = NULL;
+}
+
+int gwp_conn_close_attempts(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	struct gwp_conn_hs *hs = gcp->hs;
+	int n = 0;
+	uint8_t i;
+
+	if (!hs)
+		return 0;
+
+	for (i = 0; i < GWP_MAX_CONN_CAND; i++) {
+		if (hs->attempt_fd[i] < 0)
+			continue;
+		__sys_close(hs->attempt_fd[i]);
+		hs->attempt_fd[i] = -1;
 		n++;
 	}
 
+	gwp_timer_del(&w->tw, &hs->attempt_timer);
 	return n;
 }
 
-void gwp_conn_set_candidates(struct gwp_conn_pair *gcp,
-			     const struct gwp_sockaddr *addrs, uint8_t nr)
+int gwp_conn_set_candidates(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    const struct gwp_sockaddr *addrs, uint8_t nr)
 {
+	struct gwp_conn_hs *hs = gwp_conn_hs_get(w, gcp);
+
+	if (unlikely(!hs))
+		return -ENOMEM;
+
 	if (nr > GWP_MAX_CONN_CAND)
 		nr = GWP_MAX_CONN_CAND;
 
-	memcpy(gcp->cand, addrs, (size_t)nr * sizeof(*addrs));
-	gcp->nr_cand = nr;
-	gcp->next_cand = 0;
+	memcpy(hs->cand, addrs, (size_t)nr * sizeof(*addrs));
+	hs->nr_cand = nr;
+	hs->next_cand = 0;
 
 	/*
 	 * Keep target_addr meaningful for callers that read it before the
 	 * first attempt starts (logging, upstream_dst_from_sockaddr()).
 	 */
 	if (nr)
-		gcp->target_addr = gcp->cand[0];
+		gcp->target_addr = hs->cand[0];
+	return 0;
 }
 
-void gwp_conn_set_single_candidate(struct gwp_conn_pair *gcp,
-				   const struct gwp_sockaddr *addr)
+int gwp_conn_set_single_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+				  const struct gwp_sockaddr *addr)
 {
-	gwp_conn_set_candidates(gcp, addr, 1);
+	return gwp_conn_set_candidates(w, gcp, addr, 1);
 }
 
 static int prepare_target_addr_domain(struct gwp_wrk *w,
@@ -2648,10 +3659,15 @@ static int prepare_target_addr_domain(struct gwp_wrk *w,
 {
 	struct gwp_ctx *ctx = w->ctx;
 	struct gwp_cfg *cfg = &ctx->cfg;
+	struct gwp_conn_hs *hs;
 	int r;
 
+	hs = gwp_conn_hs_get(w, gcp);
+	if (unlikely(!hs))
+		return -ENOMEM;
+
 	/* Remember the requested hostname for ACL "-m domain" matching. */
-	gcp->req_domain = host;
+	hs->req_domain = host;
 
 	/*
 	 * socks5h://: don't resolve locally; hand the hostname to the upstream
@@ -2670,26 +3686,29 @@ static int prepare_target_addr_domain(struct gwp_wrk *w,
 
 		if (endp == port || *endp || !p || p > 65535)
 			return -EINVAL;
-		return upstream_dst_from_domain(host, (uint16_t)p, &gcp->up_dst);
+		return upstream_dst_from_domain(host, (uint16_t)p, hs->up_dst);
 	}
 
-	if (cfg->use_raw_dns) {
-		return gwp_raw_dns_resolve(w, gcp, host, port);
-	} else {
+	if (ctx->dns) {
 		struct gwp_sockaddr addrs[GWP_MAX_CONN_CAND];
 		uint8_t nr = 0;
 
-		r = gwp_dns_cache_lookup_list(ctx->dns, host, port, addrs,
+		r = gwp_dns_cache_lookup_list(ctx->dns, host, port, w->idx, addrs,
 					      GWP_MAX_CONN_CAND, &nr);
 		if (!r) {
-			gwp_conn_set_candidates(gcp, addrs, nr);
+			r = gwp_conn_set_candidates(w, gcp, addrs, nr);
+			if (unlikely(r))
+				return r;
 			pr_dbg(&ctx->lh, "Found %s:%s in DNS cache %s (%u addr)",
 				host, port, ip_to_str(&gcp->target_addr), nr);
 			return 0;
 		}
-
-		return queue_dns_resolution(w, gcp, host, port);
 	}
+
+	if (cfg->use_raw_dns)
+		return gwp_raw_dns_resolve(w, gcp, host, port);
+
+	return queue_dns_resolution(w, gcp, host, port);
 }
 
 static int socks5_prepare_target_addr_domain(struct gwp_wrk *w,
@@ -2727,14 +3746,12 @@ int gwp_socks5_prepare_target_addr(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		memcpy(&ta->i4.sin_addr, &dst->ip4, 4);
 		ta->i4.sin_port = dst->port;
 		ta->i4.sin_family = AF_INET;
-		gwp_conn_set_single_candidate(gcp, ta);
-		return 0;
+		return gwp_conn_set_single_candidate(w, gcp, ta);
 	case GWP_SOCKS5_ATYP_IPV6:
 		memcpy(&ta->i6.sin6_addr, &dst->ip6, 16);
 		ta->i6.sin6_port = dst->port;
 		ta->i6.sin6_family = AF_INET6;
-		gwp_conn_set_single_candidate(gcp, ta);
-		return 0;
+		return gwp_conn_set_single_candidate(w, gcp, ta);
 	case GWP_SOCKS5_ATYP_DOMAIN:
 		return socks5_prepare_target_addr_domain(w, gcp);
 	}
@@ -2751,6 +3768,8 @@ int gwp_socks5_handle_data(struct gwp_conn_pair *gcp)
 
 	assert(sc);
 
+	gwp_conn_linearize(&gcp->client);
+	gwp_conn_linearize(&gcp->target);
 	in = gcp->client.buf;
 	in_len = gcp->client.len;
 	out = gcp->target.buf + gcp->target.len;
@@ -2856,10 +3875,11 @@ enum gwp_udp_act gwp_udp_relay_classify(struct gwp_wrk *w,
 					const struct gwp_sockaddr *src,
 					struct gwp_udp_out *out)
 {
+	struct gwp_conn_udp *udp = gcp->udp;
 	bool client_dgram;
 
-	if (gcp->udp_pinned) {
-		client_dgram = gwp_sockaddr_eq(src, &gcp->udp_peer);
+	if (udp->pinned) {
+		client_dgram = gwp_sockaddr_eq(src, &udp->peer);
 	} else {
 		/*
 		 * Until the client is pinned nothing can be relayed back, so
@@ -2869,8 +3889,8 @@ enum gwp_udp_act gwp_udp_relay_classify(struct gwp_wrk *w,
 		 */
 		if (!gwp_sockaddr_ip_eq(src, &gcp->client_addr))
 			return GWP_UDP_DROP;
-		gcp->udp_peer = *src;
-		gcp->udp_pinned = true;
+		udp->peer = *src;
+		udp->pinned = true;
 		client_dgram = true;
 	}
 
@@ -2885,7 +3905,8 @@ enum gwp_udp_act gwp_udp_relay_classify(struct gwp_wrk *w,
 			return GWP_UDP_DROP;
 		if (gwp_socks5_addr_to_sockaddr(&dst, &tsa, &tslen))
 			return GWP_UDP_DROP;	/* domain target: unsupported */
-		if (!gwp_ctx_acl_output_allowed(w->ctx, &gcp->udp_peer, &tsa,
+		if (!gwp_ctx_acl_output_allowed(w->ctx, &udp->acl_memo,
+						&udp->peer, &tsa,
 						gcp_req_user(gcp),
 						GWP_ACL_PROTO_UDP))
 			return GWP_UDP_DROP;	/* ACL denied this datagram */
@@ -2904,11 +3925,11 @@ enum gwp_udp_act gwp_udp_relay_classify(struct gwp_wrk *w,
 						     : 3 + 1 + 16 + 2;
 		if (gwp_socks5_udp_build_hdr(&sa, base - h, h, &hlen))
 			return GWP_UDP_DROP;
-		/* The relay is dual-stack, so udp_peer is always AF_INET6. */
+		/* The relay is dual-stack, so the peer is always AF_INET6. */
 		out->buf = base - h;
 		out->len = h + n;
-		out->dst = gcp->udp_peer;
-		out->dstlen = sizeof(gcp->udp_peer.i6);
+		out->dst = udp->peer;
+		out->dstlen = sizeof(udp->peer.i6);
 		return GWP_UDP_TO_CLIENT;
 	}
 }
@@ -3017,6 +4038,12 @@ int gwp_socks5_udp_associate_setup(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		goto reply;
 	}
 
+	gcp->udp = calloc(1, sizeof(*gcp->udp));
+	if (!gcp->udp) {
+		rep = GWP_SOCKS5_REP_FAILURE;
+		goto reply;
+	}
+
 	fd = __sys_socket(AF_INET6, type, 0);
 	if (fd < 0) {
 		pr_err(&ctx->lh, "UDP associate: socket() failed: %s", strerror(-fd));
@@ -3067,6 +4094,7 @@ int gwp_socks5_udp_associate_setup(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		gcp->idx, gcp->client.fd, fd);
 
 reply:
+	gwp_conn_linearize(&gcp->target);
 	out_len = gcp->target.cap - gcp->target.len;
 	r = gwp_socks5_conn_cmd_udp_associate_res(gcp->s5_conn,
 			(rep == GWP_SOCKS5_REP_SUCCESS) ? &bnd : NULL, rep,
@@ -3125,8 +4153,11 @@ int gwp_handle_conn_state_socks5(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
  */
 static int http_reject_unauthorized(struct gwp_conn_pair *gcp)
 {
-	int r = gwp_http_build_auth_required_reply(gcp->target.buf + gcp->target.len,
-						   gcp->target.cap - gcp->target.len);
+	int r;
+
+	gwp_conn_linearize(&gcp->target);
+	r = gwp_http_build_auth_required_reply(gcp->target.buf + gcp->target.len,
+					       gcp->target.cap - gcp->target.len);
 	if (r < 0)
 		return -ENOBUFS;
 
@@ -3143,8 +4174,11 @@ static int http_reject_unauthorized(struct gwp_conn_pair *gcp)
  */
 static int http_reject_too_large(struct gwp_conn_pair *gcp)
 {
-	int r = gwp_http_build_too_large_reply(gcp->target.buf + gcp->target.len,
-					       gcp->target.cap - gcp->target.len);
+	int r;
+
+	gwp_conn_linearize(&gcp->target);
+	r = gwp_http_build_too_large_reply(gcp->target.buf + gcp->target.len,
+					   gcp->target.cap - gcp->target.len);
 	if (r < 0)
 		return -E2BIG;
 
@@ -3163,6 +4197,7 @@ static int http_inject_forward_request(struct gwp_conn_pair *gcp,
 	if (req_len > (size_t)(gcp->client.cap - gcp->client.len))
 		return -E2BIG;
 
+	gwp_conn_linearize(&gcp->client);
 	if (gcp->client.len)
 		memmove(gcp->client.buf + req_len, gcp->client.buf, gcp->client.len);
 	memcpy(gcp->client.buf, req, req_len);
@@ -3210,6 +4245,7 @@ int gwp_handle_conn_state_http(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		return -EINVAL;
 	}
 
+	gwp_conn_linearize(&gcp->client);
 	in_len = gcp->client.len;
 	r = gwp_http_conn_process(gcp->http_conn, ctx->auth, gcp->client.buf,
 				  &in_len, &host, &port, &req, &req_len);
@@ -3313,6 +4349,7 @@ static void *gwp_ctx_thread_entry(void *arg)
 
 	ctx->stop = true;
 	gwp_ctx_signal_all_workers(ctx);
+	log_pool_stats(w);
 	pr_info(&ctx->lh, "Worker %u stopped", w->idx);
 	return (void *)(intptr_t)r;
 }
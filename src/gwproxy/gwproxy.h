@@ -16,6 +16,8 @@
 #include <gwproxy/dns.h>
 #include <gwproxy/acl.h>
 #include <gwproxy/log.h>
+#include <gwproxy/timer.h>
+#include <gwproxy/pool.h>
 #include <assert.h>
 #ifdef CONFIG_IO_URING
 #include <liburing.h>
@@ -34,9 +36,12 @@
  */
 struct gwp_ssl_ctx;
 struct gwp_ssl;
+struct gwp_tls_pool;
+struct gwp_tls_job;
 struct gwp_iou_tls;
 struct gwp_iou_udp;
 struct gwp_acl;
+struct gwp_qsbr;
 
 struct gwp_cfg {
 	const char	*event_loop;
@@ -48,11 +53,20 @@ struct gwp_cfg {
 	bool		prefer_ipv6;
 	bool		use_raw_dns;
 	int		protocol_timeout;
+	/*
+	 * Close a forwarding pair after this many seconds without traffic in
+	 * either direction; 0 disables it.
+	 */
+	int		idle_timeout;
 	const char	*auth_file;
 	const char	*acl_file;
 	bool		acl_allow_all;	/* skip the built-in default ACL */
 	int		dns_cache_secs;
 	int		dns_cache_max_entries;	/* cap; <=0 = unlimited */
+	/* Refresh-ahead share of the lifetime, in percent; 0 = off. */
+	int		dns_cache_refresh;
+	/* How long an expired entry still serves while it is refreshed. */
+	int		dns_cache_stale_secs;
 	int		nr_workers;
 	int		nr_dns_workers;
 	int		connect_timeout;
@@ -74,6 +88,9 @@ struct gwp_cfg {
 	const char	*log_file;
 	const char	*pid_file;
 	const char	*dns_servers;
+	/* --raw-dns: per-try timeout ceiling in ms, and tries per query. */
+	int		raw_dns_timeout;
+	int		raw_dns_tries;
 	const char	*upstream_proxy;
 	int		mark;
 	/*
@@ -87,10 +104,83 @@ struct gwp_cfg {
 	bool		as_transparent;
 	const char	*tls_cert;
 	const char	*tls_key;
+	/*
+	 * --tls-ktls: once a TLS handshake is done and OpenSSL holds no
+	 * buffered record in either direction, hand the session keys to the
+	 * kernel (TCP_ULP "tls") and forward that client as a plain socket.
+	 */
+	bool		tls_ktls;
+	/*
+	 * TLS session resumption: ticket key rotation period in seconds (0 =
+	 * no tickets) and the size of the shared session ID cache (0 = none).
+	 */
+	int		tls_ticket_secs;
+	int		tls_session_cache;
+	/*
+	 * Crypto threads that run TLS handshake steps for the workers; 0 runs
+	 * them inline on the worker.
+	 */
+	int		tls_hs_threads;
+	/*
+	 * Forward plaintext pairs with splice(2) through a pipe instead of
+	 * copying through the per-connection buffers (epoll only).
+	 */
+	bool		use_splice;
+	/*
+	 * Forwarded chunks of at least this many bytes are sent zero-copy
+	 * (MSG_ZEROCOPY on epoll, IORING_OP_SEND_ZC on io_uring); 0 = off.
+	 */
+	int		zerocopy_min;
+	/*
+	 * Number of buffers in each worker's io_uring provided-buffer ring
+	 * (power of two, 0 = off). Plaintext forwarding recvs then borrow a
+	 * ring buffer instead of each connection owning its own.
+	 */
+	int		iou_buf_ring;
+	/*
+	 * io_uring ring setup, per worker: SQ and CQ sizes (CQ 0 = twice the
+	 * SQ), how completion task work is run (GWP_IOU_TASKRUN_*), an
+	 * optional SQPOLL thread (pinned from @iou_sqpoll_cpu, -1 = anywhere),
+	 * whether the rings attach to worker 0's async backend, and a cap on
+	 * each worker's io-wq threads (0 = kernel default).
+	 */
+	int		iou_entries;
+	int		iou_cq_entries;
+	int		iou_taskrun;
+	bool		iou_sqpoll;
+	int		iou_sqpoll_cpu;
+	bool		iou_attach_wq;
+	int		iou_wq_max;
+	/*
+	 * Slots in each worker's registered file table (0 = off). A client or
+	 * target socket whose fd is below it is used through IOSQE_FIXED_FILE.
+	 */
+	int		iou_fixed_files;
+	/*
+	 * Queue each forwarded send linked ahead of the next recv on the same
+	 * buffer, so a chunk costs one completion instead of two.
+	 */
+	bool		iou_link_forward;
+	/*
+	 * Free connection pairs (and their buffers) each worker keeps for
+	 * reuse instead of returning them to libc. 0 disables caching.
+	 */
+	int		pool_max;
 };
 
 struct gwp_ctx;
 
+enum {
+	GWP_IOU_TASKRUN_OFF	= 0,
+	/* IORING_SETUP_COOP_TASKRUN: no IPI to interrupt a running worker. */
+	GWP_IOU_TASKRUN_COOP	= 1,
+	/*
+	 * IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN: completions
+	 * are only run when the worker waits for them.
+	 */
+	GWP_IOU_TASKRUN_DEFER	= 2,
+};
+
 enum {
 	GWP_UPSTREAM_SOCKS5	= 0,
 	GWP_UPSTREAM_HTTP	= 1,
@@ -130,15 +220,24 @@ enum {
 	EV_BIT_EVENTFD			= (2ull << 48ull),
 	EV_BIT_TARGET			= (3ull << 48ull),
 	EV_BIT_CLIENT			= (4ull << 48ull),
+	/*
+	 * A connection timer on the worker's timer wheel (see timer.h) fired.
+	 * Timers carry their event word, so an expired one is dispatched like
+	 * any I/O event; no descriptor stands behind it.
+	 */
 	EV_BIT_TIMER			= (5ull << 48ull),
 	EV_BIT_CLIENT_SOCKS5		= (6ull << 48ull),
-	EV_BIT_DNS_QUERY		= (7ull << 48ull),
+	/*
+	 * 7 was the per-query DNS eventfd; resolved queries now come back on
+	 * the worker's completion queue (EV_BIT_EVENTFD, EV_BIT_IOU_WRK_CQ).
+	 */
 	EV_BIT_SOCKS5_AUTH_FILE		= (8ull << 48ull),
 
 	/*
-	 * Raw DNS resolver socket (--raw-dns), epoll only. Values 9-21 belong
-	 * to the io_uring selectors below, so use 26 -- this used to be 19,
-	 * which is EV_BIT_IOU_TLS_HS_SEND.
+	 * A raw DNS resolver socket (--raw-dns); the low bits hold its
+	 * struct gwp_dns_server, not a pair. Values 9-21 belong to the io_uring
+	 * selectors below, so use 26 -- this used to be 19, which is
+	 * EV_BIT_IOU_TLS_HS_SEND.
 	 */
 	EV_BIT_RAW_DNS_QUERY		= (26ull << 48ull),
 
@@ -176,15 +275,26 @@ enum {
 	/* Fires when it is time to start the next attempt in the race. */
 	EV_BIT_ATTEMPT_TIMER		= (48ull << 48ull),
 
+	/*
+	 * A --raw-dns query's retransmit timer (gwp_dns_query::timer). 50-55
+	 * are io_uring selectors below, so use 56.
+	 */
+	EV_BIT_RAW_DNS_TIMER		= (56ull << 48ull),
+
 	EV_BIT_CLIENT_PROT		= (1000ull << 48ull),
 
 #ifdef CONFIG_IO_URING
 	/*
 	 * Only used by io_uring.
 	 */
-	EV_BIT_IOU_DNS_QUERY		= EV_BIT_DNS_QUERY,
 	EV_BIT_IOU_SOCKS5_AUTH_FILE	= EV_BIT_SOCKS5_AUTH_FILE,
+	/*
+	 * The one io_uring timeout that wakes the worker for its timer wheel.
+	 * It carries no pair pointer; EV_BIT_IOU_TIMER_DEL acknowledges the
+	 * update that pulls it in when an earlier timer is armed.
+	 */
 	EV_BIT_IOU_TIMER		= EV_BIT_TIMER,
+	/* The low bits hold the index of the accept in iou->accept[]. */
 	EV_BIT_IOU_ACCEPT		= EV_BIT_ACCEPT,
 	EV_BIT_IOU_CLIENT_PROT		= EV_BIT_CLIENT_SOCKS5,
 	EV_BIT_IOU_CLIENT_RECV		= EV_BIT_CLIENT,
@@ -212,19 +322,44 @@ enum {
 	EV_BIT_IOU_UDP_TX		= (23ull << 48ull),
 	EV_BIT_IOU_UDP_CANCEL		= (24ull << 48ull),
 	EV_BIT_IOU_ACL_FILE		= EV_BIT_ACL_FILE,
+	/* The recv kept armed on each raw DNS server socket. */
+	EV_BIT_IOU_RAW_DNS_RECV		= EV_BIT_RAW_DNS_QUERY,
 
 	/*
-	 * Happy Eyeballs on io_uring. The attempt-delay timeout shares the
-	 * generic EV_BIT_ATTEMPT_TIMER selector, but it needs a removal key
-	 * distinct from the connect timer's (EV_BIT_IOU_TIMER | gcp): the two
-	 * are live at the same time, and io_uring_prep_timeout_remove()
-	 * addresses a timeout solely by its user_data. A losing attempt's
-	 * socket is retired with its own cancel selector so the completion is
-	 * not mistaken for the adopted target's.
+	 * Happy Eyeballs on io_uring. A losing attempt's socket is retired
+	 * with its own cancel selector so the completion is not mistaken for
+	 * the adopted target's. 49 was the attempt-delay timeout's removal
+	 * key, before the delay moved onto the timer wheel.
 	 */
-	EV_BIT_IOU_ATTEMPT_TIMER	= EV_BIT_ATTEMPT_TIMER,
-	EV_BIT_IOU_ATTEMPT_TIMER_DEL	= (49ull << 48ull),
 	EV_BIT_IOU_ATTEMPT_CANCEL	= (50ull << 48ull),
+
+	/* Ends the armed accepts when accepting is paused. */
+	EV_BIT_IOU_ACCEPT_CANCEL	= (51ull << 48ull),
+
+	/*
+	 * A zero-copy send (--zerocopy-min). Both its completions carry the
+	 * selector: the send result, then the IORING_CQE_F_NOTIF one.
+	 */
+	EV_BIT_IOU_TARGET_SEND_ZC	= (52ull << 48ull),
+	EV_BIT_IOU_CLIENT_SEND_ZC	= (53ull << 48ull),
+
+	/*
+	 * A send linked ahead of the next recv (--iou-link-forward). It only
+	 * completes when it fails; the low bits hold the fd, not a pair.
+	 */
+	EV_BIT_IOU_LINK_SEND		= (54ull << 48ull),
+
+	/*
+	 * The read on the worker's completion eventfd: resolved DNS queries
+	 * and, with --tls-hs-threads, finished handshake steps.
+	 */
+	EV_BIT_IOU_WRK_CQ		= (55ull << 48ull),
+
+	/*
+	 * An --iou-fixed-files slot update. It only completes when it fails;
+	 * the low bits hold the fd. 56 is EV_BIT_RAW_DNS_TIMER.
+	 */
+	EV_BIT_IOU_FILES_UPDATE		= (57ull << 48ull),
 #endif
 };
 
@@ -318,12 +453,63 @@ enum {
 	CONN_STATE_TLS_MAX		= 699,
 };
 
+/*
+ * A pipe that carries one forwarding direction in --splice mode: bytes move
+ * from the source socket into @fd[1] and out of @fd[0] to the peer without
+ * ever being copied to user space. @len counts what sits in the pipe not yet
+ * written to the peer. @full is set when the pipe refused more input while it
+ * still held data, so the source stops polling for EPOLLIN until it drains;
+ * the byte count alone cannot tell, as a pipe runs out of slots before bytes.
+ */
+struct gwp_pipe {
+	int		fd[2];
+	uint32_t	len;
+	bool		full;
+};
+
+/* Idle pipes each worker keeps for reuse in --splice mode. */
+#define GWP_PIPE_POOL_MAX	64u
+
+/*
+ * @buf is a ring of @cap bytes: the @len buffered bytes start at @head and
+ * wrap at @cap, so consuming a prefix (gwp_conn_buf_advance()) moves @head
+ * instead of the remaining bytes. An empty ring is always reset to @head 0,
+ * hence code that fills a fresh buffer and parses it sees plain linear
+ * memory. Code that needs the buffered bytes contiguous at @buf (protocol
+ * parsers, fixed-offset appends) calls gwp_conn_linearize() first.
+ */
 struct gwp_conn {
 	int		fd;
 	uint32_t	len;
 	uint32_t	cap;
+	uint32_t	head;
 	char		*buf;
-	uint32_t	ep_mask;
+	/*
+	 * Bytes just behind @head that a zero-copy send still has in flight:
+	 * sent, but the kernel reads them out of @buf until it posts the
+	 * completion, so they are not free space either. 0 when no zero-copy
+	 * send from this buffer is outstanding.
+	 */
+	uint32_t	zc_pinned;
+	/*
+	 * A worker runs one event loop, so each of these belongs to a loop
+	 * the other never touches, and both read 0 as idle: init_conn() and
+	 * free_conn() reset either by clearing @ep_mask.
+	 *
+	 * @ep_mask: only ever EPOLLIN, EPOLLOUT and EPOLLRDHUP.
+	 *
+	 * @pbuf_ref: --iou-buf-ring: one more than the provided-buffer id
+	 * @buf is lent from, or 0 when @buf is privately owned (or NULL). A
+	 * lent buffer belongs to the worker's buffer ring and is handed back,
+	 * not freed, once its bytes have been sent. The ring holds at most
+	 * 32768 buffers, so the id always fits.
+	 */
+	union {
+		uint16_t	ep_mask;
+#ifdef CONFIG_IO_URING
+		uint16_t	pbuf_ref;
+#endif
+	};
 
 	/*
 	 * Half-close bookkeeping for the forwarding path. @rd_eof is set once
@@ -332,9 +518,16 @@ struct gwp_conn {
 	 * this fd's write side (propagated the peer's EOF towards it). The
 	 * connection pair is torn down only after both directions have been
 	 * fully drained and shut, so no buffered data is dropped on close.
+	 *
+	 * @ktls: the kernel does the TLS record layer on @fd (--tls-ktls):
+	 * @tls is gone, reads and writes carry plaintext, but MSG_ZEROCOPY
+	 * and MSG_WAITALL sends are refused and a read that hits a non-data
+	 * record (close_notify, an alert) fails with EIO.
+	 *
+	 * All three share one byte; a byte of its own for @ktls would cost
+	 * every pair 16 bytes of padding.
 	 */
-	bool		rd_eof;
-	bool		wr_shut;
+	bool		rd_eof : 1, wr_shut : 1, ktls : 1;
 
 	/*
 	 * TLS state for this endpoint (HTTPS proxy). NULL for a plaintext
@@ -344,6 +537,13 @@ struct gwp_conn {
 	 * gwp_free_conn_pair().
 	 */
 	struct gwp_ssl	*tls;
+
+	/*
+	 * --splice: the pipe this endpoint's inbound bytes are spliced into on
+	 * their way to the peer, NULL when forwarding through @buf. Bytes
+	 * already in @buf when the pipe is attached are flushed ahead of it.
+	 */
+	struct gwp_pipe	*pipe;
 };
 
 enum {
@@ -360,6 +560,48 @@ enum {
 	 * attempt, and a local would only remember the most recent walk.
 	 */
 	GWP_CONN_FLAG_ACL_CAND_OK	= (1ull << 3ull),
+	/*
+	 * --splice could not be set up for this pair (TLS on an endpoint, or
+	 * no pipe to be had); it forwards through its buffers for good.
+	 */
+	GWP_CONN_FLAG_NO_SPLICE		= (1ull << 4ull),
+	/*
+	 * The pair is forwarding and has no use for its connect state any
+	 * more; gcp->hs goes as soon as no connect attempt is in flight.
+	 */
+	GWP_CONN_FLAG_HS_DONE		= (1ull << 5ull),
+	/*
+	 * --zerocopy-min: the pair's sockets are set up for zero-copy sends
+	 * (GWP_CONN_FLAG_ZC), or it copies for good (GWP_CONN_FLAG_NO_ZC):
+	 * TLS on an endpoint, SO_ZEROCOPY refused, or the kernel reported
+	 * that it copied a zero-copy send anyway (loopback, a device without
+	 * scatter-gather), where asking again only adds the completion cost.
+	 */
+	GWP_CONN_FLAG_ZC		= (1ull << 6ull),
+	GWP_CONN_FLAG_NO_ZC		= (1ull << 7ull),
+	/*
+	 * epoll: the pair is finished but a zero-copy send still pins one of
+	 * its buffers, so it lingers (off epoll) until the completion is in.
+	 */
+	GWP_CONN_FLAG_ZC_LINGER		= (1ull << 8ull),
+	/*
+	 * io_uring: the notification of a zero-copy send out of client.buf
+	 * (_C) or target.buf (_T) is still to come. One at a time per buffer.
+	 */
+	GWP_CONN_FLAG_ZC_NOTIF_C	= (1ull << 9ull),
+	GWP_CONN_FLAG_ZC_NOTIF_T	= (1ull << 10ull),
+	/*
+	 * io_uring: the recv in flight for the client (_C) or the target (_T)
+	 * is linked behind a send of everything in its buffer; its completion
+	 * means that send went out whole.
+	 */
+	GWP_CONN_FLAG_LINK_C		= (1ull << 11ull),
+	GWP_CONN_FLAG_LINK_T		= (1ull << 12ull),
+	/*
+	 * --tls-ktls: the client's TLS stays in user space for good (the
+	 * cipher or the kernel said no); stop trying to hand it over.
+	 */
+	GWP_CONN_FLAG_NO_KTLS		= (1ull << 13ull),
 };
 
 enum {
@@ -368,8 +610,6 @@ enum {
 	GWP_PROT_TYPE_HTTP	= 2,
 };
 
-struct gwp_dns_packet;
-
 /*
  * Per-connection socket options that the ACL OUTPUT chain can impose on the
  * outgoing target socket (composable -j MARK / -j BIND modifiers). Built from
@@ -382,82 +622,33 @@ struct gwp_conn_sockopt {
 	struct gwp_acl_bind	bind;		/* -j BIND: bind.set when present */
 };
 
-struct gwp_conn_pair {
-	/*
-	 * Field order here is deliberate: members are grouped by alignment,
-	 * widest first, with the one-byte scalars collected at the end. Laid
-	 * out in logical order instead, the small members scatter and leave
-	 * 22 bytes of holes. Keep new members in the group that matches their
-	 * alignment rather than next to the code that uses them; `pahole -C
-	 * gwp_conn_pair src/gwproxy/gwproxy.c.o` reports the damage if not.
-	 */
-	struct gwp_conn		target;
-	struct gwp_conn		client;
-	uint64_t		flags;
-
-#ifdef CONFIG_IO_URING
-	struct __kernel_timespec	ts;
-	/*
-	 * The Connection Attempt Delay needs its own timespec: an armed
-	 * io_uring timeout keeps reading the struct it was given, so it cannot
-	 * share @ts with the connect timer that is live alongside it.
-	 * @attempt_timer_armed (below) tracks whether one is outstanding, since
-	 * io_uring has no timerfd to test for.
-	 */
-	struct __kernel_timespec	ats;
-#ifdef CONFIG_HTTPS
-	/*
-	 * Persistent ciphertext scratch for the client's TLS on the io_uring
-	 * loop. Unlike epoll (synchronous stack scratch), an async recv/send
-	 * needs the wire buffers to outlive the operation. Allocated when a TLS
-	 * handshake starts, freed in gwp_free_conn_pair().
-	 */
-	struct gwp_iou_tls		*tls_io;
-#endif
-#endif
-
-	union {
-		struct gwp_socks5_conn	*s5_conn;
-		struct gwp_http_conn	*http_conn;
-	};
-	union {
-		struct gwp_dns_entry	*gde;
-		struct gwp_dns_packet	*gdp;
-	};
-
-	/*
-	 * @udp_iou is the io_uring UDP relay's per-connection async scratch
-	 * (msghdr + buffer), NULL on the epoll loop which relays synchronously
-	 * into the per-worker udp_buf.
-	 */
-	struct gwp_iou_udp	*udp_iou;
+/*
+ * Connect-phase state of a pair: the candidate addresses, the Happy Eyeballs
+ * race and whatever the ACL and the upstream handshake decided along the way.
+ * None of it is needed once the pair forwards, so it lives outside the pair,
+ * allocated by gwp_conn_hs_get() when the target is first looked at (or
+ * earlier, when a client TLS handshake step is offloaded) and released by
+ * gwp_conn_hs_release() when forwarding starts.
+ */
+struct gwp_conn_hs {
+	/* Fires when the next connect attempt should join the race. */
+	struct gwp_timer	attempt_timer;
 
 	/*
 	 * The hostname the client asked for, when it used a domain target
 	 * (SOCKS5 ATYP 0x03 or an HTTP host), for ACL "-m domain" matching.
-	 * Points into s5_conn/http_conn and stays valid for the connection's
-	 * life; NULL for literal-IP requests.
+	 * Points into s5_conn/http_conn; NULL for literal-IP requests.
 	 */
 	const char		*req_domain;
 
-	int			conn_state;
-	int			timer_fd;
-	/*
-	 * @udp_fd is the per-connection bound UDP socket a SOCKS5 UDP
-	 * ASSOCIATE client sends datagrams to (-1 when not a UDP association);
-	 * its lifetime is tied to this (TCP control) connection.
-	 */
-	int			udp_fd;
 	/*
-	 * @attempt_timer_fd fires when the next connect attempt should be
-	 * started. It is separate from timer_fd, which bounds the whole
-	 * connect.
+	 * Destination requested from the upstream proxy, NULL unless
+	 * ctx->upstream.enabled. For socks5:// this is filled from
+	 * target_addr (an IP); for socks5h:// it carries the hostname. Its
+	 * 262 bytes are carved from the tail of the same allocation, so a
+	 * pair that does not chain through an upstream never pays for them.
 	 */
-	int			attempt_timer_fd;
-	uint32_t		idx;
-#ifdef CONFIG_IO_URING
-	int			ref_cnt;
-#endif
+	struct gwp_socks5_addr	*up_dst;
 
 	/*
 	 * Connect attempts still in flight, one slot per candidate already
@@ -467,15 +658,6 @@ struct gwp_conn_pair {
 	 */
 	int			attempt_fd[GWP_MAX_CONN_CAND];
 
-	/*
-	 * @udp_peer is the UDP client's source address, pinned from its first
-	 * datagram (@udp_pinned); datagrams from other sources are treated as
-	 * replies from targets.
-	 */
-	struct gwp_sockaddr	udp_peer;
-	struct gwp_sockaddr	client_addr;
-	struct gwp_sockaddr	target_addr;
-
 	/*
 	 * Candidate target addresses, in the order they should be tried (see
 	 * struct gwp_dns_entry). A name that resolves to several addresses
@@ -505,34 +687,127 @@ struct gwp_conn_pair {
 	 */
 	struct gwp_conn_sockopt	acl_sockopt;
 
+#ifdef CONFIG_HTTPS
 	/*
-	 * Destination requested from the upstream SOCKS5 proxy. Only used
-	 * when ctx->upstream.enabled. For socks5:// this is filled from
-	 * target_addr (an IP); for socks5h:// it carries the hostname.
-	 *
-	 * This is the single largest member (262 bytes, mostly the 256-byte
-	 * domain buffer) and is dead weight on every connection that does not
-	 * chain through an upstream proxy.
+	 * --tls-hs-threads: the handshake step a crypto thread is running on
+	 * client.tls, NULL when none. The worker leaves client.tls alone
+	 * while it is set, and the pair keeps this struct until it is back.
 	 */
-	struct gwp_socks5_addr	up_dst;
+	struct gwp_tls_job	*tls_job;
+#endif
 
-	/* One-byte scalars last, so they pack instead of each opening a hole. */
-	bool			is_target_alive;
-	uint8_t			prot_type;
-	bool			udp_pinned;
+	uint8_t			nr_cand;
+	uint8_t			next_cand;
 	/*
 	 * True while an upstream-handshake request is still being flushed to
 	 * the proxy (target buffer holds outbound bytes); false while awaiting
 	 * a reply.
 	 */
 	bool			up_tx;
-	uint8_t			nr_cand;
-	uint8_t			next_cand;
+};
+
+/*
+ * SOCKS5 UDP ASSOCIATE state, allocated with the relay socket. @peer is the
+ * UDP client's source address, pinned from its first datagram (@pinned);
+ * datagrams from other sources are treated as replies from targets.
+ */
+struct gwp_conn_udp {
+	struct gwp_sockaddr	peer;
+	bool			pinned;
+	/* OUTPUT verdicts for this association's datagrams. */
+	struct gwp_acl_memo	acl_memo;
+	/*
+	 * The io_uring relay's async scratch (msghdr + buffer), NULL on the
+	 * epoll loop which relays synchronously into the per-worker udp_buf.
+	 */
+	struct gwp_iou_udp	*iou;
+};
+
+struct gwp_conn_pair {
+	/*
+	 * Field order here is deliberate: members are grouped by alignment,
+	 * widest first, with the one-byte scalars collected at the end. Laid
+	 * out in logical order instead, the small members scatter and leave
+	 * 22 bytes of holes. Keep new members in the group that matches their
+	 * alignment rather than next to the code that uses them; `pahole -C
+	 * gwp_conn_pair src/gwproxy/gwproxy.c.o` reports the damage if not.
+	 *
+	 * Only what a forwarding pair touches lives here; connect-phase and
+	 * UDP state hang off @hs and @udp. With hundreds of thousands of
+	 * long-lived tunnels every byte counts, so keep every build (epoll or
+	 * io_uring, with or without HTTPS) at or below 256 bytes.
+	 */
+	struct gwp_conn		target;
+	struct gwp_conn		client;
+	uint64_t		flags;
+
+	/*
+	 * Timer on the worker's wheel. It bounds the protocol handshake, then
+	 * the connect, then (with --idle-timeout) a forwarding pair's silence.
+	 * Cancelled in gwp_free_conn_pair().
+	 */
+	struct gwp_timer	timer;
+
+	/*
+	 * Wheel time (ms) of the last forwarded I/O. Stamped on every transfer
+	 * instead of re-arming the idle timer; the timer checks it when it
+	 * fires and re-arms itself for whatever is left.
+	 */
+	uint64_t		last_active;
+
+#ifdef CONFIG_IO_URING
+#ifdef CONFIG_HTTPS
+	/*
+	 * Persistent ciphertext scratch for the client's TLS on the io_uring
+	 * loop. Unlike epoll (synchronous stack scratch), an async recv/send
+	 * needs the wire buffers to outlive the operation. Allocated when a TLS
+	 * handshake starts, freed in gwp_free_conn_pair().
+	 */
+	struct gwp_iou_tls		*tls_io;
+#endif
+#endif
+
+	union {
+		struct gwp_socks5_conn	*s5_conn;
+		struct gwp_http_conn	*http_conn;
+	};
+	union {
+		struct gwp_dns_entry	*gde;
+		struct gwp_dns_query	*gdq;
+	};
+
+	/* Connect-phase state; NULL before the target is known and after. */
+	struct gwp_conn_hs	*hs;
+	/* SOCKS5 UDP ASSOCIATE state; NULL for every other pair. */
+	struct gwp_conn_udp	*udp;
+
+	/*
+	 * @udp_fd is the per-connection bound UDP socket a SOCKS5 UDP
+	 * ASSOCIATE client sends datagrams to (-1 when not a UDP association);
+	 * its lifetime is tied to this (TCP control) connection.
+	 */
+	int			udp_fd;
+	uint32_t		idx;
 #ifdef CONFIG_IO_URING
-	bool			attempt_timer_armed;
+	int			ref_cnt;
 #endif
+
+	struct gwp_sockaddr	client_addr;
+	struct gwp_sockaddr	target_addr;
+
+	/* CONN_STATE_*; the largest is below 700. */
+	uint16_t		conn_state;
+
+	/* One-byte scalars last, so they pack instead of each opening a hole. */
+	bool			is_target_alive;
+	uint8_t			prot_type;
 };
 
+static_assert(sizeof(struct gwp_conn) <= 48,
+	      "struct gwp_conn outgrew 48 bytes");
+static_assert(sizeof(struct gwp_conn_pair) <= 256,
+	      "struct gwp_conn_pair outgrew 256 bytes");
+
 
 struct gwp_conn_slot {
 	struct gwp_conn_pair	**pairs;
@@ -541,25 +816,80 @@ struct gwp_conn_slot {
 };
 
 #ifdef CONFIG_IO_URING
+/* Single-shot accepts each worker keeps armed on its listener. */
+#define GWP_IOU_NR_ACCEPT	8
+
+/* One of them, and where the kernel writes its peer's address. */
+struct gwp_iou_accept {
+	struct gwp_sockaddr	addr;
+	socklen_t		addr_len;
+	bool			armed;
+};
+
 struct iou {
 	struct io_uring		ring;
-	struct gwp_sockaddr	accept_addr;
-	socklen_t		accept_addr_len;
+	struct gwp_iou_accept	accept[GWP_IOU_NR_ACCEPT];
+	/*
+	 * --zerocopy-min: the kernel refused IORING_OP_SEND_ZC with usage
+	 * reports (before 6.2), so this worker sends by copy.
+	 */
+	bool			no_send_zc;
 
 	/*
 	 * Deadline for the accept-retry timer armed when accept() is paused
 	 * due to fd exhaustion (EMFILE/ENFILE). Must outlive SQE submission.
+	 * @accept_retry_armed while it is pending, so there is only ever one.
 	 */
 	struct __kernel_timespec accept_retry_ts;
-};
-#endif
+	bool			accept_retry_armed;
+
+	/*
+	 * The single timeout that wakes this worker for its timer wheel.
+	 * @tw_deadline is the wheel time (ms) it is set to fire at, valid
+	 * while @tw_armed. Only pulled in when an earlier timer is armed; a
+	 * later one is left to the wakeup that is already scheduled.
+	 */
+	struct __kernel_timespec tw_ts;
+	uint64_t		tw_deadline;
+	bool			tw_armed;
+
+	/*
+	 * --iou-buf-ring: the provided-buffer ring shared by this worker's
+	 * forwarding recvs. @pbuf_mem holds @pbuf_nr buffers of @pbuf_size
+	 * bytes each; @pbuf_br is NULL when the ring is off or could not be
+	 * registered.
+	 */
+	struct io_uring_buf_ring *pbuf_br;
+	char			*pbuf_mem;
+	uint32_t		pbuf_nr;
+	uint32_t		pbuf_size;
+
+	/*
+	 * Worker 0 only: the ring gwp_ctx_signal_all_io_uring() sends the
+	 * stop messages from, and whether it already has.
+	 */
+	struct io_uring		*sig_ring;
+	_Atomic(bool)		sig_sent;
 
-struct gwp_dns_resolver;
+	/*
+	 * --iou-fixed-files: size of the ring's sparse file table, and a bit
+	 * per slot that currently holds the socket of the same fd number.
+	 * @ff_fds[i] is i: the queued slot updates read the fd to install
+	 * from it, so it has to stay put until the kernel issues them.
+	 */
+	uint64_t		*ff_map;
+	int			*ff_fds;
+	uint32_t		nr_ff;
 
-struct gwp_wrk_dns {
-	struct gwp_dns_resolver		*resolvers;
-	uint32_t			nr;
+	/*
+	 * The DNS threads, and the crypto threads with --tls-hs-threads, ring
+	 * @cq_ev_fd when they complete work for this worker, and a read on it
+	 * (into @cq_ev_val) is kept armed. -1 when neither exists.
+	 */
+	int			cq_ev_fd;
+	uint64_t		cq_ev_val;
 };
+#endif
 
 struct gwp_wrk {
 	int			tcp_fd;
@@ -584,10 +914,18 @@ struct gwp_wrk {
 
 	bool			accept_is_stopped;
 	bool			need_join;
+	/* The kernel refused the "tls" ULP once; stop asking for it. */
+	bool			no_ktls;
 	struct gwp_ctx		*ctx;
 	uint32_t		idx;
 	pthread_t		thread;
 
+	/*
+	 * Every per-connection timeout of this worker. The event loop sleeps
+	 * no longer than gwp_tw_next_ms() and expires it after each wakeup.
+	 */
+	struct gwp_timer_wheel	tw;
+
 	/*
 	 * Per-worker scratch for the SOCKS5 UDP relay, allocated at worker
 	 * start when SOCKS5 is enabled. A datagram is received at offset
@@ -596,8 +934,30 @@ struct gwp_wrk {
 	 */
 	unsigned char		*udp_buf;
 
+	/*
+	 * --splice: pipes released by closed pairs, kept so the next pair
+	 * does not pay pipe2() and two close() calls per direction.
+	 */
+	struct gwp_pipe		**pipe_pool;
+	uint32_t		nr_pipe_pool;
+
+	/*
+	 * Free-lists for connection pairs and their I/O buffers, bounded by
+	 * --pool-max. One buffer class per distinct buffer size, so
+	 * --client-buf-size and --target-buf-size share a class when equal.
+	 */
+	struct gwp_pool		pair_pool;
+	struct gwp_pool		buf_pool[2];
+	uint8_t			nr_buf_pool;
+	/* struct gwp_conn_hs, plus room for up_dst with an upstream proxy. */
+	struct gwp_pool		hs_pool;
+
+	/* OUTPUT verdicts for this worker's TCP targets. */
+	struct gwp_acl_memo	acl_memo;
+
 #ifdef CONFIG_NEW_DNS_RESOLVER
-	struct gwp_wrk_dns	*dns;
+	/* --raw-dns: this worker's stub resolver. */
+	struct gwp_dns_resolver	*dns;
 #endif
 };
 
@@ -615,6 +975,8 @@ struct gwp_ctx {
 	struct gwp_socks5_ctx		*socks5;
 	struct gwp_auth			*auth;
 	struct gwp_ssl_ctx		*ssl_ctx;
+	/* --tls-hs-threads: one completion queue per worker, by index. */
+	struct gwp_tls_pool		*tls_pool;
 	struct gwp_dns_ctx		*dns;
 	struct gwp_upstream		upstream;
 	/*
@@ -633,6 +995,18 @@ struct gwp_ctx {
 	struct gwp_acl			*acl;
 	int				acl_ino_fd;
 	char				*acl_ino_buf;
+	/*
+	 * Watch descriptors on @acl_ino_fd: @acl_wd for the rule file's
+	 * directory, @acl_set_wds for those of the current sets' files.
+	 */
+	int				acl_wd;
+	uint32_t			nr_acl_set_wds;
+	int				*acl_set_wds;
+	/*
+	 * Frees the ACL rules and auth entries a reload replaced once every
+	 * worker is past them. A worker is its reader slot by index.
+	 */
+	struct gwp_qsbr			*qsbr;
 	_Atomic(int32_t)		nr_fd_closed;
 	_Atomic(int32_t)		nr_accept_stopped;
 };
@@ -642,7 +1016,48 @@ int gwp_free_conn_pair(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
 int gwp_create_sock_target(struct gwp_wrk *w, struct gwp_sockaddr *addr,
 			   const struct gwp_conn_sockopt *so,
 			   bool *is_target_alive, bool non_block);
-int gwp_create_timer(int fd, int sec, int nsec);
+
+/*
+ * Arm @gcp's connection timer (protocol, connect or idle) to fire in @sec
+ * seconds; @sec <= 0 only cancels it.
+ */
+void gwp_conn_arm_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp, int sec);
+
+/*
+ * The pair has just started forwarding: swap whatever its connection timer
+ * was bounding for the idle timeout (or nothing, without --idle-timeout).
+ */
+void gwp_conn_start_idle_timer(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+
+/*
+ * @gcp's connection timer fired while it was forwarding. Returns 0 if it
+ * saw traffic within --idle-timeout (the timer is re-armed for the rest),
+ * or -ETIMEDOUT when the pair has really been idle that long.
+ */
+int gwp_conn_idle_expired(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+
+/* Note forwarded traffic on @gcp for the idle timeout. */
+static inline void gwp_conn_touch(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
+{
+	gcp->last_active = w->tw.now;
+}
+
+/*
+ * Take a pipe from the worker's pool, or create one. Returns NULL (with the
+ * errno in *@err) when no pipe can be had. gwp_pipe_put() gives it back: an
+ * empty pipe is pooled, one still holding bytes is closed. Returns how many
+ * descriptors that closed.
+ */
+struct gwp_pipe *gwp_pipe_get(struct gwp_wrk *w, int *err);
+int gwp_pipe_put(struct gwp_wrk *w, struct gwp_pipe *p);
+
+/*
+ * A connection I/O buffer of @size bytes (4 KiB aligned) from the worker's
+ * pool, and back. @size must be the conn's cap, i.e. one of the configured
+ * buffer sizes.
+ */
+void *gwp_conn_buf_get(struct gwp_wrk *w, uint32_t size);
+void gwp_conn_buf_put(struct gwp_wrk *w, void *buf, uint32_t size);
 void gwp_setup_cli_sock_options(struct gwp_wrk *w, int fd);
 
 /*
@@ -693,7 +1108,7 @@ struct gwp_udp_out {
  * SOCKS5 UDP relay per-datagram classifier, shared by both event loops. @base
  * points at a received datagram of @n bytes, with GWP_SOCKS5_UDP_HDR_MAX bytes
  * of slack before it; @src is its source. Maintain the client pin
- * (gcp->udp_peer / gcp->udp_pinned) and decide:
+ * (gcp->udp->peer / gcp->udp->pinned) and decide:
  *   GWP_UDP_TO_TARGET - client datagram: strip the SOCKS5 header, forward @out
  *                       to the encapsulated target.
  *   GWP_UDP_TO_CLIENT - target reply: prepend a SOCKS5 header in the slack, send
@@ -714,6 +1129,7 @@ enum gwp_udp_act gwp_udp_relay_classify(struct gwp_wrk *w,
  * @user is the authenticated username for "-m user", or NULL when the
  * connection is unauthenticated. */
 bool gwp_ctx_acl_output_allowed(struct gwp_ctx *ctx,
+				struct gwp_acl_memo *memo,
 				const struct gwp_sockaddr *client,
 				const struct gwp_sockaddr *target,
 				const char *user, enum gwp_acl_proto proto);
@@ -727,26 +1143,87 @@ bool gwp_ctx_acl_output_dnat(struct gwp_ctx *ctx,
 			     struct gwp_conn_sockopt *so,
 			     enum gwp_acl_proto proto);
 
-/* Convenience wrapper: ACL OUTPUT check for a TCP target (gcp->target_addr). */
-bool gwp_ctx_acl_target_allowed(struct gwp_ctx *ctx, struct gwp_conn_pair *gcp);
+/*
+ * Convenience wrapper: ACL OUTPUT check for a TCP target (gcp->target_addr),
+ * remembered in the calling worker's @memo.
+ */
+bool gwp_ctx_acl_target_allowed(struct gwp_ctx *ctx, struct gwp_acl_memo *memo,
+				struct gwp_conn_pair *gcp);
+
+/*
+ * The pair's connect-phase state, allocated on first use with every attempt
+ * slot idle. Returns NULL when out of memory.
+ */
+struct gwp_conn_hs *gwp_conn_hs_get(struct gwp_wrk *w,
+				    struct gwp_conn_pair *gcp);
+
+/*
+ * The pair is forwarding: free its connect-phase state. With attempts still
+ * being reaped (io_uring retires losers on their own completion) only mark
+ * it done; call again once the last one is gone.
+ */
+void gwp_conn_hs_release(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
 
 /*
  * Install the addresses the connect path may try, in priority order, and reset
- * the attempt cursor. At most GWP_MAX_CONN_CAND are kept.
+ * the attempt cursor. At most GWP_MAX_CONN_CAND are kept. Returns -ENOMEM if
+ * the connect-phase state cannot be allocated.
  */
-void gwp_conn_set_candidates(struct gwp_conn_pair *gcp,
-			     const struct gwp_sockaddr *addrs, uint8_t nr);
+int gwp_conn_set_candidates(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+			    const struct gwp_sockaddr *addrs, uint8_t nr);
 /* The one-address case: a literal IP, a transparent redirect, an upstream. */
-void gwp_conn_set_single_candidate(struct gwp_conn_pair *gcp,
-				   const struct gwp_sockaddr *addr);
+int gwp_conn_set_single_candidate(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
+				  const struct gwp_sockaddr *addr);
+
+#ifdef CONFIG_NEW_DNS_RESOLVER
+/*
+ * Hand a finished --raw-dns query's addresses to the connect path and free
+ * the query. Returns 0 when there is something to connect to, otherwise the
+ * query's error for the client's failure reply.
+ */
+int gwp_raw_dns_finish(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+#endif
+
+/*
+ * Close every connect attempt still in flight and cancel the attempt timer,
+ * e.g. once one attempt has won the race or the pair is being torn down.
+ * Returns how many descriptors were closed, which the epoll loop credits to
+ * its accept-rearm accounting.
+ */
+int gwp_conn_close_attempts(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+
+#ifdef CONFIG_HTTPS
+/*
+ * --tls-ktls: move the client's TLS record layer into the kernel once the
+ * handshake is done and no record is buffered in user space, after which the
+ * client is a plain socket (client.tls NULL, client.ktls set). Cheap to call
+ * on every event until it either happens or is given up on. Returns 0 whether
+ * or not it switched, <0 if the attempt left the socket unusable.
+ */
+int gwp_conn_ktls_attach(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
 
 /*
- * Close every connect attempt still in flight and the attempt timer, e.g. once
- * one attempt has won the race or the pair is being torn down. Returns how many
- * descriptors were closed, which the epoll loop credits to its accept-rearm
- * accounting.
+ * --tls-hs-threads: hand the next step of the client's handshake, whose
+ * ciphertext the caller already fed, to a crypto thread. Returns 1 when it
+ * was queued (the caller parks the connection until the step comes back
+ * from gwp_conn_tls_reap()), 0 when there is no pool and the caller steps
+ * inline, <0 on error.
  */
-int gwp_conn_close_attempts(struct gwp_conn_pair *gcp);
+int gwp_conn_tls_offload(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
+
+/*
+ * The handshake steps finished for @w's connections, oldest first, linked
+ * through ->next. Steps whose connection was closed meanwhile are freed here
+ * and not returned.
+ */
+struct gwp_tls_job *gwp_conn_tls_reap(struct gwp_wrk *w);
+
+/*
+ * Detach a reaped @job from its connection and free it. Returns the step's
+ * gwp_ssl_handshake() result; a failure is logged here.
+ */
+int gwp_conn_tls_finish(struct gwp_wrk *w, struct gwp_tls_job *job);
+#endif
 
 /* True if the ACL INPUT chain permits an incoming client for @proto (allow-all
  * with no ACL). */
@@ -762,12 +1239,154 @@ const char *ip_to_str(const struct gwp_sockaddr *gs);
  * the reload handlers use this to reload only for their own file. */
 bool gwp_inotify_event_matches(const void *buf, size_t len, const char *path);
 
+/*
+ * The ACL watch fired with the events in @buf: reload the rule file or the
+ * address sets it names, whichever changed. Shared by both event loops.
+ */
+void gwp_ctx_acl_files_changed(struct gwp_ctx *ctx, const void *buf,
+			       size_t len);
+
+/* Ring offset one past the last buffered byte. */
+static inline uint32_t gwp_conn_tail(const struct gwp_conn *conn)
+{
+	uint32_t t = conn->head + conn->len;
+
+	return (t >= conn->cap) ? t - conn->cap : t;
+}
+
+/* The oldest buffered bytes that are contiguous in memory. */
+static inline char *gwp_conn_data(const struct gwp_conn *conn)
+{
+	return conn->buf + conn->head;
+}
+
+static inline uint32_t gwp_conn_data_len(const struct gwp_conn *conn)
+{
+	uint32_t n = conn->cap - conn->head;
+
+	return (conn->len < n) ? conn->len : n;
+}
+
+/* The free space right after the buffered bytes, up to the wrap point. */
+static inline char *gwp_conn_room(const struct gwp_conn *conn)
+{
+	return conn->buf + gwp_conn_tail(conn);
+}
+
+/*
+ * The free space runs from the tail up to the oldest byte still in use,
+ * which is the start of the zero-copy pinned region when there is one.
+ */
+static inline uint32_t gwp_conn_free_len(const struct gwp_conn *conn)
+{
+	return conn->cap - conn->len - conn->zc_pinned;
+}
+
+static inline uint32_t gwp_conn_room_len(const struct gwp_conn *conn)
+{
+	uint32_t n = conn->cap - gwp_conn_tail(conn);
+	uint32_t room = gwp_conn_free_len(conn);
+
+	return (room < n) ? room : n;
+}
+
+/*
+ * Describe the buffered bytes (gwp_conn_data_iov()) or the free space
+ * (gwp_conn_room_iov()) as up to two segments, in ring order. Returns the
+ * number of segments filled in, 0 when there is nothing to describe.
+ */
+static inline int gwp_conn_data_iov(const struct gwp_conn *conn,
+				    struct iovec iov[2])
+{
+	uint32_t n = gwp_conn_data_len(conn);
+
+	if (!n)
+		return 0;
+	iov[0].iov_base = gwp_conn_data(conn);
+	iov[0].iov_len = n;
+	if (n == conn->len)
+		return 1;
+	iov[1].iov_base = conn->buf;
+	iov[1].iov_len = conn->len - n;
+	return 2;
+}
+
+static inline int gwp_conn_room_iov(const struct gwp_conn *conn,
+				    struct iovec iov[2])
+{
+	uint32_t n = gwp_conn_room_len(conn);
+	uint32_t room = gwp_conn_free_len(conn);
+
+	if (!n)
+		return 0;
+	iov[0].iov_base = gwp_conn_room(conn);
+	iov[0].iov_len = n;
+	if (n == room)
+		return 1;
+	iov[1].iov_base = conn->buf;
+	iov[1].iov_len = room - n;
+	return 2;
+}
+
+/*
+ * @len bytes at @head went out in a zero-copy send: they leave the ring but
+ * stay pinned until gwp_conn_zc_done(). Bytes sent by copy while a zero-copy
+ * send is outstanding join the pinned region too (gwp_conn_buf_advance()), so
+ * it stays one run ending at @head and is handed back in one go.
+ */
+static inline void gwp_conn_buf_advance_zc(struct gwp_conn *conn, size_t len)
+{
+	assert(len <= conn->len);
+	conn->len -= len;
+	conn->zc_pinned += len;
+	conn->head += len;
+	if (conn->head >= conn->cap)
+		conn->head -= conn->cap;
+}
+
 static inline void gwp_conn_buf_advance(struct gwp_conn *conn, size_t len)
 {
+	if (conn->zc_pinned) {
+		gwp_conn_buf_advance_zc(conn, len);
+		return;
+	}
+
 	assert(len <= conn->len);
 	conn->len -= len;
-	if (conn->len)
-		memmove(conn->buf, conn->buf + len, conn->len);
+	if (!conn->len) {
+		conn->head = 0;
+		return;
+	}
+	conn->head += len;
+	if (conn->head >= conn->cap)
+		conn->head -= conn->cap;
+}
+
+/* The kernel is done with @conn's outstanding zero-copy send. */
+static inline void gwp_conn_zc_done(struct gwp_conn *conn)
+{
+	conn->zc_pinned = 0;
+	if (!conn->len)
+		conn->head = 0;
+}
+
+void __gwp_conn_linearize(struct gwp_conn *conn);
+
+/*
+ * Move the buffered bytes to the start of @buf, so @buf[0..@len) holds them
+ * in order and @buf + @len is the free space. Free when @head is already 0,
+ * which is the common case for every protocol step.
+ */
+static inline void gwp_conn_linearize(struct gwp_conn *conn)
+{
+	if (conn->head)
+		__gwp_conn_linearize(conn);
+}
+
+/* Bytes taken from @conn's fd and not yet handed to its peer. */
+static inline size_t gwp_conn_pending(const struct gwp_conn *conn)
+{
+	return conn->len + (conn->pipe ? conn->pipe->len : 0);
 }
 
 static inline
@@ -831,9 +1450,9 @@ enum gwp_upstream_io {
 };
 
 /*
- * Begin the upstream-proxy handshake: finalize gcp->up_dst and build the SOCKS5
- * greeting or HTTP CONNECT into gcp->target.buf. Returns GWP_UPSTREAM_IO_SEND,
- * or a negative errno.
+ * Begin the upstream-proxy handshake: finalize gcp->hs->up_dst and build the
+ * SOCKS5 greeting or HTTP CONNECT into gcp->target.buf. Returns
+ * GWP_UPSTREAM_IO_SEND, or a negative errno.
  */
 int gwp_upstream_hs_start(struct gwp_wrk *w, struct gwp_conn_pair *gcp);
 
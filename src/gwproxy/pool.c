@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <gwproxy/pool.h>
+#include <gwproxy/common.h>
+#include <stdlib.h>
+#include <string.h>
+
+__cold
+void gwp_pool_init(struct gwp_pool *p, size_t size, size_t align,
+		   uint32_t max_free)
+{
+	memset(p, 0, sizeof(*p));
+
+	/* A cached object holds the free-list link in its first bytes. */
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	p->size = size;
+	p->align = align;
+	p->max_free = max_free;
+}
+
+__cold
+void gwp_pool_destroy(struct gwp_pool *p)
+{
+	void *obj;
+
+	while ((obj = p->free_list)) {
+		p->free_list = *(void **)obj;
+		free(obj);
+	}
+	p->nr_free = 0;
+}
+
+__hot
+void *gwp_pool_get(struct gwp_pool *p)
+{
+	void *obj = p->free_list;
+
+	if (obj) {
+		p->free_list = *(void **)obj;
+		p->nr_free--;
+		p->st.nr_hit++;
+	} else if (p->align) {
+		if (posix_memalign(&obj, p->align, p->size))
+			return NULL;
+	} else {
+		obj = malloc(p->size);
+		if (!obj)
+			return NULL;
+	}
+
+	p->st.nr_get++;
+	if (++p->st.in_use > p->st.peak_in_use)
+		p->st.peak_in_use = p->st.in_use;
+	return obj;
+}
+
+__hot
+void gwp_pool_put(struct gwp_pool *p, void *obj)
+{
+	if (!obj)
+		return;
+
+	p->st.in_use--;
+	if (p->nr_free >= p->max_free) {
+		p->st.nr_release++;
+		free(obj);
+		return;
+	}
+
+	*(void **)obj = p->free_list;
+	p->free_list = obj;
+	p->nr_free++;
+}
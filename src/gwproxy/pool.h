@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef GWPROXY_POOL_H
+#define GWPROXY_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Per-worker free-list of fixed-size objects.
+ *
+ * A connection pair and its two I/O buffers used to cost three heap
+ * allocations on accept and three frees on close. A pool keeps released
+ * objects on an intrusive LIFO list instead, so a busy worker recycles the
+ * memory it touched last (still warm in cache, already faulted in) and
+ * never takes the allocator's locks in steady state. Up to @max_free
+ * objects are kept; anything released beyond that goes back to libc so an
+ * idle worker gives memory back after a burst.
+ *
+ * Not thread-safe: a pool belongs to one worker, and every object taken
+ * from it must be returned by the same worker.
+ */
+struct gwp_pool_stats {
+	uint64_t	nr_get;		/* objects handed out */
+	uint64_t	nr_hit;		/* ... of which came from the free-list */
+	uint64_t	nr_release;	/* put back to libc past the high-water mark */
+	uint32_t	in_use;
+	uint32_t	peak_in_use;
+};
+
+struct gwp_pool {
+	void			*free_list;
+	uint32_t		nr_free;
+	uint32_t		max_free;
+	size_t			size;
+	/* 0 means whatever malloc() gives. */
+	size_t			align;
+	struct gwp_pool_stats	st;
+};
+
+void gwp_pool_init(struct gwp_pool *p, size_t size, size_t align,
+		   uint32_t max_free);
+
+/* Release every cached object. Objects still in use are not tracked. */
+void gwp_pool_destroy(struct gwp_pool *p);
+
+/* Returns NULL on allocation failure. The memory is not zeroed. */
+void *gwp_pool_get(struct gwp_pool *p);
+
+void gwp_pool_put(struct gwp_pool *p, void *obj);
+
+#endif /* #ifndef GWPROXY_POOL_H */
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <gwproxy/qsbr.h>
+#include <gwproxy/common.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* An offline slot holds no snapshot, so it is past every epoch. */
+#define QSBR_OFFLINE	UINT64_MAX
+
+struct qsbr_slot {
+	/* The epoch this reader saw when it last came online. */
+	_Atomic(uint64_t)	seen;
+} __attribute__((__aligned__(64)));
+
+struct qsbr_node {
+	struct qsbr_node	*next;
+	void			(*fn)(void *);
+	void			*p;
+	/* Ripe once every slot has seen at least this epoch. */
+	uint64_t		epoch;
+};
+
+struct gwp_qsbr {
+	/* Bumped by every retire; readers only ever load it. */
+	_Atomic(uint64_t)	epoch __attribute__((__aligned__(64)));
+	/* Non-zero while @pending is not empty: a cheap check for readers. */
+	_Atomic(uint32_t)	nr_pending;
+	pthread_mutex_t		lock;
+	struct qsbr_node	*pending;
+	uint32_t		nr_slots;
+	struct qsbr_slot	*slots;
+};
+
+__cold
+int gwp_qsbr_init(struct gwp_qsbr **q_p, uint32_t nr_readers)
+{
+	struct gwp_qsbr *q;
+	uint32_t i;
+	int r;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -ENOMEM;
+
+	q->slots = aligned_alloc(64, sizeof(*q->slots) * (nr_readers ? nr_readers : 1));
+	if (!q->slots) {
+		free(q);
+		return -ENOMEM;
+	}
+
+	r = pthread_mutex_init(&q->lock, NULL);
+	if (r) {
+		free(q->slots);
+		free(q);
+		return -r;
+	}
+
+	q->nr_slots = nr_readers;
+	for (i = 0; i < nr_readers; i++)
+		atomic_init(&q->slots[i].seen, QSBR_OFFLINE);
+	atomic_init(&q->epoch, 0);
+	atomic_init(&q->nr_pending, 0);
+	*q_p = q;
+	return 0;
+}
+
+static void run_list(struct qsbr_node *n)
+{
+	struct qsbr_node *next;
+
+	for (; n; n = next) {
+		next = n->next;
+		n->fn(n->p);
+		free(n);
+	}
+}
+
+/* Unlink the ripe nodes under @q->lock and hand them back. */
+static struct qsbr_node *collect_ripe(struct gwp_qsbr *q)
+{
+	struct qsbr_node *ripe = NULL, **pp, *n;
+	uint64_t min = QSBR_OFFLINE, seen;
+	uint32_t i;
+
+	for (i = 0; i < q->nr_slots; i++) {
+		seen = atomic_load(&q->slots[i].seen);
+		if (seen < min)
+			min = seen;
+	}
+
+	pp = &q->pending;
+	while ((n = *pp)) {
+		if (n->epoch > min) {
+			pp = &n->next;
+			continue;
+		}
+		*pp = n->next;
+		n->next = ripe;
+		ripe = n;
+		atomic_fetch_sub_explicit(&q->nr_pending, 1,
+					  memory_order_relaxed);
+	}
+	return ripe;
+}
+
+__cold
+void gwp_qsbr_free(struct gwp_qsbr *q)
+{
+	if (!q)
+		return;
+
+	run_list(q->pending);
+	pthread_mutex_destroy(&q->lock);
+	free(q->slots);
+	free(q);
+}
+
+__hot
+void gwp_qsbr_online(struct gwp_qsbr *q, uint32_t reader)
+{
+	if (!q)
+		return;
+
+	/*
+	 * Sequentially consistent on purpose: a retire that bumped the epoch
+	 * before this load published its new snapshot before the bump, so
+	 * the snapshot loads that follow this store see it. One that bumps
+	 * it after will find this slot behind and wait for it.
+	 */
+	atomic_store(&q->slots[reader].seen, atomic_load(&q->epoch));
+}
+
+__hot
+void gwp_qsbr_offline(struct gwp_qsbr *q, uint32_t reader)
+{
+	struct qsbr_node *ripe;
+
+	if (!q)
+		return;
+
+	atomic_store_explicit(&q->slots[reader].seen, QSBR_OFFLINE,
+			      memory_order_release);
+	if (likely(!atomic_load_explicit(&q->nr_pending, memory_order_relaxed)))
+		return;
+
+	/* Someone else is already reclaiming; they will see this slot. */
+	if (pthread_mutex_trylock(&q->lock))
+		return;
+	ripe = collect_ripe(q);
+	pthread_mutex_unlock(&q->lock);
+	run_list(ripe);
+}
+
+int gwp_qsbr_retire(struct gwp_qsbr *q, void (*fn)(void *), void *p)
+{
+	struct qsbr_node *n, *ripe;
+
+	n = malloc(sizeof(*n));
+	if (!n)
+		return -ENOMEM;
+
+	n->fn = fn;
+	n->p = p;
+	/* The caller's unpublishing store comes before this bump. */
+	n->epoch = atomic_fetch_add(&q->epoch, 1) + 1;
+
+	pthread_mutex_lock(&q->lock);
+	n->next = q->pending;
+	q->pending = n;
+	atomic_fetch_add_explicit(&q->nr_pending, 1, memory_order_relaxed);
+	ripe = collect_ripe(q);
+	pthread_mutex_unlock(&q->lock);
+	run_list(ripe);
+	return 0;
+}
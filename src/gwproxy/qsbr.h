@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
+ */
+#ifndef GWPROXY_QSBR_H
+#define GWPROXY_QSBR_H
+
+#include <stdint.h>
+
+/*
+ * Quiescent-state-based reclamation for read-mostly snapshots.
+ *
+ * The ACL and the credential store are read on every connection and
+ * replaced only when their file changes. They are published as immutable
+ * snapshots behind an atomic pointer: a reader loads the pointer and uses
+ * what it points to, and never writes shared memory to do so. A reload
+ * builds a new snapshot, swaps it in and retires the old one here.
+ *
+ * Each reader thread (a worker) owns a slot on its own cache line. It is
+ * online while it may hold a snapshot pointer and offline while it blocks
+ * in the event loop, where it holds none. A retired object is freed once
+ * every slot has been offline, or come online again, since it was retired.
+ * Nobody waits for that: ripe objects are freed by the next reader that
+ * goes offline, by the next retire, or by gwp_qsbr_free().
+ *
+ * A reader must only touch a snapshot between gwp_qsbr_online() and
+ * gwp_qsbr_offline() on its own slot. Slots start offline.
+ */
+struct gwp_qsbr;
+
+int gwp_qsbr_init(struct gwp_qsbr **q_p, uint32_t nr_readers);
+
+/* Runs every pending retire callback. No reader may be online. */
+void gwp_qsbr_free(struct gwp_qsbr *q);
+
+void gwp_qsbr_online(struct gwp_qsbr *q, uint32_t reader);
+void gwp_qsbr_offline(struct gwp_qsbr *q, uint32_t reader);
+
+/*
+ * Call @fn(@p) once no reader can still see @p. The caller must already
+ * have unpublished @p. Returns 0, or -ENOMEM, in which case @p is left
+ * to the caller.
+ */
+int gwp_qsbr_retire(struct gwp_qsbr *q, void (*fn)(void *), void *p);
+
+#endif /* #ifndef GWPROXY_QSBR_H */
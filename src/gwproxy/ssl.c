@@ -9,25 +9,122 @@
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/kdf.h>
+#include <openssl/core_names.h>
+#define GWP_SSL_HAVE_KTLS
+#endif
 
 #include "ssl.h"
 
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/*
+ * A session ticket key. Tickets are AES-256-CBC + HMAC-SHA256 sealed, as
+ * OpenSSL does with its own keys; @name travels in the clear in front of the
+ * ticket and picks the key on the way back in.
+ */
+struct tkt_key {
+	unsigned char	name[16];
+	unsigned char	aes[32];
+	unsigned char	hmac[32];
+	/* CLOCK_MONOTONIC seconds at creation; 0 for an empty slot. */
+	time_t		born;
+};
+
+/*
+ * Session ID cache shard. Entries hang off a small hash table and, oldest
+ * first, off a FIFO that eviction takes from. Shards sit on their own cache
+ * lines so workers resuming different sessions do not share one.
+ */
+struct sess_ent {
+	struct sess_ent	*hnext;
+	struct sess_ent	*prev;
+	struct sess_ent	*next;
+	SSL_SESSION	*sess;
+	unsigned int	id_len;
+	unsigned char	id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+};
+
+#define SESS_NR_SHARDS	16u
+
+struct sess_shard {
+	pthread_mutex_t	lock;
+	struct sess_ent	**bucket;
+	uint32_t	mask;
+	uint32_t	nr;
+	uint32_t	max;
+	struct sess_ent	*oldest;
+	struct sess_ent	*newest;
+} __attribute__((__aligned__(64)));
+
 struct gwp_ssl_ctx {
-	SSL_CTX	*ctx;
+	SSL_CTX			*ctx;
+
+	/*
+	 * Stateless resumption: tkt[0] seals new tickets, tkt[1] is the key
+	 * it replaced and still opens (and re-issues) tickets sealed under
+	 * it. One writer rotates them every @ticket_secs; every handshake
+	 * that touches a ticket takes the lock shared.
+	 */
+	pthread_rwlock_t	tkt_lock;
+	struct tkt_key		tkt[2];
+	unsigned int		ticket_secs;
+
+	/* Stateful resumption, NULL unless enabled. */
+	struct sess_shard	*shards;
+
+	atomic_ulong		nr_full;
+	atomic_ulong		nr_resumed;
+	atomic_ulong		nr_ticket_bad;
+	atomic_ulong		nr_cache_hit;
+	atomic_ulong		nr_cache_miss;
+	atomic_ulong		nr_cache_evict;
 };
 
 struct gwp_ssl {
 	SSL	*ssl;
 	BIO	*rbio;	/* network -> SSL: we BIO_write received ciphertext here */
 	BIO	*wbio;	/* SSL -> network: we BIO_read ciphertext to send here */
+
+	/*
+	 * Kernel TLS needs what OpenSSL keeps to itself: the sequence number
+	 * of the next record each way under the current keys, counted off the
+	 * message callback, and under TLS 1.3 the application traffic secrets,
+	 * caught from the key log callback as they are derived.
+	 */
+	uint64_t	tx_seq;
+	uint64_t	rx_seq;
+	unsigned char	tx_secret[EVP_MAX_MD_SIZE];
+	unsigned char	rx_secret[EVP_MAX_MD_SIZE];
+	size_t		tx_secret_len;
+	size_t		rx_secret_len;
+
+	struct gwp_ssl_ctx	*ctx;
+	/* The handshake's outcome is in the ctx's resumption counters. */
+	bool			hs_counted;
 };
 
 /* ALPN wire form of the one application protocol gwproxy speaks to clients. */
@@ -51,6 +148,94 @@ static int alpn_select_cb(SSL *ssl, const unsigned char **out,
 	return SSL_TLSEXT_ERR_NOACK;
 }
 
+/*
+ * Count records per direction, off the header of each. A TLS 1.2
+ * ChangeCipherSpec record switches that direction to the new keys, so the
+ * numbering restarts behind it; the one TLS 1.3 sends for middlebox
+ * compatibility changes nothing (see ktls_keylog_cb()).
+ */
+static void ktls_msg_cb(int write_p, int version, int content_type,
+			const void *buf, size_t len, SSL *ssl, void *arg)
+{
+	struct gwp_ssl *s = SSL_get_app_data(ssl);
+	const unsigned char *hdr = buf;
+	uint64_t *seq;
+
+	(void)version;
+	(void)arg;
+	if (!s || content_type != SSL3_RT_HEADER || !len)
+		return;
+
+	seq = write_p ? &s->tx_seq : &s->rx_seq;
+	if (hdr[0] == SSL3_RT_CHANGE_CIPHER_SPEC &&
+	    SSL_version(ssl) != TLS1_3_VERSION)
+		*seq = 0;
+	else
+		(*seq)++;
+}
+
+static size_t hex_to_bin(const char *hex, unsigned char *out, size_t max)
+{
+	size_t n = 0;
+	long v;
+	char b[3];
+
+	while (n < max && hex[0] && hex[1]) {
+		b[0] = hex[0];
+		b[1] = hex[1];
+		b[2] = '\0';
+		v = strtol(b, NULL, 16);
+		out[n++] = (unsigned char)v;
+		hex += 2;
+	}
+	return n;
+}
+
+/*
+ * A line is "<label> <client random> <secret>", all hex after the label.
+ * OpenSSL logs a direction's first application traffic secret right as that
+ * direction switches to it, after the last record under the handshake keys,
+ * so this is where its record numbering restarts.
+ */
+static void ktls_keylog_cb(const SSL *ssl, const char *line)
+{
+	struct gwp_ssl *s = SSL_get_app_data(ssl);
+	bool server = SSL_is_server((SSL *)ssl);
+	unsigned char *secret;
+	const char *p;
+	size_t *len;
+
+	if (!s)
+		return;
+
+	if (!strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24)) {
+		secret = server ? s->tx_secret : s->rx_secret;
+		len = server ? &s->tx_secret_len : &s->rx_secret_len;
+		if (server)
+			s->tx_seq = 0;
+		else
+			s->rx_seq = 0;
+	} else if (!strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24)) {
+		secret = server ? s->rx_secret : s->tx_secret;
+		len = server ? &s->rx_secret_len : &s->tx_secret_len;
+		if (server)
+			s->rx_seq = 0;
+		else
+			s->tx_seq = 0;
+	} else {
+		return;
+	}
+
+	p = strchr(line + 24, ' ');
+	*len = p ? hex_to_bin(p + 1, secret, EVP_MAX_MD_SIZE) : 0;
+}
+
+static void ssl_ctx_set_ktls_cbs(SSL_CTX *ctx)
+{
+	SSL_CTX_set_msg_callback(ctx, ktls_msg_cb);
+	SSL_CTX_set_keylog_callback(ctx, ktls_keylog_cb);
+}
+
 int gwp_ssl_ctx_server_create(struct gwp_ssl_ctx **out, const char *cert_file,
 			      const char *key_file)
 {
@@ -59,12 +244,18 @@ int gwp_ssl_ctx_server_create(struct gwp_ssl_ctx **out, const char *cert_file,
 	if (!c)
 		return -ENOMEM;
 
+	if (pthread_rwlock_init(&c->tkt_lock, NULL)) {
+		free(c);
+		return -ENOMEM;
+	}
+
 	c->ctx = SSL_CTX_new(TLS_server_method());
 	if (!c->ctx)
 		goto err;
 
 	SSL_CTX_set_min_proto_version(c->ctx, TLS1_2_VERSION);
 	SSL_CTX_set_alpn_select_cb(c->ctx, alpn_select_cb, NULL);
+	ssl_ctx_set_ktls_cbs(c->ctx);
 	if (SSL_CTX_use_certificate_chain_file(c->ctx, cert_file) != 1)
 		goto err;
 	if (SSL_CTX_use_PrivateKey_file(c->ctx, key_file, SSL_FILETYPE_PEM) != 1)
@@ -78,6 +269,7 @@ int gwp_ssl_ctx_server_create(struct gwp_ssl_ctx **out, const char *cert_file,
 err:
 	if (c->ctx)
 		SSL_CTX_free(c->ctx);
+	pthread_rwlock_destroy(&c->tkt_lock);
 	free(c);
 	return -EINVAL;
 }
@@ -89,26 +281,460 @@ int gwp_ssl_ctx_client_create(struct gwp_ssl_ctx **out)
 	if (!c)
 		return -ENOMEM;
 
+	if (pthread_rwlock_init(&c->tkt_lock, NULL)) {
+		free(c);
+		return -ENOMEM;
+	}
+
 	c->ctx = SSL_CTX_new(TLS_client_method());
 	if (!c->ctx) {
+		pthread_rwlock_destroy(&c->tkt_lock);
 		free(c);
 		return -EINVAL;
 	}
 
 	SSL_CTX_set_min_proto_version(c->ctx, TLS1_2_VERSION);
 	SSL_CTX_set_verify(c->ctx, SSL_VERIFY_NONE, NULL);
+	ssl_ctx_set_ktls_cbs(c->ctx);
 	*out = c;
 	return 0;
 }
 
+static void sess_cache_free(struct gwp_ssl_ctx *c);
+
 void gwp_ssl_ctx_free(struct gwp_ssl_ctx *ctx)
 {
 	if (!ctx)
 		return;
 	SSL_CTX_free(ctx->ctx);
+	sess_cache_free(ctx);
+	pthread_rwlock_destroy(&ctx->tkt_lock);
+	OPENSSL_cleanse(ctx->tkt, sizeof(ctx->tkt));
 	free(ctx);
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static time_t mono_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static int tkt_key_new(struct tkt_key *k)
+{
+	if (RAND_bytes(k->name, sizeof(k->name)) != 1 ||
+	    RAND_priv_bytes(k->aes, sizeof(k->aes)) != 1 ||
+	    RAND_priv_bytes(k->hmac, sizeof(k->hmac)) != 1)
+		return -EIO;
+
+	/* 0 marks an empty slot. */
+	k->born = mono_secs() ?: 1;
+	return 0;
+}
+
+/*
+ * The key to seal a new ticket with, rotated first if it is due. Only the
+ * handshake that notices the rotation is due pays for it, under the lock
+ * held exclusively; everyone else copies the key out under a shared lock.
+ */
+static int tkt_key_current(struct gwp_ssl_ctx *c, struct tkt_key *out)
+{
+	time_t now = mono_secs();
+	int r = 0;
+
+	pthread_rwlock_rdlock(&c->tkt_lock);
+	if (now - c->tkt[0].born < (time_t)c->ticket_secs) {
+		*out = c->tkt[0];
+		pthread_rwlock_unlock(&c->tkt_lock);
+		return 0;
+	}
+	pthread_rwlock_unlock(&c->tkt_lock);
+
+	pthread_rwlock_wrlock(&c->tkt_lock);
+	if (now - c->tkt[0].born >= (time_t)c->ticket_secs) {
+		struct tkt_key k;
+
+		r = tkt_key_new(&k);
+		if (!r) {
+			c->tkt[1] = c->tkt[0];
+			c->tkt[0] = k;
+		}
+		OPENSSL_cleanse(&k, sizeof(k));
+	}
+	*out = c->tkt[0];
+	pthread_rwlock_unlock(&c->tkt_lock);
+	return r;
+}
+
+/*
+ * The key named @name. Returns 1 for the current key, 2 for the previous
+ * one (the ticket is good, but gets re-issued under the current key), and 0
+ * when no key by that name is left.
+ */
+static int tkt_key_find(struct gwp_ssl_ctx *c, const unsigned char *name,
+			struct tkt_key *out)
+{
+	time_t now = mono_secs();
+	int r = 0, i;
+
+	pthread_rwlock_rdlock(&c->tkt_lock);
+	for (i = 0; i < 2; i++) {
+		const struct tkt_key *k = &c->tkt[i];
+
+		if (!k->born || memcmp(k->name, name, sizeof(k->name)))
+			continue;
+		/*
+		 * The previous key retired when the current one was made, and
+		 * nothing sealed under it lives longer than one period.
+		 */
+		if (i && now - c->tkt[0].born >= (time_t)c->ticket_secs)
+			break;
+		*out = *k;
+		r = i + 1;
+		break;
+	}
+	pthread_rwlock_unlock(&c->tkt_lock);
+	return r;
+}
+
+static int tkt_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+		      EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc)
+{
+	struct gwp_ssl_ctx *c = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	OSSL_PARAM params[3];
+	struct tkt_key k;
+	int r;
+
+	if (enc) {
+		if (tkt_key_current(c, &k) ||
+		    RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) {
+			r = -1;
+			goto out;
+		}
+		memcpy(name, k.name, sizeof(k.name));
+		r = 1;
+	} else {
+		r = tkt_key_find(c, name, &k);
+		if (!r) {
+			atomic_fetch_add_explicit(&c->nr_ticket_bad, 1,
+						  memory_order_relaxed);
+			goto out;
+		}
+	}
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+						      k.hmac, sizeof(k.hmac));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char *)"SHA256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (!EVP_MAC_CTX_set_params(hctx, params) ||
+	    !EVP_CipherInit_ex(ectx, EVP_aes_256_cbc(), NULL, k.aes, iv, enc))
+		r = -1;
+out:
+	OPENSSL_cleanse(&k, sizeof(k));
+	return r;
+}
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
+
+static struct sess_shard *sess_shard_of(struct gwp_ssl_ctx *c,
+					const unsigned char *id,
+					unsigned int len, uint32_t *hash)
+{
+	uint32_t h = 2166136261u;	/* FNV-1a */
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ id[i]) * 16777619u;
+	*hash = h / SESS_NR_SHARDS;
+	return &c->shards[h % SESS_NR_SHARDS];
+}
+
+static struct sess_ent **sess_slot(struct sess_shard *sh, uint32_t hash,
+				   const unsigned char *id, unsigned int len)
+{
+	struct sess_ent **pp = &sh->bucket[hash & sh->mask];
+
+	for (; *pp; pp = &(*pp)->hnext) {
+		if ((*pp)->id_len == len && !memcmp((*pp)->id, id, len))
+			break;
+	}
+	return pp;
+}
+
+/* Take the entry at @pp out of both lists; the caller frees it. */
+static struct sess_ent *sess_unlink(struct sess_shard *sh,
+				    struct sess_ent **pp)
+{
+	struct sess_ent *e = *pp;
+
+	*pp = e->hnext;
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		sh->oldest = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		sh->newest = e->prev;
+	sh->nr--;
+	return e;
+}
+
+static void sess_ent_free(struct sess_ent *e)
+{
+	SSL_SESSION_free(e->sess);
+	free(e);
+}
+
+/* OpenSSL hands over a new session; returning 1 keeps its reference. */
+static int sess_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	struct gwp_ssl_ctx *c = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	struct sess_ent *e, *old = NULL, *evict = NULL, **pp;
+	struct sess_shard *sh;
+	const unsigned char *id;
+	unsigned int len;
+	uint32_t h;
+
+	id = SSL_SESSION_get_id(sess, &len);
+	if (!len || len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+		return 0;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return 0;
+
+	e->sess = sess;
+	e->id_len = len;
+	memcpy(e->id, id, len);
+	e->next = NULL;
+
+	sh = sess_shard_of(c, id, len, &h);
+	pthread_mutex_lock(&sh->lock);
+	pp = sess_slot(sh, h, id, len);
+	if (*pp) {
+		old = sess_unlink(sh, pp);
+		pp = sess_slot(sh, h, id, len);
+	}
+	e->hnext = NULL;
+	*pp = e;
+	e->prev = sh->newest;
+	if (sh->newest)
+		sh->newest->next = e;
+	else
+		sh->oldest = e;
+	sh->newest = e;
+
+	/* Over the shard's share: the oldest session goes. */
+	if (++sh->nr > sh->max) {
+		struct sess_ent *x = sh->oldest;
+
+		sess_shard_of(c, x->id, x->id_len, &h);
+		evict = sess_unlink(sh, sess_slot(sh, h, x->id, x->id_len));
+	}
+	pthread_mutex_unlock(&sh->lock);
+
+	if (old)
+		sess_ent_free(old);
+	if (evict) {
+		sess_ent_free(evict);
+		atomic_fetch_add_explicit(&c->nr_cache_evict, 1,
+					  memory_order_relaxed);
+	}
+	return 1;
+}
+
+/*
+ * A client offered session ID @id. The reference returned is the caller's
+ * (*copy = 0): it is taken under the shard lock, before another worker can
+ * evict and free the session.
+ */
+static SSL_SESSION *sess_get_cb(SSL *ssl, const unsigned char *id, int len,
+				int *copy)
+{
+	struct gwp_ssl_ctx *c = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	struct sess_ent *e, *stale = NULL, **pp;
+	SSL_SESSION *sess = NULL;
+	struct sess_shard *sh;
+	uint32_t h;
+
+	*copy = 0;
+	if (len <= 0 || len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+		goto out;
+
+	sh = sess_shard_of(c, id, (unsigned int)len, &h);
+	pthread_mutex_lock(&sh->lock);
+	pp = sess_slot(sh, h, id, (unsigned int)len);
+	e = *pp;
+	if (e) {
+		SSL_SESSION *x = e->sess;
+
+		if ((time_t)SSL_SESSION_get_time(x) +
+		    (time_t)SSL_SESSION_get_timeout(x) <= time(NULL)) {
+			stale = sess_unlink(sh, pp);
+		} else if (SSL_SESSION_up_ref(x) == 1) {
+			sess = x;
+		}
+	}
+	pthread_mutex_unlock(&sh->lock);
+
+	if (stale)
+		sess_ent_free(stale);
+out:
+	atomic_fetch_add_explicit(sess ? &c->nr_cache_hit : &c->nr_cache_miss,
+				  1, memory_order_relaxed);
+	return sess;
+}
+
+/* OpenSSL drops a session: expired, failed, or a single-use ticket used. */
+static void sess_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+	struct gwp_ssl_ctx *c = SSL_CTX_get_app_data(ctx);
+	struct sess_ent *e = NULL, **pp;
+	const unsigned char *id;
+	struct sess_shard *sh;
+	unsigned int len;
+	uint32_t h;
+
+	if (!c || !c->shards)
+		return;
+
+	id = SSL_SESSION_get_id(sess, &len);
+	sh = sess_shard_of(c, id, len, &h);
+	pthread_mutex_lock(&sh->lock);
+	pp = sess_slot(sh, h, id, len);
+	if (*pp)
+		e = sess_unlink(sh, pp);
+	pthread_mutex_unlock(&sh->lock);
+
+	if (e)
+		sess_ent_free(e);
+}
+
+static int sess_cache_init(struct gwp_ssl_ctx *c, unsigned int max)
+{
+	uint32_t per = (max + SESS_NR_SHARDS - 1) / SESS_NR_SHARDS, nb = 1;
+	unsigned int i;
+
+	/* Buckets: the next power of two at or above a shard's share. */
+	while (nb < per)
+		nb <<= 1;
+
+	c->shards = aligned_alloc(64, sizeof(*c->shards) * SESS_NR_SHARDS);
+	if (!c->shards)
+		return -ENOMEM;
+
+	for (i = 0; i < SESS_NR_SHARDS; i++) {
+		struct sess_shard *sh = &c->shards[i];
+
+		memset(sh, 0, sizeof(*sh));
+		sh->bucket = calloc(nb, sizeof(*sh->bucket));
+		if (!sh->bucket || pthread_mutex_init(&sh->lock, NULL)) {
+			free(sh->bucket);
+			sh->bucket = NULL;
+			while (i--) {
+				pthread_mutex_destroy(&c->shards[i].lock);
+				free(c->shards[i].bucket);
+			}
+			free(c->shards);
+			c->shards = NULL;
+			return -ENOMEM;
+		}
+		sh->mask = nb - 1;
+		sh->max = per;
+	}
+
+	return 0;
+}
+
+static void sess_cache_free(struct gwp_ssl_ctx *c)
+{
+	struct sess_ent *e, *n;
+	unsigned int i;
+
+	if (!c->shards)
+		return;
+
+	for (i = 0; i < SESS_NR_SHARDS; i++) {
+		struct sess_shard *sh = &c->shards[i];
+
+		for (e = sh->oldest; e; e = n) {
+			n = e->next;
+			sess_ent_free(e);
+		}
+		pthread_mutex_destroy(&sh->lock);
+		free(sh->bucket);
+	}
+	free(c->shards);
+	c->shards = NULL;
+}
+
+int gwp_ssl_ctx_set_resumption(struct gwp_ssl_ctx *c, unsigned int ticket_secs,
+			       unsigned int cache_max)
+{
+	SSL_CTX *ctx = c->ctx;
+	int r;
+
+	SSL_CTX_set_app_data(ctx, c);
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"gwproxy", 7);
+
+	if (ticket_secs) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		c->ticket_secs = ticket_secs;
+		r = tkt_key_new(&c->tkt[0]);
+		if (r)
+			return r;
+		if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tkt_key_cb) != 1)
+			return -EINVAL;
+#endif
+		/* A ticket outlives its key by up to one rotation, not more. */
+		SSL_CTX_set_timeout(ctx, ticket_secs);
+	} else {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		/* TLS 1.3 would still issue stateful tickets; useless uncached. */
+		if (!cache_max)
+			SSL_CTX_set_num_tickets(ctx, 0);
+	}
+
+	if (!cache_max) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		return 0;
+	}
+
+	r = sess_cache_init(c, cache_max);
+	if (r)
+		return r;
+
+	/*
+	 * OpenSSL's own cache is one table behind one lock for the whole
+	 * process; every worker would meet on it.
+	 */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER |
+					    SSL_SESS_CACHE_NO_INTERNAL);
+	SSL_CTX_sess_set_new_cb(ctx, sess_new_cb);
+	SSL_CTX_sess_set_get_cb(ctx, sess_get_cb);
+	SSL_CTX_sess_set_remove_cb(ctx, sess_remove_cb);
+	return 0;
+}
+
+void gwp_ssl_ctx_resume_stats(struct gwp_ssl_ctx *c,
+			      struct gwp_ssl_resume_stats *st)
+{
+	st->nr_full = atomic_load_explicit(&c->nr_full, memory_order_relaxed);
+	st->nr_resumed = atomic_load_explicit(&c->nr_resumed,
+					      memory_order_relaxed);
+	st->nr_ticket_bad = atomic_load_explicit(&c->nr_ticket_bad,
+						 memory_order_relaxed);
+	st->nr_cache_hit = atomic_load_explicit(&c->nr_cache_hit,
+						memory_order_relaxed);
+	st->nr_cache_miss = atomic_load_explicit(&c->nr_cache_miss,
+						 memory_order_relaxed);
+	st->nr_cache_evict = atomic_load_explicit(&c->nr_cache_evict,
+						  memory_order_relaxed);
+}
+
 static struct gwp_ssl *ssl_new(struct gwp_ssl_ctx *ctx)
 {
 	struct gwp_ssl *s = calloc(1, sizeof(*s));
@@ -134,6 +760,8 @@ static struct gwp_ssl *ssl_new(struct gwp_ssl_ctx *ctx)
 
 	/* SSL takes ownership of both BIOs; SSL_free() will release them. */
 	SSL_set_bio(s->ssl, s->rbio, s->wbio);
+	SSL_set_app_data(s->ssl, s);
+	s->ctx = ctx;
 	return s;
 }
 
@@ -159,10 +787,45 @@ void gwp_ssl_free(struct gwp_ssl *s)
 {
 	if (!s)
 		return;
+	/*
+	 * OpenSSL drops the session of a connection freed without a
+	 * close_notify as if it had failed, which a proxied connection that
+	 * simply ends, or one handed over to kTLS, has not. A fatal error
+	 * already dropped it when it happened.
+	 */
+	if (SSL_is_init_finished(s->ssl))
+		SSL_set_shutdown(s->ssl, SSL_get_shutdown(s->ssl) |
+					 SSL_SENT_SHUTDOWN);
 	SSL_free(s->ssl);	/* also frees the two BIOs set via SSL_set_bio */
+	OPENSSL_cleanse(s, sizeof(*s));
 	free(s);
 }
 
+int gwp_ssl_set_max_version(struct gwp_ssl *s, int version)
+{
+	return SSL_set_max_proto_version(s->ssl, version) == 1 ? 0 : -EINVAL;
+}
+
+struct gwp_ssl_session *gwp_ssl_get1_session(struct gwp_ssl *s)
+{
+	return (struct gwp_ssl_session *)SSL_get1_session(s->ssl);
+}
+
+int gwp_ssl_set_session(struct gwp_ssl *s, struct gwp_ssl_session *sess)
+{
+	return SSL_set_session(s->ssl, (SSL_SESSION *)sess) == 1 ? 0 : -EINVAL;
+}
+
+void gwp_ssl_session_free(struct gwp_ssl_session *sess)
+{
+	SSL_SESSION_free((SSL_SESSION *)sess);
+}
+
+bool gwp_ssl_session_reused(struct gwp_ssl *s)
+{
+	return SSL_session_reused(s->ssl) == 1;
+}
+
 int gwp_ssl_set_alpn(struct gwp_ssl *s, const void *protos, size_t len)
 {
 	/* SSL_set_alpn_protos() returns 0 on success (note the inverted sense). */
@@ -266,9 +929,16 @@ int gwp_ssl_handshake(struct gwp_ssl *s)
 {
 	int r = SSL_do_handshake(s->ssl);
 
-	if (r == 1)
-		return GWP_SSL_OK;
-	return map_err(s, r);
+	if (r != 1)
+		return map_err(s, r);
+
+	if (!s->hs_counted) {
+		s->hs_counted = true;
+		atomic_fetch_add_explicit(SSL_session_reused(s->ssl) ?
+					  &s->ctx->nr_resumed : &s->ctx->nr_full,
+					  1, memory_order_relaxed);
+	}
+	return GWP_SSL_OK;
 }
 
 int gwp_ssl_read(struct gwp_ssl *s, void *buf, size_t len, size_t *out_len)
@@ -321,6 +991,284 @@ int gwp_ssl_shutdown(struct gwp_ssl *s)
 	return map_err(s, r);
 }
 
+bool gwp_ssl_ktls_ready(struct gwp_ssl *s)
+{
+	return SSL_is_init_finished(s->ssl) && !SSL_has_pending(s->ssl) &&
+	       !BIO_ctrl_pending(s->rbio) && !BIO_ctrl_pending(s->wbio);
+}
+
+#ifdef GWP_SSL_HAVE_KTLS
+/* TLS 1.3 HKDF-Expand-Label with an empty context (RFC 8446, 7.1). */
+static int hkdf_expand_label(const EVP_MD *md, const unsigned char *secret,
+			     size_t secret_len, const char *label,
+			     unsigned char *out, size_t out_len)
+{
+	unsigned char info[2 + 1 + 6 + 16 + 1];
+	size_t label_len = strlen(label), info_len;
+	int mode = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+	OSSL_PARAM params[5], *p = params;
+	EVP_KDF_CTX *kctx;
+	EVP_KDF *kdf;
+	int r;
+
+	info[0] = (unsigned char)(out_len >> 8);
+	info[1] = (unsigned char)out_len;
+	info[2] = (unsigned char)(6 + label_len);
+	memcpy(&info[3], "tls13 ", 6);
+	memcpy(&info[9], label, label_len);
+	info[9 + label_len] = 0;
+	info_len = 10 + label_len;
+
+	kdf = EVP_KDF_fetch(NULL, "HKDF", NULL);
+	kctx = kdf ? EVP_KDF_CTX_new(kdf) : NULL;
+	EVP_KDF_free(kdf);
+	if (!kctx)
+		return -ENOMEM;
+
+	*p++ = OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode);
+	*p++ = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST,
+						(char *)EVP_MD_get0_name(md), 0);
+	*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY,
+						 (void *)secret, secret_len);
+	*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info,
+						 info_len);
+	*p = OSSL_PARAM_construct_end();
+	r = EVP_KDF_derive(kctx, out, out_len, params);
+	EVP_KDF_CTX_free(kctx);
+	return r == 1 ? 0 : -EINVAL;
+}
+
+/* The TLS 1.2 key block (RFC 5246, 6.3), which for AEAD ciphers has no MAC keys. */
+static int tls12_key_block(SSL *ssl, const EVP_MD *md, unsigned char *out,
+			   size_t out_len)
+{
+	unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+	unsigned char seed[13 + 2 * SSL3_RANDOM_SIZE];
+	OSSL_PARAM params[4], *p = params;
+	size_t master_len;
+	EVP_KDF_CTX *kctx;
+	EVP_KDF *kdf;
+	int r;
+
+	master_len = SSL_SESSION_get_master_key(SSL_get_session(ssl), master,
+						sizeof(master));
+	memcpy(seed, "key expansion", 13);
+	SSL_get_server_random(ssl, seed + 13, SSL3_RANDOM_SIZE);
+	SSL_get_client_random(ssl, seed + 13 + SSL3_RANDOM_SIZE,
+			      SSL3_RANDOM_SIZE);
+
+	kdf = EVP_KDF_fetch(NULL, "TLS1-PRF", NULL);
+	kctx = kdf ? EVP_KDF_CTX_new(kdf) : NULL;
+	EVP_KDF_free(kdf);
+	if (!kctx) {
+		OPENSSL_cleanse(master, sizeof(master));
+		return -ENOMEM;
+	}
+
+	*p++ = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST,
+						(char *)EVP_MD_get0_name(md), 0);
+	*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SECRET, master,
+						 master_len);
+	*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SEED, seed,
+						 sizeof(seed));
+	*p = OSSL_PARAM_construct_end();
+	r = EVP_KDF_derive(kctx, out, out_len, params);
+	EVP_KDF_CTX_free(kctx);
+	OPENSSL_cleanse(master, sizeof(master));
+	return r == 1 ? 0 : -EINVAL;
+}
+
+union ktls_crypto_info {
+	struct tls12_crypto_info_aes_gcm_128		gcm128;
+	struct tls12_crypto_info_aes_gcm_256		gcm256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305	chacha;
+#endif
+};
+
+/*
+ * The write key and IV of the side that sends in direction @tx. @iv gets the
+ * whole nonce base: 12 bytes, except the 4-byte salt of TLS 1.2 AES-GCM.
+ */
+static int ktls_keys(struct gwp_ssl *s, bool tx, const EVP_MD *md,
+		     unsigned char *key, size_t key_len, unsigned char *iv,
+		     size_t iv_len)
+{
+	unsigned char kb[2 * 32 + 2 * 12];
+	bool client_side = tx != (bool)SSL_is_server(s->ssl);
+	size_t off;
+	int r;
+
+	if (SSL_version(s->ssl) == TLS1_3_VERSION) {
+		const unsigned char *secret = tx ? s->tx_secret : s->rx_secret;
+		size_t len = tx ? s->tx_secret_len : s->rx_secret_len;
+
+		if (!len)
+			return -EOPNOTSUPP;
+		r = hkdf_expand_label(md, secret, len, "key", key, key_len);
+		if (!r)
+			r = hkdf_expand_label(md, secret, len, "iv", iv, iv_len);
+		return r;
+	}
+
+	r = tls12_key_block(s->ssl, md, kb, 2 * key_len + 2 * iv_len);
+	if (!r) {
+		off = client_side ? 0 : key_len;
+		memcpy(key, kb + off, key_len);
+		off = 2 * key_len + (client_side ? 0 : iv_len);
+		memcpy(iv, kb + off, iv_len);
+	}
+	OPENSSL_cleanse(kb, sizeof(kb));
+	return r;
+}
+
+int gwp_ssl_ktls_info(struct gwp_ssl *s, bool tx, void *buf, size_t len)
+{
+	const SSL_CIPHER *c = SSL_get_current_cipher(s->ssl);
+	int version = SSL_version(s->ssl);
+	unsigned char key[32], iv[12], seq[8];
+	union ktls_crypto_info ci;
+	size_t key_len, iv_len, ci_len;
+	uint64_t n = tx ? s->tx_seq : s->rx_seq;
+	const EVP_MD *md;
+	int i, nid, r;
+
+	if (!c || (version != TLS1_2_VERSION && version != TLS1_3_VERSION))
+		return -EOPNOTSUPP;
+
+	md = SSL_CIPHER_get_handshake_digest(c);
+	nid = SSL_CIPHER_get_cipher_nid(c);
+	switch (nid) {
+	case NID_aes_128_gcm:
+		key_len = 16;
+		break;
+	case NID_aes_256_gcm:
+		key_len = 32;
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case NID_chacha20_poly1305:
+		key_len = 32;
+		break;
+#endif
+	default:
+		return -EOPNOTSUPP;
+	}
+	if (!md)
+		return -EOPNOTSUPP;
+
+	iv_len = (nid != NID_chacha20_poly1305 && version == TLS1_2_VERSION) ?
+		 4 : 12;
+	r = ktls_keys(s, tx, md, key, key_len, iv, iv_len);
+	if (r)
+		goto out;
+
+	for (i = 7; i >= 0; i--) {
+		seq[i] = (unsigned char)n;
+		n >>= 8;
+	}
+
+	memset(&ci, 0, sizeof(ci));
+	ci.gcm128.info.version = (version == TLS1_3_VERSION) ? TLS_1_3_VERSION :
+							       TLS_1_2_VERSION;
+	switch (nid) {
+	case NID_aes_128_gcm:
+		ci.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(ci.gcm128.key, key, 16);
+		memcpy(ci.gcm128.salt, iv, 4);
+		/*
+		 * TLS 1.2 sends the rest of the nonce with each record; any
+		 * value that never repeats will do, and the kernel counts up
+		 * from this one.
+		 */
+		memcpy(ci.gcm128.iv, iv_len == 12 ? iv + 4 : seq, 8);
+		memcpy(ci.gcm128.rec_seq, seq, 8);
+		ci_len = sizeof(ci.gcm128);
+		break;
+	case NID_aes_256_gcm:
+		ci.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(ci.gcm256.key, key, 32);
+		memcpy(ci.gcm256.salt, iv, 4);
+		memcpy(ci.gcm256.iv, iv_len == 12 ? iv + 4 : seq, 8);
+		memcpy(ci.gcm256.rec_seq, seq, 8);
+		ci_len = sizeof(ci.gcm256);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	default:
+		ci.chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(ci.chacha.key, key, 32);
+		memcpy(ci.chacha.iv, iv, 12);
+		memcpy(ci.chacha.rec_seq, seq, 8);
+		ci_len = sizeof(ci.chacha);
+		break;
+#endif
+	}
+
+	if (ci_len > len) {
+		r = -ENOSPC;
+		goto out;
+	}
+	memcpy(buf, &ci, ci_len);
+	r = (int)ci_len;
+out:
+	OPENSSL_cleanse(key, sizeof(key));
+	OPENSSL_cleanse(iv, sizeof(iv));
+	OPENSSL_cleanse(&ci, sizeof(ci));
+	return r;
+}
+
+int gwp_ssl_ktls_start(struct gwp_ssl *s, int fd)
+{
+	union ktls_crypto_info ci;
+	int n, r;
+
+	if (!gwp_ssl_ktls_ready(s))
+		return -EOPNOTSUPP;
+
+	n = gwp_ssl_ktls_info(s, true, &ci, sizeof(ci));
+	if (n < 0)
+		return (n == -EOPNOTSUPP) ? n : -EOPNOTSUPP;
+
+	/* ENOENT: no "tls" ULP; ENOPROTOOPT: a kernel older than ULPs. */
+	if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"))) {
+		r = (errno == ENOENT || errno == ENOPROTOOPT) ? -ENOENT :
+								 -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* Until a key is in, the ULP passes everything through untouched. */
+	if (setsockopt(fd, SOL_TLS, TLS_TX, &ci, (socklen_t)n)) {
+		r = -EOPNOTSUPP;
+		goto out;
+	}
+
+	n = gwp_ssl_ktls_info(s, false, &ci, sizeof(ci));
+	if (n < 0 || setsockopt(fd, SOL_TLS, TLS_RX, &ci, (socklen_t)n)) {
+		r = -EIO;
+		goto out;
+	}
+	r = 0;
+out:
+	OPENSSL_cleanse(&ci, sizeof(ci));
+	return r;
+}
+#else /* !GWP_SSL_HAVE_KTLS */
+int gwp_ssl_ktls_info(struct gwp_ssl *s, bool tx, void *buf, size_t len)
+{
+	(void)s;
+	(void)tx;
+	(void)buf;
+	(void)len;
+	return -EOPNOTSUPP;
+}
+
+int gwp_ssl_ktls_start(struct gwp_ssl *s, int fd)
+{
+	(void)s;
+	(void)fd;
+	return -EOPNOTSUPP;
+}
+#endif /* GWP_SSL_HAVE_KTLS */
+
 const char *gwp_ssl_errstr(void)
 {
 	static __thread char buf[256];
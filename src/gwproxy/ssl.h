@@ -6,7 +6,8 @@
  * buffers. Received ciphertext is fed in with gwp_ssl_bio_write(); ciphertext
  * the engine wants to send is pulled out with gwp_ssl_bio_read(); plaintext
  * crosses via gwp_ssl_read()/gwp_ssl_write(). It knows nothing about sockets or
- * the event loop, so the same code serves epoll and io_uring.
+ * the event loop, so the same code serves epoll and io_uring. The one exception
+ * is gwp_ssl_ktls_start(), which hands the negotiated keys to a socket.
  *
  * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
  */
@@ -14,9 +15,11 @@
 #define GWPROXY__SSL_H
 
 #include <stddef.h>
+#include <stdbool.h>
 
 struct gwp_ssl_ctx;
 struct gwp_ssl;
+struct gwp_ssl_session;
 
 /*
  * Result of a TLS operation. After any non-OK result the caller should also
@@ -37,6 +40,38 @@ int gwp_ssl_ctx_server_create(struct gwp_ssl_ctx **out, const char *cert_file,
 int gwp_ssl_ctx_client_create(struct gwp_ssl_ctx **out);
 void gwp_ssl_ctx_free(struct gwp_ssl_ctx *ctx);
 
+/*
+ * Session resumption for a server ctx, so a returning client skips the
+ * certificate and key exchange. Call once, before the first connection.
+ *
+ * @ticket_secs > 0 turns on stateless session tickets sealed with keys held
+ * in the ctx, replaced every @ticket_secs seconds. A ticket sealed under the
+ * previous key is still accepted (and replaced with a fresh one), so any
+ * ticket is good for its whole @ticket_secs lifetime. 0 turns tickets off.
+ *
+ * @cache_max > 0 adds a session ID cache of about that many sessions for TLS
+ * 1.2 session IDs and, with tickets off, TLS 1.3's stateful tickets. It is
+ * split into independently locked shards, so workers resuming different
+ * sessions do not contend. 0 turns stateful resumption off.
+ *
+ * Both are safe to use from every worker at once. Returns 0 or -errno.
+ */
+int gwp_ssl_ctx_set_resumption(struct gwp_ssl_ctx *c, unsigned int ticket_secs,
+			       unsigned int cache_max);
+
+/* Counters since the ctx was created, across all workers. */
+struct gwp_ssl_resume_stats {
+	unsigned long	nr_full;	/* handshakes with no resumption */
+	unsigned long	nr_resumed;	/* ... resumed, by ticket or by ID */
+	unsigned long	nr_ticket_bad;	/* tickets under a key no longer held */
+	unsigned long	nr_cache_hit;
+	unsigned long	nr_cache_miss;
+	unsigned long	nr_cache_evict;	/* pushed out to make room */
+};
+
+void gwp_ssl_ctx_resume_stats(struct gwp_ssl_ctx *c,
+			      struct gwp_ssl_resume_stats *st);
+
 /*
  * Allocate a per-connection TLS state in server (accept) or client (connect)
  * role, wired to internal memory BIOs. Returns NULL on allocation failure.
@@ -90,6 +125,19 @@ int gwp_ssl_write(struct gwp_ssl *s, const void *buf, size_t len,
 /* Queue a close_notify into the send BIO (best effort). */
 int gwp_ssl_shutdown(struct gwp_ssl *s);
 
+/*
+ * Client side: the session negotiated on @s, to offer on a later connection
+ * to the same server with gwp_ssl_set_session() before its handshake. Under
+ * TLS 1.3 the server sends it after the handshake, so it is only there once
+ * the client has read past it. Returns NULL when there is none.
+ */
+struct gwp_ssl_session *gwp_ssl_get1_session(struct gwp_ssl *s);
+int gwp_ssl_set_session(struct gwp_ssl *s, struct gwp_ssl_session *sess);
+void gwp_ssl_session_free(struct gwp_ssl_session *sess);
+
+/* Whether the completed handshake on @s resumed a session. */
+bool gwp_ssl_session_reused(struct gwp_ssl *s);
+
 /*
  * Set the client-side ALPN protocol list (@protos in ALPN wire form: each entry
  * a length byte followed by that many bytes). Returns 0 on success, <0 on error.
@@ -97,6 +145,12 @@ int gwp_ssl_shutdown(struct gwp_ssl *s);
  */
 int gwp_ssl_set_alpn(struct gwp_ssl *s, const void *protos, size_t len);
 
+/*
+ * Cap the protocol version this connection may negotiate (TLS1_2_VERSION,
+ * ...). Returns 0 on success, <0 on error.
+ */
+int gwp_ssl_set_max_version(struct gwp_ssl *s, int version);
+
 /*
  * The ALPN protocol negotiated for this connection as a NUL-terminated string,
  * or NULL if none was selected. Points at a per-thread buffer valid until the
@@ -104,6 +158,33 @@ int gwp_ssl_set_alpn(struct gwp_ssl *s, const void *protos, size_t len);
  */
 const char *gwp_ssl_alpn(struct gwp_ssl *s);
 
+/*
+ * Kernel TLS. Once the handshake is over, the record layer can move into the
+ * kernel (setsockopt SOL_TLS): the socket then reads and writes plaintext and
+ * this object is no longer needed. Only AES-128-GCM, AES-256-GCM and
+ * ChaCha20-Poly1305 under TLS 1.2 or 1.3 qualify.
+ *
+ * gwp_ssl_ktls_ready() says whether the switch can happen now: the handshake
+ * is done, every received byte has been decrypted (so the socket's read
+ * position is on a record boundary) and no ciphertext is waiting to be sent.
+ */
+bool gwp_ssl_ktls_ready(struct gwp_ssl *s);
+
+/*
+ * Fill @buf with the struct tls12_crypto_info_* for the send (@tx) or receive
+ * direction, at the current record sequence number. Returns its size, or
+ * -EOPNOTSUPP for a cipher or version the kernel cannot take over.
+ */
+int gwp_ssl_ktls_info(struct gwp_ssl *s, bool tx, void *buf, size_t len);
+
+/*
+ * Install both directions on @fd. Returns 0 on success. -ENOENT means the
+ * kernel has no TLS support and -EOPNOTSUPP that this connection's cipher is
+ * not offloadable; either way nothing changed and the connection carries on
+ * through the BIOs. Any other error leaves the socket unusable.
+ */
+int gwp_ssl_ktls_start(struct gwp_ssl *s, int fd);
+
 /*
  * A human-readable string for the most recent OpenSSL error on this thread
  * (drains one entry from the error queue). For logging by the caller.
@@ -20,6 +20,7 @@
 #include <sys/resource.h>
 #include <sys/timerfd.h>
 #include <sys/inotify.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
@@ -206,6 +207,17 @@ static inline ssize_t __sys_send(int sockfd, const void *buf, size_t len,
 	return __sys_sendto(sockfd, buf, len, flags, NULL, 0);
 }
 
+static inline ssize_t __sys_recvmsg(int sockfd, struct msghdr *msg, int flags)
+{
+	return (ssize_t) __do_syscall3(__NR_recvmsg, sockfd, msg, flags);
+}
+
+static inline ssize_t __sys_sendmsg(int sockfd, const struct msghdr *msg,
+				    int flags)
+{
+	return (ssize_t) __do_syscall3(__NR_sendmsg, sockfd, msg, flags);
+}
+
 static inline int __sys_accept4(int sockfd, struct sockaddr *addr,
 				 socklen_t *addrlen, int flags)
 {
@@ -296,6 +308,19 @@ static inline pid_t __sys_gettid(void)
 {
 	return (pid_t)__do_syscall0(__NR_gettid);
 }
+
+static inline int __sys_pipe2(int fds[2], int flags)
+{
+	return (int) __do_syscall2(__NR_pipe2, fds, flags);
+}
+
+static inline ssize_t __sys_splice(int fd_in, loff_t *off_in, int fd_out,
+				   loff_t *off_out, size_t len,
+				   unsigned int flags)
+{
+	return (ssize_t) __do_syscall6(__NR_splice, fd_in, off_in, fd_out,
+				       off_out, len, flags);
+}
 #else /* #ifdef __x86_64__ */
 
 #include <errno.h>
@@ -351,6 +376,19 @@ static inline ssize_t __sys_send(int sockfd, const void *buf, size_t len,
 	return __sys_sendto(sockfd, buf, len, flags, NULL, 0);
 }
 
+static inline ssize_t __sys_recvmsg(int sockfd, struct msghdr *msg, int flags)
+{
+	ssize_t r = recvmsg(sockfd, msg, flags);
+	return (r < 0) ? -errno : r;
+}
+
+static inline ssize_t __sys_sendmsg(int sockfd, const struct msghdr *msg,
+				    int flags)
+{
+	ssize_t r = sendmsg(sockfd, msg, flags);
+	return (r < 0) ? -errno : r;
+}
+
 static inline int __sys_accept4(int sockfd, struct sockaddr *addr,
 				 socklen_t *addrlen, int flags)
 {
@@ -448,6 +486,20 @@ static inline pid_t __sys_gettid(void)
 {
 	return (pid_t)syscall(__NR_gettid);
 }
+
+static inline int __sys_pipe2(int fds[2], int flags)
+{
+	int r = pipe2(fds, flags);
+	return (r < 0) ? -errno : r;
+}
+
+static inline ssize_t __sys_splice(int fd_in, loff_t *off_in, int fd_out,
+				   loff_t *off_out, size_t len,
+				   unsigned int flags)
+{
+	ssize_t r = splice(fd_in, off_in, fd_out, off_out, len, flags);
+	return (r < 0) ? -errno : r;
+}
 #endif /* #endif __x86_64__ */
 
 #endif /* #ifndef GWPROXY_SYSCALL_H */
@@ -8,9 +8,13 @@
 #undef NDEBUG
 #endif
 #include <gwproxy/acl.h>
+#include <gwproxy/qsbr.h>
 #include <gwproxy/common.h>
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -222,6 +226,96 @@ static noinline void test_domain(void)
 	gwp_acl_destroy(a);
 }
 
+static noinline void test_domain_suffix(void)
+{
+	struct gwp_acl *a = NULL;
+	struct gwp_acl_req req;
+
+	/* A zone matches itself and every name under it, on label bounds. */
+	assert(!gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain-suffix *.Example.com -j REJECT\n"
+		"-A OUTPUT -m domain --domain-suffix .org -j REJECT\n"));
+	assert(out(a, NULL, "example.com", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "www.EXAMPLE.com", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "a.b.c.example.com", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "badexample.com", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	assert(out(a, NULL, "example.com.au", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	assert(out(a, NULL, "gnu.org", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "org", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "org.com", 443, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	assert(out(a, NULL, NULL, 443, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	gwp_acl_destroy(a);
+
+	/* Negated, and tried in order with exact and catch-all rules. */
+	a = NULL;
+	assert(!gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain mail.corp.test -j ACCEPT\n"
+		"-A OUTPUT -m domain --domain-suffix corp.test -j MARK --set-mark 7\n"
+		"-A OUTPUT -m domain --domain-suffix wiki.corp.test -j ACCEPT\n"
+		"-A OUTPUT -m domain ! --domain-suffix corp.test -j ACCEPT\n"
+		"-A OUTPUT -j REJECT\n"));
+	memset(&req, 0, sizeof(req));
+	req.domain = "mail.corp.test"; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT && !req.mark_set);
+	memset(&req, 0, sizeof(req));
+	req.domain = "x.wiki.corp.test"; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(req.mark_set && req.mark == 7);
+	assert(out(a, NULL, "git.corp.test", 0, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, NULL, "example.net", 0, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	gwp_acl_destroy(a);
+
+	/* OUTPUT-only, not with -d, and no bare or inner wildcards. */
+	a = NULL;
+	assert(gwp_acl_parse_str(&a,
+		"-A INPUT -m domain --domain-suffix example.com -j REJECT\n"));
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain-suffix * -j REJECT\n"));
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain-suffix *. -j REJECT\n"));
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain-suffix a.*.com -j REJECT\n"));
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -d 1.2.3.4 -m domain --domain-suffix a.com -j REJECT\n"));
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain a.com --domain-suffix a.com -j REJECT\n"));
+
+	assert(gwp_acl_parse_str(&a,
+		"-A OUTPUT -m domain --domain-suffix ..com -j REJECT\n"));
+}
+
+/* Many zones, some nested: the first one in file order still wins. */
+static noinline void test_domain_suffix_large(void)
+{
+	struct gwp_acl *a = NULL;
+	struct gwp_acl_req req;
+	size_t cap = 1u << 20, len = 0;
+	char *big = malloc(cap), dom[64];
+	unsigned i;
+
+	assert(big);
+	for (i = 0; i < 5000; i++) {
+		len += (size_t)snprintf(big + len, cap - len,
+			"-A OUTPUT -m domain --domain-suffix z%u.test -j MARK --set-mark %u --accept\n"
+			"-A OUTPUT -m domain --domain-suffix sub.z%u.test -j REJECT\n",
+			i, i + 1, i);
+		assert(len < cap);
+	}
+	assert(!gwp_acl_parse_str(&a, big));
+	free(big);
+
+	for (i = 0; i < 5000; i += 13) {
+		snprintf(dom, sizeof(dom), "host.sub.z%u.test", i);
+		memset(&req, 0, sizeof(req));
+		req.domain = dom; req.proto = GWP_ACL_PROTO_TCP;
+		assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+		assert(req.mark_set && req.mark == i + 1);
+	}
+	assert(out(a, NULL, "z5000.test", 0, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	assert(out(a, NULL, "a..z7.test", 0, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	gwp_acl_destroy(a);
+}
+
 static noinline void test_domain_regexp(void)
 {
 #ifdef CONFIG_PCRE
@@ -706,18 +800,576 @@ static noinline void test_domain_only_target_criteria(void)
 	gwp_acl_destroy(a);
 }
 
+/*
+ * Rules filed under different indexes (catch-all, -d, -s, -m domain,
+ * --dports) must still be tried in file order: a modifier above a terminal
+ * rule applies, and a terminal rule above a modifier hides it.
+ */
+static noinline void test_compiled_order(void)
+{
+	struct gwp_sockaddr t = sa4("10.1.2.3", 8080);
+	struct gwp_sockaddr t6 = sa6("2001:db8::1", 443);
+	struct gwp_sockaddr c = sa4mapped("192.0.2.7", 5000);
+	struct gwp_acl *a = NULL;
+	struct gwp_acl_req req;
+
+	assert(!gwp_acl_parse_str(&a,
+		"-A OUTPUT -j MARK --set-mark 1\n"
+		"-A OUTPUT -d 10.0.0.0/8 -j MARK --set-mark 2\n"
+		"-A OUTPUT -m domain --domain A.Example -j MARK --set-mark 3\n"
+		"-A OUTPUT --dports 8080,8080-8081 -j ACCEPT\n"
+		"-A OUTPUT -d 10.1.0.0/16 -j REJECT\n"
+		"-A OUTPUT -d 10.1.2.0/24 --dports 8080 -j REJECT\n"
+		"-A OUTPUT -d 10.2.0.0/16 -j MARK --set-mark 4 --accept\n"
+		"-A OUTPUT -d 10.2.0.0/16 -j REJECT\n"
+		"-A OUTPUT -d 2001:db8::/32 -j MARK --set-mark 6\n"
+		"-A OUTPUT ! -d 10.0.0.0/8 --dports 443 -j REJECT\n"
+		"-A OUTPUT -d 0.0.0.0/0 --dports 22 -j REJECT\n"
+		"-A INPUT -s 192.0.2.0/24 --sports 5000 -j REJECT\n"
+		"-A INPUT -s 192.0.2.7 -j ACCEPT\n"
+		"-A INPUT -j REJECT\n"
+		"-P OUTPUT ACCEPT\n"));
+
+	/* The --dports ACCEPT sits above both REJECTs of 10.1.2.3. */
+	memset(&req, 0, sizeof(req));
+	req.target = &t; req.dport = 8080; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(req.mark_set && req.mark == 2);
+	assert(out(a, &t, NULL, 8081, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+
+	/* Domain-only: the -d and --dports rules cannot match. */
+	memset(&req, 0, sizeof(req));
+	req.domain = "a.EXAMPLE"; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(req.mark_set && req.mark == 3);
+
+	t = sa4("10.2.0.9", 80);
+	memset(&req, 0, sizeof(req));
+	req.target = &t; req.dport = 80; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(req.mark_set && req.mark == 4);
+
+	t = sa4("10.9.0.1", 443);
+	assert(out(a, &t, NULL, 443, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	t = sa4("192.168.1.1", 443);
+	assert(out(a, &t, NULL, 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(out(a, &t, NULL, 22, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	memset(&req, 0, sizeof(req));
+	req.target = &t; req.dport = 80; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(req.mark_set && req.mark == 1);
+
+	memset(&req, 0, sizeof(req));
+	req.target = &t6; req.dport = 443; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_REJECT);
+	assert(req.mark_set && req.mark == 6);
+
+	/* A v4-mapped client is found under its IPv4 prefixes. */
+	assert(in(a, &c, 5000, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	assert(in(a, &c, 5001, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	c = sa4("192.0.2.8", 5001);
+	assert(in(a, &c, 5001, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	gwp_acl_destroy(a);
+}
+
+/* A generated 20k-rule chain: only the matching rule decides. */
+static noinline void test_compiled_large(void)
+{
+	size_t cap = 2u << 20, len = 0;
+	struct gwp_sockaddr t;
+	struct gwp_acl *a = NULL;
+	struct gwp_acl_req req;
+	char *text = malloc(cap), ip[32], dom[64];
+	unsigned i;
+
+	assert(text);
+	for (i = 0; i < 5000; i++) {
+		len += (size_t)snprintf(text + len, cap - len,
+			"-A OUTPUT -d 10.%u.%u.0/24 -j REJECT\n"
+			"-A OUTPUT -m domain --domain host%u.example -j MARK --set-mark %u\n"
+			"-A OUTPUT -d 2001:db8:%x::/48 --dports 443 -j REJECT\n"
+			"-A OUTPUT -d 172.16.%u.%u -j DNAT --to 192.0.2.1:%u\n",
+			i >> 8, i & 255, i, i + 1, i, i >> 8, i & 255,
+			1000 + i);
+		assert(len < cap);
+	}
+#ifdef CONFIG_PCRE
+	/* Regex rules are never indexed; this one is on the catch-all. */
+	len += (size_t)snprintf(text + len, cap - len,
+		"-A OUTPUT -m domain --domain-regexp ^deny -j REJECT\n");
+#endif
+	snprintf(text + len, cap - len, "-P OUTPUT ACCEPT\n");
+	assert(!gwp_acl_parse_str(&a, text));
+	free(text);
+
+	for (i = 0; i < 5000; i += 7) {
+		snprintf(ip, sizeof(ip), "10.%u.%u.200", i >> 8, i & 255);
+		t = sa4(ip, 80);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+
+		snprintf(dom, sizeof(dom), "HOST%u.example", i);
+		memset(&req, 0, sizeof(req));
+		req.domain = dom; req.proto = GWP_ACL_PROTO_TCP;
+		assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+		assert(req.mark_set && req.mark == i + 1);
+
+		snprintf(ip, sizeof(ip), "2001:db8:%x:1::5", i);
+		t = sa6(ip, 443);
+		assert(out(a, &t, NULL, 443, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+
+		snprintf(ip, sizeof(ip), "172.16.%u.%u", i >> 8, i & 255);
+		t = sa4(ip, 80);
+		memset(&req, 0, sizeof(req));
+		req.target = &t; req.dport = 80; req.proto = GWP_ACL_PROTO_TCP;
+		assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+		assert(req.dnat_applied && ntohs(req.dnat.i4.sin_port) == 1000 + i);
+	}
+
+	t = sa4("10.200.0.1", 80);
+	assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	t = sa4("172.16.200.1", 80);
+	memset(&req, 0, sizeof(req));
+	req.target = &t; req.dport = 80; req.proto = GWP_ACL_PROTO_TCP;
+	assert(gwp_acl_eval_output(a, &req) == GWP_ACL_ACCEPT);
+	assert(!req.dnat_applied && !req.mark_set);
+	assert(out(a, NULL, "host5000.example", 0, GWP_ACL_PROTO_TCP) ==
+	       GWP_ACL_ACCEPT);
+#ifdef CONFIG_PCRE
+	assert(out(a, NULL, "deny.example", 0, GWP_ACL_PROTO_TCP) ==
+	       GWP_ACL_REJECT);
+#endif
+	gwp_acl_destroy(a);
+}
+
+static void write_rules(const char *path, const char *text)
+{
+	FILE *f = fopen(path, "w");
+
+	assert(f);
+	assert(fputs(text, f) >= 0);
+	fclose(f);
+}
+
+struct reload_reader {
+	struct gwp_acl		*acl;
+	struct gwp_qsbr		*q;
+	_Atomic(bool)		stop;
+	unsigned long		nr_evals;
+};
+
+/* Either ruleset may be live, but eval never sees a half-swapped one. */
+static void *reload_reader(void *arg)
+{
+	struct reload_reader *rr = arg;
+	struct gwp_sockaddr t = sa4("10.1.2.3", 80);
+	struct gwp_acl_req req;
+	int i;
+
+	while (!atomic_load(&rr->stop)) {
+		gwp_qsbr_online(rr->q, 0);
+		for (i = 0; i < 16; i++) {
+			memset(&req, 0, sizeof(req));
+			req.target = &t; req.dport = 80;
+			req.proto = GWP_ACL_PROTO_TCP;
+			if (gwp_acl_eval_output(rr->acl, &req) == GWP_ACL_REJECT)
+				assert(req.mark_set && req.mark == 1);
+			else
+				assert(req.mark_set && req.mark == 2);
+			rr->nr_evals++;
+		}
+		gwp_qsbr_offline(rr->q, 0);
+	}
+	return NULL;
+}
+
+/*
+ * gwp_acl_reload() swaps whole rulesets under a running reader; the old
+ * one is freed through the qsbr domain once the reader has moved on.
+ */
+static noinline void test_reload_under_reader(void)
+{
+	static const char rules_a[] =
+		"-A OUTPUT -j MARK --set-mark 1\n"
+		"-A OUTPUT -d 10.0.0.0/8 -j REJECT\n";
+	static const char rules_b[] =
+		"-A OUTPUT -j MARK --set-mark 2\n"
+		"-A OUTPUT -d 10.0.0.0/8 -j ACCEPT\n";
+	char path[] = "/tmp/gwp_acl_reload.XXXXXX";
+	struct reload_reader rr = { 0 };
+	struct gwp_sockaddr t = sa4("10.1.2.3", 80);
+	pthread_t thr;
+	int fd, i;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	write_rules(path, rules_a);
+
+	assert(!gwp_qsbr_init(&rr.q, 1));
+	assert(!gwp_acl_create(&rr.acl, path));
+	gwp_acl_set_qsbr(rr.acl, rr.q);
+	assert(!pthread_create(&thr, NULL, reload_reader, &rr));
+
+	for (i = 0; i < 200; i++) {
+		write_rules(path, (i & 1) ? rules_a : rules_b);
+		assert(!gwp_acl_reload(rr.acl));
+	}
+
+	/* A bad file keeps the rules in place. */
+	write_rules(path, "-A OUTPUT -j NOPE\n");
+	assert(gwp_acl_reload(rr.acl) < 0);
+
+	atomic_store(&rr.stop, true);
+	pthread_join(thr, NULL);
+	assert(out(rr.acl, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+
+	gwp_acl_destroy(rr.acl);
+	gwp_qsbr_free(rr.q);
+	unlink(path);
+}
+
+static bool set_path_is(const char *path, void *arg)
+{
+	return !strcmp(path, arg);
+}
+
+static int count_set(const char *path, void *arg)
+{
+	(void)path;
+	(*(int *)arg)++;
+	return 0;
+}
+
+static noinline void test_match_set(void)
+{
+	char path[] = "/tmp/gwp_acl_set.XXXXXX";
+	char rules[256];
+	struct gwp_sockaddr t, c;
+	struct gwp_acl *a;
+	int fd, nr = 0;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	write_rules(path,
+		"# threat feed\n"
+		"10.0.0.0/8\n"
+		"  10.1.0.0/16   # overlaps the /8\n"
+		"\n"
+		"192.168.1.5\n"
+		"172.16.0.1-172.16.0.10\n"
+		"1.2.3.0/25\n"
+		"1.2.3.128/25\n"
+		"255.255.255.255\n"
+		"2001:db8::/32\n"
+		"::1\n"
+		"fe80::1-fe80::ff");
+
+	snprintf(rules, sizeof(rules),
+		 "--set bad %s\n"
+		 "-A OUTPUT -m set --match-set bad dst -j REJECT\n"
+		 "-A INPUT -m set ! --match-set bad src -j REJECT\n", path);
+	assert(!gwp_acl_parse_str(&a, rules));
+	assert(!gwp_acl_for_each_set(a, count_set, &nr));
+	assert(nr == 1);
+
+#define SET_OUT(ip, want) do {						\
+		t = strchr(ip, ':') ? sa6(ip, 80) : sa4(ip, 80);	\
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == (want)); \
+	} while (0)
+	SET_OUT("10.2.3.4", GWP_ACL_REJECT);
+	SET_OUT("10.255.255.255", GWP_ACL_REJECT);
+	SET_OUT("11.0.0.0", GWP_ACL_ACCEPT);
+	SET_OUT("9.255.255.255", GWP_ACL_ACCEPT);
+	SET_OUT("192.168.1.5", GWP_ACL_REJECT);
+	SET_OUT("192.168.1.6", GWP_ACL_ACCEPT);
+	SET_OUT("172.16.0.1", GWP_ACL_REJECT);
+	SET_OUT("172.16.0.10", GWP_ACL_REJECT);
+	SET_OUT("172.16.0.11", GWP_ACL_ACCEPT);
+	SET_OUT("1.2.3.127", GWP_ACL_REJECT);
+	SET_OUT("1.2.3.128", GWP_ACL_REJECT);
+	SET_OUT("1.2.4.0", GWP_ACL_ACCEPT);
+	SET_OUT("0.0.0.0", GWP_ACL_ACCEPT);
+	SET_OUT("255.255.255.255", GWP_ACL_REJECT);
+	SET_OUT("255.255.255.254", GWP_ACL_ACCEPT);
+	SET_OUT("2001:db8:ffff::1", GWP_ACL_REJECT);
+	SET_OUT("2001:db9::", GWP_ACL_ACCEPT);
+	SET_OUT("::1", GWP_ACL_REJECT);
+	SET_OUT("::2", GWP_ACL_ACCEPT);
+	SET_OUT("fe80::80", GWP_ACL_REJECT);
+	SET_OUT("fe80::100", GWP_ACL_ACCEPT);
+	t = sa4mapped("10.9.9.9", 80);
+	assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+	/* No target address: a dst set matches neither way. */
+	assert(out(a, NULL, "x.example", 80, GWP_ACL_PROTO_TCP) ==
+	       GWP_ACL_ACCEPT);
+
+	c = sa4("10.0.0.1", 1234);
+	assert(in(a, &c, 1234, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+	c = sa4("8.8.8.8", 1234);
+	assert(in(a, &c, 1234, GWP_ACL_PROTO_TCP) == GWP_ACL_REJECT);
+
+	/* The set reloads on its own; the rules stay as they are. */
+	write_rules(path, "8.8.8.0/24\n");
+	assert(gwp_acl_reload_sets(a, set_path_is, "/nonexistent") == 0);
+	SET_OUT("10.2.3.4", GWP_ACL_REJECT);
+	assert(gwp_acl_reload_sets(a, set_path_is, path) == 1);
+	SET_OUT("10.2.3.4", GWP_ACL_ACCEPT);
+	SET_OUT("8.8.8.8", GWP_ACL_REJECT);
+	SET_OUT("::1", GWP_ACL_ACCEPT);
+	assert(in(a, &c, 1234, GWP_ACL_PROTO_TCP) == GWP_ACL_ACCEPT);
+
+	/* A bad set file keeps the previous contents. */
+	write_rules(path, "8.8.4.4\nnot-an-address\n");
+	assert(gwp_acl_reload_sets(a, set_path_is, path) == -EINVAL);
+	SET_OUT("8.8.8.8", GWP_ACL_REJECT);
+	SET_OUT("8.8.4.4", GWP_ACL_ACCEPT);
+	write_rules(path, "");
+	assert(gwp_acl_reload_sets(a, set_path_is, path) == 1);
+	SET_OUT("8.8.8.8", GWP_ACL_ACCEPT);
+#undef SET_OUT
+	gwp_acl_destroy(a);
+
+	/* Parse errors. */
+	write_rules(path, "10.0.0.0/8\n");
+#define SET_BAD(fmt, want) do {						\
+		snprintf(rules, sizeof(rules), fmt, path);		\
+		assert(gwp_acl_parse_str(&a, rules) == (want));		\
+	} while (0)
+	SET_BAD("--set s %s\n-A OUTPUT -m set --match-set t dst -j REJECT\n",
+		-EINVAL);
+	SET_BAD("--set s %s\n-A OUTPUT -m set -j REJECT\n", -EINVAL);
+	SET_BAD("--set s %s\n-A OUTPUT -m set --match-set s -j REJECT\n",
+		-EINVAL);
+	SET_BAD("--set s %s\n-A OUTPUT -m set --match-set s both -j REJECT\n",
+		-EINVAL);
+	SET_BAD("--set s %s\n-A INPUT -m set --match-set s dst -j REJECT\n",
+		-EINVAL);
+	SET_BAD("--set s %s\n-A OUTPUT --match-set s dst -j REJECT\n",
+		-EINVAL);
+	SET_BAD("-A OUTPUT -m set --match-set s dst -j REJECT\n--set s %s\n",
+		-EINVAL);
+	SET_BAD("--set s %s\n--set s /dev/null\n", -EEXIST);
+	SET_BAD("--set s %s extra\n", -EINVAL);
+	SET_BAD("--set s %s.missing\n", -ENOENT);
+#undef SET_BAD
+	write_rules(path, "10.0.0.9-10.0.0.1\n");
+	snprintf(rules, sizeof(rules), "--set s %s\n", path);
+	assert(gwp_acl_parse_str(&a, rules) == -EINVAL);
+	write_rules(path, "10.0.0.1-::1\n");
+	assert(gwp_acl_parse_str(&a, rules) == -EINVAL);
+	write_rules(path, "10.0.0.0/33\n");
+	assert(gwp_acl_parse_str(&a, rules) == -EINVAL);
+
+	unlink(path);
+}
+
+/* A feed-sized set: every other address of a wide block, so nothing merges. */
+static noinline void test_match_set_large(void)
+{
+	enum { NR = 200000 };
+	char path[] = "/tmp/gwp_acl_set.XXXXXX";
+	char rules[128], ip[INET6_ADDRSTRLEN];
+	struct gwp_sockaddr t;
+	struct gwp_acl *a;
+	struct in_addr in4;
+	uint32_t i;
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	f = fdopen(fd, "w");
+	assert(f);
+	for (i = NR; i-- > 0;) {
+		in4.s_addr = htonl(0x0b000000u + 2 * i);
+		assert(inet_ntop(AF_INET, &in4, ip, sizeof(ip)));
+		fprintf(f, "%s\n", ip);
+		fprintf(f, "2001:db8::%x:%x/128\n", i >> 15, (i & 0x7fff) * 2);
+	}
+	fclose(f);
+
+	snprintf(rules, sizeof(rules),
+		 "--set feed %s\n"
+		 "-A OUTPUT -m set --match-set feed dst -j REJECT\n", path);
+	assert(!gwp_acl_parse_str(&a, rules));
+
+	for (i = 0; i < NR; i += 97) {
+		in4.s_addr = htonl(0x0b000000u + 2 * i);
+		assert(inet_ntop(AF_INET, &in4, ip, sizeof(ip)));
+		t = sa4(ip, 80);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) ==
+		       GWP_ACL_REJECT);
+		in4.s_addr = htonl(0x0b000000u + 2 * i + 1);
+		assert(inet_ntop(AF_INET, &in4, ip, sizeof(ip)));
+		t = sa4(ip, 80);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) ==
+		       GWP_ACL_ACCEPT);
+
+		snprintf(ip, sizeof(ip), "2001:db8::%x:%x", i >> 15,
+			 (i & 0x7fff) * 2);
+		t = sa6(ip, 80);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) ==
+		       GWP_ACL_REJECT);
+		snprintf(ip, sizeof(ip), "2001:db8::%x:%x", i >> 15,
+			 (i & 0x7fff) * 2 + 1);
+		t = sa6(ip, 80);
+		assert(out(a, &t, NULL, 80, GWP_ACL_PROTO_TCP) ==
+		       GWP_ACL_ACCEPT);
+	}
+
+	gwp_acl_destroy(a);
+	unlink(path);
+}
+
+static enum gwp_acl_verdict out_memo(struct gwp_acl *a, struct gwp_acl_memo *m,
+				     struct gwp_sockaddr *c,
+				     struct gwp_sockaddr *t, const char *dom,
+				     const char *user, struct gwp_acl_req *req)
+{
+	memset(req, 0, sizeof(*req));
+	req->client = c;
+	req->target = t;
+	req->domain = dom;
+	req->user = user;
+	req->sport = c ? ntohs(c->i4.sin_port) : 0;
+	req->dport = t ? ntohs(t->i4.sin_port) : 0;
+	req->proto = GWP_ACL_PROTO_UDP;
+	return gwp_acl_eval_output_memo(a, m, req);
+}
+
+/*
+ * The memo answers repeats from its entries, keys on everything the rules
+ * can see, and forgets everything when the rules or a set reload.
+ */
+static noinline void test_memo(void)
+{
+	char path[] = "/tmp/gwp_acl_memo.XXXXXX";
+	char set_path[] = "/tmp/gwp_acl_memo_set.XXXXXX";
+	char rules[512], longdom[200];
+	struct gwp_sockaddr c1 = sa4("192.0.2.1", 1000);
+	struct gwp_sockaddr c2 = sa4("192.0.2.2", 1000);
+	struct gwp_sockaddr t = sa4("198.51.100.1", 443);
+	struct gwp_sockaddr tm = sa4mapped("198.51.100.1", 443);
+	struct gwp_sockaddr t2;
+	struct gwp_acl_memo m = { 0 };
+	struct gwp_acl_req req;
+	struct gwp_acl *a;
+	int fd, i;
+
+	fd = mkstemp(set_path);
+	assert(fd >= 0);
+	close(fd);
+	write_rules(set_path, "203.0.113.0/24\n");
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	snprintf(rules, sizeof(rules),
+		 "--set bad %s\n"
+		 "-A OUTPUT -m set --match-set bad dst -j REJECT\n"
+		 "-A OUTPUT -j MARK --set-mark 7\n"
+		 "-A OUTPUT -m user --user eve -j REJECT\n"
+		 "-A OUTPUT -m domain --domain blocked.example -j REJECT\n"
+		 "-A OUTPUT --dports 443 -j DNAT --to :8443\n", set_path);
+	write_rules(path, rules);
+	assert(!gwp_acl_create(&a, path));
+
+	/* A repeat is answered from the memo, outputs and all. */
+	for (i = 0; i < 3; i++) {
+		assert(out_memo(a, &m, &c1, &t, NULL, NULL, &req) ==
+		       GWP_ACL_ACCEPT);
+		assert(req.mark_set && req.mark == 7);
+		assert(req.dnat_applied && req.dnat.sa.sa_family == AF_INET);
+		assert(ntohs(req.dnat.i4.sin_port) == 8443);
+	}
+	assert(m.next == 1);
+
+	/* No rule looks at the client, so another client shares the entry. */
+	assert(out_memo(a, &m, &c2, &t, NULL, NULL, &req) == GWP_ACL_ACCEPT);
+	assert(m.next == 1);
+
+	/* The DNAT copies the target's family, so the target keys exactly. */
+	assert(out_memo(a, &m, &c1, &tm, NULL, NULL, &req) == GWP_ACL_ACCEPT);
+	assert(req.dnat.sa.sa_family == AF_INET6);
+	assert(m.next == 2);
+
+	/* Domain and user are part of the key. */
+	assert(out_memo(a, &m, &c1, &t, "blocked.example", NULL, &req) ==
+	       GWP_ACL_REJECT);
+	assert(out_memo(a, &m, &c1, &t, "ok.example", NULL, &req) ==
+	       GWP_ACL_ACCEPT);
+	assert(out_memo(a, &m, &c1, &t, NULL, "eve", &req) == GWP_ACL_REJECT);
+	assert(out_memo(a, &m, &c1, &t, NULL, "bob", &req) == GWP_ACL_ACCEPT);
+	assert(out_memo(a, &m, &c1, &t, "eve", NULL, &req) == GWP_ACL_ACCEPT);
+
+	/* Too long to keep inline: evaluated every time, never remembered. */
+	memset(longdom, 'a', sizeof(longdom) - 1);
+	longdom[sizeof(longdom) - 1] = '\0';
+	i = (int)m.next;
+	assert(out_memo(a, &m, &c1, &t, longdom, NULL, &req) == GWP_ACL_ACCEPT);
+	assert(m.next == (uint32_t)i);
+
+	/* More targets than entries: evicted ones are just evaluated again. */
+	for (i = 0; i < 3 * (int)GWP_ACL_MEMO_NR; i++) {
+		char ip[32];
+
+		snprintf(ip, sizeof(ip), "203.0.%d.1", 112 + (i & 3));
+		t2 = sa4(ip, 80);
+		assert(out_memo(a, &m, &c1, &t2, NULL, NULL, &req) ==
+		       ((i & 3) == 1 ? GWP_ACL_REJECT : GWP_ACL_ACCEPT));
+	}
+
+	/* A set reload invalidates what the old contents decided. */
+	t2 = sa4("203.0.113.9", 80);
+	assert(out_memo(a, &m, &c1, &t2, NULL, NULL, &req) == GWP_ACL_REJECT);
+	write_rules(set_path, "");
+	assert(gwp_acl_reload_sets(a, set_path_is, set_path) == 1);
+	assert(out_memo(a, &m, &c1, &t2, NULL, NULL, &req) == GWP_ACL_ACCEPT);
+
+	/* So does a rule reload, and new rules on the client key it. */
+	snprintf(rules, sizeof(rules),
+		 "--set bad %s\n"
+		 "-A OUTPUT -s 192.0.2.2 -j REJECT\n"
+		 "-A OUTPUT --sports 2000 -j REJECT\n", set_path);
+	write_rules(path, rules);
+	assert(!gwp_acl_reload(a));
+	assert(out_memo(a, &m, &c1, &t, NULL, NULL, &req) == GWP_ACL_ACCEPT);
+	assert(!req.mark_set && !req.dnat_applied);
+	assert(out_memo(a, &m, &c2, &t, NULL, NULL, &req) == GWP_ACL_REJECT);
+	c1.i4.sin_port = htons(2000);
+	assert(out_memo(a, &m, &c1, &t, NULL, NULL, &req) == GWP_ACL_REJECT);
+	c1.i4.sin_port = htons(1000);
+	assert(out_memo(a, &m, &c1, &t, NULL, NULL, &req) == GWP_ACL_ACCEPT);
+
+	/* No memo: plain evaluation. */
+	assert(out_memo(a, NULL, &c2, &t, NULL, NULL, &req) == GWP_ACL_REJECT);
+
+	gwp_acl_destroy(a);
+	unlink(path);
+	unlink(set_path);
+}
+
 static void run_tests(void)
 {
 	size_t i;
 
 	/* Negative cases print the offending line to stderr; run them once. */
 	test_parse_errors();
+	test_compiled_large();
+	test_domain_suffix_large();
+	test_reload_under_reader();
+	test_match_set();
+	test_match_set_large();
+	test_memo();
 
 	for (i = 0; i < 200; i++) {
 		test_default_ruleset();
 		test_ports_and_negation();
 		test_input_and_proto();
 		test_domain();
+		test_domain_suffix();
 		test_domain_regexp();
 		test_domain_only_target_criteria();
 		test_user();
@@ -725,6 +1377,7 @@ static void run_tests(void)
 		test_bind();
 		test_dnat();
 		test_comments_and_default_policy();
+		test_compiled_order();
 	}
 	printf("All tests passed!\n");
 }
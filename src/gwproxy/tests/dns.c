@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -31,8 +33,8 @@ struct req_template {
  * fails, the assertion below aborts, and `make test-unit` stops before the
  * socks5/http1/http/acl binaries ever run -- indistinguishable from a real
  * regression in gwp_dns_queue(). Repeating a handful of local names keeps the
- * many-requests shape (queue, workers, eventfd, refcounts, cache inserts) that
- * this test is actually about, and covers both address families.
+ * many-requests shape (queue, workers, completion queues, refcounts, cache
+ * inserts) that this test is actually about, and covers both address families.
  */
 static const struct req_template req_template[] = {
 	{ "localhost",		"80" },
@@ -52,12 +54,20 @@ static const struct req_template req_template[] = {
 	{ "::1",		"9090" },
 };
 
-static int poll_all_in(struct pollfd *pfd, int n, int timeout)
+/*
+ * Play the worker: wait on @efd, reap completion queue @cq and drop the
+ * queue's reference on each entry, until @n entries came back. Every entry
+ * must come back exactly once, on the queue it was queued to.
+ */
+static int reap_all(struct gwp_dns_ctx *ctx, uint32_t cq, int efd, int n)
 {
-	int ret, i, t = 0;
+	struct pollfd pfd = { .fd = efd, .events = POLLIN };
+	struct gwp_dns_entry *e, *next;
+	eventfd_t val;
+	int ret, t = 0;
 
-	while (1) {
-		ret = poll(pfd, n, timeout);
+	while (t < n) {
+		ret = poll(&pfd, 1, 5000);
 		if (ret < 0) {
 			perror("poll");
 			return -1;
@@ -67,45 +77,61 @@ static int poll_all_in(struct pollfd *pfd, int n, int timeout)
 			return -ETIMEDOUT;
 		}
 
-		for (i = 0; i < n; i++) {
-			if (pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) {
-				pfd[i].events = 0;
-				t++;
-			}
+		assert(!eventfd_read(efd, &val));
+		for (e = gwp_dns_reap(ctx, cq); e; e = next) {
+			next = e->next;
+			assert(e->cq == cq);
+			assert(*(int *)e->udata == 0);
+			*(int *)e->udata = 1;
+			gwp_dns_entry_put(e);
+			t++;
 		}
+	}
+
+	return 0;
+}
 
-		if (t == n)
-			return 0;
+static struct gwp_dns_ctx *init_ctx(struct gwp_dns_cfg *cfg, int *efd)
+{
+	struct gwp_dns_ctx *ctx;
+	uint32_t i;
+	int r;
+
+	r = gwp_dns_ctx_init(&ctx, cfg);
+	assert(!r);
+	assert(ctx != NULL);
+
+	for (i = 0; i < (cfg->nr_cq ? cfg->nr_cq : 1); i++) {
+		efd[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		assert(efd[i] >= 0);
+		gwp_dns_set_cq_fd(ctx, i, efd[i]);
 	}
+	return ctx;
 }
 
 static void test_basic_dns_multiple_requests(void)
 {
 	struct gwp_dns_cfg cfg = { .nr_workers = 1 };
 	struct gwp_dns_entry *earr[ARRAY_SIZE(req_template)];
-	struct pollfd pfd[ARRAY_SIZE(req_template)];
+	int done[ARRAY_SIZE(req_template)] = { 0 };
 	struct gwp_dns_ctx *ctx;
-	int i, n;
+	int i, n, efd;
 	int r;
 
-	r = gwp_dns_ctx_init(&ctx, &cfg);
-	assert(!r);
-	assert(ctx != NULL);
+	ctx = init_ctx(&cfg, &efd);
 
 	n = (int)ARRAY_SIZE(req_template);
 	for (i = 0; i < n; i++) {
 		const struct req_template *rt = &req_template[i];
-		earr[i] = gwp_dns_queue(ctx, rt->domain, rt->service);
+		earr[i] = gwp_dns_queue(ctx, rt->domain, rt->service, 0, &done[i]);
 		assert(earr[i]);
-		assert(earr[i]->ev_fd >= 0);
-		pfd[i].fd = earr[i]->ev_fd;
-		pfd[i].events = POLLIN;
 	}
 
-	r = poll_all_in(pfd, n, 5000);
+	r = reap_all(ctx, 0, efd, n);
 	assert(!r);
 
 	for (i = 0; i < n; i++) {
+		assert(done[i]);
 		assert(earr[i]->res == 0);
 		r = earr[i]->addrs[0].sa.sa_family;
 		assert(r == AF_INET || r == AF_INET6);
@@ -114,6 +140,104 @@ static void test_basic_dns_multiple_requests(void)
 	for (i = 0; i < n; i++)
 		gwp_dns_entry_put(earr[i]);
 	gwp_dns_ctx_free(ctx);
+	close(efd);
+}
+
+/*
+ * Several DNS threads completing onto two workers' queues: each entry comes
+ * back on its own queue. Entries whose owner let go before the result came
+ * back are released by the DNS thread or by the reap, never handed out.
+ */
+static void test_completion_queues(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 4, .nr_cq = 2 };
+	struct gwp_dns_entry *earr[ARRAY_SIZE(req_template)];
+	int done[ARRAY_SIZE(req_template)] = { 0 };
+	struct gwp_dns_entry *orphan;
+	struct gwp_dns_ctx *ctx;
+	int i, n, efd[2], r;
+
+	ctx = init_ctx(&cfg, efd);
+
+	n = (int)ARRAY_SIZE(req_template);
+	for (i = 0; i < n; i++) {
+		const struct req_template *rt = &req_template[i];
+
+		/* The owner lets go right away, as a closing worker would. */
+		orphan = gwp_dns_queue(ctx, rt->domain, rt->service,
+				       (uint32_t)i & 1u, NULL);
+		assert(orphan);
+		gwp_dns_entry_put(orphan);
+
+		earr[i] = gwp_dns_queue(ctx, rt->domain, rt->service,
+					(uint32_t)i & 1u, &done[i]);
+		assert(earr[i]);
+	}
+
+	r = reap_all(ctx, 0, efd[0], (n + 1) / 2);
+	assert(!r);
+	r = reap_all(ctx, 1, efd[1], n / 2);
+	assert(!r);
+
+	for (i = 0; i < n; i++) {
+		assert(done[i]);
+		assert(earr[i]->res == 0);
+		gwp_dns_entry_put(earr[i]);
+	}
+	gwp_dns_ctx_free(ctx);
+	close(efd[0]);
+	close(efd[1]);
+}
+
+/*
+ * A herd of requests for one name and service shares one resolution, even
+ * when the request it attached to is dropped first. Each waiter still comes
+ * back on its own queue with its own copy of the answer, and a different
+ * service is not mixed in.
+ */
+static void test_singleflight(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 1, .nr_cq = 2 };
+	struct gwp_dns_entry *earr[64], *other, *lead;
+	int done[64] = { 0 }, other_done = 0;
+	struct gwp_dns_ctx *ctx;
+	int i, efd[2], r;
+
+	ctx = init_ctx(&cfg, efd);
+
+	lead = gwp_dns_queue(ctx, "localhost", "80", 0, NULL);
+	assert(lead);
+	for (i = 0; i < 64; i++) {
+		earr[i] = gwp_dns_queue(ctx, i & 2 ? "LOCALHOST" : "localhost",
+					"80", (uint32_t)i & 1u, &done[i]);
+		assert(earr[i]);
+	}
+	other = gwp_dns_queue(ctx, "localhost", "443", 0, &other_done);
+	assert(other);
+	gwp_dns_entry_put(lead);
+
+	r = reap_all(ctx, 0, efd[0], 32 + 1);
+	assert(!r);
+	r = reap_all(ctx, 1, efd[1], 32);
+	assert(!r);
+
+	assert(other_done && other->res == 0 && other->nr_addrs >= 1);
+	assert(ntohs(other->addrs[0].i4.sin_port) == 443);
+	for (i = 0; i < 64; i++) {
+		assert(done[i]);
+		assert(earr[i]->res == 0);
+		assert(earr[i]->nr_addrs == earr[0]->nr_addrs);
+		assert(!memcmp(earr[i]->addrs, earr[0]->addrs,
+			       sizeof(earr[0]->addrs[0]) * earr[0]->nr_addrs));
+		assert(ntohs(earr[i]->addrs[0].i4.sin_port) == 80);
+	}
+	for (i = 0; i < 64; i++)
+		gwp_dns_entry_put(earr[i]);
+	gwp_dns_entry_put(other);
+
+	gwp_dns_ctx_free(ctx);
+	close(efd[0]);
+	close(efd[1]);
 }
 
 static void test_dns_cache(void)
@@ -122,19 +246,13 @@ static void test_dns_cache(void)
 	struct gwp_sockaddr addr;
 	struct gwp_dns_ctx *ctx;
 	struct gwp_dns_entry *e;
-	struct pollfd pfd;
-	int r;
+	int r, efd, done = 0;
 
-	r = gwp_dns_ctx_init(&ctx, &cfg);
-	assert(!r);
-	assert(ctx != NULL);
+	ctx = init_ctx(&cfg, &efd);
 
-	e = gwp_dns_queue(ctx, "localhost", "80");
+	e = gwp_dns_queue(ctx, "localhost", "80", 0, &done);
 	assert(e != NULL);
-	assert(e->ev_fd >= 0);
-	pfd.fd = e->ev_fd;
-	pfd.events = POLLIN;
-	r = poll_all_in(&pfd, 1, 5000);
+	r = reap_all(ctx, 0, efd, 1);
 	assert(r == 0);
 	assert(e->res == 0);
 	r = e->addrs[0].sa.sa_family;
@@ -148,6 +266,7 @@ static void test_dns_cache(void)
 	r = gwp_dns_cache_lookup(ctx, "aaaa.com", "80", &addr);
 	assert(r == -ENOENT);
 	gwp_dns_ctx_free(ctx);
+	close(efd);
 }
 
 /* A throwaway one-address (IPv4) addrinfo for direct cache-layer tests. */
@@ -169,6 +288,7 @@ static void fill_ai_v4(struct addrinfo *ai, struct sockaddr_in *sa)
 static void test_dns_cache_cap(void)
 {
 	struct gwp_dns_cache *cache = NULL;
+	struct gwp_dns_cache_stats st;
 	struct gwp_dns_cache_entry *e;
 	struct sockaddr_in sa;
 	struct addrinfo ai;
@@ -187,22 +307,95 @@ static void test_dns_cache_cap(void)
 		assert(!r);
 	}
 
-	/* A fifth distinct key is refused and not cached. */
+	/* Everything but host0 gets asked for again. */
+	for (i = 1; i < 4; i++) {
+		snprintf(key, sizeof(key), "host%d.example", i);
+		r = gwp_dns_cache_getent(cache, key, &e);
+		assert(!r);
+		gwp_dns_cache_putent(e);
+	}
+
+	/* A fifth distinct key is cached; the cold host0 makes room. */
 	r = gwp_dns_cache_insert(cache, "host4.example", &ai, time(NULL) + 100);
-	assert(r == -ENOSPC);
+	assert(!r);
 	r = gwp_dns_cache_getent(cache, "host4.example", &e);
-	assert(r == -ENOENT);
-
-	/* Existing keys remain; replacing one (same key) is allowed when full. */
-	r = gwp_dns_cache_getent(cache, "host0.example", &e);
 	assert(!r);
 	gwp_dns_cache_putent(e);
-	r = gwp_dns_cache_insert(cache, "host0.example", &ai, time(NULL) + 100);
+	r = gwp_dns_cache_getent(cache, "host0.example", &e);
+	assert(r == -ENOENT);
+	for (i = 1; i < 4; i++) {
+		snprintf(key, sizeof(key), "host%d.example", i);
+		r = gwp_dns_cache_getent(cache, key, &e);
+		assert(!r);
+		gwp_dns_cache_putent(e);
+	}
+
+	/* Replacing an existing key at the cap evicts nothing. */
+	r = gwp_dns_cache_insert(cache, "host1.example", &ai, time(NULL) + 100);
 	assert(!r);
 
+	gwp_dns_cache_stats(cache, &st);
+	assert(st.nr_entries == 4);
+	assert(st.nr_evict == 1);
+	assert(st.nr_hit == 7);
+	assert(st.nr_miss == 1);
+
 	gwp_dns_cache_free(cache);
 }
 
+/*
+ * A heavy-tailed stream: a few hot names asked for all the time among many
+ * one-off names. The hot ones must survive a cache far smaller than the
+ * one-off set, although every hot lookup after the first is served by the
+ * worker's L1 and never reaches the shared cache: a worker that has not
+ * seen them yet still finds them there.
+ */
+static void test_dns_cache_clock(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 0, .nr_cq = 2,
+				   .cache_expiry = 100, .max_entries = 256 };
+	struct gwp_sockaddr list[GWP_DNS_MAX_ADDRS], a4;
+	struct gwp_dns_cache_stats st;
+	struct gwp_dns_ctx *ctx = NULL;
+	uint8_t nr = 0;
+	char key[32];
+	int r, i, j;
+
+	r = gwp_dns_ctx_init(&ctx, &cfg);
+	assert(!r && ctx);
+
+	memset(&a4, 0, sizeof(a4));
+	a4.i4.sin_family = AF_INET;
+	a4.i4.sin_addr.s_addr = htonl(0x7f000001);
+	for (i = 0; i < 8; i++) {
+		snprintf(key, sizeof(key), "hot%d.example", i);
+		gwp_dns_cache_store(ctx, key, &a4, 1, 100);
+	}
+
+	for (i = 0; i < 4096; i++) {
+		snprintf(key, sizeof(key), "cold%d.example", i);
+		gwp_dns_cache_store(ctx, key, &a4, 1, 100);
+		for (j = 0; j < 8; j++) {
+			snprintf(key, sizeof(key), "hot%d.example", j);
+			r = gwp_dns_cache_lookup_list(ctx, key, "80", 0, list,
+						      GWP_DNS_MAX_ADDRS, &nr);
+			assert(!r && nr == 1);
+		}
+	}
+
+	for (j = 0; j < 8; j++) {
+		snprintf(key, sizeof(key), "hot%d.example", j);
+		r = gwp_dns_cache_lookup_list(ctx, key, "80", 1, list,
+					      GWP_DNS_MAX_ADDRS, &nr);
+		assert(!r && nr == 1);
+	}
+
+	assert(!gwp_dns_ctx_cache_stats(ctx, &st));
+	assert(st.nr_entries <= 256);
+	assert(st.nr_evict >= 4096 + 8 - 256);
+	gwp_dns_ctx_free(ctx);
+}
+
 /* Keys are case-insensitive: a mixed-case insert is found by any case. */
 static void test_dns_cache_case(void)
 {
@@ -287,17 +480,13 @@ static void test_addr_list(void)
 	struct gwp_dns_ctx *ctx;
 	struct gwp_dns_entry *e;
 	uint8_t nr = 0, i;
-	struct pollfd pfd;
-	int r;
+	int r, efd, done = 0;
 
-	r = gwp_dns_ctx_init(&ctx, &cfg);
-	assert(!r);
+	ctx = init_ctx(&cfg, &efd);
 
-	e = gwp_dns_queue(ctx, "localhost", "80");
+	e = gwp_dns_queue(ctx, "localhost", "80", 0, &done);
 	assert(e != NULL);
-	pfd.fd = e->ev_fd;
-	pfd.events = POLLIN;
-	r = poll_all_in(&pfd, 1, 5000);
+	r = reap_all(ctx, 0, efd, 1);
 	assert(r == 0);
 	assert(e->res == 0);
 
@@ -332,7 +521,7 @@ static void test_addr_list(void)
 	gwp_dns_entry_put(e);
 
 	/* The cache stores every record; its list must match the resolver's. */
-	r = gwp_dns_cache_lookup_list(ctx, "localhost", "80", list,
+	r = gwp_dns_cache_lookup_list(ctx, "localhost", "80", 0, list,
 				      GWP_DNS_MAX_ADDRS, &nr);
 	assert(!r);
 	assert(nr >= 1);
@@ -342,9 +531,206 @@ static void test_addr_list(void)
 	assert(!r);
 	assert(one.sa.sa_family == list[0].sa.sa_family);
 
-	r = gwp_dns_cache_lookup_list(ctx, "aaaa.com", "80", list,
+	r = gwp_dns_cache_lookup_list(ctx, "aaaa.com", "80", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(r == -ENOENT);
+
+	gwp_dns_ctx_free(ctx);
+	close(efd);
+}
+
+/*
+ * Past its expiry an entry keeps serving inside the stale window, and only
+ * one caller at a time is told to refresh it. Past the window it is a miss.
+ */
+static void test_dns_cache_stale(void)
+{
+	struct gwp_dns_cache *cache = NULL;
+	struct gwp_dns_cache_stats st;
+	struct gwp_dns_cache_entry *e;
+	struct sockaddr_in sa;
+	struct addrinfo ai;
+	int r;
+
+	fill_ai_v4(&ai, &sa);
+	r = gwp_dns_cache_init(&cache, 16, 0);
+	assert(!r && cache);
+	gwp_dns_cache_set_refresh(cache, 10, 30);
+
+	r = gwp_dns_cache_insert(cache, "stale.example", &ai, time(NULL) - 5);
+	assert(!r);
+	r = gwp_dns_cache_getent(cache, "stale.example", &e);
+	assert(!r);
+	assert(gwp_dns_cache_claim_refresh(cache, e));
+	assert(!gwp_dns_cache_claim_refresh(cache, e));
+	gwp_dns_cache_putent(e);
+
+	r = gwp_dns_cache_insert(cache, "dead.example", &ai, time(NULL) - 31);
+	assert(!r);
+	r = gwp_dns_cache_getent(cache, "dead.example", &e);
+	assert(r == -ETIMEDOUT);
+
+	/* Nowhere near its last 10%: nothing to refresh yet. */
+	r = gwp_dns_cache_insert(cache, "fresh.example", &ai, time(NULL) + 100);
+	assert(!r);
+	r = gwp_dns_cache_getent(cache, "fresh.example", &e);
+	assert(!r);
+	assert(!gwp_dns_cache_claim_refresh(cache, e));
+	assert(gwp_dns_cache_entfresh(e) > time(NULL) + 80);
+	gwp_dns_cache_putent(e);
+
+	gwp_dns_cache_stats(cache, &st);
+	assert(st.nr_stale == 1 && st.nr_refresh == 1);
+	assert(st.nr_hit == 2 && st.nr_miss == 1);
+	gwp_dns_cache_free(cache);
+}
+
+/*
+ * Refresh-ahead end to end: a hit late in an entry's life still returns the
+ * cached address, and the DNS threads replace it in the background.
+ */
+static void test_dns_refresh_ahead(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 1, .cache_expiry = 4,
+				   .refresh_pct = 90 };
+	struct gwp_sockaddr list[GWP_DNS_MAX_ADDRS], a4;
+	struct gwp_dns_ctx *ctx;
+	uint8_t nr = 0;
+	int r, efd, i;
+
+	ctx = init_ctx(&cfg, &efd);
+
+	/* A made-up answer for a name the system resolver knows otherwise. */
+	memset(&a4, 0, sizeof(a4));
+	a4.i4.sin_family = AF_INET;
+	a4.i4.sin_addr.s_addr = htonl(0x7f0000fe);
+	gwp_dns_cache_store(ctx, "localhost", &a4, 1, 4);
+	r = gwp_dns_cache_lookup_list(ctx, "localhost", "80", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	assert(list[0].i4.sin_addr.s_addr == htonl(0x7f0000fe));
+
+	/* Into the last 90%: served as is, and replaced shortly after. */
+	sleep(1);
+	for (i = 0; i < 200; i++) {
+		r = gwp_dns_cache_lookup_list(ctx, "localhost", "80", 0, list,
+					      GWP_DNS_MAX_ADDRS, &nr);
+		assert(!r && nr >= 1);
+		if (list[0].sa.sa_family != AF_INET ||
+		    list[0].i4.sin_addr.s_addr != htonl(0x7f0000fe))
+			break;
+		usleep(10000);
+	}
+	assert(i < 200);
+
+	gwp_dns_ctx_free(ctx);
+	close(efd);
+}
+
+/*
+ * A cache refresh and a client lookup of the same name at the same time
+ * resolve it once, whichever comes first, although the refresh asks for no
+ * port in particular. The DNS threads are stopped first so that both stay
+ * in flight for as long as the test needs; test_singleflight() checks a
+ * follower gets its own port.
+ */
+static void test_refresh_joins_lookup(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 1, .cache_expiry = 30,
+				   .refresh_pct = 90 };
+	struct gwp_sockaddr list[GWP_DNS_MAX_ADDRS], a4;
+	struct gwp_dns_entry *ea, *eb;
+	struct gwp_dns_cache_stats st;
+	struct gwp_dns_ctx *ctx;
+	int r, efd, done[2] = { 0 };
+	uint8_t nr = 0;
+
+	ctx = init_ctx(&cfg, &efd);
+	memset(&a4, 0, sizeof(a4));
+	a4.i4.sin_family = AF_INET;
+	a4.i4.sin_addr.s_addr = htonl(0x7f0000fe);
+	gwp_dns_cache_store(ctx, "a.join.example", &a4, 1, 4);
+	gwp_dns_cache_store(ctx, "b.join.example", &a4, 1, 4);
+
+	/* Into the last 90% of both: the next hit claims a refresh. */
+	sleep(1);
+	gwp_dns_ctx_stop(ctx);
+
+	/* The refresh goes first; the lookup right behind it joins it. */
+	r = gwp_dns_cache_lookup_list(ctx, "a.join.example", "80", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	ea = gwp_dns_queue(ctx, "A.Join.Example", "8080", 0, &done[0]);
+	assert(ea);
+	assert(!gwp_dns_ctx_cache_stats(ctx, &st));
+	assert(st.nr_refresh == 1 && st.nr_coalesced == 1);
+
+	/* The lookup goes first; the refresh finds it and is dropped. */
+	eb = gwp_dns_queue(ctx, "b.join.example", "8081", 0, &done[1]);
+	assert(eb);
+	r = gwp_dns_cache_lookup_list(ctx, "b.join.example", "80", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	assert(!gwp_dns_ctx_cache_stats(ctx, &st));
+	assert(st.nr_refresh == 2 && st.nr_coalesced == 2);
+
+	gwp_dns_entry_put(ea);
+	gwp_dns_entry_put(eb);
+	gwp_dns_ctx_free(ctx);
+	close(efd);
+}
+
+/*
+ * Many names spread over the shards all stay reachable, and the per-worker
+ * front serves a repeat without losing track of a replaced entry: each queue
+ * keeps its own reference, so a swap underneath never frees what it holds.
+ */
+static void test_dns_cache_shards_l1(void)
+{
+	struct gwp_dns_cfg cfg = { .nr_workers = 0, .nr_cq = 2,
+				   .cache_expiry = 60, .max_entries = 1024 };
+	struct gwp_sockaddr list[GWP_DNS_MAX_ADDRS], a4;
+	struct gwp_dns_ctx *ctx = NULL;
+	char key[32];
+	uint8_t nr = 0;
+	int r, i;
+
+	r = gwp_dns_ctx_init(&ctx, &cfg);
+	assert(!r && ctx);
+
+	memset(&a4, 0, sizeof(a4));
+	a4.i4.sin_family = AF_INET;
+	a4.i4.sin_addr.s_addr = htonl(0x7f000001);
+	for (i = 0; i < 512; i++) {
+		snprintf(key, sizeof(key), "n%d.shard.example", i);
+		gwp_dns_cache_store(ctx, key, &a4, 1, 60);
+	}
+	for (i = 0; i < 512; i++) {
+		snprintf(key, sizeof(key), "N%d.Shard.Example", i);
+		r = gwp_dns_cache_lookup_list(ctx, key, "80", (uint32_t)i & 1u,
+					      list, GWP_DNS_MAX_ADDRS, &nr);
+		assert(!r && nr == 1);
+		assert(list[0].i4.sin_addr.s_addr == htonl(0x7f000001));
+		assert(ntohs(list[0].i4.sin_port) == 80);
+	}
+
+	/* Prime queue 0, replace the entry, and look again from both queues. */
+	r = gwp_dns_cache_lookup_list(ctx, "swap.example", "1", 0, list,
 				      GWP_DNS_MAX_ADDRS, &nr);
 	assert(r == -ENOENT);
+	gwp_dns_cache_store(ctx, "swap.example", &a4, 1, 60);
+	r = gwp_dns_cache_lookup_list(ctx, "swap.example", "1", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	a4.i4.sin_addr.s_addr = htonl(0x7f000002);
+	gwp_dns_cache_store(ctx, "swap.example", &a4, 1, 60);
+	r = gwp_dns_cache_lookup_list(ctx, "swap.example", "1", 0, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	r = gwp_dns_cache_lookup_list(ctx, "swap.example", "1", 1, list,
+				      GWP_DNS_MAX_ADDRS, &nr);
+	assert(!r && nr == 1);
+	assert(list[0].i4.sin_addr.s_addr == htonl(0x7f000002));
 
 	gwp_dns_ctx_free(ctx);
 }
@@ -352,10 +738,17 @@ static void test_addr_list(void)
 int main(void)
 {
 	test_basic_dns_multiple_requests();
+	test_completion_queues();
+	test_singleflight();
 	test_dns_cache();
 	test_dns_cache_cap();
+	test_dns_cache_clock();
 	test_dns_cache_case();
 	test_dns_cache_expiry_refcount();
+	test_dns_cache_stale();
+	test_dns_refresh_ahead();
+	test_refresh_joins_lookup();
+	test_dns_cache_shards_l1();
 	test_addr_list();
 	printf("All tests passed.\n");
 	return 0;
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ *
+ * Unit tests for the --raw-dns stub resolver (dns_resolver.c). The
+ * "server" is a UDP socket of our own: it only reads the query to learn
+ * its transaction ID, and the replies are handed to the resolver directly.
+ */
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <gwproxy/dns_resolver.h>
+#include <gwproxy/common.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct fake_srv {
+	int			fd;
+	char			addr[32];
+};
+
+static void srv_init(struct fake_srv *s)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	s->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(s->fd >= 0);
+	assert(!bind(s->fd, (struct sockaddr *)&sin, sizeof(sin)));
+	assert(!getsockname(s->fd, (struct sockaddr *)&sin, &len));
+	snprintf(s->addr, sizeof(s->addr), "127.0.0.1:%hu",
+		 ntohs(sin.sin_port));
+}
+
+/* Receive the query the resolver just sent and return its ID. */
+static uint16_t srv_recv_id(struct fake_srv *s)
+{
+	uint8_t buf[UDP_MSG_LIMIT];
+	uint16_t id;
+	ssize_t r;
+
+	r = recv(s->fd, buf, sizeof(buf), 0);
+	assert(r >= (ssize_t)sizeof(gwdns_header_pkt));
+	memcpy(&id, buf, sizeof(id));
+	return id;
+}
+
+/*
+ * An answer to @id whose question name is the raw label bytes @qname
+ * (length-prefixed, NUL-terminated), with one A record 192.0.2.1.
+ */
+static size_t build_reply(uint8_t *buf, uint16_t id, const uint8_t *qname,
+			  size_t qname_len)
+{
+	static const uint8_t hdr[] = {
+		0, 0, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 0,
+	};
+	static const uint8_t tail[] = {
+		/* QTYPE A, QCLASS IN */
+		0, 1, 0, 1,
+		/* Pointer to the question name, A, IN, TTL 60, 192.0.2.1 */
+		0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 192, 0, 2, 1,
+	};
+	size_t len = 0;
+
+	memcpy(buf, hdr, sizeof(hdr));
+	memcpy(buf, &id, sizeof(id));
+	len += sizeof(hdr);
+	memcpy(&buf[len], qname, qname_len);
+	len += qname_len;
+	memcpy(&buf[len], tail, sizeof(tail));
+	len += sizeof(tail);
+	return len;
+}
+
+/*
+ * A label is raw bytes and may carry a NUL. One that reads as the query's
+ * name up to the NUL but is longer than it must not match, and must not
+ * step the compare past the end of the name. The name sits in a zeroed
+ * buffer, so a compare that ran past it would see a match.
+ */
+static void test_question_nul_label(void)
+{
+	static const uint8_t nul_qname[] = { 6, 'a', 'b', 0, 0, 0, 0, 0 };
+	static const uint8_t good_qname[] = { 2, 'A', 'B', 0 };
+	struct gwp_dns_res_cfg cfg = { .timeout_ms = 1000, .nr_tries = 1 };
+	struct gwp_dns_query q, *done = NULL;
+	struct gwp_dns_resolver *res;
+	struct gwp_timer_wheel tw;
+	uint8_t buf[UDP_MSG_LIMIT];
+	struct gwp_sockaddr addr;
+	struct fake_srv srv;
+	char host[64] = "ab";
+	uint16_t id;
+	size_t len;
+
+	srv_init(&srv);
+	cfg.servers = srv.addr;
+	gwp_tw_init(&tw, 0);
+	assert(!gwp_dns_res_init(&res, &cfg, &tw));
+
+	memset(&q, 0, sizeof(q));
+	q.host = host;
+	q.port = 80;
+	q.restyp = GWP_DNS_RESTYP_IPV4_ONLY;
+	gwp_timer_init(&q.timer, 0);
+	assert(!gwp_dns_res_start(res, &q));
+	id = srv_recv_id(&srv);
+
+	len = build_reply(buf, id, nul_qname, sizeof(nul_qname));
+	assert(!gwp_dns_res_on_reply(res, &res->servers[0], buf, len, &done));
+	assert(!done);
+	assert(q.pending == 1u << GWP_DNS_FAM_A);
+
+	/* The real answer still gets through; the name compare ignores case. */
+	len = build_reply(buf, id, good_qname, sizeof(good_qname));
+	assert(gwp_dns_res_on_reply(res, &res->servers[0], buf, len, &done) == 1);
+	assert(done == &q);
+	assert(gwp_dns_res_collect(&q, &addr, 1) == 1);
+	assert(addr.sa.sa_family == AF_INET);
+	assert(addr.i4.sin_addr.s_addr == htonl(0xc0000201));
+
+	gwp_dns_res_cancel(res, &q);
+	gwp_dns_res_free(res);
+	close(srv.fd);
+}
+
+static void run_tests(void)
+{
+	test_question_nul_label();
+}
+
+int main(void)
+{
+	run_tests();
+	printf("All dns_resolver tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ *
+ * Unit tests for the per-worker object pool (pool.c).
+ */
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <gwproxy/pool.h>
+#include <gwproxy/common.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static noinline void test_reuse_lifo(void)
+{
+	struct gwp_pool p;
+	void *a, *b, *c;
+
+	gwp_pool_init(&p, 100, 0, 4);
+	a = gwp_pool_get(&p);
+	b = gwp_pool_get(&p);
+	assert(a && b && a != b);
+	memset(a, 0xaa, 100);
+	memset(b, 0xbb, 100);
+
+	/* The last object released is the first one handed out again. */
+	gwp_pool_put(&p, a);
+	gwp_pool_put(&p, b);
+	assert(p.nr_free == 2);
+	c = gwp_pool_get(&p);
+	assert(c == b);
+	c = gwp_pool_get(&p);
+	assert(c == a);
+
+	assert(p.st.nr_get == 4);
+	assert(p.st.nr_hit == 2);
+	assert(p.st.in_use == 2);
+	assert(p.st.peak_in_use == 2);
+
+	gwp_pool_put(&p, a);
+	gwp_pool_put(&p, b);
+	gwp_pool_put(&p, NULL);
+	assert(p.st.in_use == 0);
+	gwp_pool_destroy(&p);
+	assert(p.nr_free == 0 && !p.free_list);
+}
+
+static noinline void test_high_water_mark(void)
+{
+	void *objs[16];
+	struct gwp_pool p;
+	uint32_t i;
+
+	gwp_pool_init(&p, 64, 0, 5);
+	for (i = 0; i < 16; i++)
+		assert((objs[i] = gwp_pool_get(&p)));
+	for (i = 0; i < 16; i++)
+		gwp_pool_put(&p, objs[i]);
+
+	/* Only the mark is kept; the rest went back to libc. */
+	assert(p.nr_free == 5);
+	assert(p.st.nr_release == 11);
+	assert(p.st.peak_in_use == 16);
+	gwp_pool_destroy(&p);
+
+	/* A zero mark caches nothing at all. */
+	gwp_pool_init(&p, 64, 0, 0);
+	objs[0] = gwp_pool_get(&p);
+	gwp_pool_put(&p, objs[0]);
+	assert(p.nr_free == 0 && p.st.nr_release == 1);
+	gwp_pool_destroy(&p);
+}
+
+static noinline void test_aligned(void)
+{
+	struct gwp_pool p;
+	void *a, *b;
+
+	gwp_pool_init(&p, 16384, 4096, 2);
+	a = gwp_pool_get(&p);
+	assert(a && !((uintptr_t)a & 4095));
+	gwp_pool_put(&p, a);
+	b = gwp_pool_get(&p);
+	assert(b == a);
+	gwp_pool_put(&p, b);
+	gwp_pool_destroy(&p);
+
+	/* Smaller than the free-list link: rounded up so it still fits. */
+	gwp_pool_init(&p, 1, 0, 2);
+	assert(p.size == sizeof(void *));
+	a = gwp_pool_get(&p);
+	gwp_pool_put(&p, a);
+	gwp_pool_destroy(&p);
+}
+
+static void run_tests(void)
+{
+	test_reuse_lifo();
+	test_high_water_mark();
+	test_aligned();
+	printf("All pool tests passed!\n");
+}
+
+int main(void)
+{
+	run_tests();
+	return 0;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
+ *
+ * Unit tests for the snapshot reclamation (qsbr.c).
+ */
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <gwproxy/qsbr.h>
+#include <gwproxy/common.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CANARY	0x5ca1ab1e
+
+struct snap {
+	uint32_t	canary;
+	uint32_t	gen;
+	uint32_t	vals[64];
+};
+
+static _Atomic(uint32_t) nr_freed;
+
+static void free_snap(void *p)
+{
+	struct snap *s = p;
+
+	assert(s->canary == CANARY);
+	memset(s, 0xdd, sizeof(*s));
+	free(s);
+	atomic_fetch_add(&nr_freed, 1);
+}
+
+static struct snap *new_snap(uint32_t gen)
+{
+	struct snap *s = malloc(sizeof(*s));
+	uint32_t i;
+
+	assert(s);
+	s->canary = CANARY;
+	s->gen = gen;
+	for (i = 0; i < 64; i++)
+		s->vals[i] = gen;
+	return s;
+}
+
+static noinline void test_grace(void)
+{
+	struct gwp_qsbr *q = NULL;
+
+	assert(!gwp_qsbr_init(&q, 2));
+	atomic_store(&nr_freed, 0);
+
+	/* Nobody online: freed on the spot. */
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(0)));
+	assert(atomic_load(&nr_freed) == 1);
+
+	/* An online reader holds it until it goes offline. */
+	gwp_qsbr_online(q, 0);
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(1)));
+	assert(atomic_load(&nr_freed) == 1);
+	gwp_qsbr_offline(q, 1);
+	assert(atomic_load(&nr_freed) == 1);
+	gwp_qsbr_offline(q, 0);
+	assert(atomic_load(&nr_freed) == 2);
+
+	/* Both online: one passing through is not enough... */
+	gwp_qsbr_online(q, 0);
+	gwp_qsbr_online(q, 1);
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(2)));
+	gwp_qsbr_offline(q, 0);
+	gwp_qsbr_online(q, 0);
+	assert(atomic_load(&nr_freed) == 2);
+	/* ...the last one is, even with the first back online since. */
+	gwp_qsbr_offline(q, 1);
+	assert(atomic_load(&nr_freed) == 3);
+
+	/* Coming online after the retire does not hold it back. */
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(3)));
+	gwp_qsbr_online(q, 1);
+	gwp_qsbr_offline(q, 0);
+	assert(atomic_load(&nr_freed) == 4);
+
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(4)));
+	assert(atomic_load(&nr_freed) == 4);
+	gwp_qsbr_offline(q, 1);
+	assert(atomic_load(&nr_freed) == 5);
+
+	/* Whatever is still pending when the readers are gone goes with q. */
+	gwp_qsbr_online(q, 0);
+	assert(!gwp_qsbr_retire(q, free_snap, new_snap(5)));
+	assert(atomic_load(&nr_freed) == 5);
+	gwp_qsbr_free(q);
+	assert(atomic_load(&nr_freed) == 6);
+}
+
+#define NR_READERS	4
+#define NR_SWAPS	2000
+
+static _Atomic(struct snap *) g_cur;
+static _Atomic(bool) g_stop;
+static struct gwp_qsbr *g_q;
+
+static void *reader(void *arg)
+{
+	uint32_t id = (uint32_t)(uintptr_t)arg, i, j;
+
+	while (!atomic_load(&g_stop)) {
+		gwp_qsbr_online(g_q, id);
+		for (j = 0; j < 8; j++) {
+			const struct snap *s = atomic_load(&g_cur);
+
+			assert(s->canary == CANARY);
+			for (i = 0; i < 64; i++)
+				assert(s->vals[i] == s->gen);
+		}
+		gwp_qsbr_offline(g_q, id);
+	}
+	return NULL;
+}
+
+/* Readers race the swaps; a snapshot freed under one trips its asserts. */
+static noinline void test_swap_under_readers(void)
+{
+	pthread_t thr[NR_READERS];
+	struct snap *old;
+	uint32_t i;
+
+	assert(!gwp_qsbr_init(&g_q, NR_READERS));
+	atomic_store(&nr_freed, 0);
+	atomic_store(&g_stop, false);
+	atomic_store(&g_cur, new_snap(0));
+
+	for (i = 0; i < NR_READERS; i++)
+		assert(!pthread_create(&thr[i], NULL, reader,
+				       (void *)(uintptr_t)i));
+
+	for (i = 1; i <= NR_SWAPS; i++) {
+		old = atomic_exchange(&g_cur, new_snap(i));
+		assert(!gwp_qsbr_retire(g_q, free_snap, old));
+	}
+
+	atomic_store(&g_stop, true);
+	for (i = 0; i < NR_READERS; i++)
+		pthread_join(thr[i], NULL);
+
+	gwp_qsbr_free(g_q);
+	assert(atomic_load(&nr_freed) == NR_SWAPS);
+	free_snap(atomic_load(&g_cur));
+}
+
+int main(void)
+{
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		test_grace();
+		test_swap_under_readers();
+	}
+	printf("All tests passed!\n");
+	return 0;
+}
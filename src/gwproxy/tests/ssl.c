@@ -4,7 +4,11 @@
  *
  * A server and a client gwp_ssl are driven entirely by shuttling ciphertext
  * between their BIOs (no sockets), verifying the handshake completes and
- * application data round-trips in both directions.
+ * application data round-trips in both directions. Session resumption is
+ * checked by reconnecting with the client's session, by ticket and by ID. The
+ * kernel TLS export is
+ * checked by decrypting records the engine produced with the exported keys,
+ * nonces and sequence numbers, as the kernel would.
  *
  * Copyright (C) 2026  Alviro Iskandar Setiawan <alviro.iskandar@gnuweeb.org>
  */
@@ -12,6 +16,9 @@
 #undef NDEBUG
 #endif
 #include <gwproxy/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/tls1.h>
+#include <linux/tls.h>
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
@@ -153,6 +160,285 @@ static void test_handshake_and_roundtrip(void)
 	PRTEST_OK();
 }
 
+/*
+ * Decrypt the single application data record @rec with the kernel TLS
+ * parameters @ci and check that it carries @msg.
+ */
+static void ktls_check_record(const void *ci, const unsigned char *rec,
+			      size_t len, const char *msg)
+{
+	const struct tls_crypto_info *info = ci;
+	const unsigned char *key, *salt, *iv, *seq, *ct, *tag;
+	unsigned char nonce[12], aad[13], out[512];
+	size_t body, ct_len, aad_len;
+	const EVP_CIPHER *cipher;
+	EVP_CIPHER_CTX *ctx;
+	int i, n, fin;
+
+	if (info->cipher_type == TLS_CIPHER_AES_GCM_128) {
+		const struct tls12_crypto_info_aes_gcm_128 *c = ci;
+
+		key = c->key; salt = c->salt; iv = c->iv; seq = c->rec_seq;
+		cipher = EVP_aes_128_gcm();
+	} else {
+		const struct tls12_crypto_info_aes_gcm_256 *c = ci;
+
+		assert(info->cipher_type == TLS_CIPHER_AES_GCM_256);
+		key = c->key; salt = c->salt; iv = c->iv; seq = c->rec_seq;
+		cipher = EVP_aes_256_gcm();
+	}
+
+	assert(len > 5 + 16 && rec[0] == 0x17);
+	body = ((size_t)rec[3] << 8) | rec[4];
+	assert(body + 5 == len);
+
+	memcpy(nonce, salt, 4);
+	if (info->version == TLS_1_3_VERSION) {
+		/* Nonce: the IV XOR the sequence number; AAD: the header. */
+		memcpy(nonce + 4, iv, 8);
+		for (i = 0; i < 8; i++)
+			nonce[4 + i] ^= seq[i];
+		ct = rec + 5;
+		ct_len = body - 16;
+		memcpy(aad, rec, 5);
+		aad_len = 5;
+	} else {
+		/* Explicit nonce up front; AAD: seq, type, version, length. */
+		assert(info->version == TLS_1_2_VERSION);
+		memcpy(nonce + 4, rec + 5, 8);
+		ct = rec + 13;
+		ct_len = body - 8 - 16;
+		memcpy(aad, seq, 8);
+		memcpy(aad + 8, rec, 3);
+		aad[11] = (unsigned char)(ct_len >> 8);
+		aad[12] = (unsigned char)ct_len;
+		aad_len = 13;
+	}
+	tag = ct + ct_len;
+	assert(ct_len < sizeof(out));
+
+	ctx = EVP_CIPHER_CTX_new();
+	assert(ctx);
+	assert(EVP_DecryptInit_ex(ctx, cipher, NULL, NULL, NULL) == 1);
+	assert(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, 12, NULL) == 1);
+	assert(EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce) == 1);
+	assert(EVP_DecryptUpdate(ctx, NULL, &n, aad, (int)aad_len) == 1);
+	assert(EVP_DecryptUpdate(ctx, out, &n, ct, (int)ct_len) == 1);
+	assert(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16,
+				   (void *)tag) == 1);
+	fin = EVP_DecryptFinal_ex(ctx, out + n, &n);
+	EVP_CIPHER_CTX_free(ctx);
+	assert(fin == 1);
+
+	/* TLS 1.3 appends the real content type to the plaintext. */
+	if (info->version == TLS_1_3_VERSION)
+		assert(out[--ct_len] == 0x17);
+	assert(ct_len == strlen(msg) && !memcmp(out, msg, ct_len));
+}
+
+/*
+ * What @from would install as TLS_TX must be what @to installs as TLS_RX,
+ * and must decrypt the next record @from writes.
+ */
+static void ktls_check_dir(struct gwp_ssl *from, struct gwp_ssl *to,
+			   const char *msg)
+{
+	static unsigned char rec[1024];
+	unsigned char tx[128], rx[128], out[128];
+	size_t consumed = 0, got = 0;
+	int n, m;
+
+	assert(gwp_ssl_ktls_ready(from) && gwp_ssl_ktls_ready(to));
+	n = gwp_ssl_ktls_info(from, true, tx, sizeof(tx));
+	m = gwp_ssl_ktls_info(to, false, rx, sizeof(rx));
+	assert(n > 0 && n == m && !memcmp(tx, rx, (size_t)n));
+
+	assert(gwp_ssl_write(from, msg, strlen(msg), &consumed) == GWP_SSL_OK);
+	assert(consumed == strlen(msg));
+	/* Ciphertext still to be sent: not a record boundary yet. */
+	assert(!gwp_ssl_ktls_ready(from));
+
+	n = gwp_ssl_bio_read(from, rec, sizeof(rec));
+	assert(n > 0);
+	ktls_check_record(tx, rec, (size_t)n, msg);
+
+	/* Keep both engines in step for the next round. */
+	assert(gwp_ssl_bio_write(to, rec, (size_t)n) == n);
+	assert(gwp_ssl_read(to, out, sizeof(out), &got) == GWP_SSL_OK);
+	assert(got == strlen(msg) && !memcmp(out, msg, got));
+}
+
+static void test_ktls_export(int max_version)
+{
+	char cert[] = "/tmp/gwp_ssl_cert.XXXXXX";
+	char key[] = "/tmp/gwp_ssl_key.XXXXXX";
+	struct gwp_ssl_ctx *sctx = NULL, *cctx = NULL;
+	struct gwp_ssl *srv, *cli;
+	unsigned char buf[64];
+	size_t got;
+	int fd, r, i;
+
+	fd = mkstemp(cert); assert(fd >= 0); close(fd);
+	fd = mkstemp(key); assert(fd >= 0); close(fd);
+	write_file(cert, TEST_CERT);
+	write_file(key, TEST_KEY);
+
+	r = gwp_ssl_ctx_server_create(&sctx, cert, key); assert(!r && sctx);
+	r = gwp_ssl_ctx_client_create(&cctx); assert(!r && cctx);
+
+	srv = gwp_ssl_server_new(sctx);
+	cli = gwp_ssl_client_new(cctx);
+	assert(srv && cli);
+	if (max_version)
+		assert(gwp_ssl_set_max_version(cli, max_version) == 0);
+	assert(!gwp_ssl_ktls_ready(srv));
+
+	do_handshake(cli, srv);
+
+	/*
+	 * Under TLS 1.3 the server's session tickets follow the handshake
+	 * under the application keys; the client has them queued unread.
+	 */
+	assert(gwp_ssl_read(cli, buf, sizeof(buf), &got) == GWP_SSL_WANT_READ);
+	assert(got == 0);
+
+	for (i = 0; i < 3; i++) {
+		ktls_check_dir(srv, cli, "server -> client, via the kernel");
+		ktls_check_dir(cli, srv, "client -> server");
+	}
+
+	gwp_ssl_free(srv);
+	gwp_ssl_free(cli);
+	gwp_ssl_ctx_free(sctx);
+	gwp_ssl_ctx_free(cctx);
+	unlink(cert);
+	unlink(key);
+	PRTEST_OK();
+}
+
+/*
+ * One connection on @sctx: resume @sess if given, and return the session the
+ * client ended up with. Under TLS 1.3 the server's tickets follow the
+ * handshake, so the client reads past them first.
+ */
+static struct gwp_ssl_session *resume_conn(struct gwp_ssl_ctx *sctx,
+					   struct gwp_ssl_ctx *cctx,
+					   struct gwp_ssl_session *sess,
+					   int max_version, bool *reused)
+{
+	struct gwp_ssl_session *out;
+	struct gwp_ssl *srv, *cli;
+	unsigned char buf[64];
+	size_t got;
+
+	srv = gwp_ssl_server_new(sctx);
+	cli = gwp_ssl_client_new(cctx);
+	assert(srv && cli);
+	if (max_version)
+		assert(gwp_ssl_set_max_version(cli, max_version) == 0);
+	if (sess)
+		assert(gwp_ssl_set_session(cli, sess) == 0);
+
+	do_handshake(cli, srv);
+	assert(gwp_ssl_read(cli, buf, sizeof(buf), &got) == GWP_SSL_WANT_READ);
+	assert(gwp_ssl_session_reused(cli) == gwp_ssl_session_reused(srv));
+	*reused = gwp_ssl_session_reused(srv);
+	round_trip(cli, srv, "after resumption", strlen("after resumption"));
+
+	out = gwp_ssl_get1_session(cli);
+	assert(out);
+	gwp_ssl_free(srv);
+	gwp_ssl_free(cli);
+	return out;
+}
+
+static void test_resumption(unsigned int ticket_secs, unsigned int cache_max,
+			    int max_version, bool want_resume)
+{
+	char cert[] = "/tmp/gwp_ssl_cert.XXXXXX";
+	char key[] = "/tmp/gwp_ssl_key.XXXXXX";
+	struct gwp_ssl_ctx *sctx = NULL, *cctx = NULL;
+	struct gwp_ssl_session *s1, *s2;
+	struct gwp_ssl_resume_stats st;
+	bool reused;
+	int fd, r;
+
+	fd = mkstemp(cert); assert(fd >= 0); close(fd);
+	fd = mkstemp(key); assert(fd >= 0); close(fd);
+	write_file(cert, TEST_CERT);
+	write_file(key, TEST_KEY);
+
+	r = gwp_ssl_ctx_server_create(&sctx, cert, key); assert(!r && sctx);
+	r = gwp_ssl_ctx_client_create(&cctx); assert(!r && cctx);
+	r = gwp_ssl_ctx_set_resumption(sctx, ticket_secs, cache_max);
+	assert(!r);
+
+	s1 = resume_conn(sctx, cctx, NULL, max_version, &reused);
+	assert(!reused);
+	s2 = resume_conn(sctx, cctx, s1, max_version, &reused);
+	assert(reused == want_resume);
+
+	gwp_ssl_ctx_resume_stats(sctx, &st);
+	assert(st.nr_full == (want_resume ? 1u : 2u));
+	assert(st.nr_resumed == (want_resume ? 1u : 0u));
+	assert(st.nr_ticket_bad == 0);
+	if (!ticket_secs && cache_max)
+		assert(st.nr_cache_hit == 1);
+	if (!cache_max)
+		assert(st.nr_cache_hit == 0 && st.nr_cache_miss == 0);
+
+	gwp_ssl_session_free(s1);
+	gwp_ssl_session_free(s2);
+	gwp_ssl_ctx_free(sctx);
+	gwp_ssl_ctx_free(cctx);
+	unlink(cert);
+	unlink(key);
+	PRTEST_OK();
+}
+
+/* A cache of one session per shard keeps only the newest of each shard. */
+static void test_session_cache_evict(void)
+{
+	char cert[] = "/tmp/gwp_ssl_cert.XXXXXX";
+	char key[] = "/tmp/gwp_ssl_key.XXXXXX";
+	struct gwp_ssl_ctx *sctx = NULL, *cctx = NULL;
+	struct gwp_ssl_session *sess[64];
+	struct gwp_ssl_resume_stats st;
+	bool reused;
+	int fd, r, i;
+
+	fd = mkstemp(cert); assert(fd >= 0); close(fd);
+	fd = mkstemp(key); assert(fd >= 0); close(fd);
+	write_file(cert, TEST_CERT);
+	write_file(key, TEST_KEY);
+
+	r = gwp_ssl_ctx_server_create(&sctx, cert, key); assert(!r && sctx);
+	r = gwp_ssl_ctx_client_create(&cctx); assert(!r && cctx);
+	assert(!gwp_ssl_ctx_set_resumption(sctx, 0, 1));
+
+	for (i = 0; i < 64; i++) {
+		sess[i] = resume_conn(sctx, cctx, NULL, TLS1_2_VERSION, &reused);
+		assert(!reused);
+	}
+
+	gwp_ssl_ctx_resume_stats(sctx, &st);
+	/* 16 shards, one session each: at least 48 of 64 were pushed out. */
+	assert(st.nr_cache_evict >= 48);
+
+	/* The newest one is always still there. */
+	gwp_ssl_session_free(resume_conn(sctx, cctx, sess[63], TLS1_2_VERSION,
+					 &reused));
+	assert(reused);
+
+	for (i = 0; i < 64; i++)
+		gwp_ssl_session_free(sess[i]);
+	gwp_ssl_ctx_free(sctx);
+	gwp_ssl_ctx_free(cctx);
+	unlink(cert);
+	unlink(key);
+	PRTEST_OK();
+}
+
 static void test_bad_cert_rejected(void)
 {
 	struct gwp_ssl_ctx *sctx = NULL;
@@ -225,8 +511,17 @@ int main(void)
 		test_handshake_and_roundtrip();
 		test_bad_cert_rejected();
 		test_alpn_negotiation();
+		test_ktls_export(0);
+		test_ktls_export(TLS1_2_VERSION);
+		test_resumption(3600, 0, 0, true);
+		test_resumption(3600, 0, TLS1_2_VERSION, true);
+		test_resumption(0, 64, 0, true);
+		test_resumption(0, 64, TLS1_2_VERSION, true);
+		test_resumption(0, 0, 0, false);
 	}
 
+	test_session_cache_evict();
+
 	printf("All tests passed!\n");
 	return 0;
 }
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ *
+ * Unit tests for the per-worker timer wheel (timer.c).
+ */
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <gwproxy/timer.h>
+#include <gwproxy/common.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_RAND_TIMERS	1024u
+
+struct tt {
+	struct gwp_timer	t;
+	uint64_t		due;
+	uint64_t		fired_at;
+	bool			armed;
+};
+
+/* Expire everything due at @now; check nothing fires early. */
+static uint32_t drain(struct gwp_timer_wheel *tw, uint64_t now)
+{
+	struct gwp_timer *t;
+	uint32_t n = 0;
+
+	while ((t = gwp_tw_expire(tw, now))) {
+		struct tt *x = U64_TO_PTR(t->udata);
+
+		assert(!gwp_timer_pending(t));
+		assert(x->armed);
+		assert(x->due <= now);
+		x->armed = false;
+		x->fired_at = now;
+		n++;
+	}
+	return n;
+}
+
+static void arm(struct gwp_timer_wheel *tw, struct tt *x, uint64_t ms)
+{
+	gwp_timer_arm(tw, &x->t, ms);
+	x->due = tw->now + ms;
+	x->armed = true;
+	x->fired_at = 0;
+}
+
+static noinline void test_boundaries(void)
+{
+	static const uint64_t delays[] = {
+		0, 1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 250, 5000,
+		10000, 262143, 262144, 16777215, 16777216, 1073741823,
+		1073741824, 5000000000ull,
+	};
+	const uint32_t nr = sizeof(delays) / sizeof(delays[0]);
+	struct gwp_timer_wheel tw;
+	struct tt x[sizeof(delays) / sizeof(delays[0])];
+	uint64_t now = 1000003;
+	uint32_t i, left = nr;
+
+	gwp_tw_init(&tw, now);
+	assert(gwp_tw_next_ms(&tw) == -1);
+	for (i = 0; i < nr; i++) {
+		gwp_timer_init(&x[i].t, PTR_TO_U64(&x[i]));
+		arm(&tw, &x[i], delays[i]);
+	}
+	assert(tw.nr == nr);
+
+	/* Jump exactly as far as the wheel says is safe, every time. */
+	while (left) {
+		int ms = gwp_tw_next_ms(&tw);
+
+		assert(ms >= 0);
+		now = tw.now + (uint64_t)ms;
+		left -= drain(&tw, now);
+
+		/* Nothing still pending may have been due already. */
+		for (i = 0; i < nr; i++) {
+			if (x[i].armed)
+				assert(x[i].due > now);
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		assert(x[i].fired_at == x[i].due);
+	assert(tw.nr == 0);
+	assert(gwp_tw_next_ms(&tw) == -1);
+}
+
+static noinline void test_del_and_rearm(void)
+{
+	struct gwp_timer_wheel tw;
+	struct tt a, b, c;
+	uint64_t now = 77;
+
+	gwp_tw_init(&tw, now);
+	gwp_timer_init(&a.t, PTR_TO_U64(&a));
+	gwp_timer_init(&b.t, PTR_TO_U64(&b));
+	gwp_timer_init(&c.t, PTR_TO_U64(&c));
+
+	/* Deleting an unarmed timer is a no-op. */
+	gwp_timer_del(&tw, &a.t);
+	assert(tw.nr == 0);
+
+	arm(&tw, &a, 100);
+	arm(&tw, &b, 100);
+	arm(&tw, &c, 5000);
+	gwp_timer_del(&tw, &a.t);
+	a.armed = false;
+	assert(!gwp_timer_pending(&a.t));
+	assert(tw.nr == 2);
+
+	/* Re-arming moves the timer rather than adding it twice. */
+	arm(&tw, &c, 50);
+	assert(tw.nr == 2);
+	assert(gwp_tw_next_ms(&tw) <= 50);
+
+	assert(drain(&tw, now + 49) == 0);
+	assert(drain(&tw, now + 50) == 1 && c.fired_at == now + 50);
+	assert(drain(&tw, now + 100) == 1 && b.fired_at == now + 100);
+	assert(!a.fired_at);
+
+	/* A long sleep with nothing armed must not leave the clock behind. */
+	now += 1000000;
+	assert(drain(&tw, now) == 0);
+	arm(&tw, &a, 10);
+	assert(gwp_tw_next_ms(&tw) <= 10);
+	assert(drain(&tw, now + 10) == 1);
+}
+
+/*
+ * A handler may cancel a timer that is due in the same round (a pair torn
+ * down by its connect timeout drops its attempt timer too).
+ */
+static noinline void test_del_while_expiring(void)
+{
+	struct gwp_timer_wheel tw;
+	struct gwp_timer *t;
+	struct tt a, b;
+	uint32_t n = 0;
+
+	gwp_tw_init(&tw, 0);
+	gwp_timer_init(&a.t, PTR_TO_U64(&a));
+	gwp_timer_init(&b.t, PTR_TO_U64(&b));
+	arm(&tw, &a, 10);
+	arm(&tw, &b, 10);
+
+	while ((t = gwp_tw_expire(&tw, 10))) {
+		struct tt *x = U64_TO_PTR(t->udata);
+
+		gwp_timer_del(&tw, x == &a ? &b.t : &a.t);
+		n++;
+	}
+	assert(n == 1);
+	assert(tw.nr == 0);
+}
+
+static noinline void test_random(void)
+{
+	struct gwp_timer_wheel tw;
+	struct tt *x;
+	uint64_t now = 123456789;
+	uint32_t i, round;
+
+	x = calloc(NR_RAND_TIMERS, sizeof(*x));
+	assert(x);
+	srand(1);
+
+	gwp_tw_init(&tw, now);
+	for (i = 0; i < NR_RAND_TIMERS; i++)
+		gwp_timer_init(&x[i].t, PTR_TO_U64(&x[i]));
+
+	for (round = 0; round < 20000; round++) {
+		i = (uint32_t)rand() % NR_RAND_TIMERS;
+		switch (rand() % 4) {
+		case 0:
+			gwp_timer_del(&tw, &x[i].t);
+			x[i].armed = false;
+			break;
+		default:
+			arm(&tw, &x[i], (uint64_t)rand() % 20000000u);
+			break;
+		}
+
+		if (!(round % 7)) {
+			int ms = gwp_tw_next_ms(&tw);
+			uint64_t step = (uint64_t)rand() % 300000u;
+
+			/* Never sleep past what the wheel allows. */
+			if (ms >= 0 && step > (uint64_t)ms)
+				step = (uint64_t)ms;
+			now += step;
+			drain(&tw, now);
+			for (i = 0; i < NR_RAND_TIMERS; i++) {
+				if (x[i].armed)
+					assert(x[i].due > now);
+			}
+		}
+	}
+
+	/* Drain the rest; each fires no later than the first chance it had. */
+	while (tw.nr) {
+		int ms = gwp_tw_next_ms(&tw);
+
+		assert(ms > 0);
+		now += (uint64_t)ms;
+		drain(&tw, now);
+		for (i = 0; i < NR_RAND_TIMERS; i++) {
+			if (x[i].armed)
+				assert(x[i].due > now);
+		}
+	}
+
+	free(x);
+}
+
+/*
+ * Sleep exactly as long as gwp_tw_next_ms() says until @x fires and return
+ * how many wakeups that took. A timer far out should cost one wakeup per
+ * cascade, not one per millisecond.
+ */
+static uint32_t count_wakeups(struct gwp_timer_wheel *tw, struct tt *x,
+			      uint64_t *now)
+{
+	uint32_t nr = 0;
+	int ms;
+
+	while (x->armed) {
+		ms = gwp_tw_next_ms(tw);
+		assert(ms >= 0);
+		*now += (uint64_t)ms;
+		drain(tw, *now);
+		assert(++nr < 1000);
+	}
+	return nr;
+}
+
+static noinline void test_wakeups(void)
+{
+	static const uint64_t starts[] = { 0, 1, 63, 64, 4095, 12345, 262143,
+					   987654321 };
+	static const uint64_t delays[] = { 1, 100, 5000, 70000, 262000,
+					   3600000, 86400000 };
+	struct gwp_timer_wheel tw;
+	uint32_t i, j, nr;
+	struct tt x;
+	uint64_t now;
+
+	for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		for (j = 0; j < sizeof(delays) / sizeof(delays[0]); j++) {
+			now = starts[i];
+			gwp_tw_init(&tw, now);
+			gwp_timer_init(&x.t, PTR_TO_U64(&x));
+			/* Let the clock drift off a block boundary first. */
+			now += 7;
+			drain(&tw, now);
+			arm(&tw, &x, delays[j]);
+			nr = count_wakeups(&tw, &x, &now);
+			assert(x.fired_at == x.due);
+			/* One per level it cascades through, and the firing. */
+			assert(nr <= 2 * GWP_TW_LEVELS);
+		}
+	}
+}
+
+static void run_tests(void)
+{
+	test_boundaries();
+	test_del_and_rearm();
+	test_del_while_expiring();
+	test_random();
+	test_wakeups();
+	printf("All timer tests passed!\n");
+}
+
+int main(void)
+{
+	run_tests();
+	return 0;
+}
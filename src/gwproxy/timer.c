@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <gwproxy/timer.h>
+#include <gwproxy/common.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Furthest a timer is filed ahead of the clock: one top-level block short of
+ * the full range, so a parked timer never lands in the top-level slot the
+ * clock is currently in (which would read as "due now").
+ */
+#define GWP_TW_PARK	((1ull << (GWP_TW_BITS * GWP_TW_LEVELS)) - \
+			 (1ull << (GWP_TW_BITS * (GWP_TW_LEVELS - 1))))
+
+__hot
+uint64_t gwp_tw_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+__cold
+void gwp_tw_init(struct gwp_timer_wheel *tw, uint64_t now)
+{
+	memset(tw, 0, sizeof(*tw));
+	tw->now = now;
+	tw->clk = now;
+}
+
+static void tw_link(struct gwp_timer **head, struct gwp_timer *t)
+{
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+/* File @t in the slot that matches its distance from the wheel's clock. */
+static void tw_file(struct gwp_timer_wheel *tw, struct gwp_timer *t)
+{
+	uint64_t e = t->expires, d;
+	uint32_t lvl, idx, shift;
+
+	/* Overdue: fire on the next tick processed. */
+	if (e < tw->clk)
+		e = tw->clk;
+
+	d = e - tw->clk;
+	if (d >= GWP_TW_PARK) {
+		d = GWP_TW_PARK;
+		e = tw->clk + d;
+	}
+
+	for (lvl = 0; lvl < GWP_TW_LEVELS - 1; lvl++) {
+		if (d < (1ull << (GWP_TW_BITS * (lvl + 1))))
+			break;
+	}
+
+	shift = GWP_TW_BITS * lvl;
+	idx = (uint32_t)(e >> shift) & GWP_TW_MASK;
+	tw_link(&tw->slots[lvl][idx], t);
+	tw->occupied[lvl] |= 1ull << idx;
+}
+
+/* Take every timer out of one slot and hand it to @tw_file again. */
+static void tw_cascade(struct gwp_timer_wheel *tw, uint32_t lvl, uint32_t idx)
+{
+	struct gwp_timer *t = tw->slots[lvl][idx], *n;
+
+	tw->slots[lvl][idx] = NULL;
+	tw->occupied[lvl] &= ~(1ull << idx);
+	for (; t; t = n) {
+		n = t->next;
+		tw_file(tw, t);
+	}
+}
+
+static void tw_collect(struct gwp_timer_wheel *tw, uint32_t idx)
+{
+	struct gwp_timer *t = tw->slots[0][idx], *n;
+
+	tw->slots[0][idx] = NULL;
+	tw->occupied[0] &= ~(1ull << idx);
+	for (; t; t = n) {
+		n = t->next;
+		tw_link(&tw->expired, t);
+	}
+}
+
+static bool tw_empty(const struct gwp_timer_wheel *tw)
+{
+	uint32_t lvl;
+
+	for (lvl = 0; lvl < GWP_TW_LEVELS; lvl++) {
+		if (tw->occupied[lvl])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Process every tick up to and including @now. A tick whose level-0 slot is
+ * empty costs nothing, and a run of them up to the next cascade point is
+ * skipped in one step, so a worker that slept for a minute does not walk
+ * sixty thousand slots.
+ */
+__hot
+static void tw_advance(struct gwp_timer_wheel *tw, uint64_t now)
+{
+	gwp_tw_set_now(tw, now);
+	now = tw->now;
+
+	while (tw->clk <= now) {
+		uint32_t idx = (uint32_t)tw->clk & GWP_TW_MASK, lvl;
+		uint64_t next;
+
+		if (tw_empty(tw)) {
+			tw->clk = now + 1;
+			break;
+		}
+
+		if (!idx) {
+			for (lvl = 1; lvl < GWP_TW_LEVELS; lvl++) {
+				uint32_t i = (uint32_t)(tw->clk >> (GWP_TW_BITS * lvl)) &
+					     GWP_TW_MASK;
+
+				tw_cascade(tw, lvl, i);
+				if (i)
+					break;
+			}
+		}
+
+		if (tw->occupied[0] & (1ull << idx))
+			tw_collect(tw, idx);
+
+		if (tw->occupied[0] >> idx) {
+			tw->clk++;
+			continue;
+		}
+
+		next = (tw->clk | GWP_TW_MASK) + 1;
+		tw->clk = next < now + 1 ? next : now + 1;
+	}
+}
+
+__hot
+void gwp_timer_del(struct gwp_timer_wheel *tw, struct gwp_timer *t)
+{
+	uintptr_t p = (uintptr_t)t->pprev;
+	uintptr_t lo = (uintptr_t)&tw->slots[0][0];
+	uintptr_t hi = (uintptr_t)&tw->slots[GWP_TW_LEVELS - 1][GWP_TW_MASK];
+
+	if (!t->pprev)
+		return;
+
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+
+	/* Was the last timer in a slot: keep the occupancy bitmap exact. */
+	if (!*t->pprev && p >= lo && p <= hi) {
+		size_t flat = (p - lo) / sizeof(tw->slots[0][0]);
+
+		tw->occupied[flat / GWP_TW_SLOTS] &=
+			~(1ull << (flat % GWP_TW_SLOTS));
+	}
+
+	t->next = NULL;
+	t->pprev = NULL;
+	tw->nr--;
+}
+
+__hot
+void gwp_timer_arm(struct gwp_timer_wheel *tw, struct gwp_timer *t,
+		   uint64_t ms)
+{
+	gwp_timer_del(tw, t);
+	t->expires = tw->now + ms;
+	tw_file(tw, t);
+	tw->nr++;
+}
+
+__hot
+struct gwp_timer *gwp_tw_expire(struct gwp_timer_wheel *tw, uint64_t now)
+{
+	struct gwp_timer *t;
+
+	tw_advance(tw, now);
+	t = tw->expired;
+	if (t)
+		gwp_timer_del(tw, t);
+	return t;
+}
+
+__hot
+int gwp_tw_next_ms(const struct gwp_timer_wheel *tw)
+{
+	uint64_t best = UINT64_MAX, at;
+	uint32_t lvl;
+
+	if (tw->expired)
+		return 0;
+
+	for (lvl = 0; lvl < GWP_TW_LEVELS; lvl++) {
+		uint32_t shift = GWP_TW_BITS * lvl, pos, d;
+		uint64_t occ = tw->occupied[lvl], rot;
+
+		if (!occ)
+			continue;
+
+		/* Distance, in slots, from the current one to the next busy one. */
+		pos = (uint32_t)(tw->clk >> shift) & GWP_TW_MASK;
+		rot = pos ? (occ >> pos) | (occ << (64 - pos)) : occ;
+		d = (uint32_t)__builtin_ctzll(rot);
+
+		/*
+		 * Level 0 slots are ticks. A higher-level slot is due when the
+		 * clock reaches the start of its block, which is when it
+		 * cascades. The slot the clock is in only cascades again a
+		 * full turn later, unless the clock sits right on its start.
+		 */
+		if (!lvl) {
+			at = tw->clk + d;
+		} else {
+			at = ((tw->clk >> shift) + d) << shift;
+			if (at < tw->clk)
+				at += (uint64_t)GWP_TW_SLOTS << shift;
+		}
+		if (at < best)
+			best = at;
+	}
+
+	if (best == UINT64_MAX)
+		return -1;
+	if (best <= tw->now)
+		return 0;
+	if (best - tw->now > INT_MAX)
+		return INT_MAX;
+	return (int)(best - tw->now);
+}
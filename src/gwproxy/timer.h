@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef GWPROXY_TIMER_H
+#define GWPROXY_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Per-worker hierarchical timer wheel.
+ *
+ * Every connection timeout (protocol handshake, connect, Happy Eyeballs
+ * attempt delay, idle) used to be a timerfd or an io_uring timeout of its
+ * own. The wheel keeps them all in user space instead: arming or cancelling
+ * a timer is a couple of pointer writes, and the event loop sleeps no longer
+ * than gwp_tw_next_ms() says, so the whole worker needs at most one kernel
+ * timer (the epoll_wait() timeout, or one io_uring timeout).
+ *
+ * The resolution is one millisecond. Level L has GWP_TW_SLOTS slots, each
+ * GWP_TW_SLOTS^L ticks wide; a timer is filed in the lowest level that can
+ * hold its distance and cascades down as the wheel turns. A timer further
+ * out than the top level can hold is parked in the top level and re-filed
+ * when it comes round, so any deadline is honoured.
+ *
+ * Not thread-safe: a wheel and its timers belong to one worker.
+ */
+#define GWP_TW_BITS	6u
+#define GWP_TW_SLOTS	(1u << GWP_TW_BITS)
+#define GWP_TW_MASK	(GWP_TW_SLOTS - 1u)
+#define GWP_TW_LEVELS	5u
+
+struct gwp_timer {
+	struct gwp_timer	*next;
+	/* The link that points at us; NULL while the timer is not armed. */
+	struct gwp_timer	**pprev;
+	uint64_t		expires;	/* absolute, in ms */
+	/*
+	 * Handed back untouched when the timer fires. The event loops store
+	 * an event word here (selector | pointer, see EV_BIT_ALL), so an
+	 * expired timer is dispatched exactly like an I/O event.
+	 */
+	uint64_t		udata;
+};
+
+struct gwp_timer_wheel {
+	/* Time of the last gwp_tw_advance(), in ms. */
+	uint64_t		now;
+	/* The next tick to be processed; everything before it has fired. */
+	uint64_t		clk;
+	uint32_t		nr;
+	/* Timers that are due but not yet handed out by gwp_tw_expire(). */
+	struct gwp_timer	*expired;
+	/* Bit N of occupied[L] is set while slots[L][N] is non-empty. */
+	uint64_t		occupied[GWP_TW_LEVELS];
+	struct gwp_timer	*slots[GWP_TW_LEVELS][GWP_TW_SLOTS];
+};
+
+/* CLOCK_MONOTONIC in milliseconds. */
+uint64_t gwp_tw_clock_ms(void);
+
+void gwp_tw_init(struct gwp_timer_wheel *tw, uint64_t now);
+
+static inline void gwp_timer_init(struct gwp_timer *t, uint64_t udata)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->expires = 0;
+	t->udata = udata;
+}
+
+static inline bool gwp_timer_pending(const struct gwp_timer *t)
+{
+	return t->pprev != NULL;
+}
+
+/*
+ * Refresh the wheel's idea of the current time without firing anything. The
+ * event loop calls it as soon as it wakes up, so timers armed while handling
+ * events count from the wakeup and not from when the loop went to sleep.
+ */
+static inline void gwp_tw_set_now(struct gwp_timer_wheel *tw, uint64_t now)
+{
+	if (now > tw->now)
+		tw->now = now;
+}
+
+/*
+ * Arm @t to fire @ms milliseconds after the wheel's current time. An armed
+ * timer is moved, not duplicated.
+ */
+void gwp_timer_arm(struct gwp_timer_wheel *tw, struct gwp_timer *t,
+		   uint64_t ms);
+
+/* Cancel @t. Harmless on a timer that is not armed. */
+void gwp_timer_del(struct gwp_timer_wheel *tw, struct gwp_timer *t);
+
+/*
+ * Move the wheel to @now and return one timer that is due, already
+ * disarmed, or NULL once none is left. Call it in a loop; a handler may arm
+ * or cancel any timer, including ones that are due in the same round.
+ */
+struct gwp_timer *gwp_tw_expire(struct gwp_timer_wheel *tw, uint64_t now);
+
+/*
+ * How long the event loop may sleep, in ms, before the next timer is due:
+ * -1 when nothing is armed. Never later than the real deadline; it may be
+ * earlier for a timer that still has to cascade, which costs one spare
+ * wakeup and nothing else.
+ */
+int gwp_tw_next_ms(const struct gwp_timer_wheel *tw);
+
+#endif /* #ifndef GWPROXY_TIMER_H */
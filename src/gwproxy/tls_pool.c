@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <gwproxy/tls_pool.h>
+#include <gwproxy/common.h>
+#include <gwproxy/cq.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+struct gwp_tls_pool {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	bool			should_stop;
+	bool			stopped;
+	struct gwp_tls_job	*head;
+	struct gwp_tls_job	*tail;
+	pthread_t		*threads;
+	uint32_t		nr_threads;
+	/* Finished jobs, one queue per worker. */
+	struct gwp_cq		*cqs;
+	uint32_t		nr_cq;
+};
+
+static void run_job(struct gwp_tls_job *job)
+{
+	job->res = gwp_ssl_handshake(job->ssl);
+	if (job->res == GWP_SSL_ERROR)
+		snprintf(job->err, sizeof(job->err), "%s", gwp_ssl_errstr());
+	else
+		job->err[0] = '\0';
+}
+
+static void *tls_pool_thread_entry(void *arg)
+{
+	struct gwp_tls_pool *p = arg;
+	struct gwp_tls_job *job;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->should_stop) {
+		job = p->head;
+		if (!job) {
+			pthread_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+
+		p->head = job->next;
+		if (!p->head)
+			p->tail = NULL;
+		pthread_mutex_unlock(&p->lock);
+
+		run_job(job);
+		gwp_cq_push(&p->cqs[job->cq], job, next);
+
+		pthread_mutex_lock(&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+__cold
+int gwp_tls_pool_init(struct gwp_tls_pool **out, uint32_t nr_threads,
+		      uint32_t nr_cq)
+{
+	struct gwp_tls_pool *p;
+	uint32_t i;
+	int r;
+
+	if (!nr_threads || !nr_cq)
+		return -EINVAL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	p->cqs = aligned_alloc(64, sizeof(*p->cqs) * nr_cq);
+	p->threads = calloc(nr_threads, sizeof(*p->threads));
+	if (!p->cqs || !p->threads) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < nr_cq; i++)
+		gwp_cq_init(&p->cqs[i]);
+	p->nr_cq = nr_cq;
+
+	r = pthread_mutex_init(&p->lock, NULL);
+	if (r) {
+		r = -r;
+		goto out_free;
+	}
+
+	r = pthread_cond_init(&p->cond, NULL);
+	if (r) {
+		r = -r;
+		goto out_destroy_lock;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		r = pthread_create(&p->threads[i], NULL, tls_pool_thread_entry, p);
+		if (r) {
+			r = -r;
+			p->nr_threads = i;
+			gwp_tls_pool_stop(p);
+			goto out_destroy_cond;
+		}
+	}
+	p->nr_threads = nr_threads;
+
+	*out = p;
+	return 0;
+
+out_destroy_cond:
+	pthread_cond_destroy(&p->cond);
+out_destroy_lock:
+	pthread_mutex_destroy(&p->lock);
+out_free:
+	free(p->threads);
+	free(p->cqs);
+	free(p);
+	return r;
+}
+
+__cold
+void gwp_tls_pool_stop(struct gwp_tls_pool *p)
+{
+	uint32_t i;
+
+	if (!p || p->stopped)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->should_stop = true;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+	p->stopped = true;
+}
+
+static void free_job_list(struct gwp_tls_job *job)
+{
+	struct gwp_tls_job *next;
+
+	for (; job; job = next) {
+		next = job->next;
+		job->udata = NULL;
+		gwp_tls_job_free(job);
+	}
+}
+
+__cold
+void gwp_tls_pool_free(struct gwp_tls_pool *p)
+{
+	uint32_t i;
+
+	if (!p)
+		return;
+
+	gwp_tls_pool_stop(p);
+	free_job_list(p->head);
+	for (i = 0; i < p->nr_cq; i++)
+		free_job_list(gwp_cq_take(&p->cqs[i]));
+
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p->threads);
+	free(p->cqs);
+	free(p);
+}
+
+__cold
+void gwp_tls_pool_set_cq_fd(struct gwp_tls_pool *p, uint32_t cq, int ev_fd)
+{
+	gwp_cq_set_fd(&p->cqs[cq], ev_fd);
+}
+
+__hot
+void gwp_tls_pool_submit(struct gwp_tls_pool *p, struct gwp_tls_job *job)
+{
+	job->next = NULL;
+
+	pthread_mutex_lock(&p->lock);
+	if (p->tail)
+		p->tail->next = job;
+	else
+		p->head = job;
+	p->tail = job;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+__hot
+struct gwp_tls_job *gwp_tls_pool_reap(struct gwp_tls_pool *p, uint32_t cq)
+{
+	struct gwp_tls_job *job, *next, *fifo = NULL;
+
+	job = gwp_cq_take(&p->cqs[cq]);
+
+	/* The stack is newest first; hand them out in completion order. */
+	for (; job; job = next) {
+		next = job->next;
+		job->next = fifo;
+		fifo = job;
+	}
+	return fifo;
+}
+
+void gwp_tls_job_free(struct gwp_tls_job *job)
+{
+	if (!job)
+		return;
+	if (!job->udata)
+		gwp_ssl_free(job->ssl);
+	free(job);
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2025  Ammar Faizi <ammarfaizi2@gnuweeb.org>
+ */
+#ifndef GWPROXY_TLS_POOL_H
+#define GWPROXY_TLS_POOL_H
+
+#include <stdint.h>
+#include <gwproxy/ssl.h>
+
+/*
+ * --tls-hs-threads: TLS handshake steps run on a small pool of crypto threads.
+ *
+ * A server handshake step that answers a ClientHello signs with the
+ * certificate key and does the key exchange, which costs a worker far more
+ * than forwarding a buffer. Run inline, a burst of new TLS clients stalls
+ * every tunnel that shares the worker. With the pool, the worker feeds the
+ * ciphertext it received into the gwp_ssl, parks the connection and hands
+ * the step to a crypto thread; the step's result comes back on the worker's
+ * completion queue, and the queue's eventfd wakes the worker's event loop.
+ *
+ * The gwp_ssl uses memory BIOs, so a step never touches the socket and the
+ * crypto thread needs nothing but the gwp_ssl. While a job is in flight the
+ * worker must not touch job->ssl.
+ */
+struct gwp_tls_job {
+	struct gwp_tls_job	*next;
+	struct gwp_ssl		*ssl;
+	/*
+	 * The owner, handed back untouched. The worker clears it when the
+	 * owner goes away while the job is in flight; the job then owns
+	 * @ssl, and gwp_tls_job_free() releases both once it is reaped.
+	 */
+	void			*udata;
+	/* Completion queue (worker index) the result goes to. */
+	uint32_t		cq;
+	/* gwp_ssl_handshake() result. */
+	int			res;
+	/* The OpenSSL error, which is per-thread, when @res is GWP_SSL_ERROR. */
+	char			err[128];
+};
+
+struct gwp_tls_pool;
+
+int gwp_tls_pool_init(struct gwp_tls_pool **out, uint32_t nr_threads,
+		      uint32_t nr_cq);
+
+/*
+ * Join the crypto threads. Jobs still queued are not run; they stay for
+ * gwp_tls_pool_free(). Safe to call more than once.
+ */
+void gwp_tls_pool_stop(struct gwp_tls_pool *p);
+
+/*
+ * Stop the pool and free every job it still holds, queued or completed but
+ * not reaped, along with its gwp_ssl. Only call it once the workers are
+ * gone: by then every owner has let go of its job.
+ */
+void gwp_tls_pool_free(struct gwp_tls_pool *p);
+
+/*
+ * The eventfd written when completion queue @cq goes from empty to
+ * non-empty; -1 for none. Set it before submitting to @cq.
+ */
+void gwp_tls_pool_set_cq_fd(struct gwp_tls_pool *p, uint32_t cq, int ev_fd);
+
+/* Queue one handshake step. Never fails; the job is not copied. */
+void gwp_tls_pool_submit(struct gwp_tls_pool *p, struct gwp_tls_job *job);
+
+/*
+ * Take every finished job of queue @cq, oldest first, linked through ->next.
+ * Only the worker that owns @cq may call it. Returns NULL when none.
+ */
+struct gwp_tls_job *gwp_tls_pool_reap(struct gwp_tls_pool *p, uint32_t cq);
+
+/* Free @job, and job->ssl if the owner let go of it (udata == NULL). */
+void gwp_tls_job_free(struct gwp_tls_job *job);
+
+#endif /* #ifndef GWPROXY_TLS_POOL_H */
@@ -26,10 +26,11 @@
 const char *gwp_upstream_dst_str(struct gwp_conn_pair *gcp)
 {
 	static __thread char buf[300];
+	const struct gwp_socks5_addr *dst = gcp->hs ? gcp->hs->up_dst : NULL;
 
-	if (gcp->up_dst.ver == GWP_SOCKS5_ATYP_DOMAIN) {
-		snprintf(buf, sizeof(buf), "%s:%u", gcp->up_dst.domain.str,
-			 ntohs(gcp->up_dst.port));
+	if (dst && dst->ver == GWP_SOCKS5_ATYP_DOMAIN) {
+		snprintf(buf, sizeof(buf), "%s:%u", dst->domain.str,
+			 ntohs(dst->port));
 		return buf;
 	}
 
@@ -63,6 +64,7 @@ int gwp_upstream_splice_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	if (rlen) {
 		if (gcp->target.len + rlen > gcp->target.cap)
 			return -ENOBUFS;
+		gwp_conn_linearize(&gcp->target);
 		memmove(gcp->target.buf + rlen, gcp->target.buf,
 			gcp->target.len);
 		memcpy(gcp->target.buf, rbuf, rlen);
@@ -79,13 +81,14 @@ static int build_userpass(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 	int r;
 
 	gcp->target.len = 0;
+	gcp->target.head = 0;
 	r = gwp_socks5_cli_build_userpass(up->user, up->ulen, up->pass, up->plen,
 					  gcp->target.buf, &len);
 	if (unlikely(r))
 		return r;
 
 	gcp->target.len = (uint32_t)len;
-	gcp->up_tx = true;
+	gcp->hs->up_tx = true;
 	gcp->conn_state = CONN_STATE_UPSTREAM_S5_AUTH;
 	return 0;
 }
@@ -97,12 +100,13 @@ static int build_connect(struct gwp_conn_pair *gcp)
 	int r;
 
 	gcp->target.len = 0;
-	r = gwp_socks5_cli_build_connect(&gcp->up_dst, gcp->target.buf, &len);
+	gcp->target.head = 0;
+	r = gwp_socks5_cli_build_connect(gcp->hs->up_dst, gcp->target.buf, &len);
 	if (unlikely(r))
 		return r;
 
 	gcp->target.len = (uint32_t)len;
-	gcp->up_tx = true;
+	gcp->hs->up_tx = true;
 	gcp->conn_state = CONN_STATE_UPSTREAM_S5_CONNECT;
 	return 0;
 }
@@ -202,6 +206,8 @@ int gwp_upstream_hs_on_reply(struct gwp_wrk *w, struct gwp_conn_pair *gcp,
 	bool n = false;
 	int r;
 
+	/* The reply parsers read target.buf from offset 0. */
+	gwp_conn_linearize(&gcp->target);
 	if (gcp->conn_state >= CONN_STATE_UPSTREAM_HTTP_MIN &&
 	    gcp->conn_state <= CONN_STATE_UPSTREAM_HTTP_MAX)
 		r = http_parse(w, gcp, &n);
@@ -232,7 +238,7 @@ static int s5_start(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		return r;
 
 	gcp->target.len = (uint32_t)len;
-	gcp->up_tx = true;
+	gcp->hs->up_tx = true;
 	gcp->conn_state = CONN_STATE_UPSTREAM_S5_METHOD;
 	pr_dbg(&ctx->lh, "Upstream SOCKS5 handshake started (idx=%u, dst=%s)",
 		gcp->idx, gwp_upstream_dst_str(gcp));
@@ -253,7 +259,7 @@ static int http_start(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		return r;
 	}
 
-	r = gwp_upstream_authority(&gcp->up_dst, authority, sizeof(authority));
+	r = gwp_upstream_authority(gcp->hs->up_dst, authority, sizeof(authority));
 	if (unlikely(r))
 		return r;
 
@@ -265,7 +271,7 @@ static int http_start(struct gwp_wrk *w, struct gwp_conn_pair *gcp)
 		return r;
 
 	gcp->target.len = (uint32_t)len;
-	gcp->up_tx = true;
+	gcp->hs->up_tx = true;
 	gcp->conn_state = CONN_STATE_UPSTREAM_HTTP_CONNECT;
 	pr_dbg(&w->ctx->lh, "Upstream HTTP CONNECT started (idx=%u, dst=%s)",
 		gcp->idx, authority);
@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# --splice: plaintext pairs are forwarded with splice(2) through pipes instead
+# of the per-connection buffers. The payload must still arrive verbatim, over
+# both a plain --target forward and a SOCKS5 CONNECT tunnel (whose reply is
+# buffered before the pipes take over), and a client half-close must still be
+# propagated without losing the response. epoll only.
+
+. "$(dirname "$0")/lib.sh"
+require curl
+require python3
+require_opt --splice
+
+hp="$(pick_port)"
+make_payload "$WORK/payload.bin" 300000
+start_httpd "$hp" "$WORK" "1.0"
+
+pp="$(pick_port)"
+gwp_start "127.0.0.1:$pp" --nr-workers=2 --splice=1 --target="127.0.0.1:$hp"
+curl -s --max-time 20 "http://127.0.0.1:$pp/payload.bin" -o "$WORK/out.bin" \
+	|| fail "curl through spliced plain proxy failed"
+assert_files_equal "$WORK/payload.bin" "$WORK/out.bin" \
+	"spliced plain proxy corrupted the payload"
+
+timeout 20 python3 "$SERVERS_DIR/halfclose_client.py" \
+	127.0.0.1 "$pp" "/payload.bin" "$WORK/out2.bin" \
+	|| fail "half-close client failed"
+assert_files_equal "$WORK/payload.bin" "$WORK/out2.bin" \
+	"spliced proxy dropped response data on client half-close"
+kill "$GWP_PID" 2>/dev/null
+
+sp="$(pick_port)"
+gwp_start "127.0.0.1:$sp" --nr-workers=1 --as-socks5=1 --splice=1
+for i in 1 2 3; do
+	curl -s --max-time 20 --socks5 "127.0.0.1:$sp" \
+		"http://127.0.0.1:$hp/payload.bin" -o "$WORK/out3.bin" \
+		|| fail "curl through spliced SOCKS5 proxy failed (run $i)"
+	assert_files_equal "$WORK/payload.bin" "$WORK/out3.bin" \
+		"spliced SOCKS5 tunnel corrupted the payload (run $i)"
+done
+kill "$GWP_PID" 2>/dev/null
+
+pass
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# --zerocopy-min: large forwarded chunks are sent zero-copy and the buffer is
+# only reused once the kernel reports the send complete. Over loopback the
+# kernel copies anyway and says so, which switches the pair back to plain
+# sends after its first zero-copy one; the payload must arrive verbatim
+# either way, including on a client half-close and a SOCKS5 tunnel.
+
+. "$(dirname "$0")/lib.sh"
+require curl
+require python3
+require_opt --zerocopy-min
+
+hp="$(pick_port)"
+make_payload "$WORK/payload.bin" 300000
+start_httpd "$hp" "$WORK" "1.0"
+
+pp="$(pick_port)"
+gwp_start "127.0.0.1:$pp" --nr-workers=2 --zerocopy-min=4096 \
+	--target="127.0.0.1:$hp"
+curl -s --max-time 20 "http://127.0.0.1:$pp/payload.bin" -o "$WORK/out.bin" \
+	|| fail "curl through zero-copy plain proxy failed"
+assert_files_equal "$WORK/payload.bin" "$WORK/out.bin" \
+	"zero-copy plain proxy corrupted the payload"
+
+timeout 20 python3 "$SERVERS_DIR/halfclose_client.py" \
+	127.0.0.1 "$pp" "/payload.bin" "$WORK/out2.bin" \
+	|| fail "half-close client failed"
+assert_files_equal "$WORK/payload.bin" "$WORK/out2.bin" \
+	"zero-copy proxy dropped response data on client half-close"
+kill "$GWP_PID" 2>/dev/null
+
+sp="$(pick_port)"
+gwp_start "127.0.0.1:$sp" --nr-workers=1 --as-socks5=1 --zerocopy-min=1
+for i in 1 2 3; do
+	curl -s --max-time 20 --socks5 "127.0.0.1:$sp" \
+		"http://127.0.0.1:$hp/payload.bin" -o "$WORK/out3.bin" \
+		|| fail "curl through zero-copy SOCKS5 proxy failed (run $i)"
+	assert_files_equal "$WORK/payload.bin" "$WORK/out3.bin" \
+		"zero-copy SOCKS5 tunnel corrupted the payload (run $i)"
+done
+kill "$GWP_PID" 2>/dev/null
+
+pass
@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# --raw-dns: the workers resolve hostnames themselves over UDP, on every
+# available event loop. A fake DNS server answers for a test name; the first
+# --dns-server is a black hole, so the fetch only works if the query times
+# out there and fails over to the second one. Both A and AAAA must be asked,
+# an NXDOMAIN must come back to the client as REP 0x04, and with a DNS cache
+# the second fetch of a name must not hit the server again.
+
+. "$(dirname "$0")/lib.sh"
+require curl
+require python3
+require_opt --raw-dns-timeout
+
+start_dns()
+{
+	local name="$1"; shift
+	python3 "$SERVERS_DIR/dns_server.py" 127.0.0.1 "$WORK/$name.port" "$@" \
+		>"$WORK/$name.out" 2>&1 &
+	_PIDS+=("$!")
+	for _ in $(seq 1 50); do
+		[ -s "$WORK/$name.port" ] && break
+		sleep 0.1
+	done
+	[ -s "$WORK/$name.port" ] || fail "fake DNS server $name did not start"
+	cat "$WORK/$name.port"
+}
+
+hp="$(pick_port)"
+make_payload "$WORK/payload.bin" 100000
+start_httpd "$hp" "$WORK" "1.1"
+
+dead="$(start_dns dead --blackhole)"
+good="$(start_dns good web.gwp.test=127.0.0.1 web.gwp.test=::1)"
+servers="127.0.0.1:$dead,127.0.0.1:$good"
+
+for loop in epoll io_uring; do
+	[ "$loop" = io_uring ] && ! grep -q CONFIG_IO_URING "$ROOT/config.h" 2>/dev/null && continue
+
+	pp="$(pick_port)"
+	: >"$WORK/good.port.log"
+	gwp_start "127.0.0.1:$pp" --as-socks5=1 --event-loop="$loop" \
+		--nr-workers=1 --raw-dns=1 --dns-server="$servers" \
+		--raw-dns-timeout=200 --raw-dns-tries=3
+	curl -s --max-time 20 --proxy "socks5h://127.0.0.1:$pp" \
+		"http://web.gwp.test:$hp/payload.bin" -o "$WORK/out.bin" \
+		|| fail "[$loop] fetch through --raw-dns with a dead first server failed"
+	assert_files_equal "$WORK/payload.bin" "$WORK/out.bin" \
+		"[$loop] --raw-dns fetch corrupted the payload"
+
+	grep -q "^web.gwp.test 1$" "$WORK/good.port.log" \
+		|| fail "[$loop] no A query reached the second server"
+	grep -q "^web.gwp.test 28$" "$WORK/good.port.log" \
+		|| fail "[$loop] no AAAA query reached the second server"
+	[ -s "$WORK/dead.port.log" ] \
+		|| fail "[$loop] the first server was never asked"
+
+	rep="$(python3 "$SERVERS_DIR/socks5_probe.py" --host 127.0.0.1 \
+		--atyp domain --dst nope.gwp.test "$pp" 80)"
+	[ "$rep" = "REP=0x04" ] \
+		|| fail "[$loop] NXDOMAIN got '$rep' (want REP=0x04)"
+	kill "$GWP_PID" 2>/dev/null
+
+	# With the cache, only the first fetch asks the server.
+	cp="$(pick_port)"
+	gwp_start "127.0.0.1:$cp" --as-socks5=1 --event-loop="$loop" \
+		--nr-workers=1 --raw-dns=1 --dns-server="127.0.0.1:$good" \
+		--dns-cache-secs=60
+	: >"$WORK/good.port.log"
+	for n in 1 2; do
+		curl -s --max-time 20 --proxy "socks5h://127.0.0.1:$cp" \
+			"http://web.gwp.test:$hp/payload.bin" -o "$WORK/cout.$n" \
+			|| fail "[$loop] cached --raw-dns fetch $n failed"
+		assert_files_equal "$WORK/payload.bin" "$WORK/cout.$n" \
+			"[$loop] cached --raw-dns fetch $n corrupted the payload"
+	done
+	nr="$(grep -c "^web.gwp.test 1$" "$WORK/good.port.log")"
+	[ "$nr" = 1 ] || fail "[$loop] cached name was queried $nr times (want 1)"
+	kill "$GWP_PID" 2>/dev/null
+done
+
+pass
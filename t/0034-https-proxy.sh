@@ -7,7 +7,8 @@
 # single port serves both TLS ("curl -x https://proxy") and plaintext
 # ("curl -x http://proxy" / "socks5h://proxy") clients. Verify, on every
 # available event loop: forward-proxy over TLS, CONNECT tunnelling over TLS,
-# plaintext coexistence on the same port, and Basic auth over TLS.
+# plaintext coexistence on the same port, Basic auth over TLS, and handshakes
+# offloaded to the crypto threads.
 
 . "$(dirname "$0")/lib.sh"
 require curl
@@ -98,6 +99,29 @@ for loop in epoll io_uring; do
 		"[$loop] authenticated HTTP-forward over TLS corrupted the payload"
 
 	kill "$GWP_PID" 2>/dev/null
+
+	# (6) Handshakes on the crypto threads (--tls-hs-threads): several
+	#     clients at once, so steps from different connections interleave.
+	pp="$(pick_port)"
+	gwp_start "127.0.0.1:$pp" --as-http=1 --as-socks5=1 --event-loop="$loop" \
+		--tls-cert="$WORK/cert.pem" --tls-key="$WORK/key.pem" --nr-workers=2 \
+		--tls-hs-threads=2
+
+	pids=""
+	for i in 1 2 3 4 5 6 7 8; do
+		curl -s --max-time 20 --proxy-insecure -x "https://127.0.0.1:$pp" \
+			"http://127.0.0.1:$hp/payload.bin" -o "$WORK/hs$i.bin" &
+		pids="$pids $!"
+	done
+	for p in $pids; do
+		wait "$p" || fail "[$loop] curl over TLS with --tls-hs-threads failed"
+	done
+	for i in 1 2 3 4 5 6 7 8; do
+		assert_files_equal "$WORK/payload.bin" "$WORK/hs$i.bin" \
+			"[$loop] --tls-hs-threads corrupted the payload"
+	done
+
+	kill "$GWP_PID" 2>/dev/null
 done
 
 pass
@@ -27,12 +27,31 @@ wait_udp_bound()			# $1=port
 	fail "UDP server did not bind on $1"
 }
 
+# Number of inotify watches gwproxy ($1=pid) holds, across all its fds.
+nr_watches()
+{
+	cat /proc/"$1"/fdinfo/* 2>/dev/null | grep -c '^inotify wd:'
+}
+
 # A UDP echo server for the UDP-relay ACL checks.
 ep="$(pick_port)"
 python3 "$SERVERS_DIR/udp_echo.py" 127.0.0.1 "$ep" >"$WORK/udp_echo.log" 2>&1 &
 _PIDS+=("$!")
 wait_udp_bound "$ep"
 
+# A fake DNS server for the --domain-suffix check, so every name it asks
+# about resolves and only the ACL decides.
+python3 "$SERVERS_DIR/dns_server.py" 127.0.0.1 "$WORK/dns.port" \
+	gwp.test=127.0.0.1 a.gwp.test=127.0.0.1 x.y.gwp.test=127.0.0.1 \
+	nogwp.test=127.0.0.1 >"$WORK/dns.out" 2>&1 &
+_PIDS+=("$!")
+for _ in $(seq 1 50); do
+	[ -s "$WORK/dns.port" ] && break
+	sleep 0.1
+done
+[ -s "$WORK/dns.port" ] || fail "fake DNS server did not start"
+dnsp="$(cat "$WORK/dns.port")"
+
 # A malformed ACL is rejected at startup (gwproxy exits non-zero, no listener).
 printf -- '-A OUTPUT -j BOGUS\n' >"$WORK/bad.acl"
 bp="$(pick_port)"
@@ -168,6 +187,27 @@ for loop in epoll io_uring; do
 		"$loop -m domain corrupted the literal-IP payload"
 	kill "$GWP_PID" 2>/dev/null
 
+	# --domain-suffix: the zone and every name under it are refused (REP
+	# 0x02), while a name that only ends in the same letters is not. The
+	# names are served by the fake DNS server so each one would connect.
+	printf -- '%s\n' '-A OUTPUT -m domain --domain-suffix *.gwp.test -j REJECT' \
+		'-P OUTPUT ACCEPT' >"$WORK/domsuf.acl"
+	sp="$(pick_port)"
+	gwp_start "127.0.0.1:$sp" --as-socks5=1 --event-loop="$loop" \
+		--raw-dns=1 --dns-server="127.0.0.1:$dnsp" \
+		--acl-file="$WORK/domsuf.acl"
+	for name in gwp.test a.gwp.test x.y.GWP.test; do
+		rep="$(python3 "$SERVERS_DIR/socks5_probe.py" --host 127.0.0.1 \
+			--atyp domain --dst "$name" "$sp" "$hp")"
+		[ "$rep" = "REP=0x02" ] \
+			|| fail "$loop --domain-suffix let '$name' through ($rep)"
+	done
+	rep="$(python3 "$SERVERS_DIR/socks5_probe.py" --host 127.0.0.1 \
+		--atyp domain --dst nogwp.test "$sp" "$hp")"
+	[ "$rep" = "REP=0x00" ] \
+		|| fail "$loop --domain-suffix matched across a label boundary ($rep)"
+	kill "$GWP_PID" 2>/dev/null
+
 	# --domain-regexp (PCRE builds only): a raw/unanchored pattern matches
 	# the requested hostname; a non-matching host is served.
 	if grep -q CONFIG_PCRE "$ROOT/config.h" 2>/dev/null; then
@@ -376,6 +416,46 @@ for loop in epoll io_uring; do
 		|| fail "$loop acl not reloaded after atomic rename ($code, want 403)"
 	kill "$GWP_PID" 2>/dev/null
 
+	# -m set: the target is refused while it is in the set, and the set
+	# file (in a directory of its own) reloads without touching the rules.
+	mkdir -p "$WORK/sets"
+	printf '# feed\n192.0.2.0/24\n127.0.0.0/8\n' >"$WORK/sets/block.set"
+	printf -- '%s\n' "--set block $WORK/sets/block.set" \
+		'-A OUTPUT -m set --match-set block dst -j REJECT' \
+		'-P OUTPUT ACCEPT' >"$WORK/set.acl"
+	setp="$(pick_port)"
+	gwp_start "127.0.0.1:$setp" --as-http=1 --event-loop="$loop" \
+		--acl-file="$WORK/set.acl"
+	code="$(curl -s --max-time 20 -x "http://127.0.0.1:$setp" \
+		"http://127.0.0.1:$hp/payload.bin" -o /dev/null -w '%{http_code}')"
+	[ "$code" = 403 ] || fail "$loop -m set target got $code (want 403)"
+	printf '192.0.2.0/24\n' >"$WORK/sets/block.new"
+	mv -f "$WORK/sets/block.new" "$WORK/sets/block.set"
+	code=""
+	for _ in $(seq 1 50); do
+		code="$(curl -s --max-time 20 -x "http://127.0.0.1:$setp" \
+			"http://127.0.0.1:$hp/payload.bin" -o /dev/null \
+			-w '%{http_code}')"
+		[ "$code" = 200 ] && break
+		sleep 0.1
+	done
+	[ "$code" = 200 ] \
+		|| fail "$loop acl set not reloaded after atomic rename ($code, want 200)"
+
+	# Rules that drop the set drop the watch on its directory too: only
+	# the rule file's own directory stays watched.
+	[ "$(nr_watches "$GWP_PID")" = 2 ] \
+		|| fail "$loop want 2 ACL inotify watches, have $(nr_watches "$GWP_PID")"
+	printf -- '%s\n' '-P OUTPUT ACCEPT' >"$WORK/set.new"
+	mv -f "$WORK/set.new" "$WORK/set.acl"
+	for _ in $(seq 1 50); do
+		[ "$(nr_watches "$GWP_PID")" = 1 ] && break
+		sleep 0.1
+	done
+	[ "$(nr_watches "$GWP_PID")" = 1 ] \
+		|| fail "$loop stale ACL set watch kept after reload ($(nr_watches "$GWP_PID") watches)"
+	kill "$GWP_PID" 2>/dev/null
+
 	# INPUT chain: a denied client source is dropped at accept, before any
 	# handshake, so the connection fails outright.
 	ip="$(pick_port)"
@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# --idle-timeout: a forwarding connection that carries no data for the timeout
+# is closed, while one that keeps talking lives past it -- traffic has to push
+# the deadline out, not merely survive until the first expiry. Without the
+# option a quiet connection is left alone. Exercised on every available loop.
+
+. "$(dirname "$0")/lib.sh"
+require python3
+
+ep="$(pick_port)"
+python3 "$SERVERS_DIR/tcp_echo.py" 127.0.0.1 "$ep" >"$WORK/echo.log" 2>&1 &
+_PIDS+=("$!")
+wait_listen "$ep" || fail "TCP echo server did not start"
+
+# Talk for $2 seconds (one echo round trip every 0.3s), then go quiet and
+# wait up to $3 seconds for the proxy to close us. Prints "CLOSED <secs>"
+# with the quiet time before the close, "OPEN" if it never came, or
+# "EARLY" if the proxy hung up while we were still talking.
+# NOTE: <<- strips leading tabs, so the Python below indents with spaces.
+probe() {			# $1=port $2=talk_secs $3=quiet_deadline_secs
+	python3 - "$1" "$2" "$3" <<-'PY'
+	import socket, sys, time
+	port, talk, quiet = int(sys.argv[1]), float(sys.argv[2]), float(sys.argv[3])
+	s = socket.create_connection(('127.0.0.1', port))
+	s.settimeout(5)
+	end = time.time() + talk
+	while time.time() < end:
+	    try:
+	        s.sendall(b'x')
+	        if s.recv(1) != b'x':
+	            raise OSError
+	    except OSError:
+	        print('EARLY')
+	        sys.exit(0)
+	    time.sleep(0.3)
+	s.settimeout(quiet)
+	t0 = time.time()
+	try:
+	    data = s.recv(1)
+	except socket.timeout:
+	    print('OPEN')
+	    sys.exit(0)
+	print('CLOSED %.2f' % (time.time() - t0) if not data else 'DATA')
+	PY
+}
+
+for loop in epoll io_uring; do
+	[ "$loop" = io_uring ] && ! grep -q CONFIG_IO_URING "$ROOT/config.h" 2>/dev/null && continue
+
+	pp="$(pick_port)"
+	gwp_start "127.0.0.1:$pp" --target="127.0.0.1:$ep" \
+		--event-loop="$loop" --nr-workers=1 --idle-timeout=1
+
+	# Three seconds of chatter outlives a one-second timeout only if
+	# every round trip re-arms it; silence must then end the pair.
+	got="$(probe "$pp" 3 8)"
+	case "$got" in
+	"CLOSED "*)	;;
+	EARLY)	fail "[$loop] active connection was closed by --idle-timeout=1" ;;
+	OPEN)	fail "[$loop] idle connection outlived --idle-timeout=1" ;;
+	*)	fail "[$loop] idle-timeout probe failed: '$got'" ;;
+	esac
+	kill "$GWP_PID" 2>/dev/null
+
+	# The default is no limit at all.
+	pp="$(pick_port)"
+	gwp_start "127.0.0.1:$pp" --target="127.0.0.1:$ep" \
+		--event-loop="$loop" --nr-workers=1
+	got="$(probe "$pp" 0.5 3)"
+	[ "$got" = OPEN ] \
+		|| fail "[$loop] quiet connection closed without --idle-timeout: '$got'"
+	kill "$GWP_PID" 2>/dev/null
+done
+
+pass
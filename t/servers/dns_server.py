@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-only
+# A tiny authoritative DNS server over UDP for the --raw-dns test.
+#
+#   dns_server.py <host> <port-file> [--blackhole] [name=addr ...]
+#
+# Binds an ephemeral port on <host> and writes it to <port-file>. Each
+# name=addr adds an A or AAAA record (by the address family); any other
+# name gets NXDOMAIN, and a known name asked for the other family gets an
+# empty NOERROR. With --blackhole it reads queries and never answers, to
+# stand in for a dead server. Every query's name and type is appended to
+# <port-file>.log.
+import os, socket, struct, sys
+
+host, port_file = sys.argv[1], sys.argv[2]
+blackhole = False
+zone = {}
+for arg in sys.argv[3:]:
+    if arg == "--blackhole":
+        blackhole = True
+        continue
+    name, addr = arg.split("=", 1)
+    if ":" in addr:
+        rec = (28, socket.inet_pton(socket.AF_INET6, addr))
+    else:
+        rec = (1, socket.inet_pton(socket.AF_INET, addr))
+    zone.setdefault(name.lower().rstrip("."), []).append(rec)
+
+fam = socket.AF_INET6 if ":" in host else socket.AF_INET
+s = socket.socket(fam, socket.SOCK_DGRAM)
+s.bind((host, 0))
+with open(port_file + ".tmp", "w") as f:
+    f.write("%d\n" % s.getsockname()[1])
+# Rename so a reader never sees a half-written file.
+os.rename(port_file + ".tmp", port_file)
+log = open(port_file + ".log", "a", buffering=1)
+
+
+def parse_question(msg):
+    labels, i = [], 12
+    while msg[i]:
+        n = msg[i]
+        labels.append(msg[i + 1:i + 1 + n].decode())
+        i += 1 + n
+    qtype, qclass = struct.unpack("!HH", msg[i + 1:i + 5])
+    return ".".join(labels), qtype, qclass, msg[12:i + 5]
+
+
+while True:
+    msg, peer = s.recvfrom(65535)
+    if len(msg) < 17:
+        continue
+    try:
+        name, qtype, qclass, question = parse_question(msg)
+    except (IndexError, struct.error, UnicodeDecodeError):
+        continue
+    log.write("%s %d\n" % (name, qtype))
+    if blackhole:
+        continue
+
+    recs = zone.get(name.lower())
+    rcode = 0 if recs is not None else 3
+    answers = [r for r in (recs or []) if r[0] == qtype]
+    hdr = struct.pack("!HHHHHH", struct.unpack("!H", msg[:2])[0],
+                      0x8400 | rcode, 1, len(answers), 0, 0)
+    body = b""
+    for rtype, rdata in answers:
+        # Name compressed to the question at offset 12.
+        body += struct.pack("!HHHIH", 0xc00c, rtype, 1, 300, len(rdata))
+        body += rdata
+    s.sendto(hdr + question + body, peer)